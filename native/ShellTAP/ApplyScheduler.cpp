@@ -0,0 +1,106 @@
+// ApplyScheduler.cpp -- Time-sliced apply queue for the XAML UI thread
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "ApplyScheduler.h"
+
+ApplyScheduler::ApplyScheduler(uint32_t budgetUs)
+    : m_lineHead(0), m_chores(0), m_deadline(0)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    m_budgetTicks = freq.QuadPart * budgetUs / 1000000;
+}
+
+void ApplyScheduler::Push(const Apply& item)
+{
+    m_queues[item.isStroke ? PRIORITY_NORMAL : PRIORITY_VISIBLE].items.push_back(item);
+}
+
+bool ApplyScheduler::Pop(Apply* out)
+{
+    for (Queue& queue : m_queues) {
+        if (queue.head == queue.items.size()) continue;
+        *out = queue.items[queue.head++];
+        if (queue.head == queue.items.size()) {
+            queue.items.clear();            // keeps the capacity for the next burst
+            queue.head = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+size_t ApplyScheduler::DropTracked()
+{
+    size_t dropped = 0;
+    for (Queue& queue : m_queues) {
+        size_t kept = 0;
+        for (size_t i = queue.head; i < queue.items.size(); i++) {
+            if (queue.items[i].restore) queue.items[kept++] = queue.items[i];
+            else dropped++;
+        }
+        queue.items.resize(kept);
+        queue.head = 0;
+    }
+    return dropped;
+}
+
+bool ApplyScheduler::TakeChore(uint32_t chore)
+{
+    if (!(m_chores & chore)) return false;
+    m_chores &= ~chore;
+    return true;
+}
+
+void ApplyScheduler::PushLine(InstanceHandle handle, InstanceHandle parent, const wchar_t* name,
+                              const wchar_t* type, uint32_t numChildren)
+{
+    m_lines.push_back({ handle, parent, m_strings.Intern(name), m_strings.Intern(type), numChildren });
+}
+
+bool ApplyScheduler::PopLine(Line* out)
+{
+    if (m_lineHead == m_lines.size()) return false;
+    *out = m_lines[m_lineHead++];
+    if (m_lineHead == m_lines.size()) {
+        m_lines.clear();
+        m_lineHead = 0;
+    }
+    return true;
+}
+
+void ApplyScheduler::Clear()
+{
+    for (Queue& queue : m_queues) {
+        queue.items.clear();
+        queue.head = 0;
+    }
+    m_lines.clear();
+    m_lineHead = 0;
+    m_chores = 0;
+}
+
+size_t ApplyScheduler::MemoryBytes() const
+{
+    size_t bytes = m_lines.capacity() * sizeof(Line) + m_strings.MemoryBytes();
+    for (const Queue& queue : m_queues) bytes += queue.items.capacity() * sizeof(Apply);
+    return bytes;
+}
+
+void ApplyScheduler::BeginSlice(bool bounded)
+{
+    m_deadline = 0;
+    if (!bounded) return;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    m_deadline = now.QuadPart + m_budgetTicks;
+}
+
+bool ApplyScheduler::Expired() const
+{
+    if (m_deadline == 0) return false;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart >= m_deadline;
+}
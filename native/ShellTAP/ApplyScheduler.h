@@ -0,0 +1,115 @@
+// ApplyScheduler.h -- Time-sliced apply queue for the XAML UI thread
+//
+// Flushes and mode switches used to apply to every element they covered
+// inside one message, and discovery lines were formatted inside the tree
+// callback that saw the element. During a relayout of a large Start menu or
+// tray that held explorer's UI thread for as long as it took. The watcher
+// now queues that work here and runs it in slices of at most
+// SHELLTAP_SLICE_BUDGET_US per dispatch, highest priority first:
+//
+//   PRIORITY_VISIBLE     fills -- the background the user sees change
+//   PRIORITY_NORMAL      strokes
+//   PRIORITY_BACKGROUND  chores (gauges, warm cache, tree snapshot) and
+//                        discovery text lines; only once no apply is left
+//
+// The unit is one element (or one chore): the item in hand always finishes,
+// so a slice can overrun by one apply. What is left continues on the next
+// idle tick (WatcherBase::PostIdleDispatch), behind any input or paint.
+//
+// A mode switch with a v5 transition is not sliced: its Storyboard has to
+// collect every element before Begin.
+//
+// UI thread only, no locks.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <xamlOM.h>
+#include <cstdint>
+#include <vector>
+#include "StringPool.h"
+
+static const uint32_t SHELLTAP_SLICE_BUDGET_US = 1500;
+
+class ApplyScheduler {
+public:
+    enum Priority {
+        PRIORITY_VISIBLE = 0,
+        PRIORITY_NORMAL = 1,
+        PRIORITY_BACKGROUND = 2,
+    };
+
+    struct Apply {
+        InstanceHandle handle;
+        uint32_t typeId;        // watcher's StringPool id
+        int mode;               // AppearanceMode to apply
+        bool isStroke;          // PRIORITY_NORMAL; fills are PRIORITY_VISIBLE
+        bool restore;           // back to Default after a retarget untracked it
+    };
+
+    // Discovery text line, formatted when a slice has time left
+    struct Line {
+        InstanceHandle handle;
+        InstanceHandle parent;
+        uint32_t nameId;        // String(); 0 = unnamed
+        uint32_t typeId;
+        uint32_t numChildren;
+    };
+
+    // Background chores, each queued at most once
+    static const uint32_t CHORE_GAUGES = 0x1;
+    static const uint32_t CHORE_WARM_CACHE = 0x2;
+    static const uint32_t CHORE_SNAPSHOT = 0x4;
+
+    explicit ApplyScheduler(uint32_t budgetUs = SHELLTAP_SLICE_BUDGET_US);
+    ApplyScheduler(const ApplyScheduler&) = delete;
+    ApplyScheduler& operator=(const ApplyScheduler&) = delete;
+
+    // ── Applies ──
+    void Push(const Apply& item);
+    bool Pop(Apply* out);                   // visible first, then normal; FIFO within each
+    size_t Applies() const { return Pending(PRIORITY_VISIBLE) + Pending(PRIORITY_NORMAL); }
+
+    // A pass over the whole tracked set is about to be queued: drops every
+    // apply it supersedes (all but restores). Returns the number dropped.
+    size_t DropTracked();
+
+    // ── Background ──
+    void Defer(uint32_t chores) { m_chores |= chores; }
+    bool TakeChore(uint32_t chore);         // true (and cleared) if it was queued
+    uint32_t Chores() const { return m_chores; }
+
+    void PushLine(InstanceHandle handle, InstanceHandle parent, const wchar_t* name, const wchar_t* type,
+                  uint32_t numChildren);
+    bool PopLine(Line* out);
+    const wchar_t* String(uint32_t id) const { return m_strings.Get(id); }
+
+    bool Idle() const { return Applies() == 0 && m_chores == 0 && m_lineHead == m_lines.size(); }
+    void Clear();
+    size_t MemoryBytes() const;
+
+    // ── Slice clock ──
+    // bounded = false: run to completion (no dispatch window to continue on)
+    void BeginSlice(bool bounded);
+    bool Expired() const;
+
+private:
+    struct Queue {
+        std::vector<Apply> items;
+        size_t head = 0;
+    };
+    size_t Pending(Priority priority) const
+    {
+        return m_queues[priority].items.size() - m_queues[priority].head;
+    }
+
+    Queue m_queues[PRIORITY_BACKGROUND];    // PRIORITY_VISIBLE, PRIORITY_NORMAL
+    std::vector<Line> m_lines;
+    size_t m_lineHead;
+    StringPool m_strings;                   // discovery names and types
+    uint32_t m_chores;
+
+    LONG64 m_budgetTicks;
+    LONG64 m_deadline;                      // QPC; 0 = unbounded slice
+};
@@ -0,0 +1,285 @@
+// AsyncLog.cpp -- Lock-free asynchronous logger for ShellTAP
+//
+// Ring: bounded MPSC queue of fixed-size records (Vyukov sequence cells).
+// A producer claims a cell with one CAS on the enqueue position, formats
+// into it, then publishes by bumping the cell's sequence. The writer is
+// the only consumer, so the dequeue position is a plain integer.
+//
+// Wakeup: the writer advertises "sleeping" before blocking on an
+// auto-reset event; producers only call SetEvent when that flag is set,
+// so a steady stream of records costs no kernel transitions.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "AsyncLog.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+
+namespace AsyncLog {
+
+static const size_t RING_CAPACITY = 1024;           // power of two
+static const size_t RECORD_TEXT   = 496;
+
+struct Cell {
+    std::atomic<size_t> seq;
+    uint8_t  sink;
+    uint16_t len;
+    char     text[RECORD_TEXT];
+};
+
+struct SinkState {
+    wchar_t path[MAX_PATH];
+    bool    truncate;
+    bool    changed;     // path updated since the writer last opened it
+    FILE*   file;        // writer-owned
+    bool    dirty;       // writer-owned: unflushed data
+};
+
+static Cell g_ring[RING_CAPACITY];
+static std::atomic<size_t> g_enqueuePos(0);
+static size_t g_dequeuePos = 0;                      // writer-owned
+static std::atomic<bool> g_ringReady(false);
+static INIT_ONCE g_ringInit = INIT_ONCE_STATIC_INIT;
+
+static std::atomic<uint64_t> g_dropped(0);
+static uint64_t g_droppedReported = 0;               // writer-owned
+
+static SinkState g_sinks[SINK_COUNT] = {};
+static SRWLOCK g_sinkLock = SRWLOCK_INIT;            // guards path/truncate/changed
+
+static HANDLE g_hWriter = nullptr;
+static HANDLE g_hWake = nullptr;
+static std::atomic<bool> g_sleeping(false);
+static std::atomic<bool> g_stop(false);
+
+static BOOL CALLBACK InitRing(PINIT_ONCE, PVOID, PVOID*)
+{
+    for (size_t i = 0; i < RING_CAPACITY; i++) {
+        g_ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    g_ringReady.store(true, std::memory_order_release);
+    return TRUE;
+}
+
+static void EnsureRing()
+{
+    if (!g_ringReady.load(std::memory_order_acquire)) {
+        InitOnceExecuteOnce(&g_ringInit, InitRing, nullptr, nullptr);
+    }
+}
+
+// ── Writer side ──
+
+static FILE* OpenSink(Sink sink)
+{
+    SinkState& s = g_sinks[sink];
+    wchar_t path[MAX_PATH] = {0};
+    bool truncate = false;
+    bool changed = false;
+
+    AcquireSRWLockExclusive(&g_sinkLock);
+    changed = s.changed;
+    s.changed = false;
+    wcscpy_s(path, s.path);
+    truncate = s.truncate;
+    ReleaseSRWLockExclusive(&g_sinkLock);
+
+    if (changed && s.file) {
+        fclose(s.file);
+        s.file = nullptr;
+    }
+    if (!s.file && path[0] != 0) {
+        s.file = _wfopen(path, truncate ? L"w" : L"a");
+    }
+    return s.file;
+}
+
+static void WriteRecord(Sink sink, const char* text, size_t len)
+{
+    FILE* f = OpenSink(sink);
+    if (!f) return;
+    fwrite(text, 1, len, f);
+    fputc('\n', f);
+    g_sinks[sink].dirty = true;
+}
+
+static void ReportDrops()
+{
+    uint64_t dropped = g_dropped.load(std::memory_order_relaxed);
+    if (dropped == g_droppedReported) return;
+
+    char line[96];
+    int n = _snprintf_s(line, sizeof(line), _TRUNCATE, "[log] %llu log records dropped (ring full)",
+        (unsigned long long)(dropped - g_droppedReported));
+    g_droppedReported = dropped;
+    if (n > 0) WriteRecord(SINK_DEBUG, line, (size_t)n);
+}
+
+// Drains everything currently published; returns number of records written
+static size_t Drain()
+{
+    size_t count = 0;
+    for (;;) {
+        Cell& cell = g_ring[g_dequeuePos & (RING_CAPACITY - 1)];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        if (seq != g_dequeuePos + 1) break;
+
+        if (g_droppedReported != g_dropped.load(std::memory_order_relaxed)) ReportDrops();
+        if (cell.sink < SINK_COUNT) WriteRecord((Sink)cell.sink, cell.text, cell.len);
+
+        cell.seq.store(g_dequeuePos + RING_CAPACITY, std::memory_order_release);
+        g_dequeuePos++;
+        count++;
+    }
+    ReportDrops();
+
+    for (auto& s : g_sinks) {
+        if (s.dirty && s.file) { fflush(s.file); s.dirty = false; }
+    }
+    return count;
+}
+
+static bool RingEmpty()
+{
+    const Cell& cell = g_ring[g_dequeuePos & (RING_CAPACITY - 1)];
+    return cell.seq.load(std::memory_order_acquire) != g_dequeuePos + 1;
+}
+
+static DWORD WINAPI WriterThread(LPVOID)
+{
+    while (!g_stop.load(std::memory_order_acquire)) {
+        if (Drain() > 0) continue;
+
+        // Advertise sleep, then re-check so a record published between the
+        // drain and the flag store is not missed. Every producer that sees
+        // the flag signals g_hWake, and Stop does too, so an idle host never
+        // wakes this thread.
+        g_sleeping.store(true, std::memory_order_seq_cst);
+        if (!RingEmpty() || g_stop.load(std::memory_order_acquire)) {
+            g_sleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        WaitForSingleObject(g_hWake, INFINITE);
+        g_sleeping.store(false, std::memory_order_relaxed);
+    }
+    Drain();
+    return 0;
+}
+
+// ── Public API ──
+
+bool Start()
+{
+    EnsureRing();
+    if (g_hWriter) return true;
+
+    g_stop.store(false, std::memory_order_relaxed);
+    g_hWake = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!g_hWake) return false;
+
+    g_hWriter = CreateThread(nullptr, 0, WriterThread, nullptr, 0, nullptr);
+    if (!g_hWriter) {
+        CloseHandle(g_hWake);
+        g_hWake = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void Stop(DWORD timeoutMs)
+{
+    EnsureRing();
+    bool writerGone = true;
+    if (g_hWriter) {
+        g_stop.store(true, std::memory_order_release);
+        SetEvent(g_hWake);
+        writerGone = (WaitForSingleObject(g_hWriter, timeoutMs) == WAIT_OBJECT_0);
+        if (!writerGone) return;   // still draining; leave its files alone
+        CloseHandle(g_hWriter);
+        g_hWriter = nullptr;
+    }
+
+    // Writer has exited (or was terminated with the process): this thread
+    // is now the only consumer.
+    Drain();
+    for (auto& s : g_sinks) {
+        if (s.file) { fclose(s.file); s.file = nullptr; }
+    }
+    if (g_hWake) { CloseHandle(g_hWake); g_hWake = nullptr; }
+}
+
+void SetSink(Sink sink, const wchar_t* path, bool truncate)
+{
+    if (sink >= SINK_COUNT) return;
+    AcquireSRWLockExclusive(&g_sinkLock);
+    SinkState& s = g_sinks[sink];
+    if (wcscmp(s.path, path ? path : L"") != 0 || s.truncate != truncate) {
+        wcscpy_s(s.path, path ? path : L"");
+        s.truncate = truncate;
+        s.changed = true;
+    }
+    ReleaseSRWLockExclusive(&g_sinkLock);
+}
+
+bool SinkEnabled(Sink sink)
+{
+    if (sink >= SINK_COUNT) return false;
+    AcquireSRWLockShared(&g_sinkLock);
+    bool enabled = g_sinks[sink].path[0] != 0;
+    ReleaseSRWLockShared(&g_sinkLock);
+    return enabled;
+}
+
+void WriteV(Sink sink, const char* fmt, va_list args)
+{
+    EnsureRing();
+
+    // Claim a cell (Vyukov bounded queue, producer side)
+    Cell* cell = nullptr;
+    size_t pos = g_enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& c = g_ring[pos & (RING_CAPACITY - 1)];
+        size_t seq = c.seq.load(std::memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (g_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell = &c;
+                break;
+            }
+        } else if (dif < 0) {
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = g_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    int n = _vsnprintf_s(cell->text, RECORD_TEXT, _TRUNCATE, fmt, args);
+    cell->len = (uint16_t)(n < 0 ? strlen(cell->text) : (size_t)n);
+    cell->sink = (uint8_t)sink;
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the writer's seq_cst store of g_sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (g_sleeping.load(std::memory_order_relaxed) && g_hWake) {
+        g_sleeping.store(false, std::memory_order_relaxed);
+        SetEvent(g_hWake);
+    }
+}
+
+void Write(Sink sink, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    WriteV(sink, fmt, args);
+    va_end(args);
+}
+
+uint64_t Dropped()
+{
+    return g_dropped.load(std::memory_order_relaxed);
+}
+
+} // namespace AsyncLog
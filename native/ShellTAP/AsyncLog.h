@@ -0,0 +1,64 @@
+// AsyncLog.h -- Lock-free asynchronous logger for ShellTAP
+//
+// Producers (any thread, including the XAML UI thread inside
+// OnVisualTreeChange) format straight into a slot of a bounded MPSC ring
+// and return; a single background writer thread drains the ring to disk
+// and flushes once per batch. Nothing on the producer side takes a lock
+// or touches the file system.
+//
+// When the ring is full the record is dropped and counted; the writer
+// reports the count in-line ("N log records dropped") so gaps are visible.
+//
+// Levels are filtered at compile time: statements below TAP_LOG_LEVEL
+// expand to a dead branch, so their arguments are never evaluated.
+// Release builds (NDEBUG) default to INFO; debug builds to TRACE.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <cstdarg>
+#include <cstdint>
+
+#define TAP_LOG_TRACE 0
+#define TAP_LOG_INFO  1
+#define TAP_LOG_ERROR 2
+
+#ifndef TAP_LOG_LEVEL
+#  ifdef NDEBUG
+#    define TAP_LOG_LEVEL TAP_LOG_INFO
+#  else
+#    define TAP_LOG_LEVEL TAP_LOG_TRACE
+#  endif
+#endif
+
+#define TAP_LOG(level, sink, ...) \
+    do { if ((level) >= TAP_LOG_LEVEL) AsyncLog::Write((sink), __VA_ARGS__); } while (0)
+
+namespace AsyncLog {
+
+enum Sink : uint8_t {
+    SINK_DEBUG = 0,      // ShellTAP.log (append)
+    SINK_DISCOVERY,      // discovery element dump (truncated on open)
+    SINK_COUNT
+};
+
+// Starts the writer thread. Records written before Start() are queued.
+bool Start();
+
+// Signals the writer, waits up to timeoutMs for it to drain and exit, then
+// closes all sinks. Safe during process exit (writer already terminated).
+void Stop(DWORD timeoutMs);
+
+// Sets the file for a sink. The writer opens it lazily on the first record
+// and reopens it if the path changes later.
+void SetSink(Sink sink, const wchar_t* path, bool truncate);
+bool SinkEnabled(Sink sink);
+
+void Write(Sink sink, const char* fmt, ...);
+void WriteV(Sink sink, const char* fmt, va_list args);
+
+// Total records dropped because the ring was full
+uint64_t Dropped();
+
+} // namespace AsyncLog
@@ -0,0 +1,221 @@
+// DiscoveryTrace.cpp -- Binary discovery trace writer
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "DiscoveryTrace.h"
+#include <cstring>
+#include <cwchar>
+
+static const uint32_t TRACE_BUFFER_SIZE  = 64 * 1024;
+static const uint64_t TRACE_MAP_INITIAL  = 4 * 1024 * 1024;
+
+DiscoveryTrace::DiscoveryTrace()
+    : m_hFile(INVALID_HANDLE_VALUE), m_hMapping(nullptr), m_view(nullptr),
+      m_capacity(0), m_total(0), m_mapped(false), m_failed(false), m_qpcStart(0)
+{
+}
+
+DiscoveryTrace::~DiscoveryTrace()
+{
+    Close();
+}
+
+bool DiscoveryTrace::Open(const wchar_t* path, bool mapped, const wchar_t* targetId)
+{
+    if (IsOpen()) return true;
+
+    DWORD access = GENERIC_WRITE | (mapped ? GENERIC_READ : 0);
+    m_hFile = CreateFileW(path, access, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                          FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+    m_mapped = mapped;
+    m_failed = false;
+    m_total = 0;
+    if (mapped) {
+        if (!GrowMapping(TRACE_MAP_INITIAL)) { Close(); return false; }
+    } else {
+        m_buffer.reserve(TRACE_BUFFER_SIZE);
+    }
+
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    m_qpcStart = now.QuadPart;
+
+    TraceFileHeader* hdr = (TraceFileHeader*)Reserve(sizeof(TraceFileHeader));
+    if (!hdr) { Close(); return false; }
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = TRACE_VERSION;
+    hdr->headerSize = sizeof(TraceFileHeader);
+    hdr->qpcFrequency = freq.QuadPart;
+    hdr->qpcStart = m_qpcStart;
+    hdr->processId = GetCurrentProcessId();
+    for (int i = 0; i < 63 && targetId && targetId[i]; i++) {
+        hdr->targetId[i] = (char16_t)targetId[i];
+    }
+    return true;
+}
+
+void DiscoveryTrace::Close()
+{
+    if (!IsOpen()) return;
+
+    if (m_mapped) {
+        if (m_view) { UnmapViewOfFile(m_view); m_view = nullptr; }
+        if (m_hMapping) { CloseHandle(m_hMapping); m_hMapping = nullptr; }
+
+        // Trim the unused tail of the last growth step
+        LARGE_INTEGER end;
+        end.QuadPart = (LONGLONG)m_total;
+        SetFilePointerEx(m_hFile, end, nullptr, FILE_BEGIN);
+        SetEndOfFile(m_hFile);
+    } else {
+        FlushBuffer();
+    }
+
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_capacity = 0;
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+}
+
+bool DiscoveryTrace::GrowMapping(uint64_t needed)
+{
+    uint64_t newCap = m_capacity ? m_capacity : TRACE_MAP_INITIAL;
+    while (newCap < needed) newCap *= 2;
+
+    if (m_view) { UnmapViewOfFile(m_view); m_view = nullptr; }
+    if (m_hMapping) { CloseHandle(m_hMapping); m_hMapping = nullptr; }
+
+    // A mapping larger than the file extends the file (zero-filled)
+    m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READWRITE,
+                                    (DWORD)(newCap >> 32), (DWORD)newCap, nullptr);
+    if (!m_hMapping) return false;
+    m_view = (uint8_t*)MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)newCap);
+    if (!m_view) { CloseHandle(m_hMapping); m_hMapping = nullptr; return false; }
+
+    m_capacity = newCap;
+    return true;
+}
+
+void DiscoveryTrace::FlushBuffer()
+{
+    if (m_buffer.empty()) return;
+    DWORD written = 0;
+    if (!WriteFile(m_hFile, m_buffer.data(), (DWORD)m_buffer.size(), &written, nullptr) ||
+        written != m_buffer.size()) {
+        m_failed = true;
+    }
+    m_buffer.clear();
+}
+
+// Returns space for `bytes` contiguous bytes at the current end of the trace
+uint8_t* DiscoveryTrace::Reserve(uint32_t bytes)
+{
+    if (m_failed) return nullptr;
+
+    if (m_mapped) {
+        if (m_total + bytes > m_capacity && !GrowMapping(m_total + bytes)) {
+            m_failed = true;
+            return nullptr;
+        }
+        uint8_t* p = m_view + m_total;
+        m_total += bytes;
+        return p;
+    }
+
+    if (m_buffer.size() + bytes > TRACE_BUFFER_SIZE) FlushBuffer();
+    size_t at = m_buffer.size();
+    m_buffer.resize(at + bytes);
+    m_total += bytes;
+    return m_buffer.data() + at;
+}
+
+uint32_t DiscoveryTrace::InternString(const wchar_t* s)
+{
+    if (!s || !s[0]) return 0;
+    uint32_t id = m_strings.Find(s);
+    if (id) return id;
+
+    id = m_strings.Intern(s);
+    size_t len = wcslen(s);
+    if (len > 0xFFFF) len = 0xFFFF;
+
+    uint32_t size = TraceAlign8((uint32_t)(sizeof(TraceStringRecord) + len * sizeof(char16_t)));
+    uint8_t* p = Reserve(size);
+    if (!p) return id;
+    memset(p, 0, size);
+
+    TraceStringRecord* rec = (TraceStringRecord*)p;
+    rec->tag = TRACE_TAG_STRING;
+    rec->length = (uint16_t)len;
+    rec->id = id;
+    char16_t* chars = (char16_t*)(p + sizeof(TraceStringRecord));
+    if (sizeof(wchar_t) == sizeof(char16_t)) {
+        memcpy(chars, s, len * sizeof(char16_t));
+    } else {
+        for (size_t i = 0; i < len; i++) chars[i] = (char16_t)s[i];
+    }
+    return id;
+}
+
+void DiscoveryTrace::Record(VisualMutationType mutation, InstanceHandle handle, InstanceHandle parent,
+                            const wchar_t* name, const wchar_t* type, unsigned int numChildren)
+{
+    if (!IsOpen() || m_failed) return;
+
+    // Strings first so the reader always sees a definition before its use
+    uint32_t nameId = InternString(name);
+    uint32_t typeId = InternString(type);
+
+    TraceElementRecord* rec = (TraceElementRecord*)Reserve(sizeof(TraceElementRecord));
+    if (!rec) return;
+
+    rec->tag = TRACE_TAG_ELEMENT;
+    rec->mutation = (mutation == Remove) ? TRACE_MUTATION_REMOVE : TRACE_MUTATION_ADD;
+    rec->reserved = 0;
+    rec->nameId = nameId;
+    rec->typeId = typeId;
+    rec->numChildren = numChildren;
+    rec->handle = (uint64_t)handle;
+    rec->parent = (uint64_t)parent;
+    rec->timestamp = Timestamp();
+}
+
+void DiscoveryTrace::RecordCall(const ParentChildRelation& relation, const VisualElement& element,
+                                VisualMutationType mutation)
+{
+    if (!IsOpen() || m_failed) return;
+
+    uint32_t nameId = InternString(element.Name);
+    uint32_t typeId = InternString(element.Type);
+    uint32_t fileId = InternString(element.SrcInfo.FileName);
+
+    TraceMutationRecord* rec = (TraceMutationRecord*)Reserve(sizeof(TraceMutationRecord));
+    if (!rec) return;
+
+    rec->tag = TRACE_TAG_MUTATION;
+    rec->mutation = (uint8_t)mutation;
+    rec->reserved = 0;
+    rec->nameId = nameId;
+    rec->typeId = typeId;
+    rec->numChildren = element.NumChildren;
+    rec->handle = (uint64_t)element.Handle;
+    rec->parent = (uint64_t)relation.Parent;
+    rec->child = (uint64_t)relation.Child;
+    rec->childIndex = relation.ChildIndex;
+    rec->srcFileId = fileId;
+    rec->srcLine = element.SrcInfo.LineNumber;
+    rec->srcColumn = element.SrcInfo.ColumnNumber;
+    rec->timestamp = Timestamp();
+}
+
+int64_t DiscoveryTrace::Timestamp() const
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart - m_qpcStart;
+}
@@ -0,0 +1,62 @@
+// DiscoveryTrace.h -- Binary discovery trace writer
+//
+// Compact alternative to the text discovery log: every distinct name/type
+// is written once to a string table and elements become fixed 40-byte
+// records (see DiscoveryTraceFormat.h). Output goes either through a 64 KB
+// write buffer or, in mapped mode, straight into a memory-mapped view of
+// the file that grows by doubling -- no syscall per record in either case.
+//
+// The same writer serves recording mode: RecordCall() stores a whole
+// OnVisualTreeChange call (relation, element, mutation) as a mutation
+// record, which TAPBench --replay feeds back to a watcher.
+//
+// Decode with native\bin\TraceDecoder.exe (text or JSON).
+//
+// Not thread-safe: Record()/RecordCall() are called from OnVisualTreeChange on the XAML
+// UI thread; Open/Close from DllMain.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <xamlOM.h>     // InstanceHandle, VisualMutationType
+#include <cstdint>
+#include <vector>
+#include "DiscoveryTraceFormat.h"
+#include "StringPool.h"
+
+class DiscoveryTrace {
+public:
+    DiscoveryTrace();
+    ~DiscoveryTrace();
+
+    bool Open(const wchar_t* path, bool mapped, const wchar_t* targetId);
+    void Close();
+    bool IsOpen() const { return m_hFile != INVALID_HANDLE_VALUE; }
+
+    void Record(VisualMutationType mutation, InstanceHandle handle, InstanceHandle parent,
+                const wchar_t* name, const wchar_t* type, unsigned int numChildren);
+    void RecordCall(const ParentChildRelation& relation, const VisualElement& element,
+                    VisualMutationType mutation);
+
+    uint64_t BytesWritten() const { return m_total; }
+    size_t StringCount() const { return m_strings.Count(); }
+
+private:
+    uint32_t InternString(const wchar_t* s);
+    int64_t Timestamp() const;
+    uint8_t* Reserve(uint32_t bytes);
+    bool GrowMapping(uint64_t needed);
+    void FlushBuffer();
+
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    uint8_t* m_view;            // mapped mode: whole-file view
+    uint64_t m_capacity;        // mapped mode: current file/view size
+    uint64_t m_total;           // bytes of trace written so far
+    bool m_mapped;
+    bool m_failed;              // stop recording after an I/O error
+    int64_t m_qpcStart;
+    std::vector<uint8_t> m_buffer;  // buffered mode
+    StringPool m_strings;
+};
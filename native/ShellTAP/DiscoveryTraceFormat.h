@@ -0,0 +1,96 @@
+// DiscoveryTraceFormat.h -- On-disk layout of the binary discovery trace
+//
+// Shared by ShellTAP (writer), TraceReader.h (TraceDecoder, TAPBench
+// replay); plain C++, no Windows headers.
+//
+// File = TraceFileHeader, then a stream of 8-byte aligned records:
+//   TRACE_TAG_STRING   TraceStringRecord + length UTF-16 units, padded to 8.
+//                      Defines string id `id`; emitted once, before the
+//                      first element record that references it.
+//   TRACE_TAG_ELEMENT  TraceElementRecord (fixed 40 bytes). Discovery mode.
+//   TRACE_TAG_MUTATION TraceMutationRecord (fixed 64 bytes), version >= 2.
+//                      Recording mode (SHELLTAP_FLAG_RECORD): one per
+//                      OnVisualTreeChange call, in call order, with the whole
+//                      ParentChildRelation and VisualElement -- enough for a
+//                      replay to make the same calls again.
+//   TRACE_TAG_END (0)  End of stream. A memory-mapped trace that was not
+//                      closed cleanly ends in zero fill, which reads as END.
+//
+// String id 0 is "no string" (unnamed element / unknown type).
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <cstdint>
+
+static const char     TRACE_MAGIC[8]  = { 'S', 'T', 'A', 'P', 'T', 'R', 'C', 0 };
+static const uint32_t TRACE_VERSION   = 2;     // readers accept 1..TRACE_VERSION
+
+enum TraceTag : uint8_t {
+    TRACE_TAG_END     = 0,
+    TRACE_TAG_STRING  = 1,
+    TRACE_TAG_ELEMENT = 2,
+    TRACE_TAG_MUTATION = 3
+};
+
+// Same values as VisualMutationType in xamlOM.h
+enum TraceMutation : uint8_t {
+    TRACE_MUTATION_ADD    = 0,
+    TRACE_MUTATION_REMOVE = 1
+};
+
+#pragma pack(push, 1)
+struct TraceFileHeader {
+    char     magic[8];          // TRACE_MAGIC
+    uint32_t version;           // TRACE_VERSION
+    uint32_t headerSize;        // sizeof(TraceFileHeader); records start here
+    int64_t  qpcFrequency;      // QueryPerformanceFrequency
+    int64_t  qpcStart;          // QPC when the trace was opened
+    uint32_t processId;
+    uint32_t reserved;
+    char16_t targetId[64];      // ShellTAP TargetId, NUL-terminated
+};
+
+struct TraceStringRecord {
+    uint8_t  tag;               // TRACE_TAG_STRING
+    uint8_t  reserved;
+    uint16_t length;            // UTF-16 code units that follow (no NUL)
+    uint32_t id;
+};
+
+struct TraceElementRecord {
+    uint8_t  tag;               // TRACE_TAG_ELEMENT
+    uint8_t  mutation;          // TraceMutation
+    uint16_t reserved;
+    uint32_t nameId;
+    uint32_t typeId;
+    uint32_t numChildren;
+    uint64_t handle;
+    uint64_t parent;
+    int64_t  timestamp;         // QPC ticks since qpcStart
+};
+
+struct TraceMutationRecord {
+    uint8_t  tag;               // TRACE_TAG_MUTATION
+    uint8_t  mutation;          // VisualMutationType as passed (not clamped)
+    uint16_t reserved;
+    uint32_t nameId;            // VisualElement.Name
+    uint32_t typeId;            // VisualElement.Type
+    uint32_t numChildren;       // VisualElement.NumChildren
+    uint64_t handle;            // VisualElement.Handle
+    uint64_t parent;            // ParentChildRelation.Parent
+    uint64_t child;             // ParentChildRelation.Child
+    uint32_t childIndex;        // ParentChildRelation.ChildIndex
+    uint32_t srcFileId;         // VisualElement.SrcInfo.FileName
+    uint32_t srcLine;           // VisualElement.SrcInfo.LineNumber
+    uint32_t srcColumn;         // VisualElement.SrcInfo.ColumnNumber
+    int64_t  timestamp;         // QPC ticks since qpcStart
+};
+#pragma pack(pop)
+
+static_assert(sizeof(TraceFileHeader) == 168, "TraceFileHeader layout");
+static_assert(sizeof(TraceStringRecord) == 8, "TraceStringRecord layout");
+static_assert(sizeof(TraceElementRecord) == 40, "TraceElementRecord layout");
+static_assert(sizeof(TraceMutationRecord) == 64, "TraceMutationRecord layout");
+
+static inline uint32_t TraceAlign8(uint32_t n) { return (n + 7u) & ~7u; }
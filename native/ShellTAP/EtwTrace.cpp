@@ -0,0 +1,13 @@
+// EtwTrace.cpp -- TraceLogging (ETW) provider for ShellTAP hot paths
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "EtwTrace.h"
+
+#pragma comment(lib, "advapi32.lib")
+
+// {4babd901-8402-51bf-d4ca-54dd7e43b05d} = EventSource hash of the name
+TRACELOGGING_DEFINE_PROVIDER(
+    g_hShellTAPProvider,
+    "W11ThemeSuite.ShellTAP",
+    (0x4babd901, 0x8402, 0x51bf, 0xd4, 0xca, 0x54, 0xdd, 0x7e, 0x43, 0xb0, 0x5d));
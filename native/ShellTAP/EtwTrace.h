@@ -0,0 +1,14 @@
+// EtwTrace.h -- TraceLogging (ETW) provider for ShellTAP hot paths
+//
+// Provider "W11ThemeSuite.ShellTAP" {4babd901-8402-51bf-d4ca-54dd7e43b05d}
+// (name-hash GUID, so WPR/tracelog also accept "*W11ThemeSuite.ShellTAP").
+// Record with: wpr -start native\ShellTAP\ShellTAP.wprp -start GeneralProfile
+//
+// Spans, keywords and the TAP_ETW_* macros are TAPCore's (TAPCore\EtwTrace.h);
+// every ShellTAP event carries the TargetId.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#define TAP_ETW_PROVIDER g_hShellTAPProvider
+#include "../TAPCore/EtwTrace.h"
@@ -0,0 +1,142 @@
+// HandleMap.h -- Open-addressing hash map keyed by XAML InstanceHandle
+//
+// Linear probing over a power-of-two slot array with backward-shift deletion
+// (no tombstones), so removed slots are reused immediately and probe chains
+// stay short under constant Add/Remove churn. Handle 0 marks an empty slot;
+// XAML Diagnostics never hands out a zero handle.
+//
+// Not thread-safe. Pointers returned by Find/Insert are invalidated by the
+// next Insert or Erase.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <xamlOM.h>     // InstanceHandle
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class HandleMap {
+public:
+    HandleMap() : m_count(0) {}
+
+    T* Find(InstanceHandle key)
+    {
+        if (key == 0 || m_slots.empty()) return nullptr;
+        size_t mask = m_slots.size() - 1;
+        for (size_t i = Home(key); ; i = (i + 1) & mask) {
+            if (m_slots[i].key == key) return &m_slots[i].value;
+            if (m_slots[i].key == 0) return nullptr;
+        }
+    }
+
+    const T* Find(InstanceHandle key) const
+    {
+        return const_cast<HandleMap*>(this)->Find(key);
+    }
+
+    // Returns the existing entry or a value-initialized new one
+    T* Insert(InstanceHandle key, bool* inserted = nullptr)
+    {
+        if (inserted) *inserted = false;
+        if (key == 0) return nullptr;
+        if ((m_count + 1) * 10 > m_slots.size() * 7) Grow();
+
+        size_t mask = m_slots.size() - 1;
+        for (size_t i = Home(key); ; i = (i + 1) & mask) {
+            if (m_slots[i].key == key) return &m_slots[i].value;
+            if (m_slots[i].key == 0) {
+                m_slots[i].key = key;
+                m_slots[i].value = T();
+                m_count++;
+                if (inserted) *inserted = true;
+                return &m_slots[i].value;
+            }
+        }
+    }
+
+    bool Erase(InstanceHandle key)
+    {
+        if (key == 0 || m_slots.empty()) return false;
+        size_t mask = m_slots.size() - 1;
+        size_t i = Home(key);
+        while (m_slots[i].key != key) {
+            if (m_slots[i].key == 0) return false;
+            i = (i + 1) & mask;
+        }
+
+        // Backward-shift: pull later entries of the cluster into the hole
+        // unless their home slot lies cyclically within (hole, j].
+        for (size_t j = (i + 1) & mask; m_slots[j].key != 0; j = (j + 1) & mask) {
+            size_t k = Home(m_slots[j].key);
+            bool inRange = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (inRange) continue;
+            m_slots[i] = std::move(m_slots[j]);
+            i = j;
+        }
+        m_slots[i].key = 0;
+        m_slots[i].value = T();
+        m_count--;
+        return true;
+    }
+
+    // fn(InstanceHandle, T&) -- must not Insert or Erase
+    template <typename Fn>
+    void ForEach(Fn&& fn)
+    {
+        for (auto& slot : m_slots) {
+            if (slot.key != 0) fn(slot.key, slot.value);
+        }
+    }
+
+    template <typename Fn>
+    void ForEach(Fn&& fn) const
+    {
+        for (const auto& slot : m_slots) {
+            if (slot.key != 0) fn(slot.key, slot.value);
+        }
+    }
+
+    void Clear()
+    {
+        m_slots.clear();
+        m_slots.shrink_to_fit();
+        m_count = 0;
+    }
+
+    size_t Size() const { return m_count; }
+    size_t MemoryBytes() const { return m_slots.capacity() * sizeof(Slot); }
+
+private:
+    struct Slot {
+        InstanceHandle key;
+        T value;
+    };
+
+    size_t Home(InstanceHandle key) const
+    {
+        // splitmix64 finalizer: handles are often pointer-like and clustered
+        uint64_t x = (uint64_t)key;
+        x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return (size_t)x & (m_slots.size() - 1);
+    }
+
+    void Grow()
+    {
+        std::vector<Slot> old;
+        old.swap(m_slots);
+        m_slots.resize(old.empty() ? 16 : old.size() * 2);
+        for (auto& s : m_slots) s.key = 0;
+        m_count = 0;
+        for (auto& s : old) {
+            if (s.key != 0) *Insert(s.key) = std::move(s.value);
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_count;
+};
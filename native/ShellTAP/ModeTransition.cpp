@@ -0,0 +1,223 @@
+// ModeTransition.cpp -- Animated mode switches on the direct apply path
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "ModeTransition.h"
+#include "ShellTAP.h"
+
+namespace Anim = ABI::Windows::UI::Xaml::Media::Animation;
+using ABI::Windows::Foundation::Collections::IVector;
+
+// RoActivateInstance by runtime class name, then the interface wanted
+template <class T>
+static HRESULT Activate(const wchar_t* runtimeClass, T** out)
+{
+    *out = nullptr;
+    HSTRING_HEADER header;
+    HSTRING className = nullptr;
+    HRESULT hr = WindowsCreateStringReference(runtimeClass, (UINT32)wcslen(runtimeClass), &header, &className);
+    if (FAILED(hr)) return hr;
+
+    IInspectable* instance = nullptr;
+    hr = RoActivateInstance(className, &instance);
+    if (FAILED(hr)) return hr;
+    hr = instance->QueryInterface(__uuidof(T), (void**)out);
+    instance->Release();
+    return hr;
+}
+
+// KeyTime / Duration count 100 ns ticks
+static Anim::KeyTime KeyTimeAt(double ms)
+{
+    Anim::KeyTime time;
+    time.TimeSpan.Duration = (INT64)(ms * 10000.0);
+    return time;
+}
+
+ModeTransition::~ModeTransition()
+{
+    // Off the UI thread the Storyboard cannot be stopped or released; leak it
+    if (m_thread == GetCurrentThreadId()) Stop();
+}
+
+HRESULT ModeTransition::Open(unsigned int durationMs, unsigned int easing)
+{
+    DWORD thread = GetCurrentThreadId();
+    if (m_thread == 0) m_thread = thread;
+    if (m_thread != thread) return RPC_E_WRONG_THREAD;
+
+    Stop();
+    if (durationMs == 0) return S_FALSE;
+    m_durationMs = (durationMs < SHELLTAP_TRANSITION_MAX_MS) ? durationMs : SHELLTAP_TRANSITION_MAX_MS;
+
+    HRESULT hr = XamlGetFactory(RuntimeClass_Windows_UI_Xaml_Media_Animation_Storyboard,
+        __uuidof(Anim::IStoryboardStatics), (void**)&m_statics);
+    if (SUCCEEDED(hr)) hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_Storyboard, &m_storyboard);
+    if (SUCCEEDED(hr)) hr = m_storyboard->get_Children(&m_children);
+    if (SUCCEEDED(hr)) {
+        Anim::ITimeline* timeline = nullptr;
+        hr = m_storyboard->QueryInterface(__uuidof(Anim::ITimeline), (void**)&timeline);
+        if (SUCCEEDED(hr)) {
+            ABI::Windows::UI::Xaml::Duration duration;
+            duration.TimeSpan.Duration = (INT64)m_durationMs * 10000;
+            duration.Type = ABI::Windows::UI::Xaml::DurationType_TimeSpan;
+            hr = timeline->put_Duration(duration);
+            if (SUCCEEDED(hr)) hr = timeline->put_FillBehavior(Anim::FillBehavior_Stop);
+            timeline->Release();
+        }
+    }
+
+    // One CubicEase serves every keyframe of the transition
+    if (SUCCEEDED(hr) && easing != SHELLTAP_EASE_LINEAR) {
+        hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_CubicEase, &m_ease);
+        if (SUCCEEDED(hr)) {
+            Anim::EasingMode mode = (easing == SHELLTAP_EASE_IN)     ? Anim::EasingMode_EaseIn :
+                                    (easing == SHELLTAP_EASE_IN_OUT) ? Anim::EasingMode_EaseInOut :
+                                                                       Anim::EasingMode_EaseOut;
+            hr = m_ease->put_EasingMode(mode);
+        }
+    }
+
+    if (FAILED(hr)) {
+        Stop();
+        return hr;
+    }
+    m_building = true;
+    return S_OK;
+}
+
+HRESULT ModeTransition::Add(IInspectable* element, double fromOpacity, double toOpacity,
+                            ABI::Windows::UI::Xaml::Media::IBrush* fromFill,
+                            ABI::Windows::UI::Xaml::Media::IBrush* toFill)
+{
+    if (!m_building) return E_UNEXPECTED;
+
+    bool swap = (fromFill != toFill);
+    double delta = fromOpacity - toOpacity;
+    if (!swap && delta < 0.001 && delta > -0.001) return S_FALSE;
+
+    // An element that starts or ends invisible hides the swap by itself
+    bool dip = swap && fromOpacity > 0.0 && toOpacity > 0.0;
+    double mid = m_durationMs / 2.0;
+    double end = (double)m_durationMs;
+
+    Anim::IDoubleAnimationUsingKeyFrames* fade = nullptr;
+    IVector<Anim::DoubleKeyFrame*>* fadeFrames = nullptr;
+    Anim::ITimeline* timeline = nullptr;
+    HRESULT hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_DoubleAnimationUsingKeyFrames, &fade);
+    if (SUCCEEDED(hr)) hr = fade->get_KeyFrames(&fadeFrames);
+    if (SUCCEEDED(hr)) hr = AddOpacityKey(fadeFrames, 0.0, fromOpacity, true);
+    if (SUCCEEDED(hr) && dip) hr = AddOpacityKey(fadeFrames, mid, 0.0, false);
+    if (SUCCEEDED(hr)) hr = AddOpacityKey(fadeFrames, end, toOpacity, false);
+    if (SUCCEEDED(hr)) hr = fade->QueryInterface(__uuidof(Anim::ITimeline), (void**)&timeline);
+    if (SUCCEEDED(hr)) hr = AddTimeline(element, timeline, L"(UIElement.Opacity)");
+    if (timeline) timeline->Release();
+    if (fadeFrames) fadeFrames->Release();
+    if (fade) fade->Release();
+    if (FAILED(hr)) return hr;
+    m_elements++;
+
+    // The old brush stays up until the midpoint (or to the end, when the
+    // element fades out); from an invisible start the new one can show at once
+    if (!swap || fromOpacity <= 0.0) return S_OK;
+
+    Anim::IObjectAnimationUsingKeyFrames* brush = nullptr;
+    IVector<Anim::ObjectKeyFrame*>* brushFrames = nullptr;
+    timeline = nullptr;
+    hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_ObjectAnimationUsingKeyFrames, &brush);
+    if (SUCCEEDED(hr)) hr = brush->get_KeyFrames(&brushFrames);
+    if (SUCCEEDED(hr)) hr = AddFillKey(brushFrames, 0.0, fromFill);
+    if (SUCCEEDED(hr) && dip) hr = AddFillKey(brushFrames, mid, toFill);
+    if (SUCCEEDED(hr)) hr = brush->QueryInterface(__uuidof(Anim::ITimeline), (void**)&timeline);
+    if (SUCCEEDED(hr)) hr = AddTimeline(element, timeline, L"(Shape.Fill)");
+    if (timeline) timeline->Release();
+    if (brushFrames) brushFrames->Release();
+    if (brush) brush->Release();
+    return hr;
+}
+
+HRESULT ModeTransition::Commit()
+{
+    if (!m_building) return E_UNEXPECTED;
+    m_building = false;
+    ReleaseBuilders();
+
+    if (m_elements == 0) {
+        Stop();
+        return S_FALSE;
+    }
+    HRESULT hr = m_storyboard->Begin();
+    if (FAILED(hr)) Stop();
+    return hr;
+}
+
+void ModeTransition::Stop()
+{
+    m_building = false;
+    ReleaseBuilders();
+    if (m_storyboard) {
+        m_storyboard->Stop();
+        m_storyboard->Release();
+        m_storyboard = nullptr;
+    }
+    m_elements = 0;
+}
+
+void ModeTransition::ReleaseBuilders()
+{
+    if (m_children) { m_children->Release(); m_children = nullptr; }
+    if (m_statics) { m_statics->Release(); m_statics = nullptr; }
+    if (m_ease) { m_ease->Release(); m_ease = nullptr; }
+}
+
+// Points `timeline` at the element's property and adds it to the Storyboard
+HRESULT ModeTransition::AddTimeline(IInspectable* element, Anim::ITimeline* timeline, const wchar_t* propertyPath)
+{
+    ABI::Windows::UI::Xaml::IDependencyObject* target = nullptr;
+    HRESULT hr = element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::IDependencyObject), (void**)&target);
+    if (FAILED(hr)) return hr;
+    hr = m_statics->SetTarget(timeline, target);
+    target->Release();
+
+    HSTRING_HEADER header;
+    HSTRING path = nullptr;
+    if (SUCCEEDED(hr)) hr = WindowsCreateStringReference(propertyPath, (UINT32)wcslen(propertyPath), &header, &path);
+    if (SUCCEEDED(hr)) hr = m_statics->SetTargetProperty(timeline, path);
+    if (SUCCEEDED(hr)) hr = timeline->put_FillBehavior(Anim::FillBehavior_Stop);
+    if (SUCCEEDED(hr)) hr = m_children->Append(timeline);
+    return hr;
+}
+
+HRESULT ModeTransition::AddOpacityKey(IVector<Anim::DoubleKeyFrame*>* frames,
+                                      double atMs, double value, bool discrete)
+{
+    Anim::IDoubleKeyFrame* frame = nullptr;
+    HRESULT hr;
+    if (discrete) {
+        hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_DiscreteDoubleKeyFrame, &frame);
+    } else {
+        // No easing function: an EasingDoubleKeyFrame interpolates linearly
+        Anim::IEasingDoubleKeyFrame* eased = nullptr;
+        hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_EasingDoubleKeyFrame, &eased);
+        if (SUCCEEDED(hr) && m_ease) hr = eased->put_EasingFunction(m_ease);
+        if (SUCCEEDED(hr)) hr = eased->QueryInterface(__uuidof(Anim::IDoubleKeyFrame), (void**)&frame);
+        if (eased) eased->Release();
+    }
+    if (SUCCEEDED(hr)) hr = frame->put_KeyTime(KeyTimeAt(atMs));
+    if (SUCCEEDED(hr)) hr = frame->put_Value(value);
+    if (SUCCEEDED(hr)) hr = frames->Append(frame);
+    if (frame) frame->Release();
+    return hr;
+}
+
+HRESULT ModeTransition::AddFillKey(IVector<Anim::ObjectKeyFrame*>* frames,
+                                   double atMs, ABI::Windows::UI::Xaml::Media::IBrush* brush)
+{
+    Anim::IObjectKeyFrame* frame = nullptr;
+    HRESULT hr = Activate(RuntimeClass_Windows_UI_Xaml_Media_Animation_DiscreteObjectKeyFrame, &frame);
+    if (SUCCEEDED(hr)) hr = frame->put_KeyTime(KeyTimeAt(atMs));
+    if (SUCCEEDED(hr)) hr = frame->put_Value(brush);
+    if (SUCCEEDED(hr)) hr = frames->Append(frame);
+    if (frame) frame->Release();
+    return hr;
+}
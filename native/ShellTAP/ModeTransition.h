@@ -0,0 +1,83 @@
+// ModeTransition.h -- Animated mode switches on the direct apply path
+//
+// With a ShellTAPTransition in the config (version 5), ApplyMode still
+// writes every element's final Opacity and Fill as local values, so flushes,
+// reasserts and the warm cache see the real state. What the user sees in
+// between comes from keyframes (old value -> new value) that are collected
+// for every element into ONE Storyboard and begun once per mode change:
+// the switch costs one Begin, XAML's animation clock paces the frames, and
+// Opacity runs as an independent animation on the compositor.
+//
+// Brushes are shared (BrushCache), so a color change is never tweened on
+// the brush itself. When Fill changes, the element fades out over the first
+// half, the brush swaps at the midpoint (a discrete object keyframe) and it
+// fades in to its new opacity over the second half. FillBehavior Stop hands
+// every element back to its (already final) local values at the end.
+//
+// Opening a new transition stops the previous one: its elements jump to
+// their end values and the next one starts from there. The Storyboard, and
+// with it its references to the elements, is released then or at Stop.
+//
+// UI thread only: the first Open claims the thread, and Open fails with
+// RPC_E_WRONG_THREAD anywhere else (the caller then applies instantly).
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <windows.ui.xaml.media.animation.h>
+#include "../TAPCore/XamlDirect.h"
+
+class ModeTransition {
+public:
+    ModeTransition()
+        : m_thread(0), m_durationMs(0), m_elements(0), m_building(false),
+          m_storyboard(nullptr), m_children(nullptr), m_statics(nullptr), m_ease(nullptr) {}
+    ~ModeTransition();
+    ModeTransition(const ModeTransition&) = delete;
+    ModeTransition& operator=(const ModeTransition&) = delete;
+
+    // Stops the previous transition and starts collecting a new one.
+    // S_FALSE for a zero duration: nothing to animate.
+    // easing: SHELLTAP_EASE_*; durationMs is clamped to SHELLTAP_TRANSITION_MAX_MS.
+    HRESULT Open(unsigned int durationMs, unsigned int easing);
+
+    // One element, after its local values were set. Opacity before/after,
+    // Fill before/after (borrowed, may be null). S_FALSE if nothing moves.
+    HRESULT Add(IInspectable* element, double fromOpacity, double toOpacity,
+                ABI::Windows::UI::Xaml::Media::IBrush* fromFill,
+                ABI::Windows::UI::Xaml::Media::IBrush* toFill);
+
+    // Begins what was added since Open; S_FALSE (and nothing kept) if empty
+    HRESULT Commit();
+
+    // Stops and releases the running (or half-built) Storyboard
+    void Stop();
+
+    bool IsOpen() const { return m_building; }
+    uint32_t Elements() const { return m_elements; }
+    unsigned int DurationMs() const { return m_durationMs; }
+
+private:
+    HRESULT AddTimeline(IInspectable* element, ABI::Windows::UI::Xaml::Media::Animation::ITimeline* timeline,
+                        const wchar_t* propertyPath);
+    HRESULT AddOpacityKey(ABI::Windows::Foundation::Collections::IVector<
+                              ABI::Windows::UI::Xaml::Media::Animation::DoubleKeyFrame*>* frames,
+                          double atMs, double value, bool discrete);
+    HRESULT AddFillKey(ABI::Windows::Foundation::Collections::IVector<
+                           ABI::Windows::UI::Xaml::Media::Animation::ObjectKeyFrame*>* frames,
+                       double atMs, ABI::Windows::UI::Xaml::Media::IBrush* brush);
+    void ReleaseBuilders();
+
+    DWORD m_thread;             // owning UI thread; 0 = none yet
+    unsigned int m_durationMs;
+    uint32_t m_elements;        // elements with animations in m_storyboard
+    bool m_building;            // between Open and Commit
+
+    ABI::Windows::UI::Xaml::Media::Animation::IStoryboard* m_storyboard;
+    // Only while building:
+    ABI::Windows::Foundation::Collections::IVector<ABI::Windows::UI::Xaml::Media::Animation::Timeline*>* m_children;
+    ABI::Windows::UI::Xaml::Media::Animation::IStoryboardStatics* m_statics;
+    ABI::Windows::UI::Xaml::Media::Animation::IEasingFunctionBase* m_ease;    // null = linear
+};
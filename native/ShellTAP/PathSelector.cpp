@@ -0,0 +1,120 @@
+// PathSelector.cpp -- CSS-like ancestor path selectors for ShellTAP targets
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "PathSelector.h"
+#include <cwchar>
+#include <cwctype>
+
+bool PathSelectorSet::IsPath(const wchar_t* text)
+{
+    return text && wcspbrk(text, L" \t>#") != nullptr;
+}
+
+void PathSelectorSet::Clear()
+{
+    m_compounds.clear();
+    m_selectors.clear();
+    m_first = m_last = m_child = m_descendant = 0;
+}
+
+bool PathSelectorSet::Add(const wchar_t* text)
+{
+    if (!text) return false;
+
+    // Parse into a scratch list first: a malformed selector adds nothing
+    std::vector<Compound> parsed;
+    std::vector<bool> byChild;      // combinator leading to parsed[i], i >= 1
+    const wchar_t* p = text;
+    bool pendingChild = false;
+
+    while (true) {
+        bool sawSpace = false;
+        while (iswspace(*p)) { p++; sawSpace = true; }
+        if (*p == L'>') {
+            if (parsed.empty() || pendingChild) return false;
+            pendingChild = true;
+            p++;
+            continue;
+        }
+        if (*p == 0) break;
+        if (!parsed.empty() && !sawSpace && !pendingChild) return false;
+
+        const wchar_t* start = p;
+        while (*p && !iswspace(*p) && *p != L'>') p++;
+        std::wstring token(start, p - start);
+
+        Compound c;
+        size_t hash = token.find(L'#');
+        c.type = token.substr(0, hash);
+        if (hash != std::wstring::npos) {
+            c.name = token.substr(hash + 1);
+            if (c.name.empty() || c.name.find(L'#') != std::wstring::npos) return false;
+        }
+        if (c.type == L"*") c.type.clear();
+
+        if (!parsed.empty()) byChild.push_back(pendingChild);
+        parsed.push_back(std::move(c));
+        pendingChild = false;
+    }
+    if (parsed.empty() || pendingChild) return false;
+    if (m_compounds.size() + parsed.size() > MAX_COMPOUNDS) return false;
+
+    uint32_t base = (uint32_t)m_compounds.size();
+    m_first |= 1ull << base;
+    for (size_t i = 1; i < parsed.size(); i++) {
+        uint64_t bit = 1ull << (base + i);
+        if (byChild[i - 1]) m_child |= bit; else m_descendant |= bit;
+    }
+    uint32_t last = base + (uint32_t)parsed.size() - 1;
+    m_last |= 1ull << last;
+
+    for (Compound& c : parsed) m_compounds.push_back(std::move(c));
+    m_selectors.push_back({ text, last });
+    return true;
+}
+
+bool PathSelectorSet::TypeMatches(const std::wstring& pattern, const wchar_t* type)
+{
+    if (pattern.empty()) return true;
+    if (!type) return false;
+    if (pattern == type) return true;
+    const wchar_t* dot = wcsrchr(type, L'.');
+    return dot && pattern == dot + 1;
+}
+
+uint64_t PathSelectorSet::NameMask(const wchar_t* name) const
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < m_compounds.size(); i++) {
+        const std::wstring& want = m_compounds[i].name;
+        if (want.empty() || (name && want == name)) mask |= 1ull << i;
+    }
+    return mask;
+}
+
+uint64_t PathSelectorSet::TypeMask(const wchar_t* type) const
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < m_compounds.size(); i++) {
+        if (TypeMatches(m_compounds[i].type, type)) mask |= 1ull << i;
+    }
+    return mask;
+}
+
+int PathSelectorSet::Selected(uint64_t matched, const wchar_t* name, bool* outIsStroke) const
+{
+    *outIsStroke = false;
+    if (!(matched & m_last)) return -1;
+
+    for (size_t i = 0; i < m_selectors.size(); i++) {
+        uint32_t last = m_selectors[i].last;
+        if (!(matched & (1ull << last))) continue;
+        const std::wstring& want = m_compounds[last].name;
+        *outIsStroke = want.empty()
+            ? (name && wcsstr(name, L"Stroke") != nullptr)
+            : (want.find(L"Stroke") != std::wstring::npos);
+        return (int)i;
+    }
+    return -1;
+}
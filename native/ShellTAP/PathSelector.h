@@ -0,0 +1,81 @@
+// PathSelector.h -- CSS-like ancestor path selectors for ShellTAP targets
+//
+// A target whose name contains ' ', '>' or '#' is a path selector (XAML
+// x:Name values never do):
+//     TaskbarFrame > Grid > Rectangle#BackgroundFill
+//     Taskbar.TaskbarFrame Rectangle#BackgroundStroke
+//     #BackgroundFill
+// A compound is Type, Type#Name, #Name or * ; "A > B" means B is a child
+// of A, "A B" a descendant. Types compare against the full type name or its
+// last dotted segment ("Grid" matches "Windows.UI.Xaml.Controls.Grid", not
+// "GridViewItem"); names compare exactly.
+//
+// All compounds of all selectors share one 64-bit position space, so the
+// per-element state is two words (see TreeIndex):
+//     matched = compounds this element satisfies with a valid ancestor chain
+//     reach   = matched, OR'ed over the element and all its ancestors
+// and a child's state is computed from its parent's in a few instructions
+// (Step). The last compound of a selector in `matched` means a match.
+//
+// Not thread-safe; built before use, then read-only.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class PathSelectorSet {
+public:
+    static const size_t MAX_COMPOUNDS = 64;
+
+    PathSelectorSet() : m_first(0), m_last(0), m_child(0), m_descendant(0) {}
+
+    // True if `text` uses the path syntax rather than a plain name
+    static bool IsPath(const wchar_t* text);
+
+    // False if the selector is malformed or would exceed MAX_COMPOUNDS
+    bool Add(const wchar_t* text);
+    void Clear();
+
+    size_t Count() const { return m_selectors.size(); }
+    bool Empty() const { return m_selectors.empty(); }
+    const std::wstring& Text(size_t i) const { return m_selectors[i].text; }
+
+    // Compounds an element satisfies on its own, split by field so callers
+    // can cache each half per interned string: mask = NameMask & TypeMask
+    uint64_t NameMask(const wchar_t* name) const;
+    uint64_t TypeMask(const wchar_t* type) const;
+
+    // Child state from its own compound mask and its parent's state
+    uint64_t Step(uint64_t mask, uint64_t parentMatched, uint64_t parentReach) const
+    {
+        return mask & (m_first | ((parentMatched << 1) & m_child) | ((parentReach << 1) & m_descendant));
+    }
+
+    // Index of the first selector completed in `matched`, or -1. Stroke is
+    // decided like TargetMatcher: by the last compound's name, or by the
+    // element's when that compound has none.
+    int Selected(uint64_t matched, const wchar_t* name, bool* outIsStroke) const;
+
+private:
+    struct Compound {
+        std::wstring type;      // empty = any
+        std::wstring name;      // empty = any
+    };
+
+    struct Selector {
+        std::wstring text;
+        uint32_t last;          // position of the final compound
+    };
+
+    static bool TypeMatches(const std::wstring& pattern, const wchar_t* type);
+
+    std::vector<Compound> m_compounds;
+    std::vector<Selector> m_selectors;
+    uint64_t m_first;           // first compound of each selector
+    uint64_t m_last;            // last compound of each selector
+    uint64_t m_child;           // reached from the previous compound by '>'
+    uint64_t m_descendant;      // reached from the previous compound by ' '
+};
@@ -0,0 +1,91 @@
+// PerfCounters.cpp -- Shared-memory performance counters for ShellTAP
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "PerfCounters.h"
+#include <cstring>
+
+namespace PerfCounters {
+
+static ShellTAPCounters g_local;                     // before Open / on failure
+static ShellTAPCounters* volatile g_block = &g_local;
+static HANDLE g_hMap = nullptr;
+static LONG64 g_ticksPerUs = 0;                      // 0 until the header is set up
+
+static void InitHeader(ShellTAPCounters* c)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    c->version = SHELLTAP_COUNTERS_VERSION;
+    c->size = sizeof(ShellTAPCounters);
+    c->processId = GetCurrentProcessId();
+    c->histogramBuckets = SHELLTAP_HISTOGRAM_BUCKETS;
+    c->qpcFrequency = freq.QuadPart;
+    g_ticksPerUs = freq.QuadPart / 1000000;
+    if (g_ticksPerUs == 0) g_ticksPerUs = 1;
+}
+
+bool Open(const wchar_t* targetId)
+{
+    if (g_hMap) return true;
+    if (g_local.version == 0) InitHeader(&g_local);
+
+    wchar_t name[128];
+    wsprintfW(name, L"W11ThemeSuite_ShellTAP_%s_Counters", targetId);
+    g_hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                0, sizeof(ShellTAPCounters), name);
+    if (!g_hMap) return false;
+
+    ShellTAPCounters* view = (ShellTAPCounters*)MapViewOfFile(
+        g_hMap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShellTAPCounters));
+    if (!view) {
+        CloseHandle(g_hMap);
+        g_hMap = nullptr;
+        return false;
+    }
+
+    // Fresh block (a re-injection reuses a still-open mapping): carry over
+    // what was counted so far, so attach-time milestones are not lost.
+    memcpy(view, &g_local, sizeof(ShellTAPCounters));
+    g_block = view;
+    return true;
+}
+
+void Close()
+{
+    // Keep counting into the private block; late callbacks may still run
+    ShellTAPCounters* view = g_block;
+    g_block = &g_local;
+    if (view != &g_local) UnmapViewOfFile(view);
+    if (g_hMap) { CloseHandle(g_hMap); g_hMap = nullptr; }
+}
+
+ShellTAPCounters* Block()
+{
+    return g_block;
+}
+
+void Record(ShellTAPHistogram* hist, LONG64 ticks)
+{
+    if (ticks < 0) ticks = 0;
+    LONG64 us = g_ticksPerUs ? ticks / g_ticksPerUs : 0;
+
+    uint32_t bucket = 0;
+    while (us > 0 && bucket < SHELLTAP_HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+
+    InterlockedIncrementNoFence64(&hist->count);
+    InterlockedExchangeAddNoFence64(&hist->totalTicks, ticks);
+    InterlockedIncrementNoFence64(&hist->buckets[bucket]);
+
+    LONG64 seen = hist->maxTicks;
+    while (ticks > seen) {
+        LONG64 prev = InterlockedCompareExchangeNoFence64(&hist->maxTicks, ticks, seen);
+        if (prev == seen) break;
+        seen = prev;
+    }
+}
+
+} // namespace PerfCounters
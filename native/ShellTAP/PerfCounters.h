@@ -0,0 +1,128 @@
+// PerfCounters.h -- Shared-memory performance counters for ShellTAP
+//
+// The DLL creates "W11ThemeSuite_ShellTAP_<TargetId>_Counters" holding one
+// ShellTAPCounters block and bumps its fields with no-fence interlocked
+// adds. Readers (Get-ShellTAPCounters, or any native tool) map it read-only
+// and sample whenever they like -- no round-trip into the target process.
+//
+// Individual fields are always whole values; a sample is not an atomic
+// snapshot of the block, which is fine for rates and histograms.
+//
+// Gauges (valueHandles .. bytesHeld) hold the current value rather than a
+// running count; they are rewritten by the UI thread as the tables change,
+// so a reader can watch them stay flat over a long session.
+//
+// Histograms are log2 of microseconds: bucket 0 holds durations < 1 us,
+// bucket b (b >= 1) holds [2^(b-1), 2^b) us; the last bucket is open-ended.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+
+static const uint32_t SHELLTAP_COUNTERS_VERSION = 1;
+static const uint32_t SHELLTAP_HISTOGRAM_BUCKETS = 32;
+
+#pragma pack(push, 8)
+struct ShellTAPHistogram {
+    volatile LONG64 count;
+    volatile LONG64 totalTicks;         // QPC ticks, for the mean
+    volatile LONG64 maxTicks;
+    LONG64          reserved;
+    volatile LONG64 buckets[SHELLTAP_HISTOGRAM_BUCKETS];
+};
+
+struct ShellTAPCounters {
+    uint32_t version;                   // SHELLTAP_COUNTERS_VERSION
+    uint32_t size;                      // sizeof(ShellTAPCounters)
+    uint32_t processId;
+    uint32_t histogramBuckets;          // SHELLTAP_HISTOGRAM_BUCKETS
+    LONG64   qpcFrequency;
+
+    // Startup milestones (raw QPC, 0 = not reached); see ShellTAPStartupTimings
+    volatile LONG64 qpcAttach;
+    volatile LONG64 qpcXamlReady;
+    volatile LONG64 qpcSetSite;
+    volatile LONG64 qpcFirstApply;
+    volatile LONG64 ixdeAttempts;
+
+    // Event counts
+    volatile LONG64 addCallbacks;       // OnVisualTreeChange(Add)
+    volatile LONG64 removeCallbacks;    // OnVisualTreeChange(Remove)
+    volatile LONG64 matches;            // elements that matched a target
+    volatile LONG64 applyCalls;         // ApplyToElement calls
+    volatile LONG64 setPropertyCalls;
+    volatile LONG64 setPropertyFailures;
+    volatile LONG64 flushes;            // non-empty FlushPending batches
+    volatile LONG64 retargets;          // live target list swaps
+    volatile LONG64 directSets;         // opacity/fill set via put_Opacity/put_Fill
+    volatile LONG64 diagnosticsSets;    // ... via CreateInstance + SetProperty fallback
+    volatile LONG64 prunedCallbacks;    // Add/Remove skipped by the v4 scope rules
+    volatile LONG64 reasserts;          // elements re-queued after XAML reset their values
+    volatile LONG64 transitions;        // Storyboards begun for an animated mode switch
+
+    // Resource gauges
+    volatile LONG64 valueHandles;       // CreateInstance values held in the diagnostics handle table
+    volatile LONG64 heldReferences;     // XAML objects kept referenced: saved Fills, brushes
+    volatile LONG64 bytesHeld;          // heap held by the watcher's tables (from their capacity)
+
+    ShellTAPHistogram callbackTime;     // time spent inside OnVisualTreeChange
+    ShellTAPHistogram applyLatency;     // one ApplyToElement (direct or SetProperty)
+
+    // Apply scheduler (ApplyScheduler.h)
+    volatile LONG64 slices;             // slices that ran queued work
+    volatile LONG64 sliceYields;        // ... and left some for a later tick
+    ShellTAPHistogram sliceTime;        // one slice, budget plus the overrunning item
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ShellTAPHistogram) == 288, "ShellTAPHistogram layout");
+static_assert(sizeof(ShellTAPCounters) == 1072, "ShellTAPCounters layout");
+
+namespace PerfCounters {
+
+// Creates the named block for this target. Until then (or if creation
+// fails) counters land in a private block, so callers never check for null.
+bool Open(const wchar_t* targetId);
+void Close();
+
+ShellTAPCounters* Block();
+
+inline void Increment(volatile LONG64* counter)
+{
+    InterlockedIncrementNoFence64(counter);
+}
+
+inline void Set(volatile LONG64* gauge, LONG64 value)
+{
+    InterlockedExchange64(gauge, value);
+}
+
+// Adds one duration (QPC ticks) to a histogram
+void Record(ShellTAPHistogram* hist, LONG64 ticks);
+
+// Times a scope into a histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(ShellTAPHistogram* hist) : m_hist(hist)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        m_start = now.QuadPart;
+    }
+    ~ScopedTimer()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        Record(m_hist, now.QuadPart - m_start);
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    ShellTAPHistogram* m_hist;
+    LONG64 m_start;
+};
+
+} // namespace PerfCounters
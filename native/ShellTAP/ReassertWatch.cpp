@@ -0,0 +1,188 @@
+// ReassertWatch.cpp -- Notices when XAML overwrites the Opacity/Fill we set
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "ReassertWatch.h"
+
+// IDependencyPropertyChangedCallback for one element. XAML holds a
+// reference per registration, so the sink can outlive its entry; `owner`
+// is cleared at Unwatch and late calls are dropped.
+class ReassertWatch::Sink : public ABI::Windows::UI::Xaml::IDependencyPropertyChangedCallback {
+public:
+    Sink(ReassertWatch* owner, InstanceHandle handle) : m_refCount(1), m_owner(owner), m_handle(handle) {}
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (riid == IID_IUnknown ||
+            riid == __uuidof(ABI::Windows::UI::Xaml::IDependencyPropertyChangedCallback)) {
+            *ppv = static_cast<ABI::Windows::UI::Xaml::IDependencyPropertyChangedCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return InterlockedIncrement(&m_refCount); }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        LONG count = InterlockedDecrement(&m_refCount);
+        if (count == 0) delete this;
+        return count;
+    }
+
+    HRESULT STDMETHODCALLTYPE Invoke(ABI::Windows::UI::Xaml::IDependencyObject*,
+                                     ABI::Windows::UI::Xaml::IDependencyProperty*) override
+    {
+        if (m_owner) m_owner->OnChanged(m_handle);
+        return S_OK;
+    }
+
+    void Detach() { m_owner = nullptr; }
+
+private:
+    volatile LONG m_refCount;
+    ReassertWatch* m_owner;
+    InstanceHandle m_handle;
+};
+
+ReassertWatch::~ReassertWatch()
+{
+    // Off the UI thread the registrations cannot be undone; detach the
+    // sinks so late callbacks find no owner, and leak the rest
+    m_entries.ForEach([](InstanceHandle, Entry& entry) {
+        if (entry.sink) entry.sink->Detach();
+    });
+    if (m_thread == GetCurrentThreadId()) UnwatchAll();
+}
+
+HRESULT ReassertWatch::Watch(InstanceHandle handle, IInspectable* element)
+{
+    DWORD thread = GetCurrentThreadId();
+    if (m_thread != 0 && m_thread != thread) return RPC_E_WRONG_THREAD;
+    if (m_entries.Find(handle)) return S_FALSE;
+
+    ABI::Windows::UI::Xaml::IDependencyProperty* opacity = XamlDirect::OpacityProperty();
+    if (!opacity) return E_NOINTERFACE;
+
+    ABI::Windows::UI::Xaml::IDependencyObject2* object = nullptr;
+    HRESULT hr = element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::IDependencyObject2), (void**)&object);
+    if (FAILED(hr)) return hr;
+
+    IWeakReferenceSource* source = nullptr;
+    IWeakReference* weak = nullptr;
+    hr = object->QueryInterface(__uuidof(IWeakReferenceSource), (void**)&source);
+    if (SUCCEEDED(hr)) {
+        hr = source->GetWeakReference(&weak);
+        source->Release();
+    }
+    if (FAILED(hr)) {
+        object->Release();
+        return hr;
+    }
+
+    Entry entry = {};
+    entry.weak = weak;
+    entry.sink = new Sink(this, handle);
+    entry.throttle.windowStart = GetTickCount();
+
+    hr = object->RegisterPropertyChangedCallback(opacity, entry.sink, &entry.opacityToken);
+    if (SUCCEEDED(hr)) {
+        entry.hasOpacity = true;
+
+        // Fill exists on Shapes only
+        ABI::Windows::UI::Xaml::Shapes::IShape* shape = nullptr;
+        ABI::Windows::UI::Xaml::IDependencyProperty* fill = XamlDirect::FillProperty();
+        if (fill && SUCCEEDED(element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::Shapes::IShape), (void**)&shape))) {
+            shape->Release();
+            entry.hasFill = SUCCEEDED(object->RegisterPropertyChangedCallback(fill, entry.sink, &entry.fillToken));
+        }
+    }
+    object->Release();
+    if (FAILED(hr)) {
+        Release(entry);
+        return hr;
+    }
+
+    m_thread = thread;
+    Entry* slot = m_entries.Insert(handle);
+    if (!slot) {
+        Release(entry);
+        return E_INVALIDARG;
+    }
+    *slot = entry;
+    return S_OK;
+}
+
+// An element that is already gone took its registrations with it
+void ReassertWatch::Release(Entry& entry)
+{
+    if (entry.sink) entry.sink->Detach();
+    if (entry.weak) {
+        ABI::Windows::UI::Xaml::IDependencyObject2* object = nullptr;
+        if (SUCCEEDED(entry.weak->Resolve(__uuidof(ABI::Windows::UI::Xaml::IDependencyObject2),
+                                          (IInspectable**)&object)) && object) {
+            if (entry.hasOpacity) {
+                object->UnregisterPropertyChangedCallback(XamlDirect::OpacityProperty(), entry.opacityToken);
+            }
+            if (entry.hasFill) {
+                object->UnregisterPropertyChangedCallback(XamlDirect::FillProperty(), entry.fillToken);
+            }
+            object->Release();
+        }
+        entry.weak->Release();
+    }
+    if (entry.sink) entry.sink->Release();
+    entry = Entry();
+}
+
+void ReassertWatch::Unwatch(InstanceHandle handle)
+{
+    if (m_thread != GetCurrentThreadId()) return;
+    Entry* entry = m_entries.Find(handle);
+    if (!entry) return;
+    Entry copy = *entry;
+    m_entries.Erase(handle);
+    if (copy.held) m_held--;
+    if (copy.throttle.deferred) m_deferred--;
+    Release(copy);
+}
+
+void ReassertWatch::UnwatchAll()
+{
+    if (m_thread != GetCurrentThreadId()) return;
+    m_entries.ForEach([](InstanceHandle, Entry& entry) { Release(entry); });
+    m_entries.Clear();
+    m_thread = 0;
+    m_holdUntil = 0;
+    m_held = 0;
+    m_deferred = 0;
+}
+
+void ReassertWatch::OnChanged(InstanceHandle handle)
+{
+    if (m_suppress > 0) return;
+    Entry* entry = m_entries.Find(handle);
+    if (!entry) return;
+
+    // Our transition's keyframes, most likely; looked at when it is done
+    if (Holding()) {
+        if (!entry->held) { entry->held = true; m_held++; }
+        return;
+    }
+
+    DWORD now = GetTickCount();
+    if (entry->throttle.Due(now)) {
+        // Window over before TakeDue got to it: this change re-queues it
+        entry->throttle.deferred = false;
+        m_deferred--;
+    }
+    bool wasDeferred = entry->throttle.deferred;
+    if (!entry->throttle.Admit(now)) {
+        if (!wasDeferred) {
+            m_deferred++;
+            m_handler(m_context, handle, true);
+        }
+        return;
+    }
+    m_handler(m_context, handle, false);
+}
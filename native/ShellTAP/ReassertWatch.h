@@ -0,0 +1,165 @@
+// ReassertWatch.h -- Notices when XAML overwrites the Opacity/Fill we set
+//
+// Styles, visual states (hover, theme or accent changes) and template
+// re-application write Opacity and Fill back without any tree mutation, so
+// OnVisualTreeChange never hears about it. For every element the direct
+// path has touched, a DependencyObject property-changed callback is
+// registered on both properties; when one fires outside our own writes,
+// the handler re-queues just that element.
+//
+// An element that keeps resetting (an animated state fighting us) is
+// re-queued at most REASSERT_BURST times per REASSERT_WINDOW_MS (Throttle).
+// The handler is told once when that limit kicks in; the element is then
+// deferred, and TakeDue hands it over once its window is over, so a last
+// reset that landed inside the burst is still undone.
+//
+// While our own mode transition animates (HoldUntil), changes are only
+// noted: its keyframes write the same properties. TakeHeld hands the noted
+// elements over once it is done.
+//
+// An entry keeps a weak reference to its element, so an element whose
+// Remove we never hear about (XAML may only report the subtree root) is not
+// kept alive; its registrations die with it.
+//
+// UI thread only: registrations belong to the thread that made the first
+// one, and Watch fails with RPC_E_WRONG_THREAD anywhere else.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <weakreference.h>
+#include "HandleMap.h"
+#include "../TAPCore/XamlDirect.h"
+
+class ReassertWatch {
+public:
+    static const DWORD REASSERT_WINDOW_MS = 1000;
+    static const uint32_t REASSERT_BURST = 8;
+
+    // throttled: this change was deferred to the end of the element's
+    // window (reported once per window; see TakeDue)
+    typedef void (*Handler)(void* context, InstanceHandle handle, bool throttled);
+
+    // Burst limit for one element's changes
+    struct Throttle {
+        DWORD windowStart;      // GetTickCount of the current window
+        uint32_t changes;       // changes seen in that window
+        bool deferred;          // a change past the burst is waiting for the window to end
+
+        // True: handle this change now. False: over the burst; deferred
+        bool Admit(DWORD now)
+        {
+            if (now - windowStart >= REASSERT_WINDOW_MS) {
+                windowStart = now;
+                changes = 0;
+            }
+            if (++changes <= REASSERT_BURST) return true;
+            deferred = true;
+            return false;
+        }
+        DWORD RemainingMs(DWORD now) const
+        {
+            DWORD elapsed = now - windowStart;
+            return elapsed >= REASSERT_WINDOW_MS ? 0 : REASSERT_WINDOW_MS - elapsed;
+        }
+        bool Due(DWORD now) const { return deferred && RemainingMs(now) == 0; }
+    };
+
+    ReassertWatch(Handler handler, void* context)
+        : m_handler(handler), m_context(context), m_thread(0), m_suppress(0), m_holdUntil(0), m_held(0),
+          m_deferred(0) {}
+    ~ReassertWatch();
+    ReassertWatch(const ReassertWatch&) = delete;
+    ReassertWatch& operator=(const ReassertWatch&) = delete;
+
+    // Registers Opacity (and Fill, for Shapes) callbacks once per handle
+    HRESULT Watch(InstanceHandle handle, IInspectable* element);
+    void Unwatch(InstanceHandle handle);
+    void UnwatchAll();
+
+    // Changes until GetTickCount() reaches `tick` are noted, not handled
+    void HoldUntil(DWORD tick) { m_holdUntil = tick; }
+    bool Holding() const { return HoldRemainingMs() != 0; }
+    DWORD HoldRemainingMs() const
+    {
+        LONG remaining = m_holdUntil ? (LONG)(m_holdUntil - GetTickCount()) : 0;
+        return remaining > 0 ? (DWORD)remaining : 0;
+    }
+
+    // Ends the hold; fn(handle) for every element that changed during it
+    template <typename Fn>
+    void TakeHeld(Fn&& fn)
+    {
+        m_holdUntil = 0;
+        if (m_held == 0) return;
+        m_held = 0;
+        m_entries.ForEach([&](InstanceHandle handle, Entry& entry) {
+            if (!entry.held) return;
+            entry.held = false;
+            fn(handle);
+        });
+    }
+
+    // fn(handle) for every deferred element whose window is over. Returns
+    // the ms until the next one is due (0 = none left).
+    template <typename Fn>
+    DWORD TakeDue(Fn&& fn)
+    {
+        if (m_deferred == 0) return 0;
+        DWORD now = GetTickCount();
+        DWORD next = 0;
+        m_entries.ForEach([&](InstanceHandle handle, Entry& entry) {
+            if (!entry.throttle.deferred) return;
+            if (!entry.throttle.Due(now)) {
+                DWORD remaining = entry.throttle.RemainingMs(now);
+                if (next == 0 || remaining < next) next = remaining;
+                return;
+            }
+            entry.throttle.deferred = false;
+            m_deferred--;
+            fn(handle);
+        });
+        return next;
+    }
+
+    size_t Count() const { return m_entries.Size(); }
+    size_t MemoryBytes() const { return m_entries.MemoryBytes(); }
+
+    // Our own writes: callbacks fired synchronously inside one are ignored
+    class Suppress {
+    public:
+        explicit Suppress(ReassertWatch& watch) : m_watch(watch) { InterlockedIncrement(&m_watch.m_suppress); }
+        ~Suppress() { InterlockedDecrement(&m_watch.m_suppress); }
+        Suppress(const Suppress&) = delete;
+        Suppress& operator=(const Suppress&) = delete;
+    private:
+        ReassertWatch& m_watch;
+    };
+
+private:
+    class Sink;
+
+    struct Entry {
+        IWeakReference* weak;   // to the element's IDependencyObject2
+        Sink* sink;
+        INT64 opacityToken;
+        INT64 fillToken;
+        bool hasOpacity;
+        bool hasFill;
+        bool held;              // changed during a hold
+        Throttle throttle;
+    };
+
+    void OnChanged(InstanceHandle handle);
+    static void Release(Entry& entry);
+
+    Handler m_handler;
+    void* m_context;
+    DWORD m_thread;             // owning UI thread; 0 = none yet
+    volatile LONG m_suppress;   // Suppress depth (the fallback apply can run off-thread)
+    DWORD m_holdUntil;          // GetTickCount; 0 = no hold
+    uint32_t m_held;            // entries marked held
+    uint32_t m_deferred;        // entries with throttle.deferred
+    HandleMap<Entry> m_entries;
+};
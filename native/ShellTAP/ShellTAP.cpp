@@ -4,12 +4,38 @@
 // Two-stage injection architecture (same as TranslucentTB):
 //   Stage 1: PowerShell injects this DLL via CreateRemoteThread + LoadLibraryW
 //   Stage 2: DllMain spawns a thread calling InitializeXamlDiagnosticsEx from
-//            within the target process. XAML Diagnostics then CoCreates our
-//            ShellTAPSite, which starts the VisualTreeWatcher.
+//            within the target process (TAPCore's XamlBootstrap). XAML
+//            Diagnostics then CoCreates our ShellTAPSite, which starts the
+//            VisualTreeWatcher.
 //
 // Configuration is read from named shared memory:
-//   "W11ThemeSuite_ShellTAP_<TargetId>_Config" -- ShellTAPConfig struct
+//   "W11ThemeSuite_ShellTAP_Init_<PID>" -- TargetId (64 wchar_t), read in DllMain
+//   "W11ThemeSuite_ShellTAP_<TargetId>_Config" -- ShellTAPConfig (v1) or
+//                                                 ShellTAPConfigV2 (seqlock, live)
+//   "W11ThemeSuite_ShellTAP_<TargetId>_ConfigEvent" -- auto-reset event, signaled
+//                                                   by PS after rewriting a v2 _Config
 //   "W11ThemeSuite_ShellTAP_<TargetId>_Mode"   -- int (mode changes from PS)
+//   "W11ThemeSuite_ShellTAP_<TargetId>_ModeEvent" -- auto-reset event, signaled
+//                                                   by PS after writing _Mode
+//   "W11ThemeSuite_ShellTAP_<TargetId>_Detach" -- auto-reset event: detach (as
+//                                                DetachShellTAP does)
+//
+// And publishes:
+//   "W11ThemeSuite_ShellTAP_<TargetId>_Counters" -- ShellTAPCounters (PerfCounters.h)
+//   "W11ThemeSuite_ShellTAP_<TargetId>_Ready"   -- manual-reset event, set when SetSite
+//                                                 has connected (TAPInject.exe waits on it)
+//   "W11ThemeSuite_ShellTAP_<TargetId>_Applied" -- manual-reset event, set on the first apply
+//   "W11ThemeSuite_ShellTAP_<TargetId>_ModeAck" -- auto-reset event, set once a mode is in
+//                                                 place; plus a "W11ThemeSuite_TAP_Registry"
+//                                                 slot (InstanceRegistry.h, for TAPBroker.exe)
+//   "W11ThemeSuite_ShellTAP_<TargetId>_Detached" -- manual-reset event, set once a
+//                                                  detach has released everything
+//   ETW provider "W11ThemeSuite.ShellTAP" -- start/stop regions (EtwTrace.h)
+//
+// And keeps, next to the DLL:
+//   "ShellTAP_<TargetId>.cache" -- warm-start cache (WarmCache.h)
+//   "ShellTAP_<TargetId>_record.trace" -- tree-callback recording, with
+//                                         SHELLTAP_FLAG_RECORD (TAPBench --replay)
 //
 // If no config shared memory exists, operates in discovery mode (logs all elements).
 //
@@ -18,6 +44,20 @@
 #include <initguid.h>   // Must come before guids.h
 #include "ShellTAP.h"
 #include "guids.h"
+#include "TargetMatcher.h"
+#include "AsyncLog.h"
+#include "DiscoveryTrace.h"
+#include "PerfCounters.h"
+#include "EtwTrace.h"
+#include "TreeSnapshot.h"
+#include "../TAPCore/Detach.h"
+#include "../TAPCore/InstanceRegistry.h"
+#include "../TAPCore/MonitorThread.h"
+#include "../TAPCore/PropertyChain.h"
+#include "../TAPCore/StartupEvents.h"
+#include "../TAPCore/XamlBootstrap.h"
+#include "../TAPCore/XamlDirect.h"
+#include "WarmCache.h"
 #include <string>
 #include <cstring>
 #include <oleauto.h>     // SysAllocString, SysFreeString
@@ -29,32 +69,10 @@
 #pragma comment(lib, "WindowsApp.lib")
 
 // ── Debug logging ──
-static FILE* g_logFile = nullptr;
-static wchar_t g_logPath[MAX_PATH] = {0};
-
-static void DebugLog(const char* fmt, ...)
-{
-    if (!g_logFile) {
-        if (g_logPath[0] != 0) {
-            g_logFile = _wfopen(g_logPath, L"a");
-        } else {
-            // Fallback: log next to the DLL
-            wchar_t dllDir[MAX_PATH];
-            GetModuleFileNameW(g_hModule, dllDir, MAX_PATH);
-            PathRemoveFileSpecW(dllDir);
-            wchar_t logPath[MAX_PATH];
-            wsprintfW(logPath, L"%s\\ShellTAP.log", dllDir);
-            g_logFile = _wfopen(logPath, L"a");
-        }
-        if (!g_logFile) return;
-    }
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(g_logFile, fmt, args);
-    va_end(args);
-    fprintf(g_logFile, "\n");
-    fflush(g_logFile);
-}
+// Records go through the AsyncLog ring; the writer thread owns the files.
+// DebugTrace is for per-element detail and compiles out of release builds.
+#define DebugLog(...)   TAP_LOG(TAP_LOG_INFO,  AsyncLog::SINK_DEBUG, __VA_ARGS__)
+#define DebugTrace(...) TAP_LOG(TAP_LOG_TRACE, AsyncLog::SINK_DEBUG, __VA_ARGS__)
 
 // ── Globals ──
 HMODULE g_hModule = nullptr;
@@ -65,28 +83,314 @@ AppearanceMode g_mode = MODE_TRANSPARENT;
 VisualTreeWatcher* g_pWatcher = nullptr;
 
 // ── Configuration from shared memory ──
-static ShellTAPConfig g_config = {0};
+// Effective configuration, parsed from either the v1 or the v2 layout
+struct ConfigSnapshot {
+    int  version;
+    LONG sequence;                                    // v2 seqlock value it was read at
+    int  mode;
+    int  flags;
+    wchar_t logPath[MAX_PATH];
+    std::vector<std::pair<std::wstring, std::wstring>> targets;   // (name, type)
+    ShellTAPStyle styles[SHELLTAP_STYLE_SLOTS];       // v3 overrides; zero otherwise
+    std::vector<std::pair<std::wstring, std::wstring>> scopeInclude;  // v4 ancestor selectors
+    std::vector<std::pair<std::wstring, std::wstring>> scopeExclude;  // v4 pruned subtrees
+    ShellTAPTransition transition;                    // v5; zero (instant) otherwise
+};
+
+static ConfigSnapshot g_config;
 static bool g_discoveryMode = true;  // default: discovery mode
 static wchar_t g_targetId[64] = L"Unknown";
 
+// Active matcher. Swapped only on the UI thread (initially in DllMain,
+// before any callback), so Match() never races a rebuild.
+static std::unique_ptr<TargetMatcher> g_pMatcher(new TargetMatcher());
+
+// ── Live v2 config (kept mapped for reconfiguration) ──
+static HANDLE g_hConfigMap = nullptr;
+static const BYTE* g_pConfigView = nullptr;
+static SIZE_T g_configViewSize = 0;
+static HANDLE g_hConfigEvent = nullptr;  // auto-reset, signaled by PS after each rewrite
+static bool g_liveConfig = false;        // v2 mapping held: track known elements
+
 // ── Shared memory for mode IPC ──
 static HANDLE g_hModeMap = nullptr;
 static volatile int* g_pSharedMode = nullptr;
-static HANDLE g_hMonitorThread = nullptr;
-static bool g_bStopMonitor = false;
+static HANDLE g_hModeEvent = nullptr;    // auto-reset, signaled after each write
+
+// ── Warm-start cache ──
+// g_warm is loaded by the bootstrap thread before IXDE and only read after it
+// (watcher construction). Write-backs are handed to the monitor thread,
+// which owns the file; the newest snapshot wins.
+static wchar_t g_cachePath[MAX_PATH] = L"";
+static WarmCache::Key g_cacheKey = {};
+static WarmCache::Contents g_warm;
+static SRWLOCK g_cacheLock = SRWLOCK_INIT;
+static WarmCache::Contents g_cachePending;      // under g_cacheLock
+static bool g_cachePosted = false;              // under g_cacheLock
+static HANDLE g_hCacheEvent = nullptr;          // auto-reset; null = cache disabled
 
 // ── Discovery mode log ──
-static FILE* g_discoveryLog = nullptr;
+// Text lines go through the AsyncLog discovery sink; with
+// SHELLTAP_FLAG_BINARY_TRACE, elements go to g_trace instead.
+static DiscoveryTrace g_trace;
+
+// ── Recording mode ──
+// SHELLTAP_FLAG_RECORD: every OnVisualTreeChange call, exactly as XAML
+// Diagnostics made it, goes to g_record before the watcher looks at it --
+// in targeting mode too -- so TAPBench --replay can repeat the stream.
+static DiscoveryTrace g_record;
 
 static void DiscoveryLog(const char* fmt, ...)
 {
-    if (!g_discoveryLog) return;
     va_list args;
     va_start(args, fmt);
-    vfprintf(g_discoveryLog, fmt, args);
+    AsyncLog::WriteV(AsyncLog::SINK_DISCOVERY, fmt, args);
     va_end(args);
-    fprintf(g_discoveryLog, "\n");
-    fflush(g_discoveryLog);
+}
+
+static std::unique_ptr<TargetMatcher> CompileTargets(const ConfigSnapshot& cfg)
+{
+    std::unique_ptr<TargetMatcher> matcher(new TargetMatcher());
+    for (size_t i = 0; i < cfg.targets.size(); i++) {
+        const wchar_t* name = cfg.targets[i].first.c_str();
+        if (PathSelectorSet::IsPath(name)) {
+            bool ok = matcher->AddPath(name);
+            DebugLog("  Target[%u]: path '%ls'%s", (unsigned)i, name,
+                ok ? "" : " -- malformed or over the compound limit, ignored");
+            continue;
+        }
+        DebugLog("  Target[%u]: name='%ls' type='%ls'", (unsigned)i,
+            name, cfg.targets[i].second.c_str());
+        matcher->AddRule(name, cfg.targets[i].second.c_str());
+    }
+    matcher->Build();
+    return matcher;
+}
+
+// Scope rules are plain name/type selectors; null when the list is empty
+static std::unique_ptr<TargetMatcher> CompileScope(
+    const std::vector<std::pair<std::wstring, std::wstring>>& rules, const char* kind)
+{
+    if (rules.empty()) return nullptr;
+    std::unique_ptr<TargetMatcher> matcher(new TargetMatcher());
+    for (size_t i = 0; i < rules.size(); i++) {
+        DebugLog("  Scope %s[%u]: name='%ls' type='%ls'", kind, (unsigned)i,
+            rules[i].first.c_str(), rules[i].second.c_str());
+        matcher->AddRule(rules[i].first.c_str(), rules[i].second.c_str());
+    }
+    matcher->Build();
+    return matcher;
+}
+
+static void ParseConfigV1(const ShellTAPConfig& raw, ConfigSnapshot* out)
+{
+    out->version = raw.version;
+    out->sequence = 0;
+    out->mode = raw.mode;
+    out->flags = raw.flags;
+    wcsncpy_s(out->logPath, raw.logPath, _TRUNCATE);
+    memset(out->styles, 0, sizeof(out->styles));
+    memset(&out->transition, 0, sizeof(out->transition));
+    out->targets.clear();
+    for (int i = 0; i < raw.targetCount && i < 8; i++) {
+        out->targets.emplace_back(
+            std::wstring(raw.targetNames[i], wcsnlen(raw.targetNames[i], 64)),
+            std::wstring(raw.targetTypes[i], wcsnlen(raw.targetTypes[i], 128)));
+    }
+}
+
+// Bytes between the v2 header and the first target entry
+static SIZE_T ExtensionSize(int version)
+{
+    SIZE_T size = 0;
+    if (version >= SHELLTAP_CONFIG_VERSION_3) size += sizeof(ShellTAPStyle) * SHELLTAP_STYLE_SLOTS;
+    if (version >= SHELLTAP_CONFIG_VERSION_4) size += sizeof(ShellTAPScopeHeader);
+    if (version >= SHELLTAP_CONFIG_VERSION_5) size += sizeof(ShellTAPTransition);
+    return size;
+}
+
+static ShellTAPScopeHeader* ScopeHeader(BYTE* block)
+{
+    return (ShellTAPScopeHeader*)(block + sizeof(ShellTAPConfigV2) + sizeof(ShellTAPStyle) * SHELLTAP_STYLE_SLOTS);
+}
+
+static const ShellTAPTransition* TransitionSection(const BYTE* block)
+{
+    return (const ShellTAPTransition*)(block + sizeof(ShellTAPConfigV2) +
+        sizeof(ShellTAPStyle) * SHELLTAP_STYLE_SLOTS + sizeof(ShellTAPScopeHeader));
+}
+
+// Validates and unpacks a private copy of a v2-v5 block
+static bool ParseConfigV2(BYTE* block, SIZE_T size, ConfigSnapshot* out)
+{
+    const ShellTAPConfigV2* hdr = (const ShellTAPConfigV2*)block;
+    const ShellTAPStyle* styles = (const ShellTAPStyle*)(block + sizeof(ShellTAPConfigV2));
+    int includeCount = 0, excludeCount = 0;
+    if (hdr->version >= SHELLTAP_CONFIG_VERSION_4) {
+        includeCount = ScopeHeader(block)->includeCount;
+        excludeCount = ScopeHeader(block)->excludeCount;
+    }
+
+    const ShellTAPTargetV2* entries = (const ShellTAPTargetV2*)(
+        block + sizeof(ShellTAPConfigV2) + ExtensionSize(hdr->version));
+    int entryCount = hdr->targetCount + includeCount + excludeCount;
+    const wchar_t* blob = (const wchar_t*)(entries + entryCount);
+    if ((const BYTE*)(blob + hdr->stringChars) > block + size) return false;
+
+    out->version = hdr->version;
+    out->sequence = hdr->sequence;
+    out->mode = hdr->mode;
+    out->flags = hdr->flags;
+    wcsncpy_s(out->logPath, hdr->logPath, _TRUNCATE);
+    memset(out->styles, 0, sizeof(out->styles));
+    if (hdr->version >= SHELLTAP_CONFIG_VERSION_3) memcpy(out->styles, styles, sizeof(out->styles));
+    memset(&out->transition, 0, sizeof(out->transition));
+    if (hdr->version >= SHELLTAP_CONFIG_VERSION_5) out->transition = *TransitionSection(block);
+
+    unsigned int chars = (unsigned int)hdr->stringChars;
+    auto unpack = [&](const ShellTAPTargetV2* first, int count,
+                      std::vector<std::pair<std::wstring, std::wstring>>* list) {
+        list->clear();
+        list->reserve(count);
+        for (int i = 0; i < count; i++) {
+            const ShellTAPTargetV2& e = first[i];
+            if (e.nameOffset > chars || e.nameLength > chars - e.nameOffset ||
+                e.typeOffset > chars || e.typeLength > chars - e.typeOffset) {
+                return false;
+            }
+            list->emplace_back(std::wstring(blob + e.nameOffset, e.nameLength),
+                               std::wstring(blob + e.typeOffset, e.typeLength));
+        }
+        return true;
+    };
+    return unpack(entries, hdr->targetCount, &out->targets) &&
+           unpack(entries + hdr->targetCount, includeCount, &out->scopeInclude) &&
+           unpack(entries + hdr->targetCount + includeCount, excludeCount, &out->scopeExclude);
+}
+
+// Seqlock read side: copy the block out of the live mapping and accept the
+// copy only if the sequence was even before and unchanged after.
+static bool SnapshotConfigV2(ConfigSnapshot* out)
+{
+    const ShellTAPConfigV2* live = (const ShellTAPConfigV2*)g_pConfigView;
+    std::vector<BYTE> copy;
+
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        LONG before = ReadAcquire(&live->sequence);
+        if (before & 1) {            // writer active
+            if (attempt < 64) YieldProcessor(); else Sleep(1);
+            continue;
+        }
+
+        int version = live->version;
+        int count = live->targetCount;
+        int chars = live->stringChars;
+        int includeCount = 0, excludeCount = 0;
+        bool sane = version >= SHELLTAP_CONFIG_VERSION_2 && version <= SHELLTAP_CONFIG_VERSION_5 &&
+                    sizeof(ShellTAPConfigV2) + ExtensionSize(version) <= g_configViewSize;
+        if (sane && version >= SHELLTAP_CONFIG_VERSION_4) {
+            const ShellTAPScopeHeader* scope = ScopeHeader((BYTE*)g_pConfigView);
+            includeCount = scope->includeCount;
+            excludeCount = scope->excludeCount;
+        }
+        sane = sane && count >= 0 && chars >= 0 && includeCount >= 0 && excludeCount >= 0;
+
+        SIZE_T need = sizeof(ShellTAPConfigV2) + ExtensionSize(version) +
+                      (SIZE_T)(sane ? count + includeCount + excludeCount : 0) * sizeof(ShellTAPTargetV2) +
+                      (SIZE_T)(sane ? chars : 0) * sizeof(wchar_t);
+        sane = sane && need <= g_configViewSize;
+        if (sane) copy.assign(g_pConfigView, g_pConfigView + need);
+
+        MemoryBarrier();
+        if (ReadAcquire(&live->sequence) != before) continue;   // torn: retry
+        if (!sane) return false;
+
+        // Parse exactly what was sized above
+        ShellTAPConfigV2* hdr = (ShellTAPConfigV2*)copy.data();
+        hdr->version = version;
+        hdr->targetCount = count;
+        hdr->stringChars = chars;
+        if (version >= SHELLTAP_CONFIG_VERSION_4) {
+            ScopeHeader(copy.data())->includeCount = includeCount;
+            ScopeHeader(copy.data())->excludeCount = excludeCount;
+        }
+        return ParseConfigV2(copy.data(), copy.size(), out);
+    }
+    DebugLog("Config v2: writer never settled; keeping current targets");
+    return false;
+}
+
+// ── Effective per-mode styles ──
+// Built-in table overlaid with the config's SHELLTAP_STYLE_SET slots. Written
+// by DllMain and the monitor thread, read by ApplyToElement on the UI thread.
+static const ShellTAPStyle s_builtinStyles[MODE_COUNT] = {
+    //  flags  fill                   color        opacity strokeOpacity tintOpacity
+    { 0, SHELLTAP_FILL_RESTORE, 0x00000000, 1.0f, 1.0f, 0.0f },    // Default
+    { 0, SHELLTAP_FILL_SOLID,   0x00000000, 0.0f, 0.0f, 0.0f },    // Transparent
+    { 0, SHELLTAP_FILL_SOLID,   0x00000000, 0.3f, 0.0f, 0.0f },    // Acrylic
+    { 0, SHELLTAP_FILL_SOLID,   0x80000000, 1.0f, 0.0f, 0.0f },    // Tint: 50% black
+    { 0, SHELLTAP_FILL_ACRYLIC, 0xFF000000, 1.0f, 0.0f, 0.3f },    // Blur: dark acrylic
+};
+
+static SRWLOCK g_styleLock = SRWLOCK_INIT;
+static ShellTAPStyle g_styles[MODE_COUNT];
+
+// Rebuilds g_styles from `cfg`; true if any slot changed
+static bool LoadStyles(const ConfigSnapshot& cfg)
+{
+    ShellTAPStyle next[MODE_COUNT];
+    for (int m = 0; m < MODE_COUNT; m++) {
+        next[m] = (cfg.styles[m].flags & SHELLTAP_STYLE_SET) ? cfg.styles[m] : s_builtinStyles[m];
+    }
+
+    AcquireSRWLockExclusive(&g_styleLock);
+    bool changed = memcmp(next, g_styles, sizeof(next)) != 0;
+    memcpy(g_styles, next, sizeof(next));
+    ReleaseSRWLockExclusive(&g_styleLock);
+
+    for (int m = 0; m < MODE_COUNT && changed; m++) {
+        if (!(cfg.styles[m].flags & SHELLTAP_STYLE_SET)) continue;
+        DebugLog("  Style[%d]: fill=%u color=#%08X opacity=%.2f stroke=%.2f tint=%.2f", m,
+            next[m].fill, next[m].color, next[m].opacity, next[m].strokeOpacity, next[m].tintOpacity);
+    }
+    return changed;
+}
+
+static ShellTAPStyle GetStyle(AppearanceMode mode)
+{
+    AcquireSRWLockShared(&g_styleLock);
+    ShellTAPStyle style = g_styles[(mode >= 0 && mode < MODE_COUNT) ? mode : MODE_DEFAULT];
+    ReleaseSRWLockShared(&g_styleLock);
+    return style;
+}
+
+// ── Mode switch transition ──
+// v5 duration/easing, same writers and lock as the style table; read by
+// ApplyMode on the UI thread. Zero duration = instant.
+static ShellTAPTransition g_transition;
+
+// Reasserts stay held this long past the Storyboard's duration (its
+// Completed can land a frame or two late)
+static const UINT TRANSITION_HOLD_SLACK_MS = 100;
+
+static void LoadTransition(const ConfigSnapshot& cfg)
+{
+    AcquireSRWLockExclusive(&g_styleLock);
+    bool changed = memcmp(&cfg.transition, &g_transition, sizeof(g_transition)) != 0;
+    g_transition = cfg.transition;
+    ReleaseSRWLockExclusive(&g_styleLock);
+
+    if (changed) {
+        DebugLog("  Transition: %u ms, easing=%u", cfg.transition.durationMs, cfg.transition.easing);
+    }
+}
+
+static ShellTAPTransition GetTransition()
+{
+    AcquireSRWLockShared(&g_styleLock);
+    ShellTAPTransition transition = g_transition;
+    ReleaseSRWLockShared(&g_styleLock);
+    return transition;
 }
 
 // Read configuration from shared memory (written by PowerShell before injection)
@@ -101,39 +405,111 @@ static bool ReadConfig()
         return false;
     }
 
-    void* pView = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, sizeof(ShellTAPConfig));
-    if (pView) {
-        memcpy(&g_config, pView, sizeof(ShellTAPConfig));
-        UnmapViewOfFile(pView);
+    const BYTE* pView = (const BYTE*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION mbi = {};
+    SIZE_T viewSize = (pView && VirtualQuery(pView, &mbi, sizeof(mbi))) ? mbi.RegionSize : 0;
+    int version = (viewSize >= sizeof(int)) ? *(const volatile int*)pView : 0;
+
+    bool ok = false;
+    if (version == SHELLTAP_CONFIG_VERSION && viewSize >= sizeof(ShellTAPConfig)) {
+        ShellTAPConfig raw;
+        memcpy(&raw, pView, sizeof(raw));
+        ParseConfigV1(raw, &g_config);
+        ok = true;
+    } else if (version >= SHELLTAP_CONFIG_VERSION_2 && version <= SHELLTAP_CONFIG_VERSION_5 &&
+               viewSize >= sizeof(ShellTAPConfigV2) + ExtensionSize(version)) {
+        // Keep the mapping: PowerShell rewrites it in place for live retargeting
+        g_hConfigMap = hMap;
+        g_pConfigView = pView;
+        g_configViewSize = viewSize;
+        ok = SnapshotConfigV2(&g_config);
+        if (ok) {
+            wchar_t eventName[128];
+            wsprintfW(eventName, L"W11ThemeSuite_ShellTAP_%s_ConfigEvent", g_targetId);
+            g_hConfigEvent = CreateEventW(nullptr, FALSE, FALSE, eventName);
+            g_liveConfig = true;
+        }
+    }
+
+    if (!g_liveConfig) {
+        if (pView) UnmapViewOfFile(pView);
+        CloseHandle(hMap);
+        g_hConfigMap = nullptr;
+        g_pConfigView = nullptr;
     }
-    CloseHandle(hMap);
 
-    if (g_config.version != SHELLTAP_CONFIG_VERSION) {
-        DebugLog("Config version mismatch: expected %d, got %d", SHELLTAP_CONFIG_VERSION, g_config.version);
+    if (!ok) {
+        DebugLog("Config version mismatch: expected %d-%d, got %d",
+            SHELLTAP_CONFIG_VERSION, SHELLTAP_CONFIG_VERSION_5, version);
         return false;
     }
 
-    g_mode = (AppearanceMode)g_config.mode;
-    g_discoveryMode = (g_config.targetCount == 0);
+    g_mode = (g_config.mode >= 0 && g_config.mode < MODE_COUNT) ? (AppearanceMode)g_config.mode : MODE_TRANSPARENT;
+    g_discoveryMode = g_config.targets.empty();
+    LoadStyles(g_config);
+    LoadTransition(g_config);
 
     if (g_config.logPath[0] != 0) {
-        wcscpy_s(g_logPath, g_config.logPath);
+        AsyncLog::SetSink(AsyncLog::SINK_DEBUG, g_config.logPath, false);
     }
 
-    DebugLog("Config loaded: mode=%d, targetCount=%d, discovery=%s",
-        g_config.mode, g_config.targetCount, g_discoveryMode ? "YES" : "NO");
+    DebugLog("Config v%d loaded: mode=%d, targetCount=%u, scope=%u/%u, discovery=%s, live=%s",
+        g_config.version, g_config.mode, (unsigned)g_config.targets.size(),
+        (unsigned)g_config.scopeInclude.size(), (unsigned)g_config.scopeExclude.size(),
+        g_discoveryMode ? "YES" : "NO", g_liveConfig ? "YES" : "NO");
 
-    for (int i = 0; i < g_config.targetCount && i < 8; i++) {
-        DebugLog("  Target[%d]: name='%ls' type='%ls'",
-            i, g_config.targetNames[i], g_config.targetTypes[i]);
+    g_pMatcher = CompileTargets(g_config);
+    return true;
+}
+
+// Monitor thread, on _ConfigEvent: re-read the v2 block and hand the new
+// target list to the watcher. Nothing is re-matched on this thread.
+static void ReloadConfig()
+{
+    if (!g_liveConfig) return;
+
+    ConfigSnapshot next;
+    if (!SnapshotConfigV2(&next)) return;
+    if (next.sequence == g_config.sequence) return;   // spurious or duplicate signal
+
+    DebugLog("Config v%d update: sequence %ld -> %ld, targetCount=%u",
+        next.version, g_config.sequence, next.sequence, (unsigned)next.targets.size());
+    g_config.sequence = next.sequence;
+    g_config.targets = std::move(next.targets);
+    memcpy(g_config.styles, next.styles, sizeof(g_config.styles));
+    g_config.transition = next.transition;
+    LoadTransition(g_config);
+
+    // The scope index is built from the first Add callbacks on; switching
+    // rules would need the whole tree re-walked, so they stay as injected.
+    if (next.scopeInclude != g_config.scopeInclude || next.scopeExclude != g_config.scopeExclude) {
+        DebugLog("Config update: scope rules changed; they take effect at the next injection");
     }
 
-    return true;
+    // A new style table (e.g. another preset) re-applies the current mode;
+    // the brushes come out of BrushCache, so only new colors allocate.
+    bool restyle = LoadStyles(g_config);
+
+    std::unique_ptr<TargetMatcher> matcher = CompileTargets(g_config);
+    if (g_pWatcher) {
+        g_pWatcher->RequestRetarget(std::move(matcher));
+        if (restyle) g_pWatcher->RequestApplyMode(g_mode);
+    }
 }
 
 // Initialize mode IPC shared memory
+// The change event is created before the mapping: PowerShell treats the
+// mapping's existence as "DLL ready", so the event must already be there.
 static void InitModeSharedMemory()
 {
+    if (g_hModeMap) return;  // SetSite can run more than once
+
+    wchar_t eventName[128];
+    wsprintfW(eventName, L"W11ThemeSuite_ShellTAP_%s_ModeEvent", g_targetId);
+    g_hModeEvent = CreateEventW(nullptr, FALSE, FALSE, eventName);
+    wsprintfW(eventName, L"W11ThemeSuite_ShellTAP_%s_", g_targetId);
+    Detach::CreateEvents(eventName);
+
     wchar_t modeName[128];
     wsprintfW(modeName, L"W11ThemeSuite_ShellTAP_%s_Mode", g_targetId);
 
@@ -146,117 +522,297 @@ static void InitModeSharedMemory()
             *g_pSharedMode = (int)g_mode;
         }
     }
-    DebugLog("Mode shared memory '%ls' initialized (ptr=%p)", modeName, g_pSharedMode);
+    DebugLog("Mode shared memory '%ls' initialized (ptr=%p, event=%p)",
+        modeName, g_pSharedMode, g_hModeEvent);
 }
 
-// Monitor thread: polls shared memory for mode changes from PowerShell
-static DWORD WINAPI MonitorThread(LPVOID)
+// ── Startup timing ──
+// QPC stamps of each startup milestone; 0 = not reached yet. Reported in the
+// log and through GetShellTAPStartupTimings.
+static LONG64 g_qpcFrequency = 0;
+static volatile LONG64 g_qpcAttach = 0;       // DLL_PROCESS_ATTACH
+static volatile LONG64 g_qpcXamlReady = 0;    // Windows.UI.Xaml.dll present
+static volatile LONG64 g_qpcSetSite = 0;      // XAML Diagnostics called SetSite
+static volatile LONG64 g_qpcFirstApply = 0;   // first successful SetProperty
+static volatile LONG g_ixdeAttempts = 0;
+
+static LONG64 QpcNow()
 {
-    while (!g_bStopMonitor) {
-        if (g_pSharedMode) {
-            int newMode = *g_pSharedMode;
-            if (newMode >= 0 && newMode <= 2 && newMode != (int)g_mode) {
-                g_mode = (AppearanceMode)newMode;
-                DebugLog("Mode changed to %d via shared memory", newMode);
-                if (g_pWatcher) {
-                    g_pWatcher->ApplyMode(g_mode);
-                }
-            }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+// Mirrors the milestones into the shared counters block
+static void PublishStartup()
+{
+    ShellTAPCounters* c = PerfCounters::Block();
+    c->qpcAttach = g_qpcAttach;
+    c->qpcXamlReady = g_qpcXamlReady;
+    c->qpcSetSite = g_qpcSetSite;
+    c->qpcFirstApply = g_qpcFirstApply;
+    c->ixdeAttempts = g_ixdeAttempts;
+}
+
+// Stamps a milestone the first time it is reached; true if this call did
+static bool MarkStartup(volatile LONG64* milestone)
+{
+    if (InterlockedCompareExchange64(milestone, QpcNow(), 0) != 0) return false;
+    PublishStartup();
+    return true;
+}
+
+// Milliseconds from DLL attach to `stamp`; -1 if the milestone is unset
+static double MilestoneMs(LONG64 stamp)
+{
+    if (stamp == 0 || g_qpcAttach == 0 || g_qpcFrequency == 0) return -1.0;
+    return (double)(stamp - g_qpcAttach) * 1000.0 / (double)g_qpcFrequency;
+}
+
+static void NoteFirstApply()
+{
+    if (g_qpcFirstApply != 0 || !MarkStartup(&g_qpcFirstApply)) return;
+    StartupEvents::SignalApplied();
+    DebugLog("Startup: first apply at %.1f ms (XAML ready %.1f ms, SetSite %.1f ms, %ld IXDE attempts)",
+        MilestoneMs(g_qpcFirstApply), MilestoneMs(g_qpcXamlReady),
+        MilestoneMs(g_qpcSetSite), g_ixdeAttempts);
+}
+
+// Picks up a mode written to the shared _Mode block and applies (or acks) it
+static void CheckSharedMode()
+{
+    if (!g_pSharedMode) return;
+    int newMode = *g_pSharedMode;
+    if (newMode >= 0 && newMode < MODE_COUNT && newMode != (int)g_mode) {
+        g_mode = (AppearanceMode)newMode;
+        DebugLog("Mode changed to %d via shared memory", newMode);
+        if (g_pWatcher) {
+            g_pWatcher->RequestApplyMode(g_mode);   // ApplyMode acks
+            return;
+        }
+    }
+    // Nothing to apply (same mode, or no watcher yet): the mode is in place
+    InstanceRegistry::AckMode((int)g_mode);
+}
+
+// ── Warm-start cache I/O ──
+// Bootstrap thread, once Windows.UI.Xaml.dll is loaded (the cache is keyed
+// by its version). A missing or stale file leaves g_warm empty.
+static void LoadWarmCache()
+{
+    if (g_discoveryMode || (g_config.flags & SHELLTAP_FLAG_NO_WARM_CACHE)) return;
+    if (!WarmCache::CurrentKey(&g_cacheKey)) {
+        DebugLog("Warm cache: no version info for Windows.UI.Xaml.dll / host -- disabled");
+        return;
+    }
+
+    wchar_t dllDir[MAX_PATH];
+    GetModuleFileNameW(g_hModule, dllDir, MAX_PATH);
+    PathRemoveFileSpecW(dllDir);
+    wsprintfW(g_cachePath, L"%s\\ShellTAP_%s.cache", dllDir, g_targetId);
+    g_hCacheEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    if (WarmCache::Load(g_cachePath, g_cacheKey, &g_warm)) {
+        DebugLog("Warm cache: %u types, last mode %d (%ls)", (unsigned)g_warm.types.size(),
+            g_warm.lastMode, g_cachePath);
+        if ((g_config.flags & SHELLTAP_FLAG_RESUME_MODE) &&
+            g_warm.lastMode >= 0 && g_warm.lastMode < MODE_COUNT) {
+            g_mode = (AppearanceMode)g_warm.lastMode;
+            DebugLog("Warm cache: resuming mode %d", g_warm.lastMode);
         }
-        Sleep(250);
+    } else {
+        g_warm = WarmCache::Contents();
+        DebugLog("Warm cache: none usable for xaml=%016llX host=%016llX -- cold start",
+            (unsigned long long)g_cacheKey.xamlVersion, (unsigned long long)g_cacheKey.hostVersion);
     }
-    return 0;
 }
 
+// Any thread: replaces the pending snapshot and wakes the monitor thread
+static void PostWarmCache(WarmCache::Contents&& contents)
+{
+    if (!g_hCacheEvent) return;
+    AcquireSRWLockExclusive(&g_cacheLock);
+    g_cachePending = std::move(contents);
+    g_cachePosted = true;
+    ReleaseSRWLockExclusive(&g_cacheLock);
+    SetEvent(g_hCacheEvent);
+}
+
+// Monitor thread
+static void WriteWarmCache()
+{
+    WarmCache::Contents contents;
+    AcquireSRWLockExclusive(&g_cacheLock);
+    bool posted = g_cachePosted;
+    if (posted) contents = std::move(g_cachePending);
+    g_cachePosted = false;
+    ReleaseSRWLockExclusive(&g_cacheLock);
+    if (!posted) return;
+
+    bool ok = WarmCache::Save(g_cachePath, g_cacheKey, contents);
+    DebugLog("Warm cache: saved %u types, mode %d%s", (unsigned)contents.types.size(),
+        contents.lastMode, ok ? "" : " -- write FAILED");
+}
+
+// Monitor thread, on TreeSnapshot's request event
+static void RequestTreeSnapshot()
+{
+    if (g_pWatcher) g_pWatcher->RequestTreeSnapshot();
+}
+
+// Monitor thread (TAPCore\MonitorThread.h): blocks until PowerShell signals
+// a mode change, a v2 config rewrite, or detach. No timeout -- an idle
+// process sees zero wakeups from this thread.
 static void StartMonitorThread()
 {
-    g_bStopMonitor = false;
-    g_hMonitorThread = CreateThread(nullptr, 0, MonitorThread, nullptr, 0, nullptr);
+    const MonitorThread::Wait extra[] = {
+        { g_hConfigEvent, ReloadConfig },
+        { g_hCacheEvent, WriteWarmCache },
+        { TreeSnapshot::RequestEvent(), RequestTreeSnapshot },
+    };
+    MonitorThread::Start(g_hModeEvent, CheckSharedMode, extra, (int)(sizeof(extra) / sizeof(extra[0])));
 }
 
 // ══════════════════════════════════════════════
 // Stage 2: Self-injection into XAML Diagnostics
+// XamlBootstrap waits for the host's Windows.UI.Xaml.dll and retries IXDE;
+// the events below stamp the startup milestones and emit the ETW regions.
 // ══════════════════════════════════════════════
-typedef HRESULT(WINAPI* PFN_InitializeXamlDiagnosticsEx)(
-    LPCWSTR endPointName,
-    DWORD pid,
-    LPCWSTR wszDllXamlDiagnostics,
-    LPCWSTR wszTAPDllName,
-    CLSID tapClsid,
-    LPCWSTR wszInitializationData
-);
-
-static DWORD WINAPI SelfInjectThread(LPVOID)
+// XamlBootstrap's log lines, at DebugLog level
+static void CoreLog(const char* fmt, ...)
 {
-    DebugLog("=== SelfInjectThread started (target=%ls) ===", g_targetId);
+    if (TAP_LOG_INFO < TAP_LOG_LEVEL) return;
+    va_list args;
+    va_start(args, fmt);
+    AsyncLog::WriteV(AsyncLog::SINK_DEBUG, fmt, args);
+    va_end(args);
+}
 
-    wchar_t dllPath[MAX_PATH];
-    GetModuleFileNameW(g_hModule, dllPath, MAX_PATH);
-    DebugLog("DLL path: %ls", dllPath);
+class ShellBootstrapEvents : public XamlBootstrap::BootstrapEvents {
+public:
+    ShellBootstrapEvents() : m_span(TAP_ETW_KEYWORD_STARTUP) {}
 
-    HMODULE hWux = LoadLibraryExW(L"Windows.UI.Xaml.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
-    if (!hWux) {
-        DebugLog("LoadLibrary(Windows.UI.Xaml.dll) FAILED: 0x%08X", GetLastError());
-        return HRESULT_FROM_WIN32(GetLastError());
+    void OnXamlReady(bool hostLoaded) override
+    {
+        MarkStartup(&g_qpcXamlReady);
+        if (hostLoaded) DebugLog("Windows.UI.Xaml.dll ready after %.1f ms", MilestoneMs(g_qpcXamlReady));
+
+        // Before IXDE: the watcher seeds itself from it in SetSite
+        LoadWarmCache();
     }
 
-    auto pfnIXDE = reinterpret_cast<PFN_InitializeXamlDiagnosticsEx>(
-        GetProcAddress(hWux, "InitializeXamlDiagnosticsEx"));
-    if (!pfnIXDE) {
-        FreeLibrary(hWux);
-        return HRESULT_FROM_WIN32(GetLastError());
+    void OnAttemptStart(int attempt) override
+    {
+        InterlockedExchange(&g_ixdeAttempts, attempt);
+        PublishStartup();
+
+        m_span = EtwTrace::Span(TAP_ETW_KEYWORD_STARTUP);
+        TAP_ETW_START(m_span, "IxdeAttempt", TAP_ETW_KEYWORD_STARTUP,
+            TraceLoggingWideString(g_targetId, "TargetId"),
+            TraceLoggingInt32(attempt, "Attempt"));
     }
 
-    DWORD pid = GetCurrentProcessId();
-    HRESULT hr = E_FAIL;
-    UINT8 attempts = 1;
+    void OnAttemptStop(int attempt, HRESULT hr) override
+    {
+        TAP_ETW_STOP(m_span, "IxdeAttempt", TAP_ETW_KEYWORD_STARTUP,
+            TraceLoggingWideString(g_targetId, "TargetId"),
+            TraceLoggingInt32(attempt, "Attempt"),
+            TraceLoggingHResult(hr, "HResult"));
+        if (SUCCEEDED(hr)) {
+            DebugLog("IXDE succeeded on attempt %d (%.1f ms after attach)", attempt, MilestoneMs(QpcNow()));
+        }
+    }
 
-    do {
-        wchar_t connName[64];
-        wsprintfW(connName, L"VisualDiagConnection%d", (int)attempts);
+private:
+    EtwTrace::Span m_span;
+};
 
-        struct IxdeArgs {
-            PFN_InitializeXamlDiagnosticsEx pfn;
-            LPCWSTR conn;
-            DWORD pid;
-            LPCWSTR dllPath;
-            HRESULT hr;
-        };
+static DWORD WINAPI SelfInjectThread(LPVOID)
+{
+    DebugLog("=== SelfInjectThread started (target=%ls) ===", g_targetId);
 
-        IxdeArgs args;
-        args.pfn = pfnIXDE;
-        args.conn = connName;
-        args.pid = pid;
-        args.dllPath = dllPath;
-        args.hr = E_FAIL;
+    ShellBootstrapEvents events;
+    XamlBootstrap::Options options = { g_hModule, CLSID_ShellTAPSite, &events, CoreLog };
+    return (DWORD)XamlBootstrap::Connect(options);
+}
 
-        HANDLE hThread = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
-            auto* a = (IxdeArgs*)param;
-            a->hr = a->pfn(a->conn, a->pid, nullptr, a->dllPath, CLSID_ShellTAPSite, nullptr);
-            return 0;
-        }, &args, 0, nullptr);
+// ══════════════════════════════════════════════
+// Teardown
+// Process detach and DetachShellTAP release the same IPC state; a detach
+// (TAPCore\Detach.h) also unadvises, drains the UI thread and, when no COM
+// object of ours is left, drops the injector's LoadLibrary reference.
+// ══════════════════════════════════════════════
+// Monitor thread stopped first: nothing may wait on these any more
+static void CloseSharedState()
+{
+    if (g_pSharedMode) { UnmapViewOfFile((LPCVOID)g_pSharedMode); g_pSharedMode = nullptr; }
+    if (g_hModeMap) { CloseHandle(g_hModeMap); g_hModeMap = nullptr; }
+    if (g_hModeEvent) { CloseHandle(g_hModeEvent); g_hModeEvent = nullptr; }
+    MonitorThread::Close();
+    if (g_hConfigEvent) { CloseHandle(g_hConfigEvent); g_hConfigEvent = nullptr; }
+    if (g_hCacheEvent) { CloseHandle(g_hCacheEvent); g_hCacheEvent = nullptr; }
+    StartupEvents::Close();
+    InstanceRegistry::Unregister();
+    if (g_pConfigView) { UnmapViewOfFile(g_pConfigView); g_pConfigView = nullptr; }
+    if (g_hConfigMap) { CloseHandle(g_hConfigMap); g_hConfigMap = nullptr; }
+    g_liveConfig = false;
+    PerfCounters::Close();
+    TreeSnapshot::Close();
+    if (AsyncLog::Dropped() > 0) {
+        DebugLog("Log ring dropped %llu records", (unsigned long long)AsyncLog::Dropped());
+    }
+    if (g_trace.IsOpen()) {
+        DebugLog("Binary discovery trace closed: %llu bytes, %u strings",
+            (unsigned long long)g_trace.BytesWritten(), (unsigned)g_trace.StringCount());
+        g_trace.Close();
+    }
+    if (g_record.IsOpen()) {
+        DebugLog("Recording closed: %llu bytes, %u strings",
+            (unsigned long long)g_record.BytesWritten(), (unsigned)g_record.StringCount());
+        g_record.Close();
+    }
+}
 
-        if (hThread) {
-            WaitForSingleObject(hThread, 5000);
-            CloseHandle(hThread);
-            hr = args.hr;
+// Detach hooks (TAPCore\Detach.h), on the detach thread: no more
+// callbacks, then the UI thread lets go of its XAML objects
+static HRESULT ReleaseWatcher(DWORD timeoutMs)
+{
+    HRESULT hr = S_OK;
+    VisualTreeWatcher* watcher = g_pWatcher;
+    g_pWatcher = nullptr;
+    if (watcher) {
+        if (g_pTreeService) {
+            hr = g_pTreeService->UnadviseVisualTreeChange(watcher);
+            DebugLog("UnadviseVisualTreeChange: 0x%08X", hr);
         }
-
-        if (SUCCEEDED(hr)) {
-            DebugLog("IXDE succeeded on attempt %d", (int)attempts);
-            break;
+        if (!watcher->Detach(timeoutMs)) {
+            DebugLog("Detach: UI thread did not close the dispatch window within %u ms; "
+                     "its XAML references stay until it does", timeoutMs);
         }
+        watcher->Release();
+    }
+    if (g_pTreeService) { g_pTreeService->Release(); g_pTreeService = nullptr; }
+    if (g_pDiagnostics) { g_pDiagnostics->Release(); g_pDiagnostics = nullptr; }
+    return hr;
+}
 
-        DebugLog("IXDE attempt %d failed: 0x%08X", (int)attempts, hr);
-        ++attempts;
-        Sleep(500);
-    } while (FAILED(hr) && attempts <= 60);
+static void ReleaseSharedState()
+{
+    WriteWarmCache();           // a write-back the monitor thread had not got to
+    CloseSharedState();
+}
 
-    if (FAILED(hr)) {
-        DebugLog("IXDE FAILED after all attempts. Last HRESULT: 0x%08X", hr);
-    }
+static bool CanUnload()
+{
+    return DllCanUnloadNow() == S_OK;
+}
 
-    return hr;
+// The log writer and ETW go before FreeLibrary: they cannot be stopped from DllMain
+static void BeforeUnload()
+{
+    VisualTreeWatcher::UnregisterDispatchClass();
+    EtwTrace::Unregister();
+    AsyncLog::Stop(2000);
 }
 
 // ══════════════════════════════════════════════
@@ -268,9 +824,31 @@ BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID)
         g_hModule = hInstance;
         DisableThreadLibraryCalls(hInstance);
 
-        // Read TargetId from shared memory (written by PowerShell before injection)
-        // Fixed name: "W11ThemeSuite_ShellTAP_Init" contains the target ID string
-        HANDLE hInitMap = OpenFileMappingW(FILE_MAP_READ, FALSE, L"W11ThemeSuite_ShellTAP_Init");
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        g_qpcFrequency = freq.QuadPart;
+        g_qpcAttach = QpcNow();
+
+        // Default debug log next to the DLL; ReadConfig may redirect it
+        {
+            wchar_t logPath[MAX_PATH];
+            GetModuleFileNameW(g_hModule, logPath, MAX_PATH);
+            PathRemoveFileSpecW(logPath);
+            wcscat_s(logPath, L"\\ShellTAP.log");
+            AsyncLog::SetSink(AsyncLog::SINK_DEBUG, logPath, false);
+        }
+        AsyncLog::Start();
+        EtwTrace::Register();
+        Detach::Init({ g_hModule, CoreLog, ReleaseWatcher, ReleaseSharedState,
+                       CanUnload, BeforeUnload });
+
+        // Read TargetId from shared memory (written by PowerShell before injection).
+        // "W11ThemeSuite_ShellTAP_Init_<PID>" is per process, so several hosts
+        // can be injected at once; the unsuffixed name is the old global block.
+        wchar_t initName[64];
+        wsprintfW(initName, L"W11ThemeSuite_ShellTAP_Init_%lu", GetCurrentProcessId());
+        HANDLE hInitMap = OpenFileMappingW(FILE_MAP_READ, FALSE, initName);
+        if (!hInitMap) hInitMap = OpenFileMappingW(FILE_MAP_READ, FALSE, L"W11ThemeSuite_ShellTAP_Init");
         if (hInitMap) {
             void* pView = MapViewOfFile(hInitMap, FILE_MAP_READ, 0, 0, 64 * sizeof(wchar_t));
             if (pView) {
@@ -280,43 +858,82 @@ BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID)
             CloseHandle(hInitMap);
         }
 
+        // Counters are published from the start so startup stalls show up
+        if (PerfCounters::Open(g_targetId)) PublishStartup();
+        TreeSnapshot::Open(g_targetId);
+
+        // _Ready / _Applied for the injector (TAPInject.exe)
+        {
+            wchar_t eventPrefix[128];
+            wsprintfW(eventPrefix, L"W11ThemeSuite_ShellTAP_%s_", g_targetId);
+            StartupEvents::Create(eventPrefix);
+        }
+
+        // Built-in styles until (unless) the config overrides them
+        LoadStyles(g_config);
+
         // Read configuration from shared memory
         ReadConfig();
 
         // Open discovery log if in discovery mode
         if (g_discoveryMode) {
             wchar_t discLogPath[MAX_PATH];
+            bool binary = (g_config.flags & SHELLTAP_FLAG_BINARY_TRACE) != 0;
             if (g_config.logPath[0] != 0) {
                 wsprintfW(discLogPath, L"%s", g_config.logPath);
+                // The debug log shares logPath; keep the binary trace apart
+                if (binary && !PathRenameExtensionW(discLogPath, L".trace")) binary = false;
+            } else {
+                wchar_t dllDir[MAX_PATH];
+                GetModuleFileNameW(g_hModule, dllDir, MAX_PATH);
+                PathRemoveFileSpecW(dllDir);
+                wsprintfW(discLogPath, binary ? L"%s\\ShellTAP_%s_discovery.trace"
+                                              : L"%s\\ShellTAP_%s_discovery.log", dllDir, g_targetId);
+            }
+            if (binary && g_trace.Open(discLogPath,
+                    (g_config.flags & SHELLTAP_FLAG_TRACE_MAPPED) != 0, g_targetId)) {
+                DebugLog("Binary discovery trace: %ls (mapped=%d)", discLogPath,
+                    (g_config.flags & SHELLTAP_FLAG_TRACE_MAPPED) ? 1 : 0);
+            } else {
+                AsyncLog::SetSink(AsyncLog::SINK_DISCOVERY, discLogPath, true);
+                DiscoveryLog("=== ShellTAP Discovery Log (target=%ls) ===", g_targetId);
+                DiscoveryLog("Format: [handle] name | type\n");
+            }
+        }
+
+        // Open the recording (beside the discovery output, or at logPath)
+        if (g_config.flags & SHELLTAP_FLAG_RECORD) {
+            wchar_t recordPath[MAX_PATH];
+            if (g_config.logPath[0] != 0) {
+                wsprintfW(recordPath, L"%s", g_config.logPath);
+                if (!PathRenameExtensionW(recordPath, L".record.trace")) recordPath[0] = 0;
             } else {
                 wchar_t dllDir[MAX_PATH];
                 GetModuleFileNameW(g_hModule, dllDir, MAX_PATH);
                 PathRemoveFileSpecW(dllDir);
-                wsprintfW(discLogPath, L"%s\\ShellTAP_%s_discovery.log", dllDir, g_targetId);
+                wsprintfW(recordPath, L"%s\\ShellTAP_%s_record.trace", dllDir, g_targetId);
             }
-            g_discoveryLog = _wfopen(discLogPath, L"w");
-            if (g_discoveryLog) {
-                fprintf(g_discoveryLog, "=== ShellTAP Discovery Log (target=%ls) ===\n", g_targetId);
-                fprintf(g_discoveryLog, "Format: [handle] name | type\n\n");
-                fflush(g_discoveryLog);
+            if (recordPath[0] && g_record.Open(recordPath,
+                    (g_config.flags & SHELLTAP_FLAG_TRACE_MAPPED) != 0, g_targetId)) {
+                DebugLog("Recording tree callbacks: %ls", recordPath);
+            } else {
+                DebugLog("Recording requested but the trace could not be opened");
             }
         }
 
-        // Spawn self-injection thread
+        // Spawn self-injection thread. TAPBench builds without it and hands
+        // the site a fake diagnostics provider itself.
+#ifndef SHELLTAP_NO_BOOTSTRAP
         HANDLE hThread = CreateThread(nullptr, 0, SelfInjectThread, nullptr, 0, nullptr);
         if (hThread) CloseHandle(hThread);
+#endif
     }
     else if (reason == DLL_PROCESS_DETACH) {
-        g_bStopMonitor = true;
-        if (g_hMonitorThread) {
-            WaitForSingleObject(g_hMonitorThread, 2000);
-            CloseHandle(g_hMonitorThread);
-            g_hMonitorThread = nullptr;
-        }
-        if (g_pSharedMode) { UnmapViewOfFile((LPCVOID)g_pSharedMode); g_pSharedMode = nullptr; }
-        if (g_hModeMap) { CloseHandle(g_hModeMap); g_hModeMap = nullptr; }
-        if (g_discoveryLog) { fclose(g_discoveryLog); g_discoveryLog = nullptr; }
-        if (g_logFile) { fclose(g_logFile); g_logFile = nullptr; }
+        MonitorThread::Stop(2000);
+        CloseSharedState();
+        Detach::Close();
+        EtwTrace::Unregister();
+        AsyncLog::Stop(2000);
     }
     return TRUE;
 }
@@ -328,10 +945,10 @@ extern "C" {
 
 HRESULT __stdcall SetShellTAPMode(int mode)
 {
-    if (mode < 0 || mode > 2) return E_INVALIDARG;
+    if (mode < 0 || mode >= MODE_COUNT) return E_INVALIDARG;
     g_mode = (AppearanceMode)mode;
     if (g_pSharedMode) *g_pSharedMode = mode;
-    if (g_pWatcher) g_pWatcher->ApplyMode(g_mode);
+    if (g_pWatcher) g_pWatcher->RequestApplyMode(g_mode);
     return S_OK;
 }
 
@@ -350,110 +967,69 @@ int __stdcall GetShellTAPAppliedCount()
     return g_pWatcher ? g_pWatcher->GetTrackedCount() : 0;
 }
 
-} // extern "C"
-
-// ══════════════════════════════════════════════
-// COM: DllGetClassObject + DllCanUnloadNow
-// ══════════════════════════════════════════════
-STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv)
+HRESULT __stdcall GetShellTAPStartupTimings(ShellTAPStartupTimings* out)
 {
-    if (rclsid == CLSID_ShellTAPSite) {
-        auto* factory = new ShellTAPFactory();
-        HRESULT hr = factory->QueryInterface(riid, ppv);
-        factory->Release();
-        return hr;
-    }
-    return CLASS_E_CLASSNOTAVAILABLE;
+    if (!out) return E_POINTER;
+    out->xamlReadyMs = MilestoneMs(g_qpcXamlReady);
+    out->setSiteMs = MilestoneMs(g_qpcSetSite);
+    out->firstApplyMs = MilestoneMs(g_qpcFirstApply);
+    out->ixdeAttempts = g_ixdeAttempts;
+    return S_OK;
 }
 
-STDAPI DllCanUnloadNow()
+int __stdcall GetShellTAPTimeToFirstApplyMs()
 {
-    return (g_refCount == 0) ? S_OK : S_FALSE;
+    double ms = MilestoneMs(g_qpcFirstApply);
+    return ms < 0 ? -1 : (int)(ms + 0.5);
 }
 
-// ══════════════════════════════════════════════
-// ShellTAPFactory (IClassFactory)
-// ══════════════════════════════════════════════
-ShellTAPFactory::ShellTAPFactory() : m_refCount(1) { g_refCount++; }
-
-HRESULT ShellTAPFactory::QueryInterface(REFIID riid, void** ppv)
+// Same as signaling <prefix>Detach: unadvise, drain the monitor and UI
+// threads, free the pools and unmap every section; the elements keep the
+// values last applied. Returns once the detach thread has it; <prefix>Detached
+// is set when it is done (the module may be gone by then).
+HRESULT __stdcall DetachShellTAP()
 {
-    if (riid == IID_IUnknown || riid == IID_IClassFactory) {
-        *ppv = static_cast<IClassFactory*>(this);
-        AddRef();
-        return S_OK;
-    }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
+    return Detach::Request();
 }
 
-ULONG ShellTAPFactory::AddRef() { return InterlockedIncrement(&m_refCount); }
-ULONG ShellTAPFactory::Release()
-{
-    long ref = InterlockedDecrement(&m_refCount);
-    if (ref == 0) { g_refCount--; delete this; }
-    return ref;
-}
+} // extern "C"
 
-HRESULT ShellTAPFactory::CreateInstance(IUnknown* pOuter, REFIID riid, void** ppv)
+// ══════════════════════════════════════════════
+// COM: DllGetClassObject + DllCanUnloadNow
+// ══════════════════════════════════════════════
+STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv)
 {
-    if (pOuter) return CLASS_E_NOAGGREGATION;
-    auto* site = new ShellTAPSite();
-    HRESULT hr = site->QueryInterface(riid, ppv);
-    site->Release();
-    return hr;
+    return TAPCore::GetClassObject<ShellTAPSite>(CLSID_ShellTAPSite, rclsid, riid, ppv);
 }
 
-HRESULT ShellTAPFactory::LockServer(BOOL fLock)
+STDAPI DllCanUnloadNow()
 {
-    if (fLock) g_refCount++;
-    else g_refCount--;
-    return S_OK;
+    return (g_refCount == 0) ? S_OK : S_FALSE;
 }
 
 // ══════════════════════════════════════════════
 // ShellTAPSite (IObjectWithSite)
 // ══════════════════════════════════════════════
-ShellTAPSite::ShellTAPSite() : m_refCount(1), m_pSite(nullptr) { g_refCount++; }
-
-ShellTAPSite::~ShellTAPSite()
+HRESULT ShellTAPSite::OnSiteChanged(IUnknown* pUnkSite)
 {
-    if (m_pSite) m_pSite->Release();
-    g_refCount--;
-}
+    if (pUnkSite) MarkStartup(&g_qpcSetSite);
+    DebugLog("=== SetSite called (target=%ls, pUnkSite=%p, %.1f ms after attach) ===",
+        g_targetId, pUnkSite, MilestoneMs(QpcNow()));
 
-HRESULT ShellTAPSite::QueryInterface(REFIID riid, void** ppv)
-{
-    if (riid == IID_IUnknown || riid == IID_IObjectWithSite) {
-        *ppv = static_cast<IObjectWithSite*>(this);
-        AddRef();
-        return S_OK;
-    }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
-}
-
-ULONG ShellTAPSite::AddRef() { return InterlockedIncrement(&m_refCount); }
-ULONG ShellTAPSite::Release()
-{
-    long ref = InterlockedDecrement(&m_refCount);
-    if (ref == 0) delete this;
-    return ref;
-}
-
-HRESULT ShellTAPSite::SetSite(IUnknown* pUnkSite)
-{
-    DebugLog("=== SetSite called (target=%ls, pUnkSite=%p) ===", g_targetId, pUnkSite);
-
-    if (m_pSite) { m_pSite->Release(); m_pSite = nullptr; }
     if (g_pTreeService) { g_pTreeService->Release(); g_pTreeService = nullptr; }
     if (g_pDiagnostics) { g_pDiagnostics->Release(); g_pDiagnostics = nullptr; }
-    if (g_pWatcher) { g_pWatcher->Release(); g_pWatcher = nullptr; }
+    if (g_pWatcher) {
+        g_pWatcher->ShutdownDispatch();
+        g_pWatcher->FreeValuePool();
+        g_pWatcher->Release();
+        g_pWatcher = nullptr;
+    }
 
     if (!pUnkSite) return S_OK;
-
-    m_pSite = pUnkSite;
-    m_pSite->AddRef();
+    if (Detach::Detached()) {
+        DebugLog("SetSite after detach: ignored");
+        return S_OK;
+    }
 
     HRESULT hr = pUnkSite->QueryInterface(__uuidof(IXamlDiagnostics),
                                            reinterpret_cast<void**>(&g_pDiagnostics));
@@ -478,279 +1054,1168 @@ HRESULT ShellTAPSite::SetSite(IUnknown* pUnkSite)
 
     InitModeSharedMemory();
     StartMonitorThread();
+    {
+        wchar_t prefix[96];
+        wsprintfW(prefix, L"W11ThemeSuite_ShellTAP_%s_", g_targetId);
+        if (!InstanceRegistry::Register(g_targetId, prefix, MODE_COUNT)) {
+            DebugLog("Instance registry: no slot (TAPBroker will not see this target)");
+        }
+    }
+    StartupEvents::SignalReady();
 
     return S_OK;
 }
 
-HRESULT ShellTAPSite::GetSite(REFIID riid, void** ppvSite)
-{
-    if (!m_pSite) { *ppvSite = nullptr; return E_FAIL; }
-    return m_pSite->QueryInterface(riid, ppvSite);
-}
-
 // ══════════════════════════════════════════════
-// VisualTreeWatcher
+// VisualTreeWatcher (TAPCore::WatcherBase<ConfigPolicy>)
 // ══════════════════════════════════════════════
 VisualTreeWatcher::VisualTreeWatcher(IXamlDiagnostics* pDiag, IVisualTreeService3* pService)
-    : m_refCount(1), m_pDiag(pDiag), m_pService(pService), m_trackedCount(0)
+    : WatcherBase(pDiag, pService),
+      m_slicePosted(false), m_ackMode(-1),
+      m_cacheGeneration(0), m_cacheSavedGeneration(0), m_cacheSavedMode(-1),
+      m_reassert(&VisualTreeWatcher::OnReassert, this), m_throttlePosted(false),
+      m_flushPosted(false), m_retargetPending(false), m_pendingMode(-1), m_snapshotPending(false),
+      m_gaugeTick(0), m_detaching(false)
 {
-    g_refCount++;
-    if (m_pDiag) m_pDiag->AddRef();
-    if (m_pService) m_pService->AddRef();
-    memset(m_tracked, 0, sizeof(m_tracked));
+    InitializeSRWLock(&m_indexLock);
+    InitializeSRWLock(&m_trackedLock);
+    InitializeSRWLock(&m_retargetLock);
+    m_tree.SetScope(CompileScope(g_config.scopeInclude, "include"),
+                    CompileScope(g_config.scopeExclude, "exclude"));
+    m_tree.SetSelectors(&g_pMatcher->Paths());
+
+    // Path selectors need ancestry, and a live config may bring them later
+    m_tree.Enable(g_liveConfig || m_tree.Scoped() || !g_pMatcher->Paths().Empty());
+    SeedWarmCache();
 }
 
 VisualTreeWatcher::~VisualTreeWatcher()
 {
-    if (m_pDiag) m_pDiag->Release();
-    if (m_pService) m_pService->Release();
-    g_refCount--;
+    FreeValuePool();
 }
 
-HRESULT VisualTreeWatcher::QueryInterface(REFIID riid, void** ppv)
+// Check if an element matches any configured target.
+// Name: exact or "*"; type: substring or "*". "Stroke" in the name marks a
+// stroke element. The target list is precompiled (ReadConfig / v2 reload),
+// so the common non-match costs one hash probe on the name.
+bool VisualTreeWatcher::MatchesTarget(InstanceHandle handle, const wchar_t* name, const wchar_t* type,
+                                      bool* outIsStroke)
 {
-    if (riid == IID_IUnknown ||
-        riid == __uuidof(IVisualTreeServiceCallback) ||
-        riid == __uuidof(IVisualTreeServiceCallback2)) {
-        *ppv = static_cast<IVisualTreeServiceCallback2*>(this);
-        AddRef();
-        return S_OK;
-    }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
+    if (g_pMatcher->Match(name, type, outIsStroke) >= 0) return true;
+    return m_tree.Selected(handle, outIsStroke) >= 0;
 }
 
-ULONG VisualTreeWatcher::AddRef() { return InterlockedIncrement(&m_refCount); }
-ULONG VisualTreeWatcher::Release()
+static void LogDiscoveryLine(InstanceHandle handle, const wchar_t* name, const wchar_t* type,
+                             InstanceHandle parent, uint32_t numChildren)
 {
-    long ref = InterlockedDecrement(&m_refCount);
-    if (ref == 0) delete this;
-    return ref;
-}
-
-// Check if an element matches any configured target
-bool VisualTreeWatcher::MatchesTarget(const wchar_t* name, const wchar_t* type, bool* outIsStroke)
-{
-    *outIsStroke = false;
-
-    for (int i = 0; i < g_config.targetCount && i < 8; i++) {
-        bool nameMatch = false;
-        bool typeMatch = false;
-
-        // Name matching: exact match or wildcard "*"
-        if (g_config.targetNames[i][0] == L'*' && g_config.targetNames[i][1] == 0) {
-            nameMatch = true;
-        } else if (name && wcscmp(name, g_config.targetNames[i]) == 0) {
-            nameMatch = true;
-        }
-
-        // Type matching: substring match (e.g., "Rectangle" matches "Windows.UI.Xaml.Shapes.Rectangle")
-        if (g_config.targetTypes[i][0] == L'*' && g_config.targetTypes[i][1] == 0) {
-            typeMatch = true;
-        } else if (type && wcsstr(type, g_config.targetTypes[i]) != nullptr) {
-            typeMatch = true;
-        }
-
-        if (nameMatch && typeMatch) {
-            // Heuristic: "Stroke" in the name means it's a stroke element
-            if (name && wcsstr(name, L"Stroke") != nullptr) {
-                *outIsStroke = true;
-            }
-            return true;
-        }
-    }
-    return false;
+    DiscoveryLog("[%llu] %ls | %ls (parent=%llu, numChildren=%u)",
+        (unsigned long long)handle,
+        (name && name[0]) ? name : L"(unnamed)",
+        (type && type[0]) ? type : L"(unknown)",
+        (unsigned long long)parent,
+        numChildren);
 }
 
 // Discovery mode: log element for later analysis
-void VisualTreeWatcher::LogElement(const VisualElement& element, InstanceHandle parent)
+void VisualTreeWatcher::LogElement(const VisualElement& element, InstanceHandle parent,
+                                   VisualMutationType mutation)
 {
-    if (!g_discoveryLog) return;
+    if (g_trace.IsOpen()) {
+        g_trace.Record(mutation, element.Handle, parent, element.Name, element.Type,
+                       element.NumChildren);
+        return;
+    }
 
-    const wchar_t* name = element.Name ? element.Name : L"(unnamed)";
-    const wchar_t* type = element.Type ? element.Type : L"(unknown)";
+    // The text format only lists additions. Lines are formatted by a
+    // background slice, not inside the callback.
+    if (mutation != Add || !AsyncLog::SinkEnabled(AsyncLog::SINK_DISCOVERY)) return;
 
-    fprintf(g_discoveryLog, "[%llu] %ls | %ls (parent=%llu, numChildren=%u)\n",
-        (unsigned long long)element.Handle,
-        name, type,
-        (unsigned long long)parent,
-        element.NumChildren);
-    fflush(g_discoveryLog);
+    if (EnsureDispatchWindow()) {
+        m_scheduler.PushLine(element.Handle, parent, element.Name, element.Type, element.NumChildren);
+        ScheduleSlice();
+        return;
+    }
+    LogDiscoveryLine(element.Handle, element.Name, element.Type, parent, element.NumChildren);
 }
 
-// ── OnVisualTreeChange ──
-HRESULT VisualTreeWatcher::OnVisualTreeChange(
+// ── OnTreeChange (WatcherBase::OnVisualTreeChange) ──
+HRESULT VisualTreeWatcher::OnTreeChange(
     ParentChildRelation relation,
     VisualElement element,
     VisualMutationType mutationType)
 {
+    if (g_record.IsOpen()) g_record.RecordCall(relation, element, mutationType);
+
+    ShellTAPCounters* counters = PerfCounters::Block();
+    PerfCounters::ScopedTimer timer(&counters->callbackTime);
+
+    EtwTrace::Span span(TAP_ETW_KEYWORD_TREE);
+    TAP_ETW_START(span, "OnVisualTreeChange", TAP_ETW_KEYWORD_TREE,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt64((UINT64)element.Handle, "Handle"),
+        TraceLoggingInt32((int)mutationType, "Mutation"));
+    bool matched = false;
+
+    // A new target list arrived before the dispatch window could deliver it
+    if (m_retargetPending.load(std::memory_order_acquire)) ApplyPendingRetarget();
+
+    // Snapshot requests are posted to the dispatch window, so there has to
+    // be one once there is an index to publish (discovery tracks nothing)
+    if (m_tree.Enabled()) EnsureDispatchWindow();
+    if (m_snapshotPending.load(std::memory_order_acquire)) {
+        m_scheduler.Defer(ApplyScheduler::CHORE_SNAPSHOT);
+        ScheduleSlice();
+    }
+    if ((++m_gaugeTick & 255) == 0) {
+        m_scheduler.Defer(ApplyScheduler::CHORE_GAUGES);
+        ScheduleSlice();
+    }
+
+    // Index first: path selectors read the state it derives from the
+    // parent. Subtrees ruled out by the scope rules end here -- one index
+    // probe for the parent's state, nothing matched, logged or remembered.
+    if (m_tree.Enabled() && (mutationType == Add || mutationType == Remove)) {
+        TreeIndex::State state = (mutationType == Add)
+            ? m_tree.OnAdd(element.Handle, relation.Parent, element.Name, element.Type)
+            : m_tree.OnRemove(element.Handle, &m_removed);
+        if (state != TreeIndex::STATE_IN) {
+            // An out-of-scope root can still have had tracked descendants
+            if (mutationType == Remove && !m_removed.empty()) ForgetElements(m_removed);
+            PerfCounters::Increment((mutationType == Add) ? &counters->addCallbacks : &counters->removeCallbacks);
+            PerfCounters::Increment(&counters->prunedCallbacks);
+            TAP_ETW_STOP(span, "OnVisualTreeChange", TAP_ETW_KEYWORD_TREE,
+                TraceLoggingWideString(g_targetId, "TargetId"),
+                TraceLoggingUInt64((UINT64)element.Handle, "Handle"),
+                TraceLoggingBool(false, "Matched"),
+                TraceLoggingHResult(S_OK, "HResult"));
+            return S_OK;
+        }
+    }
+
     if (mutationType == Add) {
+        PerfCounters::Increment(&counters->addCallbacks);
+
         // In discovery mode, log everything
         if (g_discoveryMode) {
-            LogElement(element, relation.Parent);
+            LogElement(element, relation.Parent, Add);
         }
 
         // In targeting mode, check if this element matches a target
-        if (!g_discoveryMode && element.Name && element.Type) {
-            bool isStroke = false;
-            if (MatchesTarget(element.Name, element.Type, &isStroke)) {
-                DebugLog("MATCHED element: name='%ls' type='%ls' handle=%llu",
-                    element.Name, element.Type, (unsigned long long)element.Handle);
-
-                if (m_trackedCount < MAX_TRACKED) {
-                    int slot = m_trackedCount++;
-                    m_tracked[slot].handle = element.Handle;
-                    wcsncpy_s(m_tracked[slot].name, element.Name, 63);
-                    wcsncpy_s(m_tracked[slot].type, element.Type, 127);
-                    m_tracked[slot].isStroke = isStroke;
-                    m_tracked[slot].active = true;
-
-                    // Apply current mode immediately
-                    if (g_mode != MODE_DEFAULT) {
-                        ApplyMode(g_mode);
-                    }
-                }
+        bool isStroke = false;
+        if (!g_discoveryMode) {
+            matched = MatchesTarget(element.Handle, element.Name, element.Type, &isStroke);
+        }
+
+        if (matched) {
+            PerfCounters::Increment(&counters->matches);
+            DebugLog("MATCHED element: name='%ls' type='%ls' handle=%llu",
+                element.Name ? element.Name : L"", element.Type ? element.Type : L"",
+                (unsigned long long)element.Handle);
+        }
+
+        if (matched || g_liveConfig) {
+            AcquireSRWLockExclusive(&m_trackedLock);
+            uint32_t nameId = m_strings.Intern(element.Name);
+            uint32_t typeId = m_strings.Intern(element.Type);
+
+            // Remember every element so a later target list can re-match it
+            if (g_liveConfig) {
+                KnownElement* ke = m_known.Insert(element.Handle);
+                if (ke) { ke->nameId = nameId; ke->typeId = typeId; }
             }
+
+            TrackedElement* te = matched ? m_tracked.Insert(element.Handle) : nullptr;
+            if (te) {
+                te->nameId = nameId;
+                te->typeId = typeId;
+                te->isStroke = isStroke;
+
+                // Queue for the batched apply at the end of this burst
+                if (g_mode != MODE_DEFAULT) MarkDirty(element.Handle);
+            }
+            ReleaseSRWLockExclusive(&m_trackedLock);
+
+            if (te && g_mode != MODE_DEFAULT) ScheduleFlush();
         }
     }
     else if (mutationType == Remove) {
-        // Remove tracked elements that were deleted
-        for (int i = 0; i < m_trackedCount; i++) {
-            if (m_tracked[i].handle == element.Handle) {
-                m_tracked[i].active = false;
-                m_tracked[i].handle = 0;
-            }
+        PerfCounters::Increment(&counters->removeCallbacks);
+
+        if (g_discoveryMode) {
+            LogElement(element, relation.Parent, Remove);
         }
+
+        // XAML may only report the subtree root; the index knows the rest
+        if (m_removed.empty()) m_removed.push_back(element.Handle);
+        ForgetElements(m_removed);
     }
 
+    TAP_ETW_STOP(span, "OnVisualTreeChange", TAP_ETW_KEYWORD_TREE,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt64((UINT64)element.Handle, "Handle"),
+        TraceLoggingBool(matched, "Matched"),
+        TraceLoggingHResult(S_OK, "HResult"));
     return S_OK;
 }
 
+// Elements gone from the tree: tracked/known slots are reused at once, and
+// handle-keyed entries die with them (type entries stay)
+void VisualTreeWatcher::ForgetElements(std::vector<InstanceHandle>& handles)
+{
+    AcquireSRWLockExclusive(&m_trackedLock);
+    for (InstanceHandle handle : handles) {
+        m_tracked.Erase(handle);
+        m_known.Erase(handle);
+    }
+    ReleaseSRWLockExclusive(&m_trackedLock);
+
+    AcquireSRWLockExclusive(&m_indexLock);
+    for (InstanceHandle handle : handles) m_indicesByHandle.erase(handle);
+    ReleaseSRWLockExclusive(&m_indexLock);
+
+    for (InstanceHandle handle : handles) {
+        ForgetOriginalFill(handle);
+        m_reassert.Unwatch(handle);
+    }
+    handles.clear();
+}
+
+// XAML re-resolved (or failed to resolve) a resource on the element, e.g.
+// a ThemeResource after a theme or accent change: whatever it resolved to
+// replaced our value, so a tracked element is queued again.
 HRESULT VisualTreeWatcher::OnElementStateChanged(
-    InstanceHandle, VisualElementState, LPCWSTR)
+    InstanceHandle element, VisualElementState elementState, LPCWSTR context)
 {
+    DebugTrace("OnElementStateChanged: handle=%llu state=%d context='%ls'",
+        (unsigned long long)element, (int)elementState, context ? context : L"");
+    Reassert(element);
     return S_OK;
 }
 
+// ── Dispatch messages ──
+static const UINT WM_SHELLTAP_FLUSH = WM_APP + 1;
+static const UINT WM_SHELLTAP_RETARGET = WM_APP + 2;
+static const UINT WM_SHELLTAP_APPLYMODE = WM_APP + 3;
+static const UINT WM_SHELLTAP_SNAPSHOT = WM_APP + 4;
+static const UINT WM_SHELLTAP_SLICE = WM_APP + 5;
+static const UINT WM_SHELLTAP_REASSERT = WM_APP + 6;   // timer: a transition's reassert hold is over
+static const UINT WM_SHELLTAP_THROTTLED = WM_APP + 7;  // timer: a throttled element's window is over
+
+// ── Re-assert ──
+// Something other than us rewrote a tracked element's Opacity or Fill:
+// queue just that element for the next flush, in the current mode.
+void VisualTreeWatcher::OnReassert(void* context, InstanceHandle handle, bool throttled)
+{
+    auto* self = (VisualTreeWatcher*)context;
+    if (throttled) {
+        DebugLog("Reassert: element %llu reset more than %u times in %u ms; re-applying when the window ends",
+            (unsigned long long)handle, ReassertWatch::REASSERT_BURST, ReassertWatch::REASSERT_WINDOW_MS);
+        self->ScheduleThrottled(ReassertWatch::REASSERT_WINDOW_MS);
+        return;
+    }
+    self->Reassert(handle);
+}
+
+// One timer covers every deferred element: armed for the first, re-armed
+// by WM_SHELLTAP_THROTTLED for whichever is due next
+void VisualTreeWatcher::ScheduleThrottled(DWORD delayMs)
+{
+    if (m_throttlePosted) return;
+    m_throttlePosted = PostDelayedDispatch(WM_SHELLTAP_THROTTLED, delayMs);
+}
+
+void VisualTreeWatcher::Reassert(InstanceHandle handle)
+{
+    if (g_mode == MODE_DEFAULT) return;     // nothing of ours to defend
+
+    AcquireSRWLockExclusive(&m_trackedLock);
+    bool tracked = m_tracked.Find(handle) != nullptr;
+    if (tracked) MarkDirty(handle);
+    ReleaseSRWLockExclusive(&m_trackedLock);
+    if (!tracked) return;
+
+    PerfCounters::Increment(&PerfCounters::Block()->reasserts);
+    DebugTrace("Reassert: element %llu queued", (unsigned long long)handle);
+    ScheduleFlush();
+}
+
 // ── ApplyMode ──
+// Touches every tracked element once; anything still queued is covered too.
+// On the UI thread the pass goes through the scheduler like a flush and the
+// mode is acked when its last element is done. An animated switch (one
+// Storyboard for all of them) and the off-thread fallback apply it here.
 void VisualTreeWatcher::ApplyMode(AppearanceMode mode)
 {
-    DebugLog("ApplyMode: mode=%d, trackedCount=%d", (int)mode, m_trackedCount);
-    if (!m_pDiag) return;
+    EtwTrace::Span span(TAP_ETW_KEYWORD_APPLY);
+    TAP_ETW_START(span, "ApplyMode", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingInt32((int)mode, "Mode"));
+
+    std::vector<ApplyItem> items;
+
+    AcquireSRWLockExclusive(&m_trackedLock);
+    items.reserve(m_tracked.Size());
+    m_tracked.ForEach([&](InstanceHandle handle, TrackedElement& te) {
+        te.dirty = false;
+        items.push_back({ handle, te.typeId, te.isStroke });
+    });
+    m_dirty.clear();
+    ReleaseSRWLockExclusive(&m_trackedLock);
+
+    DebugLog("ApplyMode: mode=%d, trackedCount=%u", (int)mode, (unsigned)items.size());
+
+    // Queued applies of tracked elements are superseded by this pass. The
+    // scheduler only ever holds work on the UI thread.
+    bool onUiThread = OnDispatchThread();
+    if (onUiThread) m_scheduler.DropTracked();
+
+    // v5 transition: direct sets below add their elements to one Storyboard.
+    // Off the UI thread (inline fallback) Open refuses and the switch is instant.
+    if (m_pDiag) {
+        ShellTAPTransition transition = GetTransition();
+        HRESULT hrOpen = m_transition.Open(transition.durationMs, transition.easing);
+        if (FAILED(hrOpen) && hrOpen != RPC_E_WRONG_THREAD) {
+            DebugLog("ApplyMode: transition setup = 0x%08X; switching instantly", hrOpen);
+        }
+    }
+
+    HRESULT hr = m_pDiag ? S_OK : E_UNEXPECTED;
+    bool sliced = m_pDiag && onUiThread && !m_transition.IsOpen();
+    if (sliced) {
+        for (const ApplyItem& item : items) {
+            m_scheduler.Push({ item.handle, item.typeId, (int)mode, item.isStroke, false });
+        }
+        m_ackMode = (int)mode;
+        RunSlice(true);
+    } else if (m_pDiag) {
+        for (const ApplyItem& item : items) {
+            HRESULT hrItem = ApplyToElement(item.handle, item.typeId, mode, item.isStroke);
+            if (FAILED(hrItem)) hr = hrItem;
+        }
+    }
+
+    uint32_t animated = 0;
+    if (m_transition.IsOpen()) {
+        animated = m_transition.Elements();
+        ReassertWatch::Suppress quiet(m_reassert);      // Begin lands the t=0 values synchronously
+        HRESULT hrBegin = m_transition.Commit();
+        if (hrBegin == S_OK) {
+            PerfCounters::Increment(&PerfCounters::Block()->transitions);
+            DebugLog("ApplyMode: transition begun for %u elements", animated);
+
+            // The keyframes write Opacity and Fill too: changes until the
+            // Storyboard has handed back to the local values are held, then
+            // looked at once (WM_SHELLTAP_REASSERT)
+            UINT holdMs = m_transition.DurationMs() + TRANSITION_HOLD_SLACK_MS;
+            m_reassert.HoldUntil(GetTickCount() + holdMs);
+            PostDelayedDispatch(WM_SHELLTAP_REASSERT, holdMs);
+        } else {
+            if (FAILED(hrBegin)) DebugLog("ApplyMode: Storyboard.Begin = 0x%08X; switched instantly", hrBegin);
+            animated = 0;
+        }
+    }
+
+    TAP_ETW_STOP(span, "ApplyMode", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt32((UINT32)items.size(), "Elements"),
+        TraceLoggingUInt32(animated, "Animated"),
+        TraceLoggingUInt32(sliced ? (UINT32)m_scheduler.Applies() : 0, "Deferred"),
+        TraceLoggingHResult(hr, "HResult"));
+    if (sliced) return;             // RunSlice acks
+
+    if (onUiThread) {
+        m_ackMode = -1;             // a sliced switch still draining is superseded
+        m_scheduler.Defer(ApplyScheduler::CHORE_WARM_CACHE | ApplyScheduler::CHORE_GAUGES);
+        ScheduleSlice();
+    } else {
+        QueueWarmCache();
+        UpdateResourceGauges();
+    }
+    InstanceRegistry::AckMode((int)mode);
+}
+
+// ── Deferred batch apply ──
+// Caller holds m_trackedLock
+void VisualTreeWatcher::MarkDirty(InstanceHandle handle)
+{
+    TrackedElement* te = m_tracked.Find(handle);
+    if (!te || te->dirty) return;
+    te->dirty = true;
+    m_dirty.push_back(handle);
+}
 
-    for (int i = 0; i < m_trackedCount; i++) {
-        if (!m_tracked[i].active || m_tracked[i].handle == 0) continue;
-        ApplyToElement(m_tracked[i].handle, mode, m_tracked[i].isStroke);
+void VisualTreeWatcher::ScheduleFlush()
+{
+    if (m_flushPosted) return;
+    if (EnsureDispatchWindow() && PostDispatch(WM_SHELLTAP_FLUSH)) {
+        m_flushPosted = true;
+        return;
     }
+    FlushPending();  // no window: degrade to applying inline
 }
 
-// ── ApplyToElement via GetPropertyValuesChain + SetProperty ──
-void VisualTreeWatcher::ApplyToElement(InstanceHandle handle,
-                                        AppearanceMode mode,
-                                        bool isStroke)
+void VisualTreeWatcher::FlushPending()
+{
+    m_flushPosted = false;
+    AppearanceMode mode = g_mode;
+    bool apply = (mode != MODE_DEFAULT && m_pDiag);
+    size_t dirty = 0;
+
+    AcquireSRWLockExclusive(&m_trackedLock);
+    for (InstanceHandle handle : m_dirty) {
+        TrackedElement* te = m_tracked.Find(handle);  // may have been removed since
+        if (!te || !te->dirty) continue;
+        te->dirty = false;
+        if (apply) m_scheduler.Push({ handle, te->typeId, (int)mode, te->isStroke, false });
+        dirty++;
+    }
+    m_dirty.clear();
+    ReleaseSRWLockExclusive(&m_trackedLock);
+
+    if (dirty) {
+        PerfCounters::Increment(&PerfCounters::Block()->flushes);
+        DebugLog("FlushPending: mode=%d, dirty=%u", (int)mode, (unsigned)dirty);
+    }
+    RunSlice(true);     // also whatever a retarget queued
+}
+
+// ── Apply slices (ApplyScheduler.h) ──
+// UI thread. Fills, then strokes, then the background work, until the
+// budget is spent; the rest continues on the next idle tick. Without a
+// dispatch window to continue on, the queues are drained here.
+void VisualTreeWatcher::RunSlice(bool bounded)
+{
+    if (m_scheduler.Idle() && m_ackMode < 0) return;
+    bounded = bounded && DispatchWindow();
+
+    ShellTAPCounters* counters = PerfCounters::Block();
+    PerfCounters::ScopedTimer timer(&counters->sliceTime);
+    EtwTrace::Span span(TAP_ETW_KEYWORD_APPLY);
+    TAP_ETW_START(span, "ApplySlice", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt32((UINT32)m_scheduler.Applies(), "Queued"));
+
+    m_scheduler.BeginSlice(bounded);
+    uint32_t applied = 0;
+    ApplyScheduler::Apply item;
+    while (m_scheduler.Pop(&item)) {
+        // Removed since it was queued? (a restored element is no longer tracked)
+        bool live = item.restore ? m_known.Find(item.handle) != nullptr
+                                 : m_tracked.Find(item.handle) != nullptr;
+        if (live && m_pDiag) {
+            ApplyToElement(item.handle, item.typeId, (AppearanceMode)item.mode, item.isStroke);
+            applied++;
+        }
+        if (item.restore) m_reassert.Unwatch(item.handle);
+        if (m_scheduler.Expired()) break;
+    }
+    if (applied) m_scheduler.Defer(ApplyScheduler::CHORE_WARM_CACHE | ApplyScheduler::CHORE_GAUGES);
+
+    uint32_t lines = 0;
+    if (m_scheduler.Applies() == 0) {
+        if (m_ackMode >= 0) {
+            InstanceRegistry::AckMode(m_ackMode);
+            m_ackMode = -1;
+        }
+
+        // Background: one chore at a time while the slice lasts, then
+        // discovery lines
+        if (!m_scheduler.Expired() && m_scheduler.TakeChore(ApplyScheduler::CHORE_GAUGES)) {
+            UpdateResourceGauges();
+        }
+        if (!m_scheduler.Expired() && m_scheduler.TakeChore(ApplyScheduler::CHORE_WARM_CACHE)) {
+            QueueWarmCache();
+        }
+        if (!m_scheduler.Expired() && m_scheduler.TakeChore(ApplyScheduler::CHORE_SNAPSHOT) &&
+            m_snapshotPending.load(std::memory_order_acquire)) {
+            PublishTreeSnapshot();
+        }
+        ApplyScheduler::Line line;
+        while (!m_scheduler.Expired() && m_scheduler.PopLine(&line)) {
+            LogDiscoveryLine(line.handle, m_scheduler.String(line.nameId), m_scheduler.String(line.typeId),
+                             line.parent, line.numChildren);
+            lines++;
+        }
+    }
+
+    bool more = !m_scheduler.Idle();
+    PerfCounters::Increment(&counters->slices);
+    if (more) PerfCounters::Increment(&counters->sliceYields);
+
+    TAP_ETW_STOP(span, "ApplySlice", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt32(applied, "Applied"),
+        TraceLoggingUInt32(lines, "Lines"),
+        TraceLoggingUInt32((UINT32)m_scheduler.Applies(), "Remaining"));
+    if (more && bounded) ScheduleSlice();
+}
+
+// UI thread: the next slice, behind pending input and paint
+void VisualTreeWatcher::ScheduleSlice()
+{
+    if (m_slicePosted) return;
+    if (PostIdleDispatch(WM_SHELLTAP_SLICE)) {
+        m_slicePosted = true;
+        return;
+    }
+    RunSlice(false);    // no window: drain inline
+}
+
+// ── Cross-thread mode changes ──
+// Any thread. The whole mode change becomes one work item on the UI thread,
+// so SetProperty is never marshaled per element and ApplyMode never runs
+// concurrently with OnVisualTreeChange. Requests that arrive before the
+// UI thread gets to the message collapse into it (the newest mode wins).
+void VisualTreeWatcher::RequestApplyMode(AppearanceMode mode)
 {
-    IInspectable* pInspectable = nullptr;
-    HRESULT hr = m_pDiag->GetIInspectableFromHandle(handle, &pInspectable);
-    if (FAILED(hr) || !pInspectable) return;
+    if (m_pendingMode.exchange((int)mode, std::memory_order_acq_rel) >= 0) return;  // already posted
 
-    double opacity = 1.0;
-    bool setFill = false;
+    if (PostDispatch(WM_SHELLTAP_APPLYMODE)) return;
 
-    switch (mode) {
-        case MODE_TRANSPARENT:
-            opacity = 0.0;
-            setFill = true;
+    // No window yet (nothing tracked so far) or the post failed: apply here
+    int pending = m_pendingMode.exchange(-1, std::memory_order_acq_rel);
+    if (pending >= 0) ApplyMode((AppearanceMode)pending);
+}
+
+// ── Tree snapshot (TreeSnapshot.h) ──
+// Any thread. Posted to the UI thread; without a dispatch window yet, the
+// next tree callback serves it. Requests in flight collapse into one.
+void VisualTreeWatcher::RequestTreeSnapshot()
+{
+    if (m_snapshotPending.exchange(true, std::memory_order_acq_rel)) return;
+    PostDispatch(WM_SHELLTAP_SNAPSHOT);
+}
+
+// UI thread
+void VisualTreeWatcher::PublishTreeSnapshot()
+{
+    m_snapshotPending.store(false, std::memory_order_release);
+
+    // The tracked set is only mutated on this thread; the lock is for the
+    // readers elsewhere, so a shared hold is enough
+    AcquireSRWLockShared(&m_trackedLock);
+    bool ok = TreeSnapshot::Publish(m_tree, m_tree.Enabled(),
+        [](void* context, InstanceHandle handle) {
+            return ((VisualTreeWatcher*)context)->m_tracked.Find(handle) != nullptr;
+        }, this);
+    ReleaseSRWLockShared(&m_trackedLock);
+    UpdateResourceGauges();
+
+    DebugLog("Tree snapshot: %u indexed elements%s", (unsigned)m_tree.NodeCount(),
+        m_tree.Enabled() ? (ok ? "" : " -- truncated or not published") : " (no index: v1 config)");
+}
+
+// ── Live reconfiguration ──
+// Called from the monitor thread. The newest list wins if several arrive
+// before the UI thread gets to them.
+void VisualTreeWatcher::RequestRetarget(std::unique_ptr<TargetMatcher> matcher)
+{
+    AcquireSRWLockExclusive(&m_retargetLock);
+    m_pendingMatcher = std::move(matcher);
+    m_retargetPending.store(true, std::memory_order_release);
+    ReleaseSRWLockExclusive(&m_retargetLock);
+
+    // Without a window yet, the next OnVisualTreeChange picks it up instead
+    PostDispatch(WM_SHELLTAP_RETARGET);
+}
+
+// UI thread: swap in the pending matcher and diff the known elements against
+// it. New matches are queued like fresh Adds; elements that stopped matching
+// are put back to default and untracked.
+void VisualTreeWatcher::ApplyPendingRetarget()
+{
+    std::unique_ptr<TargetMatcher> next;
+    AcquireSRWLockExclusive(&m_retargetLock);
+    next.swap(m_pendingMatcher);
+    m_retargetPending.store(false, std::memory_order_relaxed);
+    ReleaseSRWLockExclusive(&m_retargetLock);
+    if (!next) return;
+
+    LONG64 start = QpcNow();
+    PerfCounters::Increment(&PerfCounters::Block()->retargets);
+    g_pMatcher.swap(next);                  // old matcher dies with `next`
+    g_discoveryMode = (g_pMatcher->RuleCount() == 0);
+    m_tree.SetSelectors(&g_pMatcher->Paths());  // before `next` frees the old set
+
+    std::vector<ApplyItem> restore;
+    size_t added = 0;
+    size_t known = 0;
+
+    AcquireSRWLockExclusive(&m_trackedLock);
+    m_known.ForEach([&](InstanceHandle handle, KnownElement& ke) {
+        known++;
+        bool isStroke = false;
+        bool match = !g_discoveryMode &&
+            MatchesTarget(handle, m_strings.Get(ke.nameId), m_strings.Get(ke.typeId), &isStroke);
+
+        TrackedElement* te = m_tracked.Find(handle);
+        if (match) {
+            if (!te) {
+                te = m_tracked.Insert(handle);
+                te->nameId = ke.nameId;
+                te->typeId = ke.typeId;
+                te->isStroke = isStroke;
+                added++;
+                if (g_mode != MODE_DEFAULT) MarkDirty(handle);
+            } else if (te->isStroke != isStroke) {
+                te->isStroke = isStroke;
+                if (g_mode != MODE_DEFAULT) MarkDirty(handle);
+            }
+        } else if (te) {
+            restore.push_back({ handle, te->typeId, te->isStroke });
+            m_tracked.Erase(handle);
+        }
+    });
+    ReleaseSRWLockExclusive(&m_trackedLock);
+
+    // Restores are scheduled like any apply; a reassert watch goes once its
+    // element is back to default
+    bool apply = (g_mode != MODE_DEFAULT && m_pDiag);
+    for (const ApplyItem& item : restore) {
+        if (apply) m_scheduler.Push({ item.handle, item.typeId, (int)MODE_DEFAULT, item.isStroke, true });
+        else m_reassert.Unwatch(item.handle);
+    }
+    FlushPending();
+
+    DebugLog("Retarget: %u rules, %u known elements, +%u / -%u tracked in %.2f ms",
+        (unsigned)g_pMatcher->RuleCount(), (unsigned)known, (unsigned)added,
+        (unsigned)restore.size(), (double)(QpcNow() - start) * 1000.0 / (double)g_qpcFrequency);
+}
+
+// ── Dispatch window (WatcherBase) ──
+void VisualTreeWatcher::OnDispatch(UINT msg)
+{
+    switch (msg) {
+        case WM_SHELLTAP_FLUSH:
+            FlushPending();
             break;
-        case MODE_ACRYLIC:
-            opacity = isStroke ? 0.0 : 0.3;
-            setFill = !isStroke;
+        case WM_SHELLTAP_RETARGET:
+            ApplyPendingRetarget();
             break;
-        case MODE_DEFAULT:
-            opacity = 1.0;
-            setFill = false;
+        case WM_SHELLTAP_APPLYMODE: {
+            int mode = m_pendingMode.exchange(-1, std::memory_order_acq_rel);
+            if (mode >= 0) ApplyMode((AppearanceMode)mode);
             break;
+        }
+        case WM_SHELLTAP_SNAPSHOT:
+            // Background work: it waits for queued applies
+            if (m_snapshotPending.load(std::memory_order_acquire)) {
+                m_scheduler.Defer(ApplyScheduler::CHORE_SNAPSHOT);
+                RunSlice(true);
+            }
+            break;
+        case WM_SHELLTAP_SLICE:
+            m_slicePosted = false;
+            RunSlice(true);
+            break;
+        case WM_SHELLTAP_REASSERT:
+            if (m_reassert.Holding()) {
+                // A later transition extended the hold (GetTickCount is coarse, too)
+                PostDelayedDispatch(WM_SHELLTAP_REASSERT, m_reassert.HoldRemainingMs());
+                break;
+            }
+            m_reassert.TakeHeld([this](InstanceHandle handle) { Reassert(handle); });
+            break;
+        case WM_SHELLTAP_THROTTLED: {
+            m_throttlePosted = false;
+            DWORD next = m_reassert.TakeDue([this](InstanceHandle handle) { Reassert(handle); });
+            if (next) ScheduleThrottled(next);
+            break;
+        }
     }
+}
 
-    SetElementOpacity(pInspectable, opacity);
-    pInspectable->Release();
+void VisualTreeWatcher::OnDispatchClosed()
+{
+    m_pendingMode.store(-1, std::memory_order_relaxed);  // never delivered
+
+    // Queued applies die with the window; discovery lines are still written
+    ApplyScheduler::Line line;
+    while (m_scheduler.PopLine(&line)) {
+        LogDiscoveryLine(line.handle, m_scheduler.String(line.nameId), m_scheduler.String(line.typeId),
+                         line.parent, line.numChildren);
+    }
+    m_scheduler.Clear();
+    m_slicePosted = false;
+    m_throttlePosted = false;
+    m_ackMode = -1;
+    m_transition.Stop();
+    ReleaseOriginalFills();
+    m_reassert.UnwatchAll();
+
+    // The brush cache outlives a watcher (SetSite can run again), not a
+    // detach; it can only be emptied on this thread
+    if (m_detaching.load(std::memory_order_acquire)) BrushCache::Shared().Reset();
 }
 
-// ── SetElementOpacity via GetPropertyValuesChain ──
-void VisualTreeWatcher::SetElementOpacity(IInspectable* pElement, double opacity)
+bool VisualTreeWatcher::Detach(DWORD timeoutMs)
 {
-    if (!m_pService || !pElement) return;
+    m_detaching.store(true, std::memory_order_release);
+    bool closed = CloseDispatch(timeoutMs);
+    FreeValuePool();
+    return closed;
+}
 
-    InstanceHandle handle = 0;
-    HRESULT hr = m_pDiag->GetHandleFromIInspectable(pElement, &handle);
-    if (FAILED(hr)) return;
+// ── Resource gauges ──
+// Estimated from table capacity: node-based maps count an entry, two
+// pointers of node overhead and the bucket array
+template <class Map>
+static size_t MapBytes(const Map& map)
+{
+    return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) +
+           map.bucket_count() * sizeof(void*);
+}
 
-    unsigned int propCount = 0;
-    PropertyChainSource* pSources = nullptr;
-    unsigned int srcCount = 0;
-    PropertyChainValue* pValues = nullptr;
+void VisualTreeWatcher::UpdateResourceGauges()
+{
+    size_t bytes = m_tree.MemoryBytes() + m_reassert.MemoryBytes() + m_scheduler.MemoryBytes();
+    size_t references = BrushCache::Shared().Size();    // reassert watches are weak
+
+    AcquireSRWLockShared(&m_trackedLock);
+    bytes += m_tracked.MemoryBytes() + m_known.MemoryBytes() + m_strings.MemoryBytes() +
+             m_dirty.capacity() * sizeof(InstanceHandle);
+    ReleaseSRWLockShared(&m_trackedLock);
+
+    AcquireSRWLockShared(&m_indexLock);
+    bytes += MapBytes(m_indicesByType) + MapBytes(m_indicesByHandle) + MapBytes(m_noDirectTypes) +
+             MapBytes(m_warmTypes) + MapBytes(m_originalFill);
+    references += m_originalFill.size();
+    ReleaseSRWLockShared(&m_indexLock);
+
+    size_t handles = m_values.Size();
+    bytes += m_values.MemoryBytes();
+
+    ShellTAPCounters* counters = PerfCounters::Block();
+    PerfCounters::Set(&counters->valueHandles, (LONG64)handles);
+    PerfCounters::Set(&counters->heldReferences, (LONG64)references);
+    PerfCounters::Set(&counters->bytesHeld, (LONG64)bytes);
+}
 
-    hr = m_pService->GetPropertyValuesChain(handle, &srcCount, &pSources, &propCount, &pValues);
-    if (FAILED(hr)) return;
+// ── ApplyToElement via GetPropertyValuesChain + SetProperty ──
+HRESULT VisualTreeWatcher::ApplyToElement(InstanceHandle handle,
+                                           uint32_t typeId,
+                                           AppearanceMode mode,
+                                           bool isStroke)
+{
+    ShellTAPCounters* counters = PerfCounters::Block();
+    PerfCounters::Increment(&counters->applyCalls);
+    PerfCounters::ScopedTimer timer(&counters->applyLatency);
 
-    unsigned int fillIndex = UINT_MAX;
-    unsigned int opacityIndex = UINT_MAX;
+    EtwTrace::Span span(TAP_ETW_KEYWORD_APPLY);
+    TAP_ETW_START(span, "ApplyToElement", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingInt32((int)mode, "Mode"));
 
-    for (unsigned int p = 0; p < propCount; p++) {
-        if (pValues[p].PropertyName) {
-            std::wstring propName(pValues[p].PropertyName);
-            if (propName == L"Fill") {
-                fillIndex = pValues[p].Index;
-            }
-            if (propName == L"Opacity") {
-                opacityIndex = pValues[p].Index;
-            }
+    ShellTAPStyle style = GetStyle(mode);
+    double opacity = isStroke ? style.strokeOpacity : style.opacity;
+
+    HRESULT hr = SetElementOpacity(handle, typeId, opacity, style);
+
+    TAP_ETW_STOP(span, "ApplyToElement", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingHResult(hr, "HResult"));
+    return hr;
+}
+
+// ── Property index cache ──
+// Returns the cached Fill/Opacity indices for this element, walking the
+// property chain only on the first lookup for a given type.
+bool VisualTreeWatcher::LookupPropertyIndices(InstanceHandle handle,
+                                               uint32_t typeId,
+                                               PropertyIndices* out)
+{
+    bool byType = (typeId != 0);
+    bool found = false;
+
+    AcquireSRWLockShared(&m_indexLock);
+    if (byType) {
+        auto it = m_indicesByType.find(typeId);
+        if (it != m_indicesByType.end()) { *out = it->second; found = true; }
+    } else {
+        auto it = m_indicesByHandle.find(handle);
+        if (it != m_indicesByHandle.end()) { *out = it->second; found = true; }
+    }
+    ReleaseSRWLockShared(&m_indexLock);
+    if (found) return true;
+
+    if (!ResolvePropertyIndices(handle, out)) return false;
+
+    AcquireSRWLockExclusive(&m_indexLock);
+    if (byType) {
+        m_indicesByType[typeId] = *out;
+        m_cacheGeneration++;
+    } else {
+        m_indicesByHandle[handle] = *out;
+    }
+    ReleaseSRWLockExclusive(&m_indexLock);
+
+    DebugTrace("  Cached property indices for type #%u (handle=%llu): fill=%u opacity=%u",
+        typeId, (unsigned long long)handle, out->fill, out->opacity);
+    return true;
+}
+
+// ── Warm-start cache ──
+// Constructor: what the last session learned per type goes straight into
+// the index caches, so the first apply of a known type does no chain walk
+// or IUIElement probe.
+void VisualTreeWatcher::SeedWarmCache()
+{
+    if (g_warm.types.empty()) return;
+
+    std::vector<uint32_t> ids;
+    ids.reserve(g_warm.types.size());
+    AcquireSRWLockExclusive(&m_trackedLock);      // m_strings is interned under it
+    for (const WarmCache::TypeEntry& t : g_warm.types) ids.push_back(m_strings.Intern(t.type.c_str()));
+    ReleaseSRWLockExclusive(&m_trackedLock);
+
+    AcquireSRWLockExclusive(&m_indexLock);
+    for (size_t i = 0; i < ids.size(); i++) {
+        const WarmCache::TypeEntry& t = g_warm.types[i];
+        if (ids[i] == 0) continue;
+        if (t.flags & SHELLTAP_WARM_TYPE_INDICES) {
+            m_indicesByType[ids[i]] = { t.fill, t.opacity };
+            m_warmTypes.insert(ids[i]);
         }
+        if (t.flags & SHELLTAP_WARM_TYPE_NO_DIRECT) m_noDirectTypes.insert(ids[i]);
     }
+    ReleaseSRWLockExclusive(&m_indexLock);
 
-    // Set Opacity
-    if (opacityIndex != UINT_MAX) {
-        std::wstring opValStr = std::to_wstring(opacity);
-        InstanceHandle hValue = 0;
-        BSTR bstrType = SysAllocString(L"Double");
-        BSTR bstrVal = SysAllocString(opValStr.c_str());
-        hr = m_pService->CreateInstance(bstrType, bstrVal, &hValue);
-        SysFreeString(bstrType);
-        SysFreeString(bstrVal);
+    // Nothing new to write until this session learns something
+    m_cacheSavedMode = g_warm.lastMode;
+    DebugLog("Warm cache: seeded %u types", (unsigned)g_warm.types.size());
+}
 
-        if (SUCCEEDED(hr)) {
-            hr = m_pService->SetProperty(handle, hValue, opacityIndex);
-            DebugLog("  SetProperty(opacity=%f, idx=%u) = 0x%08X", opacity, opacityIndex, hr);
+// After each apply batch. Only the type-level caches and the mode are
+// written; value handles and element handles die with the session.
+void VisualTreeWatcher::QueueWarmCache()
+{
+    if (!g_hCacheEvent) return;
+
+    std::unordered_map<uint32_t, WarmCache::TypeEntry> byType;
+    AcquireSRWLockExclusive(&m_indexLock);
+    bool changed = m_cacheGeneration != m_cacheSavedGeneration || (int)g_mode != m_cacheSavedMode;
+    if (changed) {
+        m_cacheSavedGeneration = m_cacheGeneration;
+        m_cacheSavedMode = (int)g_mode;
+        for (const auto& entry : m_indicesByType) {
+            WarmCache::TypeEntry& t = byType[entry.first];
+            t.fill = entry.second.fill;
+            t.opacity = entry.second.opacity;
+            t.flags = SHELLTAP_WARM_TYPE_INDICES;
         }
+        for (uint32_t typeId : m_noDirectTypes) {
+            auto ins = byType.emplace(typeId, WarmCache::TypeEntry{ std::wstring(), UINT_MAX, UINT_MAX, 0 });
+            ins.first->second.flags |= SHELLTAP_WARM_TYPE_NO_DIRECT;
+        }
+    }
+    ReleaseSRWLockExclusive(&m_indexLock);
+    if (!changed) return;
+
+    WarmCache::Contents contents;
+    contents.lastMode = (int)g_mode;
+    contents.types.reserve(byType.size());
+    AcquireSRWLockShared(&m_trackedLock);
+    for (auto& entry : byType) {
+        const wchar_t* type = m_strings.Get(entry.first);
+        if (!type || !*type) continue;
+        entry.second.type = type;
+        contents.types.push_back(std::move(entry.second));
     }
+    ReleaseSRWLockShared(&m_trackedLock);
 
-    // Set Fill to transparent brush when making transparent
-    if (fillIndex != UINT_MAX && opacity < 1.0) {
-        InstanceHandle hBrush = 0;
-        BSTR bstrType = SysAllocString(L"Windows.UI.Xaml.Media.SolidColorBrush");
-        BSTR bstrVal = SysAllocString(L"Transparent");
-        hr = m_pService->CreateInstance(bstrType, bstrVal, &hBrush);
-        SysFreeString(bstrType);
-        SysFreeString(bstrVal);
+    PostWarmCache(std::move(contents));
+}
+
+// Walk GetPropertyValuesChain once to find the Fill and Opacity indices
+bool VisualTreeWatcher::ResolvePropertyIndices(InstanceHandle handle, PropertyIndices* out)
+{
+    return PropertyChain::FindIndices(m_pService, handle, &out->fill, &out->opacity);
+}
+
+// ── Value handle pool ──
+// CreateInstance registers a new XAML object in the diagnostics handle table
+// on every call, so each distinct value is created once and its handle reused
+// across elements and mode switches (WatcherBase::m_values).
+InstanceHandle VisualTreeWatcher::GetPooledValue(const wchar_t* type, const wchar_t* value)
+{
+    InstanceHandle hValue = 0;
+    HRESULT hr = m_values.Get(m_pService, type, value, &hValue);
+    if (hr != S_OK) LogPoolMiss(hr, type, value);
+    return SUCCEEDED(hr) ? hValue : 0;
+}
+
+InstanceHandle VisualTreeWatcher::GetPooledDouble(double value)
+{
+    InstanceHandle hValue = 0;
+    HRESULT hr = m_values.GetDouble(m_pService, value, &hValue);
+    if (hr != S_OK) LogPoolMiss(hr, L"Double", std::to_wstring(value).c_str());
+    return SUCCEEDED(hr) ? hValue : 0;
+}
+
+// Pool miss: hr is the CreateInstance result (S_FALSE = created)
+void VisualTreeWatcher::LogPoolMiss(HRESULT hr, const wchar_t* type, const wchar_t* value)
+{
+    DebugLog("  CreateInstance('%ls','%ls') = 0x%08X (pooled)", type, value, SUCCEEDED(hr) ? S_OK : hr);
+    if (SUCCEEDED(hr)) PerfCounters::Set(&PerfCounters::Block()->valueHandles, (LONG64)m_values.Size());
+}
+
+// IVisualTreeService has no per-handle release: the pooled objects stay in
+// the diagnostics table until the connection closes. Dropping the pool here
+// keeps us from handing out handles that outlive the watcher's site.
+void VisualTreeWatcher::FreeValuePool()
+{
+    size_t count = m_values.Size();
+    if (count) {
+        DebugLog("FreeValuePool: forgetting %u pooled values (their handles stay in the diagnostics table)",
+            (unsigned)count);
+    }
+    m_values.Clear();
+    PerfCounters::Set(&PerfCounters::Block()->valueHandles, 0);
+}
 
+// ── Direct ABI setters ──
+// put_Opacity / put_Fill on the live object. Returns false when the caller
+// should take the diagnostics path instead: wrong thread, or a type that is
+// not a UIElement (remembered per type, so it is only probed once).
+bool VisualTreeWatcher::TrySetOpacityDirect(InstanceHandle handle, uint32_t typeId,
+                                            double opacity, const ShellTAPStyle& style)
+{
+    if (!m_pDiag) return false;
+    if (typeId != 0) {
+        AcquireSRWLockShared(&m_indexLock);
+        bool skip = m_noDirectTypes.count(typeId) != 0;
+        ReleaseSRWLockShared(&m_indexLock);
+        if (skip) return false;
+    }
+
+    IInspectable* obj = nullptr;
+    HRESULT hr = m_pDiag->GetIInspectableFromHandle(handle, &obj);
+    if (FAILED(hr) || !obj) return false;
+
+    // Animated mode switch: note where the element starts from
+    ABI::Windows::UI::Xaml::Media::IBrush* fromFill = nullptr;
+    double fromOpacity = 1.0;
+    bool animate = m_transition.IsOpen() && SUCCEEDED(XamlDirect::GetOpacity(obj, &fromOpacity));
+    if (animate) XamlDirect::GetFill(obj, &fromFill);     // not a Shape: stays null
+
+    {
+        // Our own writes fire the property-changed callbacks synchronously
+        ReassertWatch::Suppress quiet(m_reassert);
+        hr = XamlDirect::SetOpacity(obj, opacity);
         if (SUCCEEDED(hr)) {
-            hr = m_pService->SetProperty(handle, hBrush, fillIndex);
-            DebugLog("  SetProperty(fill=Transparent, idx=%u) = 0x%08X", fillIndex, hr);
+            HRESULT hrFill = SetFillDirect(handle, obj, style);
+            if (hrFill != E_NOINTERFACE) hr = hrFill;   // not a Shape: no Fill to set
+        }
+    }
+    if (SUCCEEDED(hr) && animate) {
+        ABI::Windows::UI::Xaml::Media::IBrush* toFill = nullptr;
+        XamlDirect::GetFill(obj, &toFill);
+        HRESULT hrAnim = m_transition.Add(obj, fromOpacity, opacity, fromFill, toFill);
+        if (FAILED(hrAnim)) {
+            DebugTrace("  Transition on %llu = 0x%08X; set instantly", (unsigned long long)handle, hrAnim);
         }
+        if (toFill) toFill->Release();
     }
+    if (fromFill) fromFill->Release();
+    if (SUCCEEDED(hr)) {
+        HRESULT hrWatch = m_reassert.Watch(handle, obj);
+        if (FAILED(hrWatch)) {
+            DebugTrace("  Reassert watch on %llu = 0x%08X", (unsigned long long)handle, hrWatch);
+        }
+    }
+    obj->Release();
+
+    if (hr == E_NOINTERFACE && typeId != 0) {
+        AcquireSRWLockExclusive(&m_indexLock);
+        if (m_noDirectTypes.insert(typeId).second) m_cacheGeneration++;
+        ReleaseSRWLockExclusive(&m_indexLock);
+        AcquireSRWLockShared(&m_trackedLock);     // m_strings is interned under it
+        DebugLog("  Direct setters unavailable for type '%ls'; using SetProperty", m_strings.Get(typeId));
+        ReleaseSRWLockShared(&m_trackedLock);
+    }
+    if (FAILED(hr)) {
+        DebugTrace("  Direct set(opacity=%f) on %llu = 0x%08X; falling back", opacity,
+            (unsigned long long)handle, hr);
+        return false;
+    }
+    return true;
+}
 
-    // Free property chain
-    for (unsigned int p = 0; p < propCount; p++) {
-        if (pValues[p].PropertyName) SysFreeString(pValues[p].PropertyName);
-        if (pValues[p].Value) SysFreeString(pValues[p].Value);
-        if (pValues[p].Type) SysFreeString(pValues[p].Type);
-        if (pValues[p].DeclaringType) SysFreeString(pValues[p].DeclaringType);
-        if (pValues[p].ValueType) SysFreeString(pValues[p].ValueType);
-        if (pValues[p].ItemType) SysFreeString(pValues[p].ItemType);
+// Fill half of a direct set. The first time a Shape's Fill is replaced, the
+// brush it had is kept so SHELLTAP_FILL_RESTORE can put it back.
+HRESULT VisualTreeWatcher::SetFillDirect(InstanceHandle handle, IInspectable* obj, const ShellTAPStyle& style)
+{
+    using ABI::Windows::UI::Xaml::Media::IBrush;
+
+    if (style.fill == SHELLTAP_FILL_KEEP) return S_OK;
+
+    if (style.fill == SHELLTAP_FILL_RESTORE) {
+        IBrush* original = nullptr;
+        AcquireSRWLockExclusive(&m_indexLock);
+        auto it = m_originalFill.find(handle);
+        bool saved = (it != m_originalFill.end());
+        if (saved) { original = it->second; m_originalFill.erase(it); }
+        ReleaseSRWLockExclusive(&m_indexLock);
+        if (!saved) return S_OK;           // never changed by us
+
+        HRESULT hr = XamlDirect::SetFill(obj, original);
+        if (original) original->Release();
+        return hr;
+    }
+
+    AcquireSRWLockShared(&m_indexLock);
+    bool saved = m_originalFill.count(handle) != 0;
+    ReleaseSRWLockShared(&m_indexLock);
+    if (!saved) {
+        IBrush* original = nullptr;
+        HRESULT hr = XamlDirect::GetFill(obj, &original);
+        if (FAILED(hr)) return hr;         // E_NOINTERFACE: not a Shape
+        AcquireSRWLockExclusive(&m_indexLock);
+        auto ins = m_originalFill.emplace(handle, original);
+        ReleaseSRWLockExclusive(&m_indexLock);
+        if (!ins.second && original) original->Release();
     }
-    CoTaskMemFree(pValues);
-    for (unsigned int s = 0; s < srcCount; s++) {
-        if (pSources[s].Name) SysFreeString(pSources[s].Name);
-        if (pSources[s].TargetType) SysFreeString(pSources[s].TargetType);
+
+    HRESULT hr;
+    if (style.fill == SHELLTAP_FILL_ACRYLIC) {
+        hr = XamlDirect::SetAcrylicFill(obj, style.color, style.tintOpacity);
+        if (FAILED(hr) && hr != RPC_E_WRONG_THREAD) {
+            // No AcrylicBrush (older XAML, or host backdrop refused): plain tint
+            DebugTrace("  AcrylicBrush(#%08X) = 0x%08X; using a solid tint", style.color, hr);
+            hr = XamlDirect::SetSolidFill(obj, SolidFillColor(style));
+        }
+    } else {
+        hr = XamlDirect::SetSolidFill(obj, style.color);
+    }
+    return hr;
+}
+
+// Element is gone: drop its saved Fill (UI thread)
+void VisualTreeWatcher::ForgetOriginalFill(InstanceHandle handle)
+{
+    ABI::Windows::UI::Xaml::Media::IBrush* original = nullptr;
+    AcquireSRWLockExclusive(&m_indexLock);
+    auto it = m_originalFill.find(handle);
+    bool saved = (it != m_originalFill.end());
+    if (saved) { original = it->second; m_originalFill.erase(it); }
+    ReleaseSRWLockExclusive(&m_indexLock);
+    if (original) original->Release();
+}
+
+// Dispatch window teardown (UI thread). Entries left when the watcher dies
+// elsewhere are leaked, as with BrushCache.
+void VisualTreeWatcher::ReleaseOriginalFills()
+{
+    std::unordered_map<InstanceHandle, ABI::Windows::UI::Xaml::Media::IBrush*> saved;
+    AcquireSRWLockExclusive(&m_indexLock);
+    saved.swap(m_originalFill);
+    ReleaseSRWLockExclusive(&m_indexLock);
+    for (auto& entry : saved) {
+        if (entry.second) entry.second->Release();
+    }
+}
+
+// ── SetElementOpacity: direct ABI first, cached property indices + SetProperty as fallback ──
+// Sets Opacity, and Fill as the style says.
+HRESULT VisualTreeWatcher::SetElementOpacity(InstanceHandle handle, uint32_t typeId,
+                                             double opacity, const ShellTAPStyle& style)
+{
+    if (!m_pService || handle == 0) return E_UNEXPECTED;
+
+    EtwTrace::Span span(TAP_ETW_KEYWORD_APPLY);
+    TAP_ETW_START(span, "SetElementOpacity", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingFloat64(opacity, "Opacity"),
+        TraceLoggingUInt32(style.fill, "Fill"),
+        TraceLoggingHexUInt32(style.color, "Color"));
+
+    if (TrySetOpacityDirect(handle, typeId, opacity, style)) {
+        PerfCounters::Increment(&PerfCounters::Block()->directSets);
+        NoteFirstApply();
+        TAP_ETW_STOP(span, "SetElementOpacity", TAP_ETW_KEYWORD_APPLY,
+            TraceLoggingWideString(g_targetId, "TargetId"),
+            TraceLoggingUInt64((UINT64)handle, "Handle"),
+            TraceLoggingHResult(S_OK, "HResult"));
+        return S_OK;
+    }
+    PerfCounters::Increment(&PerfCounters::Block()->diagnosticsSets);
+
+    PropertyIndices idx;
+    if (!LookupPropertyIndices(handle, typeId, &idx)) {
+        TAP_ETW_STOP(span, "SetElementOpacity", TAP_ETW_KEYWORD_APPLY,
+            TraceLoggingWideString(g_targetId, "TargetId"),
+            TraceLoggingUInt64((UINT64)handle, "Handle"),
+            TraceLoggingHResult(E_NOINTERFACE, "HResult"));
+        return E_NOINTERFACE;
+    }
+
+    HRESULT result = S_OK;      // first failure wins
+
+    HRESULT hr;
+
+    // Set Opacity
+    if (idx.opacity != UINT_MAX) {
+        InstanceHandle hValue = GetPooledDouble(opacity);
+        if (hValue) {
+            hr = m_pService->SetProperty(handle, hValue, idx.opacity);
+            PerfCounters::Increment(&PerfCounters::Block()->setPropertyCalls);
+            if (FAILED(hr)) {
+                PerfCounters::Increment(&PerfCounters::Block()->setPropertyFailures);
+                DebugLog("  SetProperty(opacity=%f, idx=%u) = 0x%08X", opacity, idx.opacity, hr);
+                if (SUCCEEDED(result)) result = hr;
+            } else {
+                NoteFirstApply();
+                DebugTrace("  SetProperty(opacity=%f, idx=%u) = 0x%08X", opacity, idx.opacity, hr);
+            }
+        }
+    }
+
+    // Set Fill to the style's brush (AcrylicBrush cannot be created from a
+    // string, so blur is its tint). There is no saved original on this
+    // path, so FILL_RESTORE leaves Fill as it is.
+    if (idx.fill != UINT_MAX &&
+        (style.fill == SHELLTAP_FILL_SOLID || style.fill == SHELLTAP_FILL_ACRYLIC)) {
+        wchar_t color[16];
+        FormatBrushValue(style, color);
+        InstanceHandle hBrush = GetPooledValue(L"Windows.UI.Xaml.Media.SolidColorBrush", color);
+        if (hBrush) {
+            hr = m_pService->SetProperty(handle, hBrush, idx.fill);
+            PerfCounters::Increment(&PerfCounters::Block()->setPropertyCalls);
+            if (FAILED(hr)) {
+                PerfCounters::Increment(&PerfCounters::Block()->setPropertyFailures);
+                DebugLog("  SetProperty(fill=%ls, idx=%u) = 0x%08X", color, idx.fill, hr);
+                if (SUCCEEDED(result)) result = hr;
+            } else {
+                NoteFirstApply();
+                DebugTrace("  SetProperty(fill=%ls, idx=%u) = 0x%08X", color, idx.fill, hr);
+            }
+        }
+    }
+
+    // Indices from the warm cache that SetProperty rejects are stale:
+    // drop them and retry once with a fresh property-chain walk
+    bool stale = false;
+    if (FAILED(result) && typeId != 0) {
+        AcquireSRWLockExclusive(&m_indexLock);
+        stale = m_warmTypes.erase(typeId) != 0;
+        if (stale) {
+            m_indicesByType.erase(typeId);
+            m_cacheGeneration++;
+        }
+        ReleaseSRWLockExclusive(&m_indexLock);
+    }
+
+    TAP_ETW_STOP(span, "SetElementOpacity", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(g_targetId, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingHResult(result, "HResult"));
+
+    if (stale) {
+        DebugLog("  Warm cache indices for type #%u rejected (0x%08X); re-resolving", typeId, result);
+        return SetElementOpacity(handle, typeId, opacity, style);
     }
-    CoTaskMemFree(pSources);
+    return result;
 }
@@ -7,6 +7,9 @@
 // Configuration is passed via a named shared memory region whose name
 // is derived from a TargetId (e.g., "Taskbar", "StartMenu", "ActionCenter").
 //
+// The site, factory and watcher core come from TAPCore (ConfigPolicy below:
+// targets are compiled from the config at run time).
+//
 // Based on techniques from RainbowTaskbar (MIT) and TranslucentTB (GPL).
 // This implementation is original code for w11-theming-suite.
 #pragma once
@@ -18,6 +21,21 @@
 #include <xamlOM.h>     // IVisualTreeService3, IXamlDiagnostics, IVisualTreeServiceCallback2
 #include <oleauto.h>    // SysAllocString, SysFreeString
 #include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ApplyScheduler.h"
+#include "HandleMap.h"
+#include "ModeTransition.h"
+#include "ReassertWatch.h"
+#include "StringPool.h"
+#include "TreeIndex.h"
+#include "TargetMatcher.h"
+#include "../TAPCore/ComServer.h"
+#include "../TAPCore/WatcherBase.h"
+#include "../TAPCore/XamlDirect.h"
 
 // Forward declarations
 class ShellTAPSite;
@@ -29,18 +47,22 @@ extern std::atomic<long> g_refCount;
 extern IVisualTreeService3* g_pTreeService;
 extern IXamlDiagnostics* g_pDiagnostics;
 
-// Appearance modes (same values as TaskbarTAP for compat)
+// Appearance modes (0-2: same values as TaskbarTAP for compat)
 enum AppearanceMode {
     MODE_DEFAULT     = 0,
     MODE_TRANSPARENT = 1,
-    MODE_ACRYLIC     = 2
+    MODE_ACRYLIC     = 2,
+    MODE_TINT        = 3,   // solid ARGB fill
+    MODE_BLUR        = 4,   // host-backdrop AcrylicBrush tinted with an ARGB color
+    MODE_COUNT
 };
 
 extern AppearanceMode g_mode;
 
 // ── Shared memory configuration ──
-// PowerShell writes this struct to "W11ThemeSuite_ShellTAP_<TargetId>"
+// PowerShell writes this struct to "W11ThemeSuite_ShellTAP_<TargetId>_Config"
 // The DLL reads it on init and monitors for mode changes.
+// Version 1: fixed layout below, read once. Version 2: see ShellTAPConfigV2.
 #pragma pack(push, 1)
 struct ShellTAPConfig {
     int      version;            // Must be 1
@@ -49,11 +71,141 @@ struct ShellTAPConfig {
     wchar_t  targetNames[8][64]; // Element names to match (e.g., "BackgroundFill")
     wchar_t  targetTypes[8][128];// Element types to match (e.g., "Rectangle")
     wchar_t  logPath[260];       // Path for discovery log output
-    int      flags;              // Reserved for future use
+    int      flags;              // SHELLTAP_FLAG_* bits
 };
 #pragma pack(pop)
 
 static const int SHELLTAP_CONFIG_VERSION = 1;
+static const int SHELLTAP_CONFIG_VERSION_2 = 2;
+static const int SHELLTAP_CONFIG_VERSION_3 = 3;
+static const int SHELLTAP_CONFIG_VERSION_4 = 4;
+static const int SHELLTAP_CONFIG_VERSION_5 = 5;
+
+// ShellTAPConfig.flags
+static const int SHELLTAP_FLAG_BINARY_TRACE = 0x1;  // discovery: binary trace instead of text log
+static const int SHELLTAP_FLAG_TRACE_MAPPED = 0x2;  // binary trace: write through a mapped view
+static const int SHELLTAP_FLAG_RESUME_MODE = 0x4;   // start in the warm cache's last mode (WarmCache.h)
+static const int SHELLTAP_FLAG_NO_WARM_CACHE = 0x8; // neither read nor write the warm cache
+static const int SHELLTAP_FLAG_RECORD = 0x10;       // record every tree callback for replay (any mode)
+
+// ── Version 2 configuration (variable-length, live-updatable) ──
+// Mapping layout:
+//   ShellTAPConfigV2
+//   ShellTAPStyle[SHELLTAP_STYLE_SLOTS]      (version >= 3)
+//   ShellTAPScopeHeader                      (version >= 4)
+//   ShellTAPTransition                       (version >= 5)
+//   ShellTAPTargetV2[targetCount]            targets
+//   ShellTAPTargetV2[includeCount]           scope roots      (version >= 4)
+//   ShellTAPTargetV2[excludeCount]           pruned subtrees  (version >= 4)
+//   UTF-16 string blob (stringChars units, not NUL-separated)
+// The mapping is created with SHELLTAP_CONFIG_V2_CAPACITY bytes so the list
+// can grow in place. The DLL keeps it open after init.
+//
+// Updates use a seqlock: the writer bumps `sequence` to odd, rewrites the
+// block, bumps it to even, then signals "..._<TargetId>_ConfigEvent". The DLL
+// copies the block and retries if the sequence was odd or moved meanwhile,
+// so it never acts on a torn target list.
+#pragma pack(push, 1)
+struct ShellTAPConfigV2 {
+    int      version;            // 2-5, see the layout above
+    volatile LONG sequence;      // Seqlock counter (odd = write in progress)
+    int      mode;               // Initial mode; later changes go through _Mode
+    int      flags;              // SHELLTAP_FLAG_* bits
+    int      targetCount;        // 0 = discovery mode
+    int      stringChars;        // Size of the string blob in UTF-16 units
+    wchar_t  logPath[260];       // Path for discovery log output
+};
+
+// A target whose name contains ' ', '>' or '#' is a path selector
+// (PathSelector.h); its type field is ignored.
+struct ShellTAPTargetV2 {
+    unsigned int nameOffset;     // Into the string blob, in UTF-16 units
+    unsigned int nameLength;
+    unsigned int typeOffset;
+    unsigned int typeLength;
+};
+
+// Version 4: ancestor scope rules (TreeIndex.h). Same Name:Type form as
+// targets. Read at injection; a live rewrite keeps the rules it started with.
+struct ShellTAPScopeHeader {
+    int      includeCount;       // roots; with any, only their subtrees are matched
+    int      excludeCount;       // subtrees skipped entirely
+    int      reserved[2];
+};
+
+// Version 5: animated mode switches (ModeTransition.h). Live-updatable like the
+// style table; a zero duration switches instantly, as before.
+struct ShellTAPTransition {
+    unsigned int durationMs;     // 0 = instant; clamped to SHELLTAP_TRANSITION_MAX_MS
+    unsigned int easing;         // SHELLTAP_EASE_*
+    unsigned int reserved[2];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ShellTAPTransition) == 16, "ShellTAPTransition layout");
+
+static const unsigned int SHELLTAP_EASE_LINEAR      = 0;
+static const unsigned int SHELLTAP_EASE_OUT         = 1;  // CubicEase, EaseOut
+static const unsigned int SHELLTAP_EASE_IN          = 2;  // CubicEase, EaseIn
+static const unsigned int SHELLTAP_EASE_IN_OUT      = 3;  // CubicEase, EaseInOut
+
+static const unsigned int SHELLTAP_TRANSITION_MAX_MS = 5000;
+
+static const unsigned int SHELLTAP_CONFIG_V2_CAPACITY = 64 * 1024;
+
+// ── Per-mode appearance ──
+// What ApplyToElement does to a matched element in each mode. The built-in
+// styles reproduce the original Default/Transparent/Acrylic behaviour; a
+// version 3 config (the v2 layout with a ShellTAPStyle table between the
+// header and the target entries) overrides any slot it marks
+// SHELLTAP_STYLE_SET. Rewriting the table plus _ConfigEvent restyles live.
+static const unsigned int SHELLTAP_FILL_KEEP    = 0;  // leave Fill alone
+static const unsigned int SHELLTAP_FILL_RESTORE = 1;  // put back the Fill seen before the first change
+static const unsigned int SHELLTAP_FILL_SOLID   = 2;  // SolidColorBrush(color)
+static const unsigned int SHELLTAP_FILL_ACRYLIC = 3;  // AcrylicBrush(HostBackdrop, TintColor=color)
+
+static const unsigned int SHELLTAP_STYLE_SET = 0x1;   // slot overrides the built-in style
+
+static const int SHELLTAP_STYLE_SLOTS = 8;            // indexed by AppearanceMode; spare slots stay zero
+
+#pragma pack(push, 1)
+struct ShellTAPStyle {
+    unsigned int flags;          // SHELLTAP_STYLE_* bits
+    unsigned int fill;           // SHELLTAP_FILL_*
+    unsigned int color;          // 0xAARRGGBB, for FILL_SOLID / FILL_ACRYLIC
+    float    opacity;            // element Opacity
+    float    strokeOpacity;      // Opacity for stroke targets
+    float    tintOpacity;        // AcrylicBrush.TintOpacity (FILL_ACRYLIC)
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ShellTAPStyle) == 24, "ShellTAPStyle layout");
+
+// SolidColorBrush colour for a style where no AcrylicBrush can be had (the
+// diagnostics path, or XAML refused one): FILL_ACRYLIC degrades to its tint
+// at TintOpacity, so the built-in Blur (opaque black at 0.3) stays
+// translucent instead of going solid black
+inline unsigned int SolidFillColor(const ShellTAPStyle& style)
+{
+    if (style.fill != SHELLTAP_FILL_ACRYLIC) return style.color;
+    float tint = style.tintOpacity < 0.0f ? 0.0f : style.tintOpacity > 1.0f ? 1.0f : style.tintOpacity;
+    unsigned int alpha = (unsigned int)((style.color >> 24) * tint + 0.5f);
+    return (alpha << 24) | (style.color & 0x00FFFFFF);
+}
+
+// Diagnostics-path brush value: "#AARRGGBB" for a SolidColorBrush
+inline void FormatBrushValue(const ShellTAPStyle& style, wchar_t (&out)[16])
+{
+    wsprintfW(out, L"#%08X", SolidFillColor(style));
+}
+
+// Startup milestones in ms after DLL attach; -1 = not reached yet
+struct ShellTAPStartupTimings {
+    double xamlReadyMs;          // Windows.UI.Xaml.dll loaded by the host
+    double setSiteMs;            // XAML Diagnostics connected (SetSite)
+    double firstApplyMs;         // first successful SetProperty
+    int    ixdeAttempts;         // InitializeXamlDiagnosticsEx calls made
+};
 
 // ── Exported C functions ──
 extern "C" {
@@ -61,44 +213,37 @@ extern "C" {
     __declspec(dllexport) int     __stdcall GetShellTAPMode();
     __declspec(dllexport) int     __stdcall GetShellTAPVersion();
     __declspec(dllexport) int     __stdcall GetShellTAPAppliedCount();
+    __declspec(dllexport) HRESULT __stdcall GetShellTAPStartupTimings(ShellTAPStartupTimings* out);
+    __declspec(dllexport) int     __stdcall GetShellTAPTimeToFirstApplyMs();
+    __declspec(dllexport) HRESULT __stdcall DetachShellTAP();
 }
 
+// ── Target policy: config-driven ──
+// Targets arrive through the _Config block (TargetMatcher, TreeIndex), so
+// the watcher handles every tree callback itself.
+struct ConfigPolicy {
+    static constexpr bool kConfigDriven = true;
+    static constexpr const wchar_t* kDispatchClass = L"W11ThemeSuite_ShellTAP_Dispatch";
+};
+
 // ── COM class: ShellTAPSite -- receives XAML diagnostics site ──
-class ShellTAPSite : public IObjectWithSite {
+class ShellTAPSite : public TAPCore::ObjectWithSite<ShellTAPSite> {
 public:
-    ShellTAPSite();
-    virtual ~ShellTAPSite();
-
-    // IUnknown
-    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override;
-    ULONG STDMETHODCALLTYPE AddRef() override;
-    ULONG STDMETHODCALLTYPE Release() override;
-
-    // IObjectWithSite
-    HRESULT STDMETHODCALLTYPE SetSite(IUnknown* pUnkSite) override;
-    HRESULT STDMETHODCALLTYPE GetSite(REFIID riid, void** ppvSite) override;
-
-private:
-    long m_refCount;
-    IUnknown* m_pSite;
+    // From SetSite: null = disconnecting
+    HRESULT OnSiteChanged(IUnknown* pUnkSite);
 };
 
 // ── COM class: VisualTreeWatcher -- watches XAML tree changes ──
-class VisualTreeWatcher : public IVisualTreeServiceCallback2 {
+class VisualTreeWatcher : public TAPCore::WatcherBase<VisualTreeWatcher, ConfigPolicy> {
 public:
     VisualTreeWatcher(IXamlDiagnostics* pDiag, IVisualTreeService3* pService);
-    virtual ~VisualTreeWatcher();
-
-    // IUnknown
-    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override;
-    ULONG STDMETHODCALLTYPE AddRef() override;
-    ULONG STDMETHODCALLTYPE Release() override;
+    ~VisualTreeWatcher() override;
 
-    // IVisualTreeServiceCallback
-    HRESULT STDMETHODCALLTYPE OnVisualTreeChange(
+    // WatcherBase::OnVisualTreeChange forwards every callback here
+    HRESULT OnTreeChange(
         ParentChildRelation relation,
         VisualElement element,
-        VisualMutationType mutationType) override;
+        VisualMutationType mutationType);
 
     // IVisualTreeServiceCallback2
     HRESULT STDMETHODCALLTYPE OnElementStateChanged(
@@ -106,52 +251,176 @@ public:
         VisualElementState elementState,
         LPCWSTR context) override;
 
-    // Apply current mode to all tracked elements
+    // WatcherBase hooks (UI thread)
+    void OnDispatch(UINT msg);
+    void OnDispatchClosed();
+
+    // Apply a mode to all tracked elements. On the UI thread the pass is
+    // sliced (ApplyScheduler); the mode is acked once it is complete.
     void ApplyMode(AppearanceMode mode);
 
+    // Apply a mode from any thread: posted to the UI thread as one batch
+    void RequestApplyMode(AppearanceMode mode);
+
     // Get count of tracked elements
-    int GetTrackedCount() const { return m_trackedCount; }
+    int GetTrackedCount() const { return (int)m_tracked.Size(); }
+
+    // Forget all pooled value instances (on detach / before Release)
+    void FreeValuePool();
+
+    // Queue the current mode for elements matched since the last flush and
+    // run the first slice. UI thread, from the dispatch window's message.
+    void FlushPending();
+
+    // Live reconfiguration: hand over a freshly compiled target list (any
+    // thread). It is swapped in on the UI thread, which then re-matches the
+    // elements it already knows instead of waiting for a tree replay.
+    void RequestRetarget(std::unique_ptr<TargetMatcher> matcher);
+
+    // Publish the tree index to <prefix>Tree (TreeSnapshot.h); any thread
+    void RequestTreeSnapshot();
+
+    // DetachShellTAP, after UnadviseVisualTreeChange: closes the dispatch
+    // window and waits, so the UI thread releases what it holds (transition,
+    // saved Fills, reassert callbacks, cached brushes), then drops the value
+    // pool. False if the UI thread did not respond within timeoutMs.
+    bool Detach(DWORD timeoutMs);
 
 private:
+    // Property indices found via GetPropertyValuesChain (UINT_MAX = absent).
+    // Indices are stable per XAML type, so they are cached by interned type id
+    // and only fall back to a per-handle entry when the element type is unknown.
+    struct PropertyIndices {
+        unsigned int fill;
+        unsigned int opacity;
+    };
+
     // Set property via GetPropertyValuesChain + SetProperty
-    void ApplyToElement(InstanceHandle handle, AppearanceMode mode, bool isStroke);
-    void SetElementOpacity(IInspectable* pElement, double opacity);
+    HRESULT ApplyToElement(InstanceHandle handle, uint32_t typeId, AppearanceMode mode, bool isStroke);
+    HRESULT SetElementOpacity(InstanceHandle handle, uint32_t typeId, double opacity, const ShellTAPStyle& style);
+    bool TrySetOpacityDirect(InstanceHandle handle, uint32_t typeId, double opacity, const ShellTAPStyle& style);
+    HRESULT SetFillDirect(InstanceHandle handle, IInspectable* obj, const ShellTAPStyle& style);
+    void ForgetOriginalFill(InstanceHandle handle);
+    void ForgetElements(std::vector<InstanceHandle>& handles);   // clears handles
+    void ReleaseOriginalFills();
+    bool LookupPropertyIndices(InstanceHandle handle, uint32_t typeId, PropertyIndices* out);
+    bool ResolvePropertyIndices(InstanceHandle handle, PropertyIndices* out);
+
+    // Value instances for SetProperty, created once per distinct (type, value)
+    InstanceHandle GetPooledValue(const wchar_t* type, const wchar_t* value);
+    InstanceHandle GetPooledDouble(double value);
+    void LogPoolMiss(HRESULT hr, const wchar_t* type, const wchar_t* value);
 
     // Discovery: log all elements
-    void LogElement(const VisualElement& element, InstanceHandle parent);
+    void LogElement(const VisualElement& element, InstanceHandle parent, VisualMutationType mutation);
+
+    // Deferred apply: new matches are queued and flushed once the current
+    // mutation burst settles, i.e. when the UI thread next pumps messages.
+    void MarkDirty(InstanceHandle handle);
+    void ScheduleFlush();
+
+    // Time-sliced applies and background work (UI thread). RunSlice works
+    // through the queues until the slice budget is spent (bounded) or they
+    // are empty, and leaves the rest to the next idle tick.
+    void RunSlice(bool bounded);
+    void ScheduleSlice();
+    ApplyScheduler m_scheduler;
+    bool m_slicePosted;
+    int m_ackMode;              // sliced mode switch to ack once drained; -1 = none
 
-    long m_refCount;
-    IXamlDiagnostics* m_pDiag;
-    IVisualTreeService3* m_pService;
+    // Property index cache (UI thread, plus RequestApplyMode's inline fallback)
+    SRWLOCK m_indexLock;
+    std::unordered_map<uint32_t, PropertyIndices> m_indicesByType;
+    std::unordered_map<InstanceHandle, PropertyIndices> m_indicesByHandle;
+    std::unordered_set<uint32_t> m_noDirectTypes;   // types without IUIElement
+    std::unordered_set<uint32_t> m_warmTypes;       // m_indicesByType entries seeded from the warm cache
 
-    // Tracked XAML element handles (matched from config targets)
-    static const int MAX_TRACKED = 32;
+    // Warm cache write-back: the snapshot is rebuilt only when the index
+    // cache (m_cacheGeneration, bumped under m_indexLock) or the mode moved
+    void SeedWarmCache();
+    void QueueWarmCache();
+    uint32_t m_cacheGeneration;
+    uint32_t m_cacheSavedGeneration;
+    int m_cacheSavedMode;
+
+    // Fill each Shape had before the direct path first replaced it, for
+    // SHELLTAP_FILL_RESTORE (AddRef'd; released on the UI thread)
+    std::unordered_map<InstanceHandle, ABI::Windows::UI::Xaml::Media::IBrush*> m_originalFill;
+
+    // Property-changed callbacks on directly set elements (UI thread)
+    ReassertWatch m_reassert;
+    static void OnReassert(void* context, InstanceHandle handle, bool throttled);
+    void Reassert(InstanceHandle handle);
+    void ScheduleThrottled(DWORD delayMs);
+    bool m_throttlePosted;                  // WM_SHELLTAP_THROTTLED timer armed
+
+    // v5 transition being collected by ApplyMode, or the last one begun
+    // (UI thread). Direct sets add to it while it is open.
+    ModeTransition m_transition;
+
+    // Tracked XAML elements (matched from config targets), keyed by handle.
+    // Names/types are interned, so an entry is a few dozen bytes.
     struct TrackedElement {
-        InstanceHandle handle;
-        wchar_t name[64];
-        wchar_t type[128];
-        bool isStroke;  // treat as stroke (set opacity=0 always when transparent)
-        bool active;
+        uint32_t nameId;    // m_strings id
+        uint32_t typeId;    // m_strings id
+        bool isStroke;      // treat as stroke (set opacity=0 always when transparent)
+        bool dirty;         // queued for the next FlushPending
     };
-    TrackedElement m_tracked[MAX_TRACKED];
-    int m_trackedCount;
+    HandleMap<TrackedElement> m_tracked;
+    StringPool m_strings;
 
-    // Check if an element matches any configured target
-    bool MatchesTarget(const wchar_t* name, const wchar_t* type, bool* outIsStroke);
-};
+    // Every live element seen since Advise (only with a v2 config), so a new
+    // target list can be matched without replaying the tree. UI thread only;
+    // interning into m_strings still happens under m_trackedLock.
+    struct KnownElement {
+        uint32_t nameId;
+        uint32_t typeId;
+    };
+    HandleMap<KnownElement> m_known;
 
-// ── COM class factory ──
-class ShellTAPFactory : public IClassFactory {
-public:
-    ShellTAPFactory();
+    // Parent->child index for the v4 scope rules and path selectors
+    // (UI thread only)
+    TreeIndex m_tree;
+    std::vector<InstanceHandle> m_removed;  // OnRemove scratch: the dropped subtree
 
-    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override;
-    ULONG STDMETHODCALLTYPE AddRef() override;
-    ULONG STDMETHODCALLTYPE Release() override;
+    // Mutated on the UI thread; ApplyMode snapshots it under this lock and
+    // applies outside it. The lock also covers readers on other threads
+    // (GetTrackedCount) and RequestApplyMode's inline fallback.
+    SRWLOCK m_trackedLock;
 
-    HRESULT STDMETHODCALLTYPE CreateInstance(IUnknown* pOuter, REFIID riid, void** ppv) override;
-    HRESULT STDMETHODCALLTYPE LockServer(BOOL fLock) override;
+    // Dirty set, flushed through the dispatch window (WatcherBase)
+    std::vector<InstanceHandle> m_dirty;
+    bool m_flushPosted;
 
-private:
-    long m_refCount;
+    // Pending target list from RequestRetarget, consumed on the UI thread
+    void ApplyPendingRetarget();
+    SRWLOCK m_retargetLock;
+    std::unique_ptr<TargetMatcher> m_pendingMatcher;
+    std::atomic<bool> m_retargetPending;
+
+    // Mode waiting for WM_SHELLTAP_APPLYMODE; -1 = nothing posted
+    std::atomic<int> m_pendingMode;
+
+    // Tree snapshot requested and not yet written (UI thread writes it)
+    void PublishTreeSnapshot();
+    std::atomic<bool> m_snapshotPending;
+
+    // Resource gauges in the counters block (UI thread): a background chore
+    // after flushes and mode switches, and every few hundred tree callbacks
+    void UpdateResourceGauges();
+    uint32_t m_gaugeTick;
+
+    // Set by Detach before the dispatch window closes
+    std::atomic<bool> m_detaching;
+
+    // Snapshot entry used to apply outside m_trackedLock (unsliced paths)
+    struct ApplyItem {
+        InstanceHandle handle;
+        uint32_t typeId;
+        bool isStroke;
+    };
+
+    // Check if an element matches any configured target: a name/type rule,
+    // or a path selector as evaluated by m_tree when the element was added
+    bool MatchesTarget(InstanceHandle handle, const wchar_t* name, const wchar_t* type, bool* outIsStroke);
 };
@@ -0,0 +1,58 @@
+// StringPool.h -- Interned wide strings addressed by 32-bit id
+//
+// XAML element names and type names repeat across thousands of elements
+// ("Windows.UI.Xaml.Shapes.Rectangle", "BackgroundFill", ...). Each distinct
+// string is stored once; callers keep the id. Id 0 is the null/empty string.
+//
+// Not thread-safe. Returned pointers stay valid for the pool's lifetime.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class StringPool {
+public:
+    StringPool() : m_bytes(0) {}
+
+    uint32_t Intern(const wchar_t* s)
+    {
+        if (!s || !s[0]) return 0;
+        std::wstring_view view(s);
+        auto it = m_index.find(view);
+        if (it != m_index.end()) return it->second;
+
+        // deque::push_back never moves existing strings, so the views
+        // used as map keys stay valid.
+        m_strings.emplace_back(view);
+        uint32_t id = (uint32_t)m_strings.size();
+        m_index.emplace(std::wstring_view(m_strings.back()), id);
+        m_bytes += (view.size() + 1) * sizeof(wchar_t);
+        return id;
+    }
+
+    // Lookup without interning; 0 if the string was never seen
+    uint32_t Find(const wchar_t* s) const
+    {
+        if (!s || !s[0]) return 0;
+        auto it = m_index.find(std::wstring_view(s));
+        return it != m_index.end() ? it->second : 0;
+    }
+
+    const wchar_t* Get(uint32_t id) const
+    {
+        return (id == 0 || id > m_strings.size()) ? L"" : m_strings[id - 1].c_str();
+    }
+
+    size_t Count() const { return m_strings.size(); }
+    size_t MemoryBytes() const { return m_bytes; }
+
+private:
+    std::deque<std::wstring> m_strings;
+    std::unordered_map<std::wstring_view, uint32_t> m_index;
+    size_t m_bytes;
+};
@@ -0,0 +1,166 @@
+// TargetMatcher.cpp -- Precompiled name/type matcher for ShellTAP targets
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "TargetMatcher.h"
+#include <algorithm>
+#include <cwchar>
+#include <queue>
+
+static bool IsWildcard(const wchar_t* s)
+{
+    return !s || s[0] == 0 || (s[0] == L'*' && s[1] == 0);
+}
+
+void TargetMatcher::AddRule(const wchar_t* name, const wchar_t* type)
+{
+    Rule r;
+    r.anyName = (name && name[0] == L'*' && name[1] == 0);
+    r.name = name ? name : L"";
+    r.type = IsWildcard(type) ? L"" : type;
+    r.pattern = NO_PATTERN;
+    if (r.anyName) r.stroke = STROKE_BY_NAME;
+    else r.stroke = (r.name.find(L"Stroke") != std::wstring::npos) ? STROKE_YES : STROKE_NO;
+    m_rules.push_back(std::move(r));
+}
+
+void TargetMatcher::Clear()
+{
+    m_rules.clear();
+    m_byName.clear();
+    m_anyNameRules.clear();
+    m_nodes.clear();
+    m_patternCount = 0;
+    m_paths.Clear();
+}
+
+uint32_t TargetMatcher::FindEdge(const Node& n, wchar_t c)
+{
+    auto it = std::lower_bound(n.next.begin(), n.next.end(), c,
+        [](const std::pair<wchar_t, uint32_t>& e, wchar_t ch) { return e.first < ch; });
+    return (it != n.next.end() && it->first == c) ? it->second : 0;
+}
+
+void TargetMatcher::Build()
+{
+    m_byName.clear();
+    m_anyNameRules.clear();
+    m_nodes.assign(1, Node{ {}, 0, {} });
+    m_patternCount = 0;
+
+    // Trie of distinct type patterns; identical types share one pattern id
+    std::unordered_map<std::wstring, uint32_t> patternIds;
+    for (uint32_t i = 0; i < (uint32_t)m_rules.size(); i++) {
+        Rule& r = m_rules[i];
+        if (r.anyName) m_anyNameRules.push_back(i);
+        else m_byName[std::wstring_view(r.name)].push_back(i);
+
+        if (r.type.empty()) continue;
+        auto found = patternIds.find(r.type);
+        if (found != patternIds.end()) { r.pattern = found->second; continue; }
+
+        uint32_t state = 0;
+        for (wchar_t c : r.type) {
+            uint32_t nxt = FindEdge(m_nodes[state], c);
+            if (!nxt) {
+                nxt = (uint32_t)m_nodes.size();
+                m_nodes.push_back(Node{ {}, 0, {} });
+                auto& edges = m_nodes[state].next;
+                edges.insert(std::upper_bound(edges.begin(), edges.end(), std::make_pair(c, 0u),
+                    [](const std::pair<wchar_t, uint32_t>& a, const std::pair<wchar_t, uint32_t>& b) {
+                        return a.first < b.first;
+                    }), std::make_pair(c, nxt));
+            }
+            state = nxt;
+        }
+        r.pattern = m_patternCount++;
+        m_nodes[state].out.push_back(r.pattern);
+        patternIds.emplace(r.type, r.pattern);
+    }
+
+    // Failure links (BFS); output sets are closed over the fail chain
+    std::queue<uint32_t> q;
+    for (auto& e : m_nodes[0].next) { m_nodes[e.second].fail = 0; q.push(e.second); }
+    while (!q.empty()) {
+        uint32_t u = q.front(); q.pop();
+        for (auto& e : m_nodes[u].next) {
+            uint32_t v = e.second;
+            uint32_t f = m_nodes[u].fail;
+            while (f && !FindEdge(m_nodes[f], e.first)) f = m_nodes[f].fail;
+            uint32_t target = FindEdge(m_nodes[f], e.first);
+            m_nodes[v].fail = (target != v) ? target : 0;
+            const auto& inherited = m_nodes[m_nodes[v].fail].out;
+            m_nodes[v].out.insert(m_nodes[v].out.end(), inherited.begin(), inherited.end());
+            q.push(v);
+        }
+    }
+}
+
+uint32_t TargetMatcher::Step(uint32_t state, wchar_t c) const
+{
+    for (;;) {
+        uint32_t nxt = FindEdge(m_nodes[state], c);
+        if (nxt) return nxt;
+        if (state == 0) return 0;
+        state = m_nodes[state].fail;
+    }
+}
+
+// Marks every pattern occurring in `type`; returns false if none did
+bool TargetMatcher::ScanType(const wchar_t* type, uint64_t* bits) const
+{
+    bool any = false;
+    uint32_t state = 0;
+    for (const wchar_t* p = type; *p; ++p) {
+        state = Step(state, *p);
+        for (uint32_t id : m_nodes[state].out) {
+            bits[id >> 6] |= (1ULL << (id & 63));
+            any = true;
+        }
+    }
+    return any;
+}
+
+int TargetMatcher::Match(const wchar_t* name, const wchar_t* type, bool* outIsStroke) const
+{
+    *outIsStroke = false;
+
+    // XAML leaves Name (and sometimes Type) null on anonymous elements;
+    // "*" rules still match them
+    if (!name) name = L"";
+    if (!type) type = L"";
+
+    // Single probe: exact-name rules for this element, plus wildcard names
+    const std::vector<uint32_t>* exact = nullptr;
+    auto it = m_byName.find(std::wstring_view(name));
+    if (it != m_byName.end()) exact = &it->second;
+    if (!exact && m_anyNameRules.empty()) return -1;
+
+    // One automaton pass over the type string covers every type rule
+    uint64_t stackBits[4] = { 0, 0, 0, 0 };
+    std::vector<uint64_t> heapBits;
+    uint64_t* bits = stackBits;
+    if (m_patternCount > 256) {
+        heapBits.assign((m_patternCount + 63) / 64, 0);
+        bits = heapBits.data();
+    }
+    if (m_patternCount) ScanType(type, bits);
+
+    // Merge both candidate lists in rule order; first hit wins
+    static const std::vector<uint32_t> none;
+    const std::vector<uint32_t>& a = exact ? *exact : none;
+    const std::vector<uint32_t>& b = m_anyNameRules;
+    size_t ia = 0, ib = 0;
+    while (ia < a.size() || ib < b.size()) {
+        uint32_t idx = (ib >= b.size() || (ia < a.size() && a[ia] < b[ib])) ? a[ia++] : b[ib++];
+        const Rule& r = m_rules[idx];
+        bool typeMatch = (r.pattern == NO_PATTERN) ||
+                         (bits[r.pattern >> 6] & (1ULL << (r.pattern & 63))) != 0;
+        if (!typeMatch) continue;
+
+        if (r.stroke == STROKE_YES) *outIsStroke = true;
+        else if (r.stroke == STROKE_BY_NAME) *outIsStroke = (wcsstr(name, L"Stroke") != nullptr);
+        return (int)idx;
+    }
+    return -1;
+}
@@ -0,0 +1,82 @@
+// TargetMatcher.h -- Precompiled name/type matcher for ShellTAP targets
+//
+// Built once from the ShellTAPConfig target list, then queried for every
+// Add mutation in OnVisualTreeChange:
+//   - exact target names live in a hash map (name -> rule indices), so most
+//     non-matching elements are rejected by a single probe;
+//   - type rules are substring matches ("Rectangle" matches
+//     "Windows.UI.Xaml.Shapes.Rectangle"), compiled into one Aho-Corasick
+//     automaton so the type string is scanned once for all rules;
+//   - the "Stroke" classification is decided per rule at compile time
+//     (per element only for wildcard-name rules).
+// Rules keep config order: the first matching rule wins, as before.
+//
+// Path selectors ("TaskbarFrame > Grid > Rectangle#BackgroundFill") depend
+// on ancestors, so Match() cannot decide them; they are only collected here
+// and evaluated by TreeIndex as the tree is built.
+//
+// Not thread-safe; Build() must not race Match().
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "PathSelector.h"
+
+class TargetMatcher {
+public:
+    TargetMatcher() : m_patternCount(0) {}
+    TargetMatcher(const TargetMatcher&) = delete;             // m_byName holds views into m_rules
+    TargetMatcher& operator=(const TargetMatcher&) = delete;
+
+    // "*" (or empty type) is a wildcard. Call Build() after the last rule.
+    void AddRule(const wchar_t* name, const wchar_t* type);
+
+    // False if the selector is malformed or the compound budget is used up
+    bool AddPath(const wchar_t* selector) { return m_paths.Add(selector); }
+    const PathSelectorSet& Paths() const { return m_paths; }
+    void Build();
+    void Clear();
+
+    // Returns the index of the first matching name/type rule, or -1.
+    // A null name or type is matched as "".
+    int Match(const wchar_t* name, const wchar_t* type, bool* outIsStroke) const;
+
+    // Name/type rules plus path selectors
+    size_t RuleCount() const { return m_rules.size() + m_paths.Count(); }
+
+private:
+    static const uint32_t NO_PATTERN = UINT32_MAX;
+
+    enum StrokeKind : uint8_t { STROKE_NO, STROKE_YES, STROKE_BY_NAME };
+
+    struct Rule {
+        std::wstring name;
+        std::wstring type;
+        uint32_t pattern;   // Aho-Corasick pattern id, NO_PATTERN = any type
+        StrokeKind stroke;
+        bool anyName;
+    };
+
+    struct Node {
+        std::vector<std::pair<wchar_t, uint32_t>> next;  // sorted by char
+        uint32_t fail;
+        std::vector<uint32_t> out;  // pattern ids ending here (incl. via fail)
+    };
+
+    uint32_t Step(uint32_t state, wchar_t c) const;
+    static uint32_t FindEdge(const Node& n, wchar_t c);
+    bool ScanType(const wchar_t* type, uint64_t* bits) const;
+
+    std::vector<Rule> m_rules;
+    std::unordered_map<std::wstring_view, std::vector<uint32_t>> m_byName;  // views into m_rules
+    std::vector<uint32_t> m_anyNameRules;
+    std::vector<Node> m_nodes;
+    uint32_t m_patternCount;
+    PathSelectorSet m_paths;
+};
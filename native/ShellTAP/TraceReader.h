@@ -0,0 +1,133 @@
+// TraceReader.h -- Reads ShellTAP binary traces (DiscoveryTraceFormat.h)
+//
+// Header-only, plain C++17, no Windows headers: used by TraceDecoder to
+// print a trace and by TAPBench to replay one. The reader walks an
+// in-memory copy of the file, absorbs string records into a table and
+// hands out element and mutation records in file order, both widened to a
+// TraceMutationRecord (an element record reads as a call with
+// child = handle and no child index or source info; `tag` tells them
+// apart).
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include "DiscoveryTraceFormat.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class TraceReader {
+public:
+    TraceReader() : m_data(nullptr), m_size(0), m_pos(0), m_truncated(false) { m_error[0] = 0; }
+
+    // Validates the header. `data` must outlive the reader.
+    bool Open(const uint8_t* data, size_t size)
+    {
+        m_data = data;
+        m_size = size;
+        m_truncated = false;
+        m_strings.assign(1, std::u16string());     // id 0 = none
+        if (size < sizeof(m_header)) {
+            snprintf(m_error, sizeof(m_error), "too small to be a ShellTAP trace");
+            return false;
+        }
+        memcpy(&m_header, data, sizeof(m_header));
+        if (memcmp(m_header.magic, TRACE_MAGIC, sizeof(m_header.magic)) != 0) {
+            snprintf(m_error, sizeof(m_error), "not a ShellTAP trace (bad magic)");
+            return false;
+        }
+        if (m_header.version < 1 || m_header.version > TRACE_VERSION ||
+            m_header.headerSize < sizeof(m_header) || m_header.headerSize > size) {
+            snprintf(m_error, sizeof(m_error), "unsupported trace version %u (header %u bytes)",
+                     m_header.version, m_header.headerSize);
+            return false;
+        }
+        m_pos = m_header.headerSize;
+        return true;
+    }
+
+    const TraceFileHeader& Header() const { return m_header; }
+
+    // Next element or mutation record. False at the end of the stream, and
+    // on a record that runs past the data or has an unknown tag (Truncated()
+    // is then true and Error() says where).
+    bool Next(TraceMutationRecord* out)
+    {
+        while (m_pos < m_size) {
+            uint8_t tag = m_data[m_pos];
+            if (tag == TRACE_TAG_END) return false;
+
+            if (tag == TRACE_TAG_STRING) {
+                TraceStringRecord rec;
+                if (!Fits(sizeof(rec))) return false;
+                memcpy(&rec, m_data + m_pos, sizeof(rec));
+                uint32_t size = TraceAlign8((uint32_t)(sizeof(rec) + rec.length * sizeof(char16_t)));
+                if (!Fits(size)) return false;
+
+                if (rec.id >= m_strings.size()) m_strings.resize(rec.id + 1);
+                std::u16string& s = m_strings[rec.id];
+                s.resize(rec.length);
+                if (rec.length) memcpy(&s[0], m_data + m_pos + sizeof(rec), rec.length * sizeof(char16_t));
+                m_pos += size;
+            }
+            else if (tag == TRACE_TAG_ELEMENT) {
+                TraceElementRecord rec;
+                if (!Fits(sizeof(rec))) return false;
+                memcpy(&rec, m_data + m_pos, sizeof(rec));
+                m_pos += sizeof(rec);
+
+                memset(out, 0, sizeof(*out));
+                out->tag = TRACE_TAG_ELEMENT;
+                out->mutation = rec.mutation;
+                out->nameId = rec.nameId;
+                out->typeId = rec.typeId;
+                out->numChildren = rec.numChildren;
+                out->handle = rec.handle;
+                out->parent = rec.parent;
+                out->child = rec.handle;
+                out->timestamp = rec.timestamp;
+                return true;
+            }
+            else if (tag == TRACE_TAG_MUTATION) {
+                if (!Fits(sizeof(*out))) return false;
+                memcpy(out, m_data + m_pos, sizeof(*out));
+                m_pos += sizeof(*out);
+                return true;
+            }
+            else {
+                snprintf(m_error, sizeof(m_error), "unknown record tag %u at offset %zu", tag, m_pos);
+                m_truncated = true;
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Defined before any record that references it; unknown ids read as ""
+    const std::u16string& String(uint32_t id) const
+    {
+        return id < m_strings.size() ? m_strings[id] : m_strings[0];
+    }
+    size_t StringCount() const { return m_strings.size() - 1; }
+
+    bool Truncated() const { return m_truncated; }
+    const char* Error() const { return m_error; }
+
+private:
+    bool Fits(size_t bytes)
+    {
+        if (m_pos + bytes <= m_size) return true;
+        snprintf(m_error, sizeof(m_error), "record at offset %zu runs past the end", m_pos);
+        m_truncated = true;
+        return false;
+    }
+
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_pos;
+    bool m_truncated;
+    char m_error[96];
+    TraceFileHeader m_header;
+    std::vector<std::u16string> m_strings;
+};
@@ -0,0 +1,217 @@
+// TreeIndex.cpp -- Incremental XAML tree index, scope rules and path selectors
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "TreeIndex.h"
+
+void TreeIndex::SetScope(std::unique_ptr<TargetMatcher> include, std::unique_ptr<TargetMatcher> exclude)
+{
+    if (include && include->RuleCount() == 0) include.reset();
+    if (exclude && exclude->RuleCount() == 0) exclude.reset();
+    m_include = std::move(include);
+    m_exclude = std::move(exclude);
+    m_nodes.Clear();
+}
+
+void TreeIndex::SetSelectors(const PathSelectorSet* paths)
+{
+    m_paths = (paths && !paths->Empty()) ? paths : nullptr;
+    m_nameMask.clear();
+    m_typeMask.clear();
+    m_nameKnown.clear();
+    m_typeKnown.clear();
+
+    // Top-down from every root, so each parent is done before its children
+    m_stack.clear();
+    m_nodes.ForEach([&](InstanceHandle handle, Node& node) {
+        if (node.parent == 0) m_stack.push_back(handle);
+    });
+    while (!m_stack.empty()) {
+        InstanceHandle h = m_stack.back();
+        m_stack.pop_back();
+        Node* n = m_nodes.Find(h);
+        if (!n) continue;
+        Evaluate(n, n->parent ? m_nodes.Find(n->parent) : nullptr);
+        for (InstanceHandle c = n->firstChild; c != 0; ) {
+            m_stack.push_back(c);
+            Node* child = m_nodes.Find(c);
+            c = child ? child->nextSibling : 0;
+        }
+    }
+}
+
+TreeIndex::State TreeIndex::Classify(State parentState, const wchar_t* name, const wchar_t* type) const
+{
+    if (parentState == STATE_PRUNED) return STATE_PRUNED;
+
+    bool stroke;
+    if (m_exclude && m_exclude->Match(name, type, &stroke) >= 0) return STATE_PRUNED;
+    if (parentState == STATE_IN || !m_include) return STATE_IN;
+    return (m_include->Match(name, type, &stroke) >= 0) ? STATE_IN : STATE_OUT;
+}
+
+uint64_t TreeIndex::CompoundMask(uint32_t nameId, uint32_t typeId)
+{
+    if (nameId >= m_nameKnown.size()) {
+        m_nameKnown.resize(nameId + 1, false);
+        m_nameMask.resize(nameId + 1, 0);
+    }
+    if (!m_nameKnown[nameId]) {
+        m_nameMask[nameId] = m_paths->NameMask(nameId ? m_strings.Get(nameId) : nullptr);
+        m_nameKnown[nameId] = true;
+    }
+    if (typeId >= m_typeKnown.size()) {
+        m_typeKnown.resize(typeId + 1, false);
+        m_typeMask.resize(typeId + 1, 0);
+    }
+    if (!m_typeKnown[typeId]) {
+        m_typeMask[typeId] = m_paths->TypeMask(typeId ? m_strings.Get(typeId) : nullptr);
+        m_typeKnown[typeId] = true;
+    }
+    return m_nameMask[nameId] & m_typeMask[typeId];
+}
+
+// Path state from the parent's; pruned elements and their parents carry none
+void TreeIndex::Evaluate(Node* node, const Node* parent)
+{
+    node->matched = 0;
+    node->reach = 0;
+    if (!m_paths || node->state == STATE_PRUNED) return;
+
+    uint64_t parentMatched = parent ? parent->matched : 0;
+    uint64_t parentReach = parent ? parent->reach : 0;
+    node->matched = m_paths->Step(CompoundMask(node->nameId, node->typeId), parentMatched, parentReach);
+    node->reach = parentReach | node->matched;
+}
+
+TreeIndex::State TreeIndex::OnAdd(InstanceHandle handle, InstanceHandle parent,
+                                  const wchar_t* name, const wchar_t* type)
+{
+    // Top level (or unknown parent): inside the scope only if nothing
+    // restricts it to include roots
+    State parentState = m_include ? STATE_OUT : STATE_IN;
+    Node* p = (parent != 0) ? m_nodes.Find(parent) : nullptr;
+    if (p) parentState = p->state;
+
+    // Below an excluded root: no string work at all
+    State state = (parentState == STATE_PRUNED)
+        ? STATE_PRUNED
+        : Classify(parentState, name ? name : L"", type ? type : L"");
+
+    bool inserted = false;
+    Node* node = m_nodes.Insert(handle, &inserted);
+    if (!node) return state;
+    if (!inserted) {
+        // Re-parented (or re-added) without a Remove in between; its
+        // children stay attached and are re-evaluated once it is linked
+        Unlink(handle, *node);
+    }
+    node->parent = p ? parent : 0;
+    node->prevSibling = 0;
+    node->nextSibling = 0;
+    node->state = state;
+    node->nameId = (state == STATE_PRUNED) ? 0 : m_strings.Intern(name);
+    node->typeId = (state == STATE_PRUNED) ? 0 : m_strings.Intern(type);
+
+    // Insert may have moved the parent's slot
+    p = p ? m_nodes.Find(parent) : nullptr;
+    Evaluate(node, p);
+
+    if (p) {
+        InstanceHandle head = p->firstChild;
+        p->firstChild = handle;
+        if (head != 0) {
+            Node* h = m_nodes.Find(head);
+            if (h) h->prevSibling = handle;
+            node->nextSibling = head;
+        }
+    }
+    if (!inserted && node->firstChild != 0) RefreshSubtree(handle);
+    return state;
+}
+
+// A moved node's descendants take their scope and path state from the new
+// position, top-down as in SetSelectors. Names of elements that were pruned
+// were never kept, so they are classified as unnamed.
+void TreeIndex::RefreshSubtree(InstanceHandle handle)
+{
+    m_stack.clear();
+    const Node* root = m_nodes.Find(handle);
+    for (InstanceHandle c = root ? root->firstChild : 0; c != 0; ) {
+        m_stack.push_back(c);
+        const Node* child = m_nodes.Find(c);
+        c = child ? child->nextSibling : 0;
+    }
+    while (!m_stack.empty()) {
+        InstanceHandle h = m_stack.back();
+        m_stack.pop_back();
+        Node* n = m_nodes.Find(h);
+        if (!n) continue;
+        const Node* parent = n->parent ? m_nodes.Find(n->parent) : nullptr;
+        State parentState = parent ? parent->state : (m_include ? STATE_OUT : STATE_IN);
+        n->state = (parentState == STATE_PRUNED)
+            ? STATE_PRUNED
+            : Classify(parentState, m_strings.Get(n->nameId), m_strings.Get(n->typeId));
+        if (n->state == STATE_PRUNED) n->nameId = n->typeId = 0;
+        Evaluate(n, parent);
+        for (InstanceHandle c = n->firstChild; c != 0; ) {
+            m_stack.push_back(c);
+            Node* child = m_nodes.Find(c);
+            c = child ? child->nextSibling : 0;
+        }
+    }
+}
+
+int TreeIndex::Selected(InstanceHandle handle, bool* outIsStroke) const
+{
+    *outIsStroke = false;
+    if (!m_paths) return -1;
+    const Node* node = m_nodes.Find(handle);
+    if (!node || !node->matched) return -1;
+    return m_paths->Selected(node->matched, m_strings.Get(node->nameId), outIsStroke);
+}
+
+// Takes `handle` out of its parent's child list (node is a copy of its entry)
+void TreeIndex::Unlink(InstanceHandle handle, const Node& node)
+{
+    if (node.prevSibling != 0) {
+        Node* prev = m_nodes.Find(node.prevSibling);
+        if (prev) prev->nextSibling = node.nextSibling;
+    } else if (node.parent != 0) {
+        Node* parent = m_nodes.Find(node.parent);
+        if (parent && parent->firstChild == handle) parent->firstChild = node.nextSibling;
+    }
+    if (node.nextSibling != 0) {
+        Node* next = m_nodes.Find(node.nextSibling);
+        if (next) next->prevSibling = node.prevSibling;
+    }
+}
+
+TreeIndex::State TreeIndex::OnRemove(InstanceHandle handle, std::vector<InstanceHandle>* removed)
+{
+    if (removed) removed->clear();
+    Node* node = m_nodes.Find(handle);
+    if (!node) return STATE_IN;
+
+    Node copy = *node;
+    Unlink(handle, copy);
+
+    // Erase the subtree; children are collected before each Erase because
+    // it can move other entries
+    m_stack.clear();
+    m_stack.push_back(handle);
+    while (!m_stack.empty()) {
+        InstanceHandle h = m_stack.back();
+        m_stack.pop_back();
+        Node* n = m_nodes.Find(h);
+        if (!n) continue;
+        for (InstanceHandle c = n->firstChild; c != 0; ) {
+            m_stack.push_back(c);
+            Node* child = m_nodes.Find(c);
+            c = child ? child->nextSibling : 0;
+        }
+        m_nodes.Erase(h);
+        if (removed) removed->push_back(h);
+    }
+    return copy.state;
+}
@@ -0,0 +1,155 @@
+// TreeIndex.h -- Incremental XAML tree index, scope rules and path selectors
+//
+// Built from the ParentChildRelation of each OnVisualTreeChange; nothing
+// ever walks the live XAML tree. Each node keeps parent / first-child /
+// sibling links, interned name and type ids, and its state:
+//
+//   Scope (optional config v4 rules):
+//   - include rules name scope roots (e.g. "*:TaskbarFrame"); with any
+//     include rule, only elements at or below a root are considered;
+//   - exclude rules name subtrees that are never relevant (e.g.
+//     "*:SystemTrayFrame"); they win over include rules.
+//   A pruned subtree costs one HandleMap probe per mutation -- no
+//   name/type matching, no interning.
+//
+//   Path selectors (PathSelector.h): two bitmasks derived from the parent's
+//   on Add, so "TaskbarFrame > Grid > Rectangle#BackgroundFill" is decided
+//   in O(1) per element. Only a new selector set re-evaluates the nodes,
+//   top-down over the index (and a re-parented node, its own subtree).
+//
+// Removing an element drops its whole subtree even when XAML only reports
+// the subtree root. Elements whose parent was never reported are treated
+// as top-level.
+//
+// Walk serializes the index on request (TreeSnapshot.h): depth-first,
+// parents before children, siblings in the order they were added.
+//
+// UI thread only (OnVisualTreeChange, retarget); not thread-safe.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "HandleMap.h"
+#include "PathSelector.h"
+#include "StringPool.h"
+#include "TargetMatcher.h"
+
+class TreeIndex {
+public:
+    enum State : uint8_t {
+        STATE_OUT    = 0,   // outside every include root (include rules only)
+        STATE_IN     = 1,   // relevant: at or below an include root, or no include rules
+        STATE_PRUNED = 2    // at or below an exclude root
+    };
+
+    TreeIndex() : m_enabled(false), m_paths(nullptr) {}
+    TreeIndex(const TreeIndex&) = delete;
+    TreeIndex& operator=(const TreeIndex&) = delete;
+
+    // Either matcher may be null or empty. Clears the index.
+    void SetScope(std::unique_ptr<TargetMatcher> include, std::unique_ptr<TargetMatcher> exclude);
+    bool Scoped() const { return m_include || m_exclude; }
+
+    // Borrowed; must outlive its use here (null = none). Re-evaluates every
+    // indexed element against the new set.
+    void SetSelectors(const PathSelectorSet* paths);
+
+    // Off: OnAdd/OnRemove are not called and the index stays empty
+    void Enable(bool on) { m_enabled = on; }
+    bool Enabled() const { return m_enabled; }
+
+    // Records an Add; returns the element's scope state
+    State OnAdd(InstanceHandle handle, InstanceHandle parent, const wchar_t* name, const wchar_t* type);
+
+    // Drops the element and everything below it; returns the state it had
+    // (STATE_IN for handles the index never saw). `removed`, if given, is
+    // set to every handle dropped, the element first.
+    State OnRemove(InstanceHandle handle, std::vector<InstanceHandle>* removed = nullptr);
+
+    // Path selector index the element matches, or -1
+    int Selected(InstanceHandle handle, bool* outIsStroke) const;
+
+    // visit(handle, parentIndex, depth, childCount, nameId, typeId, state)
+    // is called with consecutive indices (0, 1, ...); parentIndex is the
+    // parent's index, UINT32_MAX at the top level. Returning false stops.
+    template <typename Fn>
+    void Walk(Fn&& visit) const;
+
+    // Interned name/type for the ids Walk hands out ("" for 0)
+    const wchar_t* String(uint32_t id) const { return m_strings.Get(id); }
+    size_t StringCount() const { return m_strings.Count(); }
+
+    size_t NodeCount() const { return m_nodes.Size(); }
+    size_t MemoryBytes() const { return m_nodes.MemoryBytes() + m_strings.MemoryBytes(); }
+
+private:
+    struct Node {
+        InstanceHandle parent;
+        InstanceHandle firstChild;
+        InstanceHandle prevSibling;
+        InstanceHandle nextSibling;
+        uint64_t matched;       // PathSelectorSet state (0 when pruned)
+        uint64_t reach;
+        uint32_t nameId;        // m_strings id
+        uint32_t typeId;
+        State state;
+    };
+
+    State Classify(State parentState, const wchar_t* name, const wchar_t* type) const;
+    void Evaluate(Node* node, const Node* parent);
+    void RefreshSubtree(InstanceHandle handle);
+    uint64_t CompoundMask(uint32_t nameId, uint32_t typeId);
+    void Unlink(InstanceHandle handle, const Node& node);
+
+    bool m_enabled;
+    std::unique_ptr<TargetMatcher> m_include;   // null = no include rules
+    std::unique_ptr<TargetMatcher> m_exclude;   // null = no exclude rules
+    const PathSelectorSet* m_paths;             // null or empty = no selectors
+    HandleMap<Node> m_nodes;
+    StringPool m_strings;
+
+    // Per interned string: PathSelectorSet::NameMask / TypeMask, computed
+    // on first sight (index = string id)
+    std::vector<uint64_t> m_nameMask, m_typeMask;
+    std::vector<bool> m_nameKnown, m_typeKnown;
+
+    std::vector<InstanceHandle> m_stack;        // OnRemove / SetSelectors / RefreshSubtree scratch
+};
+
+template <typename Fn>
+void TreeIndex::Walk(Fn&& visit) const
+{
+    struct Pending {
+        InstanceHandle handle;
+        uint32_t parent;
+        uint32_t depth;
+    };
+    std::vector<Pending> stack;
+    std::vector<InstanceHandle> children;
+
+    m_nodes.ForEach([&](InstanceHandle handle, const Node& node) {
+        if (node.parent == 0) stack.push_back({ handle, UINT32_MAX, 0 });
+    });
+
+    uint32_t index = 0;
+    while (!stack.empty()) {
+        Pending p = stack.back();
+        stack.pop_back();
+        const Node* n = m_nodes.Find(p.handle);
+        if (!n) continue;
+
+        children.clear();
+        for (InstanceHandle c = n->firstChild; c != 0; ) {
+            children.push_back(c);
+            const Node* child = m_nodes.Find(c);
+            c = child ? child->nextSibling : 0;
+        }
+        if (!visit(p.handle, p.parent, p.depth, (uint32_t)children.size(), n->nameId, n->typeId, n->state)) return;
+
+        // Child lists are newest first, so the oldest comes off the stack first
+        for (InstanceHandle c : children) stack.push_back({ c, index, p.depth + 1 });
+        index++;
+    }
+}
@@ -0,0 +1,147 @@
+// TreeSnapshot.cpp -- The live XAML tree index, published for tooling
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "TreeSnapshot.h"
+#include <cstring>
+#include <vector>
+
+namespace TreeSnapshot {
+
+static wchar_t g_sectionName[128];
+static HANDLE g_hRequest = nullptr;
+static HANDLE g_hReady = nullptr;
+static HANDLE g_hMap = nullptr;
+static BYTE* g_view = nullptr;
+
+bool Open(const wchar_t* targetId)
+{
+    if (g_hRequest) return true;
+
+    wchar_t name[128];
+    wsprintfW(g_sectionName, L"W11ThemeSuite_ShellTAP_%s_Tree", targetId);
+    wsprintfW(name, L"W11ThemeSuite_ShellTAP_%s_TreeReady", targetId);
+    g_hReady = CreateEventW(nullptr, FALSE, FALSE, name);
+    wsprintfW(name, L"W11ThemeSuite_ShellTAP_%s_TreeRequest", targetId);
+    g_hRequest = CreateEventW(nullptr, FALSE, FALSE, name);
+    return g_hRequest && g_hReady;
+}
+
+void Close()
+{
+    if (g_view) { UnmapViewOfFile(g_view); g_view = nullptr; }
+    if (g_hMap) { CloseHandle(g_hMap); g_hMap = nullptr; }
+    if (g_hRequest) { CloseHandle(g_hRequest); g_hRequest = nullptr; }
+    if (g_hReady) { CloseHandle(g_hReady); g_hReady = nullptr; }
+}
+
+HANDLE RequestEvent()
+{
+    return g_hRequest;
+}
+
+// Pagefile-backed; pages are only touched as far as snapshots reach
+static bool EnsureSection()
+{
+    if (g_view) return true;
+    g_hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                0, SHELLTAP_TREE_CAPACITY, g_sectionName);
+    if (!g_hMap) return false;
+    g_view = (BYTE*)MapViewOfFile(g_hMap, FILE_MAP_ALL_ACCESS, 0, 0, SHELLTAP_TREE_CAPACITY);
+    if (!g_view) {
+        CloseHandle(g_hMap);
+        g_hMap = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    ShellTAPTreeHeader* hdr = (ShellTAPTreeHeader*)g_view;
+    hdr->magic = SHELLTAP_TREE_MAGIC;
+    hdr->version = SHELLTAP_TREE_VERSION;
+    hdr->headerSize = sizeof(ShellTAPTreeHeader);
+    hdr->nodeSize = sizeof(ShellTAPTreeNode);
+    hdr->capacity = SHELLTAP_TREE_CAPACITY;
+    hdr->processId = GetCurrentProcessId();
+    hdr->qpcFrequency = freq.QuadPart;
+    return true;
+}
+
+bool Publish(const TreeIndex& tree, bool indexed, TrackedFn tracked, void* context)
+{
+    if (!g_hRequest || !EnsureSection()) return false;
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    ShellTAPTreeHeader* hdr = (ShellTAPTreeHeader*)g_view;
+    LONG generation = hdr->generation;
+    if (generation & 1) generation++;                   // a previous writer died mid-update
+    InterlockedExchange(&hdr->generation, generation + 1);
+
+    // Nodes first, sized for the whole index; strings fill what is left
+    size_t roomForNodes = (SHELLTAP_TREE_CAPACITY - sizeof(ShellTAPTreeHeader) - sizeof(wchar_t)) /
+                          sizeof(ShellTAPTreeNode);
+    size_t planned = indexed ? tree.NodeCount() : 0;
+    if (planned > roomForNodes) planned = roomForNodes;
+
+    ShellTAPTreeNode* nodes = (ShellTAPTreeNode*)(g_view + sizeof(ShellTAPTreeHeader));
+    uint32_t stringsOffset = (uint32_t)(sizeof(ShellTAPTreeHeader) + planned * sizeof(ShellTAPTreeNode));
+    wchar_t* blob = (wchar_t*)(g_view + stringsOffset);
+    uint32_t blobCapacity = (SHELLTAP_TREE_CAPACITY - stringsOffset) / sizeof(wchar_t);
+    uint32_t blobUsed = 1;
+    blob[0] = L'\0';                                     // offset 0 = ""
+
+    // String id -> blob offset, so each distinct string is written once
+    std::vector<uint32_t> offsets(tree.StringCount() + 1, UINT32_MAX);
+    offsets[0] = 0;
+    auto place = [&](uint32_t id, uint32_t* out) {
+        if (id < offsets.size() && offsets[id] != UINT32_MAX) { *out = offsets[id]; return true; }
+        const wchar_t* s = tree.String(id);
+        uint32_t length = (uint32_t)wcslen(s) + 1;
+        if (length > blobCapacity - blobUsed) return false;
+        memcpy(blob + blobUsed, s, length * sizeof(wchar_t));
+        *out = blobUsed;
+        if (id < offsets.size()) offsets[id] = blobUsed;
+        blobUsed += length;
+        return true;
+    };
+
+    uint32_t count = 0;
+    bool truncated = indexed && planned < tree.NodeCount();
+    if (indexed) {
+        tree.Walk([&](InstanceHandle handle, uint32_t parent, uint32_t depth, uint32_t childCount,
+                      uint32_t nameId, uint32_t typeId, TreeIndex::State state) {
+            ShellTAPTreeNode node = {};
+            if (count >= planned || !place(nameId, &node.nameOffset) || !place(typeId, &node.typeOffset)) {
+                truncated = true;
+                return false;
+            }
+            node.handle = (uint64_t)handle;
+            node.parent = (parent == UINT32_MAX) ? SHELLTAP_TREE_NO_PARENT : parent;
+            node.childCount = childCount;
+            node.depth = (uint16_t)(depth < 0xFFFF ? depth : 0xFFFF);
+            node.state = (uint8_t)state;
+            node.flags = (tracked && tracked(context, handle)) ? SHELLTAP_TREE_NODE_TRACKED : 0;
+            nodes[count++] = node;
+            return true;
+        });
+    }
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    hdr->flags = (truncated ? SHELLTAP_TREE_TRUNCATED : 0) |
+                 (indexed ? 0 : SHELLTAP_TREE_NO_INDEX) |
+                 (tree.Scoped() ? SHELLTAP_TREE_SCOPED : 0);
+    hdr->nodeCount = count;
+    hdr->stringsOffset = stringsOffset;
+    hdr->stringChars = blobUsed;
+    hdr->qpcTaken = end.QuadPart;
+    hdr->buildMs = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)hdr->qpcFrequency;
+
+    InterlockedExchange(&hdr->generation, generation + 2);
+    SetEvent(g_hReady);
+    return !truncated;
+}
+
+} // namespace TreeSnapshot
@@ -0,0 +1,93 @@
+// TreeSnapshot.h -- The live XAML tree index, published for tooling
+//
+// On request the DLL serializes its TreeIndex into
+// "W11ThemeSuite_ShellTAP_<TargetId>_Tree": one ShellTAPTreeHeader, then
+// ShellTAPTreeNode[nodeCount] in depth-first order (every subtree is a
+// contiguous run), then a UTF-16 string blob with each distinct name and
+// type stored once, NUL-terminated. Nodes refer to their parent by index
+// and to strings by offset, so the section means the same at any mapping
+// address; readers query it in place.
+//
+//   <prefix>TreeRequest   auto-reset, signaled by tooling
+//   <prefix>TreeReady     auto-reset, signaled by the DLL after each snapshot
+//
+// The snapshot is built on the UI thread, where the index lives: the
+// request is posted to the dispatch window, or picked up by the next tree
+// callback. `generation` is a seqlock: odd while the DLL writes, +2 per
+// snapshot. Readers note it, read, and retry if it moved.
+//
+// The index runs with a v2+ config (or scope rules / path targets); without
+// it a snapshot is empty and carries SHELLTAP_TREE_NO_INDEX. Elements in
+// subtrees pruned by the v4 scope rules are present but unnamed.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include "TreeIndex.h"
+
+static const uint32_t SHELLTAP_TREE_MAGIC = 0x45455254;        // 'TREE'
+static const uint32_t SHELLTAP_TREE_VERSION = 1;
+static const uint32_t SHELLTAP_TREE_CAPACITY = 4 * 1024 * 1024;
+static const uint32_t SHELLTAP_TREE_NO_PARENT = 0xFFFFFFFF;
+
+// ShellTAPTreeHeader.flags
+static const uint32_t SHELLTAP_TREE_TRUNCATED = 0x1;   // over capacity: the nodes are a depth-first prefix
+static const uint32_t SHELLTAP_TREE_NO_INDEX  = 0x2;   // the DLL keeps no tree index (v1 config)
+static const uint32_t SHELLTAP_TREE_SCOPED    = 0x4;   // scope rules active
+
+// ShellTAPTreeNode.flags
+static const uint8_t SHELLTAP_TREE_NODE_TRACKED = 0x1;  // matched a target
+
+#pragma pack(push, 8)
+struct ShellTAPTreeHeader {
+    uint32_t magic;              // SHELLTAP_TREE_MAGIC
+    uint32_t version;            // SHELLTAP_TREE_VERSION
+    volatile LONG generation;    // seqlock; 0 = nothing published yet
+    uint32_t flags;              // SHELLTAP_TREE_* bits
+    uint32_t headerSize;         // sizeof(ShellTAPTreeHeader); nodes start here
+    uint32_t nodeSize;           // sizeof(ShellTAPTreeNode)
+    uint32_t nodeCount;
+    uint32_t stringsOffset;      // bytes from the start of the section
+    uint32_t stringChars;        // UTF-16 units used in the blob
+    uint32_t capacity;           // section size in bytes
+    uint32_t processId;
+    uint32_t reserved0;
+    int64_t  qpcFrequency;
+    int64_t  qpcTaken;           // QPC when this snapshot was written
+    double   buildMs;            // time the UI thread spent writing it
+    uint32_t reserved[2];
+};
+
+struct ShellTAPTreeNode {
+    uint64_t handle;             // InstanceHandle
+    uint32_t parent;             // node index; SHELLTAP_TREE_NO_PARENT at the top level
+    uint32_t childCount;         // its children follow within its subtree run
+    uint32_t nameOffset;         // into the string blob, UTF-16 units; 0 = ""
+    uint32_t typeOffset;
+    uint16_t depth;
+    uint8_t  state;              // TreeIndex::State
+    uint8_t  flags;              // SHELLTAP_TREE_NODE_* bits
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ShellTAPTreeHeader) == 80, "ShellTAPTreeHeader layout");
+static_assert(sizeof(ShellTAPTreeNode) == 32, "ShellTAPTreeNode layout");
+
+namespace TreeSnapshot {
+
+// Creates the request/ready events for this target. The section itself is
+// created by the first Publish.
+bool Open(const wchar_t* targetId);
+void Close();
+
+// Auto-reset; the monitor thread waits on it (null before Open)
+HANDLE RequestEvent();
+
+// UI thread. tracked(context, handle): is the element a target.
+typedef bool (*TrackedFn)(void* context, InstanceHandle handle);
+bool Publish(const TreeIndex& tree, bool indexed, TrackedFn tracked, void* context);
+
+} // namespace TreeSnapshot
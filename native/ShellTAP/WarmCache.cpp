@@ -0,0 +1,142 @@
+// WarmCache.cpp -- On-disk warm-start cache for one ShellTAP target
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "WarmCache.h"
+#include <winver.h>
+
+#pragma comment(lib, "version.lib")
+
+namespace WarmCache {
+
+static uint32_t Fnv1a(const BYTE* data, size_t size, uint32_t hash = 2166136261u)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint64_t FileVersion(const wchar_t* path)
+{
+    DWORD ignored = 0;
+    DWORD size = GetFileVersionInfoSizeW(path, &ignored);
+    if (size == 0) return 0;
+
+    std::vector<BYTE> info(size);
+    if (!GetFileVersionInfoW(path, 0, size, info.data())) return 0;
+
+    VS_FIXEDFILEINFO* fixed = nullptr;
+    UINT fixedSize = 0;
+    if (!VerQueryValueW(info.data(), L"\\", (void**)&fixed, &fixedSize) || fixedSize < sizeof(*fixed)) return 0;
+    return ((uint64_t)fixed->dwFileVersionMS << 32) | fixed->dwFileVersionLS;
+}
+
+bool CurrentKey(Key* out)
+{
+    HMODULE hWux = GetModuleHandleW(L"Windows.UI.Xaml.dll");
+    if (!hWux) return false;
+
+    wchar_t path[MAX_PATH];
+    if (!GetModuleFileNameW(hWux, path, MAX_PATH)) return false;
+    out->xamlVersion = FileVersion(path);
+    if (!GetModuleFileNameW(nullptr, path, MAX_PATH)) return false;
+    out->hostVersion = FileVersion(path);
+    return out->xamlVersion != 0 && out->hostVersion != 0;
+}
+
+bool Load(const wchar_t* path, const Key& key, Contents* out)
+{
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size = {};
+    std::vector<BYTE> data;
+    bool read = GetFileSizeEx(hFile, &size) && size.QuadPart >= (LONGLONG)(sizeof(ShellTAPWarmCacheHeader) + 4) &&
+                size.QuadPart <= 1024 * 1024;
+    if (read) {
+        data.resize((size_t)size.QuadPart);
+        DWORD got = 0;
+        read = ReadFile(hFile, data.data(), (DWORD)data.size(), &got, nullptr) && got == data.size();
+    }
+    CloseHandle(hFile);
+    if (!read) return false;
+
+    size_t body = data.size() - 4;
+    uint32_t checksum;
+    memcpy(&checksum, data.data() + body, 4);
+    if (checksum != Fnv1a(data.data(), body)) return false;
+
+    ShellTAPWarmCacheHeader hdr;
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    if (hdr.magic != SHELLTAP_WARM_CACHE_MAGIC || hdr.version != SHELLTAP_WARM_CACHE_VERSION ||
+        hdr.xamlVersion != key.xamlVersion || hdr.hostVersion != key.hostVersion ||
+        hdr.typeCount > SHELLTAP_WARM_CACHE_MAX_TYPES) {
+        return false;
+    }
+
+    Contents contents;
+    contents.lastMode = hdr.lastMode;
+    contents.types.reserve(hdr.typeCount);
+    size_t pos = sizeof(hdr);
+    for (uint32_t i = 0; i < hdr.typeCount; i++) {
+        ShellTAPWarmCacheType entry;
+        if (body - pos < sizeof(entry)) return false;
+        memcpy(&entry, data.data() + pos, sizeof(entry));
+        pos += sizeof(entry);
+        if (entry.typeChars == 0 || (body - pos) / sizeof(wchar_t) < entry.typeChars) return false;
+
+        TypeEntry t;
+        t.type.assign((const wchar_t*)(data.data() + pos), entry.typeChars);
+        t.fill = entry.fill;
+        t.opacity = entry.opacity;
+        t.flags = entry.flags;
+        contents.types.push_back(std::move(t));
+        pos += entry.typeChars * sizeof(wchar_t);
+    }
+    if (pos != body) return false;
+
+    *out = std::move(contents);
+    return true;
+}
+
+bool Save(const wchar_t* path, const Key& key, const Contents& contents)
+{
+    ShellTAPWarmCacheHeader hdr = {};
+    hdr.magic = SHELLTAP_WARM_CACHE_MAGIC;
+    hdr.version = SHELLTAP_WARM_CACHE_VERSION;
+    hdr.xamlVersion = key.xamlVersion;
+    hdr.hostVersion = key.hostVersion;
+    hdr.lastMode = contents.lastMode;
+
+    std::vector<BYTE> data(sizeof(hdr));
+    for (const TypeEntry& t : contents.types) {
+        if (t.type.empty() || hdr.typeCount == SHELLTAP_WARM_CACHE_MAX_TYPES) continue;
+        ShellTAPWarmCacheType entry = { t.fill, t.opacity, t.flags, (uint32_t)t.type.size() };
+        const BYTE* e = (const BYTE*)&entry;
+        const BYTE* s = (const BYTE*)t.type.data();
+        data.insert(data.end(), e, e + sizeof(entry));
+        data.insert(data.end(), s, s + t.type.size() * sizeof(wchar_t));
+        hdr.typeCount++;
+    }
+    memcpy(data.data(), &hdr, sizeof(hdr));
+    uint32_t checksum = Fnv1a(data.data(), data.size());
+    const BYTE* c = (const BYTE*)&checksum;
+    data.insert(data.end(), c, c + 4);
+
+    wchar_t temp[MAX_PATH + 8];
+    wsprintfW(temp, L"%s.tmp", path);
+    HANDLE hFile = CreateFileW(temp, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+    DWORD written = 0;
+    bool ok = WriteFile(hFile, data.data(), (DWORD)data.size(), &written, nullptr) && written == data.size();
+    CloseHandle(hFile);
+
+    if (ok) ok = MoveFileExW(temp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+    if (!ok) DeleteFileW(temp);
+    return ok;
+}
+
+} // namespace WarmCache
@@ -0,0 +1,81 @@
+// WarmCache.h -- On-disk warm-start cache for one ShellTAP target
+//
+// After an explorer (or shell host) restart, the DLL otherwise re-learns
+// everything: GetPropertyValuesChain per matched type, IUIElement probes
+// for types without direct setters, and the mode last set through _Mode.
+// The cache keeps exactly that, next to the DLL as
+// ShellTAP_<TargetId>.cache:
+//
+//   ShellTAPWarmCacheHeader
+//   typeCount x { ShellTAPWarmCacheType, wchar_t type[typeChars] }
+//   uint32 checksum (FNV-1a of everything before it)
+//
+// The types are the concrete XAML types the target list resolved to.
+// The file is keyed by the Windows.UI.Xaml.dll and host executable file
+// versions: a different build, a bad checksum or a short read and the
+// whole file is ignored (the DLL then warms up as before). Writes go to
+// a temporary file that is moved over the old one, so readers never see
+// a partial cache.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static const uint32_t SHELLTAP_WARM_CACHE_MAGIC = 0x43575453;    // "STWC"
+static const uint32_t SHELLTAP_WARM_CACHE_VERSION = 1;
+static const uint32_t SHELLTAP_WARM_CACHE_MAX_TYPES = 4096;
+
+#pragma pack(push, 1)
+struct ShellTAPWarmCacheHeader {
+    uint32_t magic;             // SHELLTAP_WARM_CACHE_MAGIC
+    uint32_t version;           // SHELLTAP_WARM_CACHE_VERSION
+    uint64_t xamlVersion;       // Windows.UI.Xaml.dll file version (MS << 32 | LS)
+    uint64_t hostVersion;       // host .exe file version
+    int32_t  lastMode;          // AppearanceMode last applied; -1 = none
+    uint32_t typeCount;
+};
+
+struct ShellTAPWarmCacheType {
+    uint32_t fill;              // property chain indices (SHELLTAP_WARM_TYPE_INDICES),
+    uint32_t opacity;           // UINT_MAX = the type has no such property
+    uint32_t flags;             // SHELLTAP_WARM_TYPE_*
+    uint32_t typeChars;         // UTF-16 units that follow, no terminator
+};
+#pragma pack(pop)
+
+static const uint32_t SHELLTAP_WARM_TYPE_NO_DIRECT = 0x1;   // not a UIElement: SetProperty only
+static const uint32_t SHELLTAP_WARM_TYPE_INDICES = 0x2;     // fill/opacity are resolved
+
+namespace WarmCache {
+
+struct Key {
+    uint64_t xamlVersion;
+    uint64_t hostVersion;
+};
+
+struct TypeEntry {
+    std::wstring type;
+    uint32_t fill;
+    uint32_t opacity;
+    uint32_t flags;
+};
+
+struct Contents {
+    int lastMode = -1;
+    std::vector<TypeEntry> types;
+};
+
+// Versions of the loaded Windows.UI.Xaml.dll and of the host executable.
+// False until XAML is loaded.
+bool CurrentKey(Key* out);
+
+// False if the file is missing, corrupt or written for another build
+bool Load(const wchar_t* path, const Key& key, Contents* out);
+
+bool Save(const wchar_t* path, const Key& key, const Contents& contents);
+
+} // namespace WarmCache
@@ -0,0 +1,991 @@
+// TAPBench.cpp -- Benchmark harness for the ShellTAP watcher hot paths
+//
+// Links the real ShellTAP sources (built with SHELLTAP_NO_BOOTSTRAP, so no
+// IXDE thread) and hands ShellTAPSite a fake XAML Diagnostics provider:
+//   1. writes the Init_<PID> and _Config blocks for a private TargetId and
+//      runs ShellTAP's DllMain, exactly as an injection would
+//   2. SetSite(fake) -> the watcher Advises on the fake IVisualTreeService3
+//   3. feeds a synthetic tree through OnVisualTreeChange, churns it, and
+//      switches modes, timing each phase on this (the "UI") thread --
+//      or, with --replay, feeds a recorded call stream instead of the tree
+//
+// The fake returns no live objects from GetIInspectableFromHandle, so the
+// apply numbers are for the diagnostics path (property chain + pooled
+// CreateInstance + SetProperty), not the direct ABI setters.
+//
+// Usage:
+//   TAPBench [--elements <n>] [--match <ratio>] [--churn <ratio>] [--rounds <n>]
+//            [--fanout <n>] [--seed <n>] [--static] [--json]
+//            [--max-add-ns <ns>] [--max-apply-ns <ns>]
+//   TAPBench --replay <trace> [--paced] [--target <name:type>]... [--static] [--json]
+//            [--max-add-ns <ns>] [--max-apply-ns <ns>]
+//   TAPBench --selftest
+//
+//   --elements  Tree size, default 100000 (10k-1M is the useful range).
+//   --match     Fraction of elements that match a target, default 0.01.
+//   --churn     Fraction of leaves removed and re-added per round, default 0.1.
+//   --static    v1 config (read once): no known-element map, no tree index.
+//               Default is a live v2 config, like the PowerShell module.
+//   --json      One JSON object on stdout instead of the table.
+//   --max-*     Regression gate: exit 1 if ns per Add (per replayed call)
+//               / ns per applied element is above the budget.
+//
+// Replay:
+//   --replay    A recording made with SHELLTAP_FLAG_RECORD (-RecordTree), or
+//               a binary discovery trace. Calls are made in recorded order;
+//               the dispatch window's queue is pumped wherever the recording
+//               has a gap of more than 1 ms, as the UI thread would have.
+//   --paced     Wait out the recorded gaps (original pacing; the waits are
+//               not timed). Default is full speed.
+//   --target    Target in the module's "Name:Type" form, repeatable (up to
+//               8); default BackgroundFill:Rectangle, BackgroundStroke:Rectangle.
+//               Use the target list of the session that missed a match.
+//
+// Self-test:
+//   --selftest  Checks the edge cases the benchmarks do not cover
+//               (TargetMatcher, TreeIndex, the reassert throttle, the solid
+//               fallback for acrylic fills) and exits; nothing is injected
+//               or timed.
+//
+// Allocation counts are global operator new calls made during a phase,
+// divided by its operations (the fake itself allocates with CoTaskMemAlloc
+// and SysAllocString, so it does not show up).
+//
+// Exit codes: 0 ok, 1 over a --max budget, 2 usage, 3 setup failed,
+// 4 a --selftest check failed.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <new>
+#include <string>
+#include <vector>
+#include "../ShellTAP/ShellTAP.h"
+#include "../ShellTAP/PerfCounters.h"
+#include "../ShellTAP/TraceReader.h"
+#include "../ShellTAP/guids.h"
+
+#pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "oleaut32.lib")
+#pragma comment(lib, "user32.lib")
+
+// ShellTAP.cpp entry points, called directly instead of by the loader
+BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID);
+STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv);
+
+// ── Allocation counting ──
+static volatile LONG64 g_allocs = 0;
+static volatile LONG64 g_allocBytes = 0;
+
+void* operator new(size_t size)
+{
+    InterlockedIncrement64(&g_allocs);
+    InterlockedAdd64(&g_allocBytes, (LONG64)size);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// ── Fake XAML Diagnostics provider ──
+// Just enough of IXamlDiagnostics + IVisualTreeService3 for the watcher:
+// a fixed property chain (Fill, Opacity), counted CreateInstance and
+// SetProperty, and the Advise'd callback for the driver to call.
+static const unsigned int FAKE_FILL_INDEX = 17;
+static const unsigned int FAKE_OPACITY_INDEX = 42;
+
+class FakeDiagnostics : public IXamlDiagnostics, public IVisualTreeService3 {
+public:
+    FakeDiagnostics() : m_refCount(1), m_callback(nullptr), m_nextValue(1ull << 48),
+                        m_createCalls(0), m_setCalls(0), m_chainCalls(0)
+    {
+        m_hAdvised = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    }
+    virtual ~FakeDiagnostics()
+    {
+        DropCallback();
+        if (m_hAdvised) CloseHandle(m_hAdvised);
+    }
+
+    IVisualTreeServiceCallback* Callback() const { return m_callback; }
+    bool WaitAdvised(DWORD ms) { return WaitForSingleObject(m_hAdvised, ms) == WAIT_OBJECT_0; }
+    void DropCallback()
+    {
+        IVisualTreeServiceCallback* cb = (IVisualTreeServiceCallback*)InterlockedExchangePointer(
+            (PVOID*)&m_callback, nullptr);
+        if (cb) cb->Release();
+    }
+
+    LONG64 CreateCalls() const { return m_createCalls; }
+    LONG64 SetCalls() const { return m_setCalls; }
+    LONG64 ChainCalls() const { return m_chainCalls; }
+
+    // IUnknown (shared by both bases)
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (riid == IID_IUnknown || riid == __uuidof(IXamlDiagnostics)) {
+            *ppv = static_cast<IXamlDiagnostics*>(this);
+        } else if (riid == __uuidof(IVisualTreeService) || riid == __uuidof(IVisualTreeService2) ||
+                   riid == __uuidof(IVisualTreeService3)) {
+            *ppv = static_cast<IVisualTreeService3*>(this);
+        } else {
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return InterlockedIncrement(&m_refCount); }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        long ref = InterlockedDecrement(&m_refCount);
+        if (ref == 0) delete this;
+        return ref;
+    }
+
+    // IXamlDiagnostics
+    HRESULT STDMETHODCALLTYPE GetDispatcher(IInspectable** pp) override { *pp = nullptr; return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetUiLayer(IInspectable** pp) override { *pp = nullptr; return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetApplication(IInspectable** pp) override { *pp = nullptr; return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetIInspectableFromHandle(InstanceHandle, IInspectable** pp) override
+    {
+        *pp = nullptr;
+        return E_NOTIMPL;   // no live objects: the watcher takes the SetProperty path
+    }
+    HRESULT STDMETHODCALLTYPE GetHandleFromIInspectable(IInspectable*, InstanceHandle*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE HitTest(RECT, unsigned int*, InstanceHandle**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE RegisterInstance(IInspectable*, InstanceHandle*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetInitializationData(BSTR* p) override { *p = nullptr; return E_NOTIMPL; }
+
+    // IVisualTreeService
+    HRESULT STDMETHODCALLTYPE AdviseVisualTreeChange(IVisualTreeServiceCallback* cb) override
+    {
+        if (!cb) return E_INVALIDARG;
+        cb->AddRef();
+        DropCallback();
+        m_callback = cb;
+        SetEvent(m_hAdvised);
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE UnadviseVisualTreeChange(IVisualTreeServiceCallback*) override
+    {
+        DropCallback();
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetEnums(unsigned int*, EnumType**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE CreateInstance(BSTR, BSTR, InstanceHandle* out) override
+    {
+        InterlockedIncrement64(&m_createCalls);
+        *out = (InstanceHandle)InterlockedIncrement64((volatile LONG64*)&m_nextValue);
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetPropertyValuesChain(InstanceHandle, unsigned int* sourceCount,
+        PropertyChainSource** sources, unsigned int* propertyCount, PropertyChainValue** values) override
+    {
+        InterlockedIncrement64(&m_chainCalls);
+        *sourceCount = 0;
+        *sources = nullptr;
+        *propertyCount = 2;
+        *values = (PropertyChainValue*)CoTaskMemAlloc(2 * sizeof(PropertyChainValue));
+        if (!*values) return E_OUTOFMEMORY;
+        memset(*values, 0, 2 * sizeof(PropertyChainValue));
+        (*values)[0].PropertyName = SysAllocString(L"Fill");
+        (*values)[0].Index = FAKE_FILL_INDEX;
+        (*values)[1].PropertyName = SysAllocString(L"Opacity");
+        (*values)[1].Index = FAKE_OPACITY_INDEX;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE SetProperty(InstanceHandle, InstanceHandle, unsigned int) override
+    {
+        InterlockedIncrement64(&m_setCalls);
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE ClearProperty(InstanceHandle, unsigned int) override { return S_OK; }
+    HRESULT STDMETHODCALLTYPE GetCollectionCount(InstanceHandle, unsigned int*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetCollectionElements(InstanceHandle, unsigned int, unsigned int*,
+                                                    CollectionElementValue**) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE AddChild(InstanceHandle, InstanceHandle, unsigned int) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE RemoveChild(InstanceHandle, unsigned int) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE ClearChildren(InstanceHandle) override { return E_NOTIMPL; }
+
+    // IVisualTreeService2
+    HRESULT STDMETHODCALLTYPE GetPropertyIndex(InstanceHandle, LPCWSTR, unsigned int*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetProperty(InstanceHandle, unsigned int, InstanceHandle*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE ReplaceResource(InstanceHandle, InstanceHandle, InstanceHandle) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE RenderTargetBitmap(InstanceHandle, RenderTargetBitmapOptions, unsigned int,
+                                                 unsigned int, IBitmapData**) override { return E_NOTIMPL; }
+
+    // IVisualTreeService3
+    HRESULT STDMETHODCALLTYPE ResolveResource(InstanceHandle, LPCWSTR, ResourceType, unsigned int) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE GetDictionaryItem(InstanceHandle, LPCWSTR, BOOL, InstanceHandle*) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE AddDictionaryItem(InstanceHandle, InstanceHandle, InstanceHandle) override { return E_NOTIMPL; }
+    HRESULT STDMETHODCALLTYPE RemoveDictionaryItem(InstanceHandle, InstanceHandle) override { return E_NOTIMPL; }
+
+private:
+    long m_refCount;
+    IVisualTreeServiceCallback* m_callback;
+    HANDLE m_hAdvised;
+    volatile unsigned long long m_nextValue;
+    volatile LONG64 m_createCalls;
+    volatile LONG64 m_setCalls;
+    volatile LONG64 m_chainCalls;
+};
+
+// ── Options ──
+struct Target {
+    std::wstring name;
+    std::wstring type;
+};
+
+struct Options {
+    unsigned int elements = 100000;
+    double match = 0.01;
+    double churn = 0.1;
+    unsigned int rounds = 5;
+    unsigned int fanout = 8;
+    unsigned int seed = 1;
+    bool staticConfig = false;
+    bool json = false;
+    double maxAddNs = 0;        // 0 = no gate
+    double maxApplyNs = 0;
+    const wchar_t* replay = nullptr;
+    bool paced = false;
+    bool selftest = false;
+    std::vector<Target> targets;    // empty = the Taskbar preset
+};
+
+static void Usage()
+{
+    fwprintf(stderr, L"Usage: TAPBench [--elements <n>] [--match <ratio>] [--churn <ratio>] [--rounds <n>]\n"
+                     L"                [--fanout <n>] [--seed <n>] [--static] [--json]\n"
+                     L"                [--max-add-ns <ns>] [--max-apply-ns <ns>]\n"
+                     L"       TAPBench --replay <trace> [--paced] [--target <name:type>]... [--static] [--json]\n"
+                     L"                [--max-add-ns <ns>] [--max-apply-ns <ns>]\n"
+                     L"       TAPBench --selftest\n");
+}
+
+static bool ParseArgs(int argc, wchar_t** argv, Options* o)
+{
+    for (int i = 1; i < argc; i++) {
+        const wchar_t* a = argv[i];
+        const wchar_t* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (wcscmp(a, L"--static") == 0) { o->staticConfig = true; continue; }
+        if (wcscmp(a, L"--json") == 0)   { o->json = true; continue; }
+        if (wcscmp(a, L"--paced") == 0)  { o->paced = true; continue; }
+        if (wcscmp(a, L"--selftest") == 0) { o->selftest = true; continue; }
+        if (!v) return false;
+        if (wcscmp(a, L"--target") == 0) {
+            const wchar_t* colon = wcschr(v, L':');
+            if (!colon || colon == v || !colon[1] || o->targets.size() >= 8) return false;
+            o->targets.push_back({ std::wstring(v, colon - v), std::wstring(colon + 1) });
+            i++;
+            continue;
+        }
+        if (wcscmp(a, L"--elements") == 0)          o->elements = (unsigned int)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--match") == 0)        o->match = wcstod(v, nullptr);
+        else if (wcscmp(a, L"--churn") == 0)        o->churn = wcstod(v, nullptr);
+        else if (wcscmp(a, L"--rounds") == 0)       o->rounds = (unsigned int)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--fanout") == 0)       o->fanout = (unsigned int)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--seed") == 0)         o->seed = (unsigned int)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--max-add-ns") == 0)   o->maxAddNs = wcstod(v, nullptr);
+        else if (wcscmp(a, L"--max-apply-ns") == 0) o->maxApplyNs = wcstod(v, nullptr);
+        else if (wcscmp(a, L"--replay") == 0)       o->replay = v;
+        else return false;
+        i++;
+    }
+    if (o->targets.empty()) {
+        o->targets.push_back({ L"BackgroundFill", L"Rectangle" });
+        o->targets.push_back({ L"BackgroundStroke", L"Rectangle" });
+    }
+    if (o->paced && !o->replay) return false;
+    return o->elements >= 1 && o->fanout >= 1 &&
+           o->match >= 0.0 && o->match <= 1.0 && o->churn >= 0.0 && o->churn <= 1.0;
+}
+
+// ── Synthetic tree ──
+// Breadth-first with a fixed fanout, so every parent is added before its
+// children and everything past index (n - 2) / fanout is a leaf. Names and
+// types come from small pools, like a real tree where most elements are
+// unnamed Grids, Borders and ContentPresenters.
+static const wchar_t* const kTypes[] = {
+    L"Windows.UI.Xaml.Controls.Grid",
+    L"Windows.UI.Xaml.Controls.Border",
+    L"Windows.UI.Xaml.Controls.ContentPresenter",
+    L"Windows.UI.Xaml.Controls.TextBlock",
+    L"Windows.UI.Xaml.Controls.StackPanel",
+    L"Windows.UI.Xaml.Shapes.Rectangle",        // also the matched type
+};
+static const wchar_t* const kMatchType = L"Windows.UI.Xaml.Shapes.Rectangle";
+
+struct Node {
+    InstanceHandle handle;
+    uint32_t parent;        // index; UINT32_MAX = root
+    const wchar_t* name;
+    const wchar_t* type;
+};
+
+static uint32_t NextRandom(uint32_t* state)
+{
+    uint32_t x = *state;            // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double RandomUnit(uint32_t* state)
+{
+    return (NextRandom(state) >> 8) * (1.0 / 16777216.0);
+}
+
+struct Tree {
+    std::vector<Node> nodes;
+    std::vector<std::wstring> namePool;
+    InstanceHandle nextHandle;
+    uint32_t rng;
+};
+
+// Matches are Rectangles; everything else draws from the type pool
+static void NameNode(Tree* t, double match, Node* n)
+{
+    double r = RandomUnit(&t->rng);
+    if (r < match) {
+        n->name = (r < match * 0.75) ? L"BackgroundFill" : L"BackgroundStroke";
+        n->type = kMatchType;
+        return;
+    }
+    n->name = (r < 0.6) ? L"" : t->namePool[NextRandom(&t->rng) % t->namePool.size()].c_str();
+    n->type = kTypes[NextRandom(&t->rng) % (sizeof(kTypes) / sizeof(kTypes[0]))];
+}
+
+static void BuildTree(const Options& o, Tree* t)
+{
+    t->rng = o.seed ? o.seed : 1;
+    t->nextHandle = 0x10000;
+    t->namePool.clear();
+    for (int i = 0; i < 256; i++) t->namePool.push_back(L"Element" + std::to_wstring(i));
+
+    t->nodes.resize(o.elements);
+    for (uint32_t i = 0; i < o.elements; i++) {
+        Node& n = t->nodes[i];
+        n.handle = t->nextHandle += 0x40;
+        n.parent = (i == 0) ? UINT32_MAX : (i - 1) / o.fanout;
+        NameNode(t, o.match, &n);
+    }
+}
+
+static void Notify(IVisualTreeServiceCallback* cb, const Tree& t, uint32_t index, VisualMutationType mutation)
+{
+    const Node& n = t.nodes[index];
+    ParentChildRelation rel = {};
+    rel.Parent = (n.parent == UINT32_MAX) ? 0 : t.nodes[n.parent].handle;
+    rel.Child = n.handle;
+    VisualElement el = {};
+    el.Handle = n.handle;
+    el.Type = (BSTR)n.type;         // read-only in the watcher; no BSTR length needed
+    el.Name = (BSTR)n.name;
+    cb->OnVisualTreeChange(rel, el, mutation);
+}
+
+// Runs the dispatch window's queued work (FlushPending, ApplyMode, apply slices)
+static void PumpMessages()
+{
+    MSG msg;
+    while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+}
+
+// ── Timing ──
+static LONG64 g_qpcFreq = 1;
+
+static LONG64 Now()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+struct Phase {
+    const char* name;
+    unsigned long long ops;
+    double ns;              // total
+    LONG64 allocs;
+    LONG64 allocBytes;
+
+    double NsPerOp() const { return ops ? ns / (double)ops : 0.0; }
+    double AllocsPerOp() const { return ops ? (double)allocs / (double)ops : 0.0; }
+    double BytesPerOp() const { return ops ? (double)allocBytes / (double)ops : 0.0; }
+};
+
+class PhaseTimer {
+public:
+    PhaseTimer(Phase* phase) : m_phase(phase), m_allocs(g_allocs), m_bytes(g_allocBytes), m_start(Now()) {}
+    ~PhaseTimer()
+    {
+        LONG64 end = Now();
+        m_phase->ns += (double)(end - m_start) * 1e9 / (double)g_qpcFreq;
+        m_phase->allocs += g_allocs - m_allocs;
+        m_phase->allocBytes += g_allocBytes - m_bytes;
+    }
+private:
+    Phase* m_phase;
+    LONG64 m_allocs;
+    LONG64 m_bytes;
+    LONG64 m_start;
+};
+
+// ── Replay ──
+// The whole recording is decoded up front, so the timed loop is nothing but
+// OnVisualTreeChange calls. Strings live in one table indexed by trace
+// string id; ParentChildRelation and VisualElement point into it.
+static const double REPLAY_BURST_GAP_US = 1000.0;
+
+struct ReplayCall {
+    ParentChildRelation relation;
+    VisualElement element;
+    VisualMutationType mutation;
+    LONG64 ticks;               // recording's QPC ticks since it began
+    uint32_t nameId, typeId, fileId;
+};
+
+struct Replay {
+    std::vector<std::wstring> strings;
+    std::vector<ReplayCall> calls;
+    LONG64 qpcFrequency;
+    unsigned long long adds, removes, bursts;
+    double durationUs;          // first to last recorded call
+};
+
+static bool LoadReplay(const wchar_t* path, Replay* r)
+{
+    FILE* f = _wfopen(path, L"rb");
+    if (!f) {
+        fwprintf(stderr, L"Cannot read '%s'\n", path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+    fclose(f);
+
+    TraceReader reader;
+    if (!reader.Open(data.data(), data.size())) {
+        fwprintf(stderr, L"'%s': %hs\n", path, reader.Error());
+        return false;
+    }
+    r->qpcFrequency = reader.Header().qpcFrequency ? reader.Header().qpcFrequency : 1;
+    r->adds = r->removes = r->bursts = 0;
+
+    TraceMutationRecord rec;
+    while (reader.Next(&rec)) {
+        ReplayCall c = {};
+        c.relation.Parent = (InstanceHandle)rec.parent;
+        c.relation.Child = (InstanceHandle)rec.child;
+        c.relation.ChildIndex = rec.childIndex;
+        c.element.Handle = (InstanceHandle)rec.handle;
+        c.element.NumChildren = rec.numChildren;
+        c.element.SrcInfo.LineNumber = rec.srcLine;
+        c.element.SrcInfo.ColumnNumber = rec.srcColumn;
+        c.mutation = (VisualMutationType)rec.mutation;
+        c.ticks = rec.timestamp;
+        c.nameId = rec.nameId;
+        c.typeId = rec.typeId;
+        c.fileId = rec.srcFileId;
+        if (c.mutation == Add) r->adds++;
+        else if (c.mutation == Remove) r->removes++;
+        r->calls.push_back(c);
+    }
+    if (reader.Truncated()) fwprintf(stderr, L"'%s': %hs; replaying what came before\n", path, reader.Error());
+
+    // Strings only now: the table is final, so the pointers stay put
+    r->strings.resize(reader.StringCount() + 1);
+    for (size_t id = 1; id < r->strings.size(); id++) {
+        const std::u16string& s = reader.String((uint32_t)id);
+        r->strings[id].assign(s.begin(), s.end());
+    }
+    auto str = [r](uint32_t id) -> BSTR {
+        return (id && id < r->strings.size()) ? (BSTR)r->strings[id].c_str() : nullptr;
+    };
+    for (ReplayCall& c : r->calls) {
+        c.element.Name = str(c.nameId);     // read-only in the watcher, like the synthetic tree
+        c.element.Type = str(c.typeId);
+        c.element.SrcInfo.FileName = str(c.fileId);
+    }
+
+    r->durationUs = r->calls.empty() ? 0.0
+        : (double)(r->calls.back().ticks - r->calls.front().ticks) * 1e6 / (double)r->qpcFrequency;
+    if (r->calls.empty()) fwprintf(stderr, L"'%s' holds no tree callbacks\n", path);
+    return !r->calls.empty();
+}
+
+// Until `ticks` (recording clock) past `start` (our clock); off the timers
+static void WaitUntil(LONG64 start, LONG64 ticks, LONG64 traceFreq)
+{
+    LONG64 due = start + (LONG64)((double)ticks * (double)g_qpcFreq / (double)traceFreq);
+    for (;;) {
+        LONG64 left = due - Now();
+        if (left <= 0) return;
+        DWORD ms = (DWORD)(left * 1000 / g_qpcFreq);
+        if (ms > 2) Sleep(ms - 2);
+        else YieldProcessor();
+    }
+}
+
+// Bursts of calls (recorded gaps <= REPLAY_BURST_GAP_US) go through the
+// callback back to back; the dispatch queue is pumped after each one
+static void RunReplay(IVisualTreeServiceCallback* cb, Replay* r, bool paced, Phase* calls, Phase* flush)
+{
+    LONG64 burstGap = (LONG64)(REPLAY_BURST_GAP_US * (double)r->qpcFrequency / 1e6);
+    LONG64 origin = r->calls.front().ticks;
+    LONG64 start = Now();
+    size_t count = r->calls.size();
+
+    for (size_t i = 0; i < count;) {
+        size_t end = i + 1;
+        while (end < count && r->calls[end].ticks - r->calls[end - 1].ticks <= burstGap) end++;
+
+        if (paced) WaitUntil(start, r->calls[i].ticks - origin, r->qpcFrequency);
+        {
+            PhaseTimer t(calls);
+            for (size_t k = i; k < end; k++) {
+                const ReplayCall& c = r->calls[k];
+                cb->OnVisualTreeChange(c.relation, c.element, c.mutation);
+            }
+        }
+        {
+            PhaseTimer t(flush);
+            PumpMessages();
+        }
+        r->bursts++;
+        i = end;
+    }
+    calls->ops = count;
+    flush->ops = r->bursts;
+}
+
+// ── Shared memory the DLL reads in DllMain ──
+static HANDLE WriteInitBlock(const wchar_t* targetId)
+{
+    wchar_t name[64];
+    swprintf(name, 64, L"W11ThemeSuite_ShellTAP_Init_%lu", GetCurrentProcessId());
+    HANDLE map = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, 64 * sizeof(wchar_t), name);
+    if (!map) return nullptr;
+    wchar_t* view = (wchar_t*)MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, 64 * sizeof(wchar_t));
+    if (!view) { CloseHandle(map); return nullptr; }
+    memset(view, 0, 64 * sizeof(wchar_t));
+    wcsncpy(view, targetId, 63);
+    UnmapViewOfFile(view);
+    return map;
+}
+
+// Targets from --target (default: the module's Taskbar preset). v2 (live)
+// by default, v1 with --static.
+static HANDLE WriteConfigBlock(const Options& o, const wchar_t* targetId, const wchar_t* logPath)
+{
+    int count = (int)o.targets.size();
+
+    wchar_t name[128];
+    swprintf(name, 128, L"W11ThemeSuite_ShellTAP_%s_Config", targetId);
+    HANDLE map = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                    SHELLTAP_CONFIG_V2_CAPACITY, name);
+    if (!map) return nullptr;
+    BYTE* view = (BYTE*)MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, SHELLTAP_CONFIG_V2_CAPACITY);
+    if (!view) { CloseHandle(map); return nullptr; }
+    memset(view, 0, SHELLTAP_CONFIG_V2_CAPACITY);
+
+    if (o.staticConfig) {
+        ShellTAPConfig* cfg = (ShellTAPConfig*)view;
+        cfg->version = SHELLTAP_CONFIG_VERSION;
+        cfg->mode = MODE_TRANSPARENT;
+        cfg->targetCount = count;
+        for (int i = 0; i < count; i++) {
+            wcsncpy(cfg->targetNames[i], o.targets[i].name.c_str(), 63);
+            wcsncpy(cfg->targetTypes[i], o.targets[i].type.c_str(), 127);
+        }
+        wcsncpy(cfg->logPath, logPath, 259);
+        cfg->flags = SHELLTAP_FLAG_NO_WARM_CACHE;
+    } else {
+        ShellTAPConfigV2* hdr = (ShellTAPConfigV2*)view;
+        ShellTAPTargetV2* targets = (ShellTAPTargetV2*)(hdr + 1);
+        wchar_t* blob = (wchar_t*)(targets + count);
+        unsigned int chars = 0;
+        for (int i = 0; i < count; i++) {
+            const Target& t = o.targets[i];
+            targets[i].nameOffset = chars;
+            targets[i].nameLength = (unsigned int)t.name.size();
+            memcpy(blob + chars, t.name.c_str(), t.name.size() * sizeof(wchar_t));
+            chars += targets[i].nameLength;
+            targets[i].typeOffset = chars;
+            targets[i].typeLength = (unsigned int)t.type.size();
+            memcpy(blob + chars, t.type.c_str(), t.type.size() * sizeof(wchar_t));
+            chars += targets[i].typeLength;
+        }
+        hdr->version = SHELLTAP_CONFIG_VERSION_2;
+        hdr->sequence = 2;
+        hdr->mode = MODE_TRANSPARENT;
+        hdr->flags = SHELLTAP_FLAG_NO_WARM_CACHE;
+        hdr->targetCount = count;
+        hdr->stringChars = (int)chars;
+        wcsncpy(hdr->logPath, logPath, 259);
+    }
+    UnmapViewOfFile(view);
+    return map;
+}
+
+// ── Report ──
+static void PrintPhase(const Phase& p)
+{
+    if (!p.ops) return;
+    double perSec = p.ns > 0 ? (double)p.ops * 1e9 / p.ns : 0.0;
+    wprintf(L"  %-12hs %10.1f ns/op %10.2f M ops/s %8.2f allocs/op %9.1f bytes/op  (%llu ops)\n",
+        p.name, p.NsPerOp(), perSec / 1e6, p.AllocsPerOp(), p.BytesPerOp(), p.ops);
+}
+
+static std::wstring JsonString(const wchar_t* s)
+{
+    std::wstring out;
+    for (; *s; ++s) {
+        if (*s == L'\\' || *s == L'"') out += L'\\';
+        out += *s;
+    }
+    return out;
+}
+
+static void PrintPhaseJson(const Phase& p, bool last)
+{
+    wprintf(L"\"%hs\":{\"ops\":%llu,\"nsPerOp\":%.2f,\"allocsPerOp\":%.3f,\"bytesPerOp\":%.1f}%s",
+        p.name, p.ops, p.NsPerOp(), p.AllocsPerOp(), p.BytesPerOp(), last ? L"" : L",");
+}
+
+// ── Self-test ──
+static int g_checkFailures = 0;
+
+static void Check(bool ok, const char* what)
+{
+    wprintf(L"  %ls  %hs\n", ok ? L"ok  " : L"FAIL", what);
+    if (!ok) g_checkFailures++;
+}
+
+static void CheckMatcher()
+{
+    TargetMatcher m;
+    m.AddRule(L"*", L"Rectangle");
+    m.AddRule(L"BackgroundFill", L"*");
+    m.AddRule(L"*", L"*");
+    m.Build();
+
+    bool stroke = false;
+    Check(m.Match(nullptr, L"Windows.UI.Xaml.Shapes.Rectangle", &stroke) == 0,
+          "null name matches a *:Type rule");
+    Check(m.Match(L"BackgroundFill", nullptr, &stroke) == 1, "null type matches a Name:* rule");
+    Check(m.Match(nullptr, nullptr, &stroke) == 2, "null name and type match a *:* rule");
+
+    TargetMatcher typed;
+    typed.AddRule(L"*", L"Rectangle");
+    typed.Build();
+    Check(typed.Match(L"Fill", nullptr, &stroke) == -1, "null type does not match a type substring");
+    Check(typed.Match(L"BackgroundStroke", L"Rectangle", &stroke) == 0 && stroke,
+          "wildcard name: Stroke decided by the element name");
+}
+
+// A burst past the limit, then quiet: the element must come due once the
+// window is over, not wait for an unrelated change
+static void CheckReassertThrottle()
+{
+    const DWORD t0 = 0xFFFFFF00;                // across a GetTickCount wrap
+    ReassertWatch::Throttle throttle = { t0, 0, false };
+    uint32_t admitted = 0;
+    for (uint32_t i = 0; i < ReassertWatch::REASSERT_BURST + 4; i++) {
+        if (throttle.Admit(t0 + i)) admitted++;
+    }
+    Check(admitted == ReassertWatch::REASSERT_BURST, "a burst is admitted up to REASSERT_BURST changes");
+    Check(throttle.deferred, "the changes past it leave the element deferred");
+
+    DWORD quiet = t0 + ReassertWatch::REASSERT_WINDOW_MS / 2;
+    Check(!throttle.Due(quiet) && throttle.RemainingMs(quiet) == ReassertWatch::REASSERT_WINDOW_MS / 2,
+          "not due inside the window; due when it ends");
+    Check(throttle.Due(t0 + ReassertWatch::REASSERT_WINDOW_MS), "due once the window is over");
+
+    throttle.deferred = false;                  // TakeDue re-queued it
+    Check(throttle.Admit(t0 + ReassertWatch::REASSERT_WINDOW_MS) && throttle.changes == 1,
+          "the next change starts a new window");
+}
+
+// Solid stand-in for a blur fill, both apply paths
+static void CheckFallbackFill()
+{
+    ShellTAPStyle blur = { 0, SHELLTAP_FILL_ACRYLIC, 0xFF000000, 1.0f, 0.0f, 0.3f };   // built-in Blur
+    wchar_t value[16];
+    FormatBrushValue(blur, value);
+    Check(wcscmp(value, L"#4D000000") == 0, "Blur preset falls back to a 30% tint, not opaque black");
+
+    ShellTAPStyle tint = { 0, SHELLTAP_FILL_SOLID, 0x80000000, 1.0f, 0.0f, 0.0f };     // built-in Tint
+    FormatBrushValue(tint, value);
+    Check(wcscmp(value, L"#80000000") == 0, "a solid fill keeps its colour as is");
+
+    blur.color = 0x80112233;
+    blur.tintOpacity = 0.5f;
+    Check(SolidFillColor(blur) == 0x40112233, "tint alpha is scaled, RGB kept");
+}
+
+// Scope state of one indexed element, via the snapshot walk
+static int IndexedState(const TreeIndex& tree, InstanceHandle handle)
+{
+    int state = -1;
+    tree.Walk([&](InstanceHandle h, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, TreeIndex::State s) {
+        if (h == handle) state = (int)s;
+        return state < 0;
+    });
+    return state;
+}
+
+static void CheckTreeIndex()
+{
+    std::unique_ptr<TargetMatcher> exclude(new TargetMatcher());
+    exclude->AddRule(L"*", L"SystemTrayFrame");
+    exclude->Build();
+    TreeIndex tree;
+    tree.SetScope(nullptr, std::move(exclude));
+    tree.Enable(true);
+
+    // root -> (panel -> leaf), root -> tray
+    tree.OnAdd(0x10, 0, L"Root", L"Grid");
+    tree.OnAdd(0x20, 0x10, L"Panel", L"Grid");
+    tree.OnAdd(0x30, 0x20, L"BackgroundFill", L"Rectangle");
+    tree.OnAdd(0x40, 0x10, L"Tray", L"SystemTrayFrame");
+    Check(IndexedState(tree, 0x30) == TreeIndex::STATE_IN, "leaf starts in scope");
+
+    // Moved under the excluded root without a Remove: its subtree follows
+    tree.OnAdd(0x20, 0x40, L"Panel", L"Grid");
+    Check(IndexedState(tree, 0x20) == TreeIndex::STATE_PRUNED, "re-parented node is pruned under an exclude root");
+    Check(IndexedState(tree, 0x30) == TreeIndex::STATE_PRUNED, "its descendants are pruned with it");
+
+    tree.OnAdd(0x20, 0x10, L"Panel", L"Grid");
+    Check(IndexedState(tree, 0x30) == TreeIndex::STATE_IN, "moved back out, its descendants are in scope again");
+}
+
+static int SelfTest()
+{
+    wprintf(L"TargetMatcher\n");
+    CheckMatcher();
+    wprintf(L"TreeIndex\n");
+    CheckTreeIndex();
+    wprintf(L"ReassertWatch\n");
+    CheckReassertThrottle();
+    wprintf(L"Fallback fill\n");
+    CheckFallbackFill();
+    wprintf(L"%d check(s) failed\n", g_checkFailures);
+    return g_checkFailures ? 4 : 0;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    Options o;
+    if (!ParseArgs(argc, argv, &o)) { Usage(); return 2; }
+    if (o.selftest) return SelfTest();
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_qpcFreq = freq.QuadPart;
+
+    // Private TargetId, so a bench run never meets an injected DLL's blocks
+    wchar_t targetId[64];
+    swprintf(targetId, 64, L"Bench%lu", GetCurrentProcessId());
+    wchar_t logPath[MAX_PATH];
+    GetModuleFileNameW(nullptr, logPath, MAX_PATH);
+    wchar_t* slash = wcsrchr(logPath, L'\\');
+    wcscpy_s(slash ? slash + 1 : logPath, MAX_PATH - (slash ? (slash + 1 - logPath) : 0), L"TAPBench.log");
+
+    HANDLE hInit = WriteInitBlock(targetId);
+    HANDLE hConfig = hInit ? WriteConfigBlock(o, targetId, logPath) : nullptr;
+    if (!hConfig) {
+        fwprintf(stderr, L"Creating the init/config blocks failed: %lu\n", GetLastError());
+        return 3;
+    }
+
+    Tree tree;
+    Replay replay;
+    if (o.replay) {
+        if (!LoadReplay(o.replay, &replay)) return 3;
+    } else {
+        BuildTree(o, &tree);
+    }
+
+    // ── Attach: DllMain, then the site exactly as XAML Diagnostics drives it ──
+    DllMain(GetModuleHandleW(nullptr), DLL_PROCESS_ATTACH, nullptr);
+
+    FakeDiagnostics* fake = new FakeDiagnostics();
+    IClassFactory* factory = nullptr;
+    IObjectWithSite* site = nullptr;
+    HRESULT hr = DllGetClassObject(CLSID_ShellTAPSite, IID_IClassFactory, (void**)&factory);
+    if (SUCCEEDED(hr)) hr = factory->CreateInstance(nullptr, IID_IObjectWithSite, (void**)&site);
+    if (SUCCEEDED(hr)) hr = site->SetSite(static_cast<IXamlDiagnostics*>(fake));
+    if (factory) factory->Release();
+    if (FAILED(hr) || !fake->WaitAdvised(5000)) {
+        fwprintf(stderr, L"SetSite on the fake provider failed: 0x%08X\n", hr);
+        return 3;
+    }
+
+    IVisualTreeServiceCallback* cb = fake->Callback();
+    auto* watcher = static_cast<VisualTreeWatcher*>(cb);
+
+    Phase add = { "add" }, flush = { "flush" }, remove = { "churn-remove" },
+          readd = { "churn-add" }, churnFlush = { "churn-flush" }, apply = { "apply" },
+          replayCalls = { "replay" }, replayFlush = { "replay-flush" };
+    ShellTAPCounters* counters = PerfCounters::Block();
+    LONG64 matchesBefore = counters->matches;
+    int tracked = 0;
+
+    if (o.replay) {
+        // ── Recorded stream ──
+        RunReplay(cb, &replay, o.paced, &replayCalls, &replayFlush);
+        tracked = watcher->GetTrackedCount();
+    } else {
+        // ── Initial tree ──
+        {
+            PhaseTimer t(&add);
+            for (uint32_t i = 0; i < o.elements; i++) Notify(cb, tree, i, Add);
+        }
+        add.ops = o.elements;
+        {
+            PhaseTimer t(&flush);
+            PumpMessages();
+        }
+        tracked = watcher->GetTrackedCount();
+        flush.ops = (unsigned long long)tracked;
+
+        // ── Churn: leaves removed and re-added with fresh handles ──
+        uint32_t firstLeaf = (o.elements > 1) ? (o.elements - 2) / o.fanout + 1 : 0;
+        uint32_t leafCount = o.elements - firstLeaf;
+        uint32_t churnCount = (uint32_t)(leafCount * o.churn);
+        std::vector<uint32_t> leaves(leafCount);
+        for (uint32_t k = 0; k < leafCount; k++) leaves[k] = firstLeaf + k;
+        std::vector<uint32_t> picks(churnCount);
+        for (unsigned int round = 0; round < o.rounds && churnCount; round++) {
+            // Distinct leaves: partial Fisher-Yates over the leaf list
+            for (uint32_t k = 0; k < churnCount; k++) {
+                uint32_t j = k + NextRandom(&tree.rng) % (leafCount - k);
+                uint32_t tmp = leaves[k]; leaves[k] = leaves[j]; leaves[j] = tmp;
+                picks[k] = leaves[k];
+            }
+            {
+                PhaseTimer t(&remove);
+                for (uint32_t idx : picks) Notify(cb, tree, idx, Remove);
+            }
+            for (uint32_t idx : picks) {
+                Node& n = tree.nodes[idx];
+                n.handle = tree.nextHandle += 0x40;
+                NameNode(&tree, o.match, &n);
+            }
+            {
+                PhaseTimer t(&readd);
+                for (uint32_t idx : picks) Notify(cb, tree, idx, Add);
+            }
+            int before = watcher->GetTrackedCount();
+            {
+                PhaseTimer t(&churnFlush);
+                PumpMessages();
+            }
+            churnFlush.ops += (unsigned long long)before;
+            remove.ops += churnCount;
+            readd.ops += churnCount;
+        }
+        tracked = watcher->GetTrackedCount();
+    }
+    LONG64 matched = counters->matches - matchesBefore;
+
+    // ── Mode switches over every tracked element ──
+    static const AppearanceMode kModes[] = { MODE_ACRYLIC, MODE_DEFAULT, MODE_TINT, MODE_TRANSPARENT };
+    LONG64 setBefore = fake->SetCalls();
+    for (AppearanceMode mode : kModes) {
+        PhaseTimer t(&apply);
+        watcher->ApplyMode(mode);
+        PumpMessages();             // the slices after the first (ApplyScheduler)
+    }
+    apply.ops = (unsigned long long)tracked * (sizeof(kModes) / sizeof(kModes[0]));
+    double setPerApply = apply.ops ? (double)(fake->SetCalls() - setBefore) / (double)apply.ops : 0.0;
+
+    // ── Detach ──
+    site->SetSite(nullptr);
+    PumpMessages();                 // WM_CLOSE for the dispatch window
+    fake->DropCallback();
+    site->Release();
+    DllMain(GetModuleHandleW(nullptr), DLL_PROCESS_DETACH, nullptr);
+
+    double addNs = o.replay ? replayCalls.NsPerOp() : add.NsPerOp();
+    double applyNs = apply.NsPerOp();
+
+    if (o.json && o.replay) {
+        wprintf(L"{\"replay\":\"%s\",\"paced\":%s,\"calls\":%llu,\"adds\":%llu,\"removes\":%llu,"
+                L"\"bursts\":%llu,\"recordedMs\":%.1f,\"config\":\"%s\",\"matched\":%lld,\"tracked\":%d,"
+                L"\"callbacksPerSec\":%.0f,",
+            JsonString(o.replay).c_str(), o.paced ? L"true" : L"false", replayCalls.ops, replay.adds, replay.removes,
+            replay.bursts, replay.durationUs / 1000.0, o.staticConfig ? L"v1" : L"v2", matched, tracked,
+            addNs > 0 ? 1e9 / addNs : 0.0);
+        PrintPhaseJson(replayCalls, false);
+        PrintPhaseJson(replayFlush, false);
+        PrintPhaseJson(apply, false);
+        wprintf(L"\"setPropertyPerApply\":%.2f,\"createInstance\":%lld,\"propertyChains\":%lld}\n",
+            setPerApply, fake->CreateCalls(), fake->ChainCalls());
+    } else if (o.json) {
+        wprintf(L"{\"elements\":%u,\"match\":%.4f,\"churn\":%.4f,\"rounds\":%u,\"fanout\":%u,"
+                L"\"config\":\"%s\",\"tracked\":%d,\"callbacksPerSec\":%.0f,",
+            o.elements, o.match, o.churn, o.rounds, o.fanout,
+            o.staticConfig ? L"v1" : L"v2", tracked, addNs > 0 ? 1e9 / addNs : 0.0);
+        PrintPhaseJson(add, false);
+        PrintPhaseJson(flush, false);
+        PrintPhaseJson(remove, false);
+        PrintPhaseJson(readd, false);
+        PrintPhaseJson(churnFlush, false);
+        PrintPhaseJson(apply, false);
+        wprintf(L"\"setPropertyPerApply\":%.2f,\"createInstance\":%lld,\"propertyChains\":%lld}\n",
+            setPerApply, fake->CreateCalls(), fake->ChainCalls());
+    } else if (o.replay) {
+        wprintf(L"TAPBench: replay of %s (%llu calls: %llu adds, %llu removes; %.1f ms recorded), %s, %s config\n",
+            o.replay, replayCalls.ops, replay.adds, replay.removes, replay.durationUs / 1000.0,
+            o.paced ? L"paced" : L"full speed", o.staticConfig ? L"v1 static" : L"v2 live");
+        wprintf(L"  matched: %lld adds, tracked: %d elements, %.2f M callbacks/s\n",
+            matched, tracked, addNs > 0 ? 1e3 / addNs : 0.0);
+        PrintPhase(replayCalls);
+        PrintPhase(replayFlush);
+        PrintPhase(apply);
+        wprintf(L"  fake: %.2f SetProperty per applied element, %lld CreateInstance, %lld property chains\n",
+            setPerApply, fake->CreateCalls(), fake->ChainCalls());
+    } else {
+        wprintf(L"TAPBench: %u elements (fanout %u), match %.2f%%, churn %.1f%% x %u rounds, %s config\n",
+            o.elements, o.fanout, o.match * 100.0, o.churn * 100.0, o.rounds,
+            o.staticConfig ? L"v1 static" : L"v2 live");
+        wprintf(L"  tracked: %d elements, %.2f M callbacks/s on Add\n", tracked, addNs > 0 ? 1e3 / addNs : 0.0);
+        PrintPhase(add);
+        PrintPhase(flush);
+        PrintPhase(remove);
+        PrintPhase(readd);
+        PrintPhase(churnFlush);
+        PrintPhase(apply);
+        wprintf(L"  fake: %.2f SetProperty per applied element, %lld CreateInstance, %lld property chains\n",
+            setPerApply, fake->CreateCalls(), fake->ChainCalls());
+    }
+
+    fake->Release();
+    CloseHandle(hConfig);
+    CloseHandle(hInit);
+
+    bool over = (o.maxAddNs > 0 && addNs > o.maxAddNs) || (o.maxApplyNs > 0 && applyNs > o.maxApplyNs);
+    if (over) {
+        fwprintf(stderr, L"Over budget: add %.1f ns (max %.1f), apply %.1f ns (max %.1f)\n",
+            addNs, o.maxAddNs, applyNs, o.maxApplyNs);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,5 @@
+@echo off
+REM Build TAPBench.exe for w11-theming-suite
+REM Watcher hot-path benchmark (ShellTAP sources + fake XAML Diagnostics).
+REM Builds TAPCore.lib first; see ..\build.cmd.
+call "%~dp0..\build.cmd" bench
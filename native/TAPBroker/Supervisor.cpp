@@ -0,0 +1,556 @@
+// Supervisor.cpp -- Re-injects the TAP DLLs when their host restarts
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#define _WIN32_DCOM
+#include "Supervisor.h"
+#include "Injector.h"
+#include "Json.h"
+#include <wbemidl.h>
+#include <cstdio>
+#include <cwchar>
+#include <vector>
+
+#pragma comment(lib, "user32.lib")
+#pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "oleaut32.lib")
+#pragma comment(lib, "wbemuuid.lib")
+
+namespace Supervisor {
+
+static const wchar_t WINDOW_CLASS[] = L"W11ThemeSuite_TAPBroker_Supervisor";
+static const wchar_t SHELLTAP_PREFIX[] = L"W11ThemeSuite_ShellTAP_";
+static const DWORD STOP_WAIT_MS = 5000;
+
+// One adopted DLL instance. `process` is null while the host is down.
+struct Adoption {
+    std::wstring targetId;
+    std::wstring prefix;
+    std::wstring hostExe;       // image name, e.g. L"StartMenuExperienceHost.exe"
+    bool shellTAP;
+    DWORD pid;
+    HANDLE process;
+    HANDLE config;              // <prefix>Config, held for the next host
+    int mode;                   // last acknowledged; -1 = none seen
+    LONG64 downAt;              // QPC at exit; 0 while up
+    bool restorePending;        // re-injected, waiting for it to register
+    int restarts;
+    double lastRestoreMs;       // exit to re-registration
+};
+
+struct StartedProcess {
+    DWORD pid;
+    std::wstring exe;
+};
+
+static TAPRegistry* g_registry = nullptr;
+static wchar_t g_dllDir[MAX_PATH] = {};
+static HANDLE g_hThread = nullptr;
+static HANDLE g_hStop = nullptr;
+static HANDLE g_hChanged = nullptr;     // TAP_REGISTRY_EVENT_NAME
+static HANDLE g_hStarted = nullptr;     // WMI sink queued something
+static UINT g_taskbarCreated = 0;
+static LONG64 g_qpcFreq = 1;
+
+static SRWLOCK g_lock = SRWLOCK_INIT;   // g_adoptions (AppendJson reads it), g_started
+static std::vector<Adoption> g_adoptions;
+static std::vector<StartedProcess> g_started;
+
+static LONG64 Now()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static double MsSince(LONG64 start)
+{
+    return (double)(Now() - start) * 1000.0 / (double)g_qpcFreq;
+}
+
+static bool IsExplorer(const Adoption& a)
+{
+    return _wcsicmp(a.hostExe.c_str(), L"explorer.exe") == 0;
+}
+
+static std::wstring ImageName(HANDLE process)
+{
+    wchar_t path[MAX_PATH];
+    DWORD size = MAX_PATH;
+    if (!QueryFullProcessImageNameW(process, 0, path, &size)) return std::wstring();
+    const wchar_t* slash = wcsrchr(path, L'\\');
+    return slash ? slash + 1 : path;
+}
+
+static HANDLE OpenNamedMapping(const std::wstring& prefix, const wchar_t* suffix, DWORD access)
+{
+    return OpenFileMappingW(access, FALSE, (prefix + suffix).c_str());
+}
+
+// ── Process-start notifications (WMI) ──
+// Win32_ProcessStartTrace is an extrinsic event fed by the kernel process
+// provider, so unlike __InstanceCreationEvent it needs no WITHIN polling.
+// Indicate runs on a WMI thread: it only queues and signals g_hStarted.
+class StartSink : public IWbemObjectSink {
+public:
+    ULONG STDMETHODCALLTYPE AddRef() override { return InterlockedIncrement(&m_refs); }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        LONG refs = InterlockedDecrement(&m_refs);
+        if (refs == 0) delete this;
+        return refs;
+    }
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (riid == IID_IUnknown || riid == IID_IWbemObjectSink) {
+            *ppv = static_cast<IWbemObjectSink*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    HRESULT STDMETHODCALLTYPE Indicate(LONG count, IWbemClassObject** objects) override
+    {
+        for (LONG i = 0; i < count; i++) {
+            VARIANT name, pid;
+            VariantInit(&name);
+            VariantInit(&pid);
+            if (SUCCEEDED(objects[i]->Get(L"ProcessName", 0, &name, nullptr, nullptr)) && name.vt == VT_BSTR &&
+                SUCCEEDED(objects[i]->Get(L"ProcessID", 0, &pid, nullptr, nullptr)) && pid.vt == VT_I4) {
+                AcquireSRWLockExclusive(&g_lock);
+                g_started.push_back({ (DWORD)pid.lVal, name.bstrVal });
+                ReleaseSRWLockExclusive(&g_lock);
+                SetEvent(g_hStarted);
+            }
+            VariantClear(&name);
+            VariantClear(&pid);
+        }
+        return WBEM_S_NO_ERROR;
+    }
+
+    HRESULT STDMETHODCALLTYPE SetStatus(LONG, HRESULT, BSTR, IWbemClassObject*) override
+    {
+        return WBEM_S_NO_ERROR;
+    }
+
+private:
+    LONG m_refs = 1;
+};
+
+static IWbemServices* g_wbem = nullptr;
+static IUnsecuredApartment* g_unsecApp = nullptr;
+static IWbemObjectSink* g_stubSink = nullptr;   // what WMI calls; forwards to a StartSink
+static std::vector<std::wstring> g_watched;     // image names in the current query
+
+static bool ConnectWmi()
+{
+    HRESULT hr = CoInitializeSecurity(nullptr, -1, nullptr, nullptr, RPC_C_AUTHN_LEVEL_DEFAULT,
+                                      RPC_C_IMP_LEVEL_IMPERSONATE, nullptr, EOAC_NONE, nullptr);
+    if (FAILED(hr) && hr != RPC_E_TOO_LATE) return false;
+
+    IWbemLocator* locator = nullptr;
+    hr = CoCreateInstance(CLSID_WbemLocator, nullptr, CLSCTX_INPROC_SERVER, IID_IWbemLocator, (void**)&locator);
+    if (FAILED(hr)) return false;
+    BSTR ns = SysAllocString(L"ROOT\\CIMV2");
+    hr = locator->ConnectServer(ns, nullptr, nullptr, nullptr, 0, nullptr, nullptr, &g_wbem);
+    SysFreeString(ns);
+    locator->Release();
+    if (FAILED(hr)) return false;
+
+    hr = CoSetProxyBlanket(g_wbem, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE, nullptr, RPC_C_AUTHN_LEVEL_CALL,
+                           RPC_C_IMP_LEVEL_IMPERSONATE, nullptr, EOAC_NONE);
+    if (FAILED(hr)) return false;
+    hr = CoCreateInstance(CLSID_UnsecuredApartment, nullptr, CLSCTX_LOCAL_SERVER, IID_IUnsecuredApartment,
+                          (void**)&g_unsecApp);
+    return SUCCEEDED(hr);
+}
+
+static void Unsubscribe()
+{
+    if (g_stubSink) {
+        g_wbem->CancelAsyncCall(g_stubSink);
+        g_stubSink->Release();
+        g_stubSink = nullptr;
+    }
+    g_watched.clear();
+}
+
+// One query for exactly the non-explorer hosts adopted so far; rebuilt when
+// that set changes
+static void UpdateSubscription()
+{
+    if (!g_wbem || !g_unsecApp) return;
+
+    std::vector<std::wstring> names;
+    AcquireSRWLockExclusive(&g_lock);
+    for (const Adoption& a : g_adoptions) {
+        if (IsExplorer(a) || a.hostExe.empty()) continue;
+        bool seen = false;
+        for (const std::wstring& n : names) seen = seen || _wcsicmp(n.c_str(), a.hostExe.c_str()) == 0;
+        if (!seen) names.push_back(a.hostExe);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    if (names == g_watched) return;
+
+    Unsubscribe();
+    if (names.empty()) return;
+
+    std::wstring query = L"SELECT ProcessID, ProcessName FROM Win32_ProcessStartTrace WHERE ";
+    for (size_t i = 0; i < names.size(); i++) {
+        if (i) query += L" OR ";
+        query += L"ProcessName = '" + names[i] + L"'";
+    }
+
+    StartSink* sink = new StartSink();
+    IUnknown* stub = nullptr;
+    HRESULT hr = g_unsecApp->CreateObjectStub(sink, &stub);
+    sink->Release();
+    if (SUCCEEDED(hr)) {
+        hr = stub->QueryInterface(IID_IWbemObjectSink, (void**)&g_stubSink);
+        stub->Release();
+    }
+    if (SUCCEEDED(hr)) {
+        BSTR lang = SysAllocString(L"WQL");
+        BSTR text = SysAllocString(query.c_str());
+        hr = g_wbem->ExecNotificationQueryAsync(lang, text, WBEM_FLAG_SEND_STATUS, nullptr, g_stubSink);
+        SysFreeString(lang);
+        SysFreeString(text);
+    }
+    if (FAILED(hr)) {
+        fwprintf(stderr, L"supervisor: process-start subscription failed: 0x%08lX\n", (unsigned long)hr);
+        if (g_stubSink) { g_stubSink->Release(); g_stubSink = nullptr; }
+        return;
+    }
+    g_watched = names;
+    for (const std::wstring& n : names) wprintf(L"supervisor: watching %s starts\n", n.c_str());
+}
+
+// ── Adoptions ──
+// Called with g_lock held (exclusive, not reentrant)
+static void MarkDown(Adoption& a)
+{
+    if (a.process) { CloseHandle(a.process); a.process = nullptr; }
+    if (!a.downAt) a.downAt = Now();    // a re-injected host that died again keeps the first exit
+    a.restorePending = false;
+
+    // A crashed host never unregistered
+    for (uint32_t i = 0; i < TAP_REGISTRY_SLOTS; i++) {
+        TAPRegistrySlot* slot = &g_registry->slots[i];
+        if (slot->pid == (LONG)a.pid && a.prefix == slot->prefix) {
+            InterlockedCompareExchange(&slot->pid, 0, (LONG)a.pid);
+        }
+    }
+    wprintf(L"supervisor: %s down (pid %lu)\n", a.targetId.c_str(), a.pid);
+}
+
+static bool Exited(const Adoption& a)
+{
+    return a.process && WaitForSingleObject(a.process, 0) == WAIT_OBJECT_0;
+}
+
+// The remembered mode goes back in once the new instance is up. ShellTAP
+// usually resumes it from the warm cache already; TaskbarTAP never does.
+static void RestoreMode(const Adoption& a)
+{
+    if (a.mode < 0) return;
+    HANDLE map = OpenNamedMapping(a.prefix, L"Mode", FILE_MAP_WRITE | FILE_MAP_READ);
+    if (!map) return;
+    volatile int* view = (volatile int*)MapViewOfFile(map, FILE_MAP_WRITE | FILE_MAP_READ, 0, 0, sizeof(int));
+    if (view) {
+        if (*view != a.mode) {
+            *view = a.mode;
+            HANDLE changed = OpenEventW(EVENT_MODIFY_STATE, FALSE, (a.prefix + L"ModeEvent").c_str());
+            if (changed) { SetEvent(changed); CloseHandle(changed); }
+        }
+        UnmapViewOfFile((LPCVOID)view);
+    }
+    CloseHandle(map);
+}
+
+// Follow the registry: adopt new instances, pick up re-registrations and
+// acknowledged modes, release instances unloaded from a live host
+static void Scan()
+{
+    bool adopted = false;
+    AcquireSRWLockExclusive(&g_lock);
+    std::vector<bool> registered(g_adoptions.size(), false);
+
+    for (uint32_t i = 0; i < TAP_REGISTRY_SLOTS; i++) {
+        TAPRegistrySlot* slot = &g_registry->slots[i];
+        LONG pid = slot->pid;
+        if (pid <= 0) continue;
+
+        size_t index = 0;
+        while (index < g_adoptions.size() && g_adoptions[index].prefix != slot->prefix) index++;
+
+        if (index == g_adoptions.size()) {
+            HANDLE process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+            if (!process) continue;
+            Adoption a = {};
+            a.targetId = slot->targetId;
+            a.prefix = slot->prefix;
+            a.hostExe = ImageName(process);
+            a.shellTAP = a.prefix.compare(0, wcslen(SHELLTAP_PREFIX), SHELLTAP_PREFIX) == 0;
+            a.pid = (DWORD)pid;
+            a.process = process;
+            a.config = a.shellTAP ? OpenNamedMapping(a.prefix, L"Config", FILE_MAP_READ) : nullptr;
+            a.mode = slot->appliedMode;
+            a.lastRestoreMs = -1;
+            g_adoptions.push_back(a);
+            registered.push_back(true);
+            adopted = true;
+            wprintf(L"supervisor: adopted %s in %s (pid %ld)\n", a.targetId.c_str(), a.hostExe.c_str(), pid);
+            continue;
+        }
+
+        Adoption& a = g_adoptions[index];
+        registered[index] = true;
+        if (a.pid != (DWORD)pid || !a.process || a.restorePending) {
+            // Back after a restart (ours, or someone else's injection)
+            if (a.process) CloseHandle(a.process);
+            a.process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+            a.pid = (DWORD)pid;
+            if (a.downAt) {
+                a.lastRestoreMs = MsSince(a.downAt);
+                a.restarts++;
+                wprintf(L"supervisor: %s restored in %.0f ms (pid %ld)\n", a.targetId.c_str(), a.lastRestoreMs, pid);
+            }
+            a.downAt = 0;
+            a.restorePending = false;
+            RestoreMode(a);
+        } else if (slot->appliedMode >= 0) {
+            a.mode = slot->appliedMode;
+        }
+    }
+
+    for (size_t i = 0; i < g_adoptions.size(); ) {
+        Adoption& a = g_adoptions[i];
+        if (!registered[i] && a.process && !a.restorePending && !Exited(a)) {
+            wprintf(L"supervisor: %s unloaded from a running host, released\n", a.targetId.c_str());
+            CloseHandle(a.process);
+            if (a.config) CloseHandle(a.config);
+            g_adoptions.erase(g_adoptions.begin() + i);
+            registered.erase(registered.begin() + i);
+            continue;
+        }
+        i++;
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    if (adopted) UpdateSubscription();
+}
+
+// One host to re-inject, copied out of its adoption so the injection can
+// run without g_lock (it can take seconds; AppendJson and the WMI sink
+// would wait on it)
+struct Reinjection {
+    std::wstring targetId;
+    std::wstring prefix;        // finds the adoption again afterwards
+    bool shellTAP;
+    DWORD pid;
+    LONG64 downAt;
+};
+
+// Called with g_lock held. Queues `a` for pid unless its host is still up
+// (TaskbarCreated without a restart), it is already injected there, or it
+// is queued already (two hosts of the same image started together).
+static void QueueReinject(Adoption& a, DWORD pid, std::vector<Reinjection>* jobs)
+{
+    if (a.process && !Exited(a)) return;
+    for (const Reinjection& job : *jobs) {
+        if (job.prefix == a.prefix) return;
+    }
+    if (a.process) MarkDown(a);
+    jobs->push_back({ a.targetId, a.prefix, a.shellTAP, pid, a.downAt });
+}
+
+// Called without g_lock. The held _Config mapping is what the new DLL reads;
+// the init block only carries the TargetId.
+static void Reinject(const std::vector<Reinjection>& jobs)
+{
+    for (const Reinjection& job : jobs) {
+        wchar_t dllPath[MAX_PATH];
+        swprintf(dllPath, MAX_PATH, L"%s\\%s", g_dllDir, job.shellTAP ? L"ShellTAP.dll" : L"TaskbarTAP.dll");
+
+        HANDLE initMap = job.shellTAP ? Injector::WriteInitBlock(job.pid, job.targetId.c_str()) : nullptr;
+        bool ok = (!job.shellTAP || initMap) && Injector::InjectDll(job.pid, dllPath);
+        if (initMap) CloseHandle(initMap);
+
+        // Watch the new host from now on, so a second crash before it
+        // registers is noticed too. Skipped if the adoption was released, or
+        // Scan already saw the new instance register, meanwhile.
+        HANDLE process = ok ? OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, job.pid) : nullptr;
+        AcquireSRWLockExclusive(&g_lock);
+        for (Adoption& a : g_adoptions) {
+            if (a.prefix != job.prefix) continue;
+            if (process && !a.process) {
+                a.pid = job.pid;
+                a.process = process;
+                a.restorePending = true;
+                process = nullptr;
+            }
+            break;
+        }
+        ReleaseSRWLockExclusive(&g_lock);
+        if (process) CloseHandle(process);
+
+        wprintf(L"supervisor: %s %s into pid %lu, %.0f ms after exit\n", job.targetId.c_str(),
+                ok ? L"re-injected" : L"re-injection FAILED", job.pid, job.downAt ? MsSince(job.downAt) : 0.0);
+    }
+}
+
+static void OnProcessExit(HANDLE process)
+{
+    AcquireSRWLockExclusive(&g_lock);
+    for (Adoption& a : g_adoptions) {
+        if (a.process == process) MarkDown(a);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+static void OnTaskbarCreated()
+{
+    DWORD pid = Injector::FindTaskbarProcess();
+    if (!pid) return;
+    std::vector<Reinjection> jobs;
+    AcquireSRWLockExclusive(&g_lock);
+    for (Adoption& a : g_adoptions) {
+        if (IsExplorer(a)) QueueReinject(a, pid, &jobs);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    Reinject(jobs);
+}
+
+static void OnProcessesStarted()
+{
+    std::vector<StartedProcess> started;
+    std::vector<Reinjection> jobs;
+    AcquireSRWLockExclusive(&g_lock);
+    started.swap(g_started);
+    for (const StartedProcess& p : started) {
+        for (Adoption& a : g_adoptions) {
+            if (!IsExplorer(a) && _wcsicmp(a.hostExe.c_str(), p.exe.c_str()) == 0) QueueReinject(a, p.pid, &jobs);
+        }
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    Reinject(jobs);
+}
+
+static LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    if (msg == g_taskbarCreated && g_taskbarCreated != 0) {
+        OnTaskbarCreated();
+        return 0;
+    }
+    return DefWindowProcW(hwnd, msg, wParam, lParam);
+}
+
+// ── Supervisor thread ──
+static DWORD WINAPI SupervisorThread(LPVOID)
+{
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (!ConnectWmi()) {
+        fwprintf(stderr, L"supervisor: WMI unavailable; only explorer.exe restarts are followed\n");
+    }
+
+    // Broadcasts reach top-level windows only (not HWND_MESSAGE), and the
+    // filter lets explorer's medium-IL broadcast through to an elevated broker
+    WNDCLASSEXW wc = {};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = WndProc;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = WINDOW_CLASS;
+    RegisterClassExW(&wc);
+    HWND hwnd = CreateWindowExW(0, WINDOW_CLASS, L"", WS_POPUP, 0, 0, 0, 0, nullptr, nullptr, wc.hInstance, nullptr);
+    g_taskbarCreated = RegisterWindowMessageW(L"TaskbarCreated");
+    if (hwnd) ChangeWindowMessageFilterEx(hwnd, g_taskbarCreated, MSGFLT_ALLOW, nullptr);
+
+    Scan();
+    for (;;) {
+        HANDLE handles[MAXIMUM_WAIT_OBJECTS - 1];
+        DWORD count = 0;
+        handles[count++] = g_hStop;
+        handles[count++] = g_hChanged;
+        handles[count++] = g_hStarted;
+        AcquireSRWLockExclusive(&g_lock);
+        for (const Adoption& a : g_adoptions) {
+            if (a.process && count < MAXIMUM_WAIT_OBJECTS - 1) handles[count++] = a.process;
+        }
+        ReleaseSRWLockExclusive(&g_lock);
+
+        DWORD r = MsgWaitForMultipleObjects(count, handles, FALSE, INFINITE, QS_ALLINPUT);
+        if (r == WAIT_OBJECT_0) break;
+        if (r == WAIT_OBJECT_0 + 1) Scan();
+        else if (r == WAIT_OBJECT_0 + 2) OnProcessesStarted();
+        else if (r > WAIT_OBJECT_0 + 2 && r < WAIT_OBJECT_0 + count) OnProcessExit(handles[r - WAIT_OBJECT_0]);
+        else if (r == WAIT_OBJECT_0 + count) {
+            MSG msg;
+            while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) DispatchMessageW(&msg);
+        }
+        else if (r == WAIT_FAILED) break;
+    }
+
+    if (g_wbem) { Unsubscribe(); g_wbem->Release(); g_wbem = nullptr; }
+    if (g_unsecApp) { g_unsecApp->Release(); g_unsecApp = nullptr; }
+    if (hwnd) DestroyWindow(hwnd);
+    CoUninitialize();
+    return 0;
+}
+
+bool Start(TAPRegistry* registry, const wchar_t* dllDir)
+{
+    if (g_hThread) return true;
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_qpcFreq = freq.QuadPart;
+
+    g_registry = registry;
+    wcsncpy_s(g_dllDir, dllDir, _TRUNCATE);
+    g_hStop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    g_hChanged = CreateEventW(nullptr, FALSE, FALSE, TAP_REGISTRY_EVENT_NAME);
+    g_hStarted = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!g_hStop || !g_hChanged || !g_hStarted) return false;
+
+    g_hThread = CreateThread(nullptr, 0, SupervisorThread, nullptr, 0, nullptr);
+    return g_hThread != nullptr;
+}
+
+void Stop()
+{
+    if (!g_hThread) return;
+    SetEvent(g_hStop);
+    WaitForSingleObject(g_hThread, STOP_WAIT_MS);
+    CloseHandle(g_hThread);
+    g_hThread = nullptr;
+
+    for (Adoption& a : g_adoptions) {
+        if (a.process) CloseHandle(a.process);
+        if (a.config) CloseHandle(a.config);
+    }
+    g_adoptions.clear();
+    CloseHandle(g_hStop);
+    CloseHandle(g_hChanged);
+    CloseHandle(g_hStarted);
+}
+
+void AppendJson(std::string* out)
+{
+    if (!g_hThread) return;
+    *out += ",\"supervised\":[";
+    AcquireSRWLockExclusive(&g_lock);
+    for (size_t i = 0; i < g_adoptions.size(); i++) {
+        const Adoption& a = g_adoptions[i];
+        char buf[160];
+        snprintf(buf, sizeof(buf), ",\"up\":%s,\"mode\":%d,\"restarts\":%d,\"lastRestoreMs\":%.0f}",
+                 a.process ? "true" : "false", a.mode, a.restarts, a.lastRestoreMs);
+        if (i) *out += ",";
+        *out += "{\"target\":" + JsonString(Utf8(a.targetId.c_str())) +
+                ",\"host\":" + JsonString(Utf8(a.hostExe.c_str())) + buf;
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    *out += "]";
+}
+
+} // namespace Supervisor
@@ -0,0 +1,35 @@
+// Supervisor.h -- Re-injects the TAP DLLs when their host restarts
+//
+// Every instance that registers (InstanceRegistry.h) is adopted: the
+// supervisor remembers its target, host image and last acknowledged mode,
+// and holds its _Config mapping open so the configuration outlives the
+// host. Nothing is polled; the supervisor thread sleeps in
+// MsgWaitForMultipleObjects on:
+//   - the host process handles (exit = instance down)
+//   - "W11ThemeSuite_TAP_RegistryChanged" (registrations, acks)
+//   - the "TaskbarCreated" broadcast, for anything hosted by explorer.exe
+//   - WMI Win32_ProcessStartTrace, for the other hosts (ETW-backed, no
+//     WITHIN interval)
+// A new host is injected as soon as it appears; XamlBootstrap waits for its
+// XAML, ShellTAP resumes from its warm-start cache, and the remembered mode
+// is written back once the new instance registers. An instance that
+// unregisters while its host keeps running (unloaded on purpose) is
+// released, not restored.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include "InstanceRegistry.h"
+
+namespace Supervisor {
+
+// dllDir: where ShellTAP.dll / TaskbarTAP.dll are (the broker's directory)
+bool Start(TAPRegistry* registry, const wchar_t* dllDir);
+void Stop();
+
+// ,"supervised":[...] for the broker's list reply
+void AppendJson(std::string* out);
+
+} // namespace Supervisor
@@ -0,0 +1,464 @@
+// TAPBroker.cpp -- One command channel for every injected TAP DLL
+//
+// A long-lived process serving "\\.\pipe\W11ThemeSuite_TAPBroker". Clients
+// (Set-TAPPreset, or TAPBroker --send) write one command per line; each
+// gets one JSON line back. The broker finds the live DLL instances in the
+// shared registry (TAPCore\InstanceRegistry.h), so nothing has to tell it
+// about injections, and drives them through their existing _Mode /
+// _ModeEvent objects -- the DLLs run no pipe code of their own.
+//
+// Commands:
+//   list                          Live instances, their mode and counters.
+//   set <target>=<mode> ...       Broadcast: write every instance's mode,
+//                                 signal them all, then wait for all their
+//                                 _ModeAck events at once. <target> "*" is
+//                                 every instance that has <mode>; later
+//                                 pairs win, so "*=Transparent
+//                                 StartMenu=Acrylic" is a whole preset in
+//                                 one round trip. <mode> is
+//                                 Default, Transparent, Acrylic, Tint, Blur
+//                                 or a number.
+//   quit                          Stop the broker.
+//
+// Usage:
+//   TAPBroker [--timeout <ms>] [--no-supervise]
+//                                       serve (ack wait per set, default 2000)
+//   TAPBroker --send "<command>"        send one command to a running broker
+//
+// Unless --no-supervise, the broker also re-injects every instance it has
+// seen when its host restarts (Supervisor.h); "list" then reports each
+// supervised target's restarts and last time-to-restore.
+//
+// Exit codes: 0 ok, 1 pipe failed (or, with --send, no broker / command
+// failed), 2 usage, 3 a broker is already running.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <string>
+#include <vector>
+#include "InstanceRegistry.h"
+#include "PerfCounters.h"
+#include "Json.h"
+#include "Supervisor.h"
+
+static const wchar_t PIPE_NAME[] = L"\\\\.\\pipe\\W11ThemeSuite_TAPBroker";
+static const DWORD PIPE_BUFFER = 16 * 1024;
+static const size_t MAX_COMMAND = 4096;
+static const DWORD SEND_CONNECT_MS = 2000;
+
+static const char* const kModeNames[] = { "Default", "Transparent", "Acrylic", "Tint", "Blur" };
+
+struct Options {
+    DWORD timeoutMs = 2000;
+    const wchar_t* send = nullptr;
+    bool supervise = true;
+};
+
+static void Usage()
+{
+    fwprintf(stderr, L"Usage: TAPBroker [--timeout <ms>] [--no-supervise]\n"
+                     L"       TAPBroker --send \"<command>\"\n");
+}
+
+static bool ParseArgs(int argc, wchar_t** argv, Options* o)
+{
+    for (int i = 1; i < argc; i++) {
+        const wchar_t* a = argv[i];
+        const wchar_t* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (wcscmp(a, L"--no-supervise") == 0) { o->supervise = false; continue; }
+        if (!v) return false;
+        if (wcscmp(a, L"--timeout") == 0)   o->timeoutMs = (DWORD)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--send") == 0) o->send = v;
+        else return false;
+        i++;
+    }
+    return true;
+}
+
+static LONG64 g_qpcFreq = 1;
+
+static LONG64 Now()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static double MsSince(LONG64 start)
+{
+    return (double)(Now() - start) * 1000.0 / (double)g_qpcFreq;
+}
+
+// ── JSON ──
+static std::string JsonError(const char* fmt, const std::string& arg = std::string())
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), fmt, arg.c_str());
+    return "{\"ok\":false,\"error\":" + JsonString(buf) + "}";
+}
+
+// ── Registry ──
+static HANDLE g_hRegistryMap = nullptr;
+static TAPRegistry* g_registry = nullptr;
+
+// Held for the broker's lifetime, so the registry outlives DLL restarts
+static bool OpenRegistry()
+{
+    g_hRegistryMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                        sizeof(TAPRegistry), TAP_REGISTRY_NAME);
+    if (!g_hRegistryMap) return false;
+    g_registry = (TAPRegistry*)MapViewOfFile(g_hRegistryMap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TAPRegistry));
+    if (!g_registry) return false;
+    g_registry->slotCount = TAP_REGISTRY_SLOTS;
+    InterlockedCompareExchange(&g_registry->version, (LONG)TAP_REGISTRY_VERSION, 0);
+    return g_registry->version == (LONG)TAP_REGISTRY_VERSION;
+}
+
+// A host that crashed never unregistered: free its slot
+static bool ProcessAlive(DWORD pid)
+{
+    HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    if (!h) return GetLastError() == ERROR_ACCESS_DENIED;
+    bool alive = WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+    CloseHandle(h);
+    return alive;
+}
+
+static std::vector<TAPRegistrySlot*> LiveSlots()
+{
+    std::vector<TAPRegistrySlot*> live;
+    for (uint32_t i = 0; i < TAP_REGISTRY_SLOTS; i++) {
+        TAPRegistrySlot* slot = &g_registry->slots[i];
+        LONG pid = slot->pid;
+        if (pid <= 0) continue;
+        if (!ProcessAlive((DWORD)pid)) {
+            InterlockedCompareExchange(&slot->pid, 0, pid);
+            continue;
+        }
+        live.push_back(slot);
+    }
+    return live;
+}
+
+static HANDLE OpenNamed(const TAPRegistrySlot* slot, const wchar_t* suffix, DWORD access, bool event)
+{
+    wchar_t name[160];
+    swprintf(name, 160, L"%s%s", slot->prefix, suffix);
+    return event ? OpenEventW(access, FALSE, name) : OpenFileMappingW(access, FALSE, name);
+}
+
+// Mode as currently requested in <prefix>Mode; -1 if unreadable
+static int ReadMode(const TAPRegistrySlot* slot)
+{
+    HANDLE map = OpenNamed(slot, L"Mode", FILE_MAP_READ, false);
+    if (!map) return -1;
+    int mode = -1;
+    const volatile int* view = (const volatile int*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, sizeof(int));
+    if (view) { mode = *view; UnmapViewOfFile((LPCVOID)view); }
+    CloseHandle(map);
+    return mode;
+}
+
+// ShellTAP's counters block (PerfCounters.h); TaskbarTAP has none
+static std::string CountersJson(const TAPRegistrySlot* slot)
+{
+    HANDLE map = OpenNamed(slot, L"Counters", FILE_MAP_READ, false);
+    if (!map) return std::string();
+    std::string out;
+    const ShellTAPCounters* c = (const ShellTAPCounters*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, sizeof(ShellTAPCounters));
+    if (c && c->version == SHELLTAP_COUNTERS_VERSION && c->size >= sizeof(ShellTAPCounters)) {
+        char buf[512];
+        snprintf(buf, sizeof(buf),
+            ",\"counters\":{\"addCallbacks\":%lld,\"removeCallbacks\":%lld,\"matches\":%lld,"
+            "\"applyCalls\":%lld,\"setPropertyFailures\":%lld,\"flushes\":%lld,\"reasserts\":%lld}",
+            c->addCallbacks, c->removeCallbacks, c->matches, c->applyCalls,
+            c->setPropertyFailures, c->flushes, c->reasserts);
+        out = buf;
+    }
+    if (c) UnmapViewOfFile(c);
+    CloseHandle(map);
+    return out;
+}
+
+static std::string InstanceJson(const TAPRegistrySlot* slot)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), ",\"pid\":%ld,\"mode\":%d,\"appliedMode\":%ld",
+             slot->pid, ReadMode(slot), slot->appliedMode);
+    return "{\"target\":" + JsonString(Utf8(slot->targetId)) + buf + CountersJson(slot);
+}
+
+// ── Commands ──
+static std::vector<std::string> Split(const std::string& line)
+{
+    std::vector<std::string> words;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) i++;
+        size_t start = i;
+        while (i < line.size() && line[i] != ' ' && line[i] != '\t') i++;
+        if (i > start) words.push_back(line.substr(start, i - start));
+    }
+    return words;
+}
+
+static int ParseMode(const std::string& s)
+{
+    for (int i = 0; i < (int)(sizeof(kModeNames) / sizeof(kModeNames[0])); i++) {
+        if (_stricmp(s.c_str(), kModeNames[i]) == 0) return i;
+    }
+    char* end = nullptr;
+    long n = strtol(s.c_str(), &end, 10);
+    return (!s.empty() && *end == 0 && n >= 0 && n < 64) ? (int)n : -1;
+}
+
+static std::string CmdList()
+{
+    std::string out = "{\"ok\":true,\"instances\":[";
+    bool first = true;
+    for (TAPRegistrySlot* slot : LiveSlots()) {
+        if (!first) out += ",";
+        out += InstanceJson(slot) + "}";
+        first = false;
+    }
+    out += "]";
+    Supervisor::AppendJson(&out);
+    return out + "}";
+}
+
+struct Delivery {
+    TAPRegistrySlot* slot;
+    int mode;
+    LONG acksBefore;
+    HANDLE ack;
+    const char* error;
+    double ms;              // signal to ack
+    bool acked;
+};
+
+static bool Acked(const Delivery& d)
+{
+    return d.slot->acks != d.acksBefore && d.slot->appliedMode == d.mode;
+}
+
+static std::string CmdSet(const std::vector<std::string>& words, DWORD timeoutMs)
+{
+    if (words.size() < 2) return JsonError("set needs <target>=<mode> pairs");
+
+    std::vector<TAPRegistrySlot*> live = LiveSlots();
+    std::vector<int> modes(live.size(), -1);
+    for (size_t w = 1; w < words.size(); w++) {
+        size_t eq = words[w].find('=');
+        if (eq == std::string::npos || eq == 0) return JsonError("bad pair '%s'", words[w]);
+        std::string target = words[w].substr(0, eq);
+        int mode = ParseMode(words[w].substr(eq + 1));
+        if (mode < 0) return JsonError("unknown mode in '%s'", words[w]);
+
+        // "*" passes over instances without that mode (TaskbarTAP has no Tint)
+        bool found = false;
+        for (size_t i = 0; i < live.size(); i++) {
+            if (target == "*") {
+                if (mode < live[i]->modeCount) modes[i] = mode;
+            } else if (_stricmp(Utf8(live[i]->targetId).c_str(), target.c_str()) == 0) {
+                modes[i] = mode;
+                found = true;
+            }
+        }
+        if (!found && target != "*") return JsonError("no live instance '%s'", target);
+    }
+
+    // Signal everything first, then wait for the acks together
+    LONG64 start = Now();
+    std::vector<Delivery> deliveries;
+    for (size_t i = 0; i < live.size(); i++) {
+        if (modes[i] < 0) continue;
+        Delivery d = { live[i], modes[i], live[i]->acks, nullptr, nullptr, 0.0, false };
+        if (d.mode >= d.slot->modeCount) {
+            d.error = "mode not supported";
+            deliveries.push_back(d);
+            continue;
+        }
+
+        HANDLE map = OpenNamed(d.slot, L"Mode", FILE_MAP_WRITE, false);
+        HANDLE changed = OpenNamed(d.slot, L"ModeEvent", EVENT_MODIFY_STATE, true);
+        d.ack = OpenNamed(d.slot, L"ModeAck", SYNCHRONIZE, true);
+        volatile int* view = map ? (volatile int*)MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, sizeof(int)) : nullptr;
+        if (view && changed) {
+            *view = d.mode;
+            SetEvent(changed);
+        } else {
+            d.error = "mode objects not found";
+        }
+        if (view) UnmapViewOfFile((LPCVOID)view);
+        if (map) CloseHandle(map);
+        if (changed) CloseHandle(changed);
+        deliveries.push_back(d);
+    }
+
+    for (;;) {
+        std::vector<HANDLE> waits;
+        for (Delivery& d : deliveries) {
+            if (d.error || d.acked) continue;
+            if (Acked(d)) { d.acked = true; d.ms = MsSince(start); continue; }
+            if (d.ack) waits.push_back(d.ack);
+        }
+        double left = (double)timeoutMs - MsSince(start);
+        if (waits.empty() || left <= 0) break;
+        DWORD r = WaitForMultipleObjects((DWORD)waits.size(), waits.data(), FALSE, (DWORD)left + 1);
+        if (r == WAIT_FAILED) break;
+    }
+    double totalMs = MsSince(start);
+
+    std::string out;
+    bool allAcked = true;
+    for (const Delivery& d : deliveries) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), ",\"requested\":%d,\"acked\":%s,\"ackMs\":%.1f",
+                 d.mode, d.acked ? "true" : "false", d.ms);
+        if (!out.empty()) out += ",";
+        out += InstanceJson(d.slot) + buf;
+        if (d.error) out += ",\"error\":" + JsonString(d.error);
+        out += "}";
+        if (d.ack) CloseHandle(d.ack);
+        allAcked = allAcked && d.acked;
+    }
+
+    char head[96];
+    snprintf(head, sizeof(head), "{\"ok\":%s,\"ms\":%.1f,\"results\":[", allAcked ? "true" : "false", totalMs);
+    wprintf(L"set: %zu instance(s), %s in %.1f ms\n", deliveries.size(),
+            allAcked ? L"all acked" : L"NOT all acked", totalMs);
+    return head + out + "]}";
+}
+
+// ── Pipe server ──
+static bool ReadLine(HANDLE pipe, std::string* line, std::string* carry)
+{
+    for (;;) {
+        size_t nl = carry->find('\n');
+        if (nl != std::string::npos) {
+            *line = carry->substr(0, nl);
+            carry->erase(0, nl + 1);
+            if (!line->empty() && line->back() == '\r') line->pop_back();
+            return true;
+        }
+        if (carry->size() > MAX_COMMAND) return false;
+        char buf[1024];
+        DWORD read = 0;
+        if (!ReadFile(pipe, buf, sizeof(buf), &read, nullptr) || read == 0) return false;
+        carry->append(buf, read);
+    }
+}
+
+static bool WriteLine(HANDLE pipe, const std::string& reply)
+{
+    std::string line = reply + "\n";
+    DWORD written = 0;
+    return WriteFile(pipe, line.data(), (DWORD)line.size(), &written, nullptr) && written == line.size();
+}
+
+static int Serve(const Options& o)
+{
+    if (!OpenRegistry()) {
+        fwprintf(stderr, L"Cannot open the instance registry: %lu\n", GetLastError());
+        return 1;
+    }
+
+    // The one instance for the broker's lifetime: FIRST_PIPE_INSTANCE fails
+    // if another broker holds the name, and keeping it between clients leaves
+    // no window for a second server to take the name over.
+    HANDLE pipe = CreateNamedPipeW(PIPE_NAME,
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1, PIPE_BUFFER, PIPE_BUFFER, 0, nullptr);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        DWORD err = GetLastError();
+        if (err == ERROR_ACCESS_DENIED || err == ERROR_PIPE_BUSY) {
+            fwprintf(stderr, L"A broker is already running\n");
+            return 3;
+        }
+        fwprintf(stderr, L"CreateNamedPipe failed: %lu\n", err);
+        return 1;
+    }
+
+    // Only once the pipe shows this is the one broker
+    if (o.supervise) {
+        wchar_t dllDir[MAX_PATH];
+        GetModuleFileNameW(nullptr, dllDir, MAX_PATH);
+        wchar_t* slash = wcsrchr(dllDir, L'\\');
+        if (slash) *slash = 0;
+        if (!Supervisor::Start(g_registry, dllDir)) {
+            fwprintf(stderr, L"Supervisor failed to start: %lu\n", GetLastError());
+        }
+    }
+
+    wprintf(L"TAPBroker listening on %s\n", PIPE_NAME);
+    bool quit = false;
+    while (!quit) {
+        if (!ConnectNamedPipe(pipe, nullptr)) {
+            DWORD err = GetLastError();
+            if (err != ERROR_PIPE_CONNECTED && err != ERROR_NO_DATA) {
+                fwprintf(stderr, L"ConnectNamedPipe failed: %lu\n", err);
+                break;
+            }
+        }
+
+        // One client at a time; it may send several commands
+        std::string line, carry;
+        while (!quit && ReadLine(pipe, &line, &carry)) {
+            std::vector<std::string> words = Split(line);
+            std::string reply;
+            if (words.empty()) continue;
+            if (words[0] == "list") reply = CmdList();
+            else if (words[0] == "set") reply = CmdSet(words, o.timeoutMs);
+            else if (words[0] == "quit") { reply = "{\"ok\":true}"; quit = true; }
+            else reply = JsonError("unknown command '%s'", words[0]);
+            if (!WriteLine(pipe, reply)) break;
+        }
+        FlushFileBuffers(pipe);
+        DisconnectNamedPipe(pipe);          // ready for the next client
+    }
+    CloseHandle(pipe);
+    Supervisor::Stop();
+    return 0;
+}
+
+// ── Client ──
+static int Send(const wchar_t* command)
+{
+    if (!WaitNamedPipeW(PIPE_NAME, SEND_CONNECT_MS)) {
+        fwprintf(stderr, L"No broker on %s\n", PIPE_NAME);
+        return 1;
+    }
+    HANDLE pipe = CreateFileW(PIPE_NAME, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        fwprintf(stderr, L"Cannot connect to the broker: %lu\n", GetLastError());
+        return 1;
+    }
+
+    std::string line, carry;
+    bool ok = WriteLine(pipe, Utf8(command)) && ReadLine(pipe, &line, &carry);
+    CloseHandle(pipe);
+    if (!ok) {
+        fwprintf(stderr, L"The broker closed the connection\n");
+        return 1;
+    }
+    printf("%s\n", line.c_str());
+    return line.compare(0, 10, "{\"ok\":true") == 0 ? 0 : 1;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    Options o;
+    if (!ParseArgs(argc, argv, &o)) { Usage(); return 2; }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_qpcFreq = freq.QuadPart;
+
+    return o.send ? Send(o.send) : Serve(o);
+}
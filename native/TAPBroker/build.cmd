@@ -0,0 +1,28 @@
+@echo off
+REM Build TAPBroker.exe for w11-theming-suite
+REM Command broker that fans mode changes out to every registered TAP DLL
+setlocal
+
+set "SRCDIR=C:\Dev\w11-theming-suite\native\TAPBroker"
+set "OUTDIR=C:\Dev\w11-theming-suite\native\bin"
+set "OBJDIR=C:\Dev\w11-theming-suite\native\TAPBroker\obj"
+set "VCVARS=C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxiliary\Build\vcvars64.bat"
+
+echo [BUILD] Initializing x64 environment...
+call "%VCVARS%"
+if errorlevel 1 goto :fail
+
+if not exist "%OUTDIR%\" mkdir "%OUTDIR%"
+if not exist "%OBJDIR%\" mkdir "%OBJDIR%"
+
+echo [BUILD] Compiling TAPBroker.cpp + Supervisor.cpp + TAPCore\Injector.cpp...
+cl.exe /nologo /EHsc /O2 /MD /W3 /std:c++17 /D_CRT_SECURE_NO_WARNINGS /DUNICODE /D_UNICODE /DNDEBUG /I"%SRCDIR%\..\TAPCore" /I"%SRCDIR%\..\ShellTAP" "%SRCDIR%\TAPBroker.cpp" "%SRCDIR%\Supervisor.cpp" "%SRCDIR%\..\TAPCore\Injector.cpp" /Fe:"%OUTDIR%\TAPBroker.exe" /Fo:"%OBJDIR%\\" /link /NOLOGO /MACHINE:X64
+if errorlevel 1 goto :fail
+
+echo [BUILD] SUCCESS
+dir "%OUTDIR%\TAPBroker.exe"
+goto :eof
+
+:fail
+echo [BUILD] FAILED
+exit /b 1
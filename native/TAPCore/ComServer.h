@@ -0,0 +1,133 @@
+// ComServer.h -- In-proc COM plumbing for a TAP DLL
+//
+// XAML Diagnostics CoCreates the site class named in the IXDE call through
+// DllGetClassObject; everything else talks to the site through SetSite.
+// The factory and the IObjectWithSite boilerplate are the same for every
+// TAP DLL, so they are templates over the site class:
+//
+//   class MySite : public TAPCore::ObjectWithSite<MySite> {
+//       HRESULT OnSiteChanged(IUnknown* site);   // null = disconnecting
+//   };
+//   STDAPI DllGetClassObject(REFCLSID c, REFIID i, LPVOID* p)
+//   { return TAPCore::GetClassObject<MySite>(CLSID_MySite, c, i, p); }
+//
+// Each DLL defines g_refCount (module lock count for DllCanUnloadNow).
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <ocidl.h>      // IObjectWithSite
+#include <unknwn.h>     // IClassFactory
+#include <atomic>
+
+extern std::atomic<long> g_refCount;
+
+namespace TAPCore {
+
+// ── IObjectWithSite: Derived supplies OnSiteChanged ──
+template <class Derived>
+class ObjectWithSite : public IObjectWithSite {
+public:
+    ObjectWithSite() : m_refCount(1), m_pSite(nullptr) { g_refCount++; }
+    virtual ~ObjectWithSite()
+    {
+        if (m_pSite) m_pSite->Release();
+        g_refCount--;
+    }
+
+    // IUnknown
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (riid == IID_IUnknown || riid == IID_IObjectWithSite) {
+            *ppv = static_cast<IObjectWithSite*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return InterlockedIncrement(&m_refCount); }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        long ref = InterlockedDecrement(&m_refCount);
+        if (ref == 0) delete this;
+        return ref;
+    }
+
+    // IObjectWithSite: keeps the site, then hands it to the DLL
+    HRESULT STDMETHODCALLTYPE SetSite(IUnknown* pUnkSite) override
+    {
+        if (m_pSite) { m_pSite->Release(); m_pSite = nullptr; }
+        if (pUnkSite) {
+            m_pSite = pUnkSite;
+            m_pSite->AddRef();
+        }
+        return static_cast<Derived*>(this)->OnSiteChanged(pUnkSite);
+    }
+    HRESULT STDMETHODCALLTYPE GetSite(REFIID riid, void** ppvSite) override
+    {
+        if (!m_pSite) { *ppvSite = nullptr; return E_FAIL; }
+        return m_pSite->QueryInterface(riid, ppvSite);
+    }
+
+private:
+    long m_refCount;
+    IUnknown* m_pSite;
+};
+
+// ── IClassFactory for one site class ──
+template <class Site>
+class ClassFactory : public IClassFactory {
+public:
+    ClassFactory() : m_refCount(1) { g_refCount++; }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (riid == IID_IUnknown || riid == IID_IClassFactory) {
+            *ppv = static_cast<IClassFactory*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return InterlockedIncrement(&m_refCount); }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        long ref = InterlockedDecrement(&m_refCount);
+        if (ref == 0) { g_refCount--; delete this; }
+        return ref;
+    }
+
+    HRESULT STDMETHODCALLTYPE CreateInstance(IUnknown* pOuter, REFIID riid, void** ppv) override
+    {
+        if (pOuter) return CLASS_E_NOAGGREGATION;
+        auto* site = new Site();
+        HRESULT hr = site->QueryInterface(riid, ppv);
+        site->Release();
+        return hr;
+    }
+    HRESULT STDMETHODCALLTYPE LockServer(BOOL fLock) override
+    {
+        if (fLock) g_refCount++;
+        else g_refCount--;
+        return S_OK;
+    }
+
+private:
+    long m_refCount;
+};
+
+// DllGetClassObject body
+template <class Site>
+HRESULT GetClassObject(REFCLSID siteClsid, REFCLSID rclsid, REFIID riid, LPVOID* ppv)
+{
+    if (rclsid != siteClsid) return CLASS_E_CLASSNOTAVAILABLE;
+    auto* factory = new ClassFactory<Site>();
+    HRESULT hr = factory->QueryInterface(riid, ppv);
+    factory->Release();
+    return hr;
+}
+
+} // namespace TAPCore
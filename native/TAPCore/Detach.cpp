@@ -0,0 +1,101 @@
+// Detach.cpp -- Unadvise and unload a TAP DLL without restarting its host
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "Detach.h"
+#include "InstanceRegistry.h"
+#include "MonitorThread.h"
+
+namespace Detach {
+
+static Hooks g_hooks = {};
+static HANDLE g_hDetach = nullptr;      // auto-reset, signaled by tooling
+static HANDLE g_hDetached = nullptr;    // manual-reset, set when a detach is done
+static volatile LONG g_detached = 0;
+
+void Init(const Hooks& hooks)
+{
+    g_hooks = hooks;
+}
+
+void CreateEvents(const wchar_t* prefix)
+{
+    wchar_t name[160];
+    if (!g_hDetach) {
+        wsprintfW(name, L"%sDetach", prefix);
+        g_hDetach = CreateEventW(nullptr, FALSE, FALSE, name);
+    }
+    if (!g_hDetached) {
+        wsprintfW(name, L"%sDetached", prefix);
+        g_hDetached = CreateEventW(nullptr, TRUE, FALSE, name);
+    }
+}
+
+HANDLE Event()
+{
+    return g_hDetach;
+}
+
+bool Detached()
+{
+    return g_detached != 0;
+}
+
+// Ends in FreeLibraryAndExitThread when nothing holds the module any more
+static DWORD WINAPI DetachThread(LPVOID)
+{
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    g_hooks.log("=== Detach ===");
+
+    // Off the broker's table first, so no more mode changes are sent here
+    InstanceRegistry::Unregister();
+    MonitorThread::Stop(DETACH_TIMEOUT_MS);
+    if (g_hDetach) { CloseHandle(g_hDetach); g_hDetach = nullptr; }
+    HRESULT hr = g_hooks.releaseWatcher(DETACH_TIMEOUT_MS);
+    g_hooks.releaseShared();
+
+    bool unload = g_hooks.canUnload();
+    QueryPerformanceCounter(&end);
+    g_hooks.log("Detach: done in %.1f ms, 0x%08X (%s)",
+        (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart, hr,
+        unload ? "unloading" : "XAML Diagnostics still holds the site; staying loaded, idle");
+    if (g_hDetached) {
+        SetEvent(g_hDetached);
+        CloseHandle(g_hDetached);
+        g_hDetached = nullptr;
+    }
+    if (!unload) return 0;
+
+    g_hooks.beforeUnload();
+    FreeLibraryAndExitThread(g_hooks.module, 0);
+}
+
+bool Start()
+{
+    if (InterlockedCompareExchange(&g_detached, 1, 0) != 0) return false;
+    HANDLE hThread = CreateThread(nullptr, 0, DetachThread, nullptr, 0, nullptr);
+    if (!hThread) {
+        InterlockedExchange(&g_detached, 0);
+        return false;
+    }
+    CloseHandle(hThread);
+    return true;
+}
+
+HRESULT Request()
+{
+    if (g_detached) return S_FALSE;
+    // The monitor thread runs from SetSite on, which is also when the event appears
+    if (g_hDetach && SetEvent(g_hDetach)) return S_OK;
+    return Start() ? S_OK : (g_detached ? S_FALSE : HRESULT_FROM_WIN32(GetLastError()));
+}
+
+void Close()
+{
+    if (g_hDetach) { CloseHandle(g_hDetach); g_hDetach = nullptr; }
+    if (g_hDetached) { CloseHandle(g_hDetached); g_hDetached = nullptr; }
+}
+
+} // namespace Detach
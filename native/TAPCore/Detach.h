@@ -0,0 +1,63 @@
+// Detach.h -- Unadvise and unload a TAP DLL without restarting its host
+//
+// "<prefix>Detach" (auto-reset) is signaled by tooling or by the DLL's
+// Detach* export; the monitor thread (MonitorThread.h) waits on it and
+// calls Start. The work runs on a thread of its own, because it stops the
+// monitor thread:
+//
+//   1. leaves the instance registry (no more mode changes from TAPBroker)
+//   2. stops the monitor thread, then hooks.releaseWatcher (unadvise, drain
+//      the UI thread, drop the site's interfaces), then hooks.releaseShared
+//      (close the IPC sections and events)
+//   3. sets "<prefix>Detached" (manual-reset)
+//   4. if no COM object of ours is left (hooks.canUnload): hooks.beforeUnload
+//      (ETW and log writers, which cannot be stopped from DllMain), then
+//      FreeLibraryAndExitThread on that same thread, so no other thread is
+//      still running module code when the image goes away
+//
+// Otherwise XAML Diagnostics still holds the site and the DLL stays loaded,
+// idle: SetSite after a detach is ignored (Detached).
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+
+namespace Detach {
+
+static const DWORD DETACH_TIMEOUT_MS = 5000;   // per drain step
+
+struct Hooks {
+    HMODULE module;
+    void (*log)(const char* fmt, ...);
+    HRESULT (*releaseWatcher)(DWORD timeoutMs);
+    void (*releaseShared)();
+    bool (*canUnload)();
+    void (*beforeUnload)();
+};
+
+// DllMain (process attach)
+void Init(const Hooks& hooks);
+
+// prefix: e.g. L"W11ThemeSuite_TaskbarTAP_". Once; SetSite can run again.
+void CreateEvents(const wchar_t* prefix);
+
+// <prefix>Detach, for the monitor thread's wait; null before CreateEvents
+HANDLE Event();
+
+// A detach ran, or is running: stay dormant
+bool Detached();
+
+// Monitor thread, on Event(): starts the detach thread. False if none was
+// started (already detached, or CreateThread failed).
+bool Start();
+
+// The Detach* export. Signals Event(), or starts the detach thread itself
+// before SetSite (no event, no monitor thread yet). S_FALSE if already
+// detached; wait on <prefix>Detached for the end.
+HRESULT Request();
+
+// Process detach
+void Close();
+
+} // namespace Detach
@@ -0,0 +1,82 @@
+// EtwTrace.h -- TraceLogging (ETW) start/stop regions for a TAP DLL
+//
+// The including DLL defines TAP_ETW_PROVIDER as its provider handle
+// (TRACELOGGING_DEFINE_PROVIDER in one of its translation units) before
+// including this header; everything below writes to that provider.
+//
+// Each traced operation is a start/stop pair sharing an activity id, so WPA
+// shows it as a region next to the UI thread's frames. Events carry the
+// fields the call site passes (TargetId first, by convention); stop events
+// carry the HRESULT.
+//
+// With no session listening, a span costs one TraceLoggingProviderEnabled
+// check (a load and compare): no activity id, no event packing.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#ifndef TAP_ETW_PROVIDER
+#error TAP_ETW_PROVIDER (the provider handle) must be defined before TAPCore\EtwTrace.h
+#endif
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>    // WINEVENT_OPCODE_*, WINEVENT_LEVEL_*
+
+TRACELOGGING_DECLARE_PROVIDER(TAP_ETW_PROVIDER);
+
+// Keywords (select with e.g. "W11ThemeSuite.ShellTAP:0x2")
+#define TAP_ETW_KEYWORD_TREE    0x1     // OnVisualTreeChange
+#define TAP_ETW_KEYWORD_APPLY   0x2     // ApplyMode, ApplyToElement, SetElementOpacity
+#define TAP_ETW_KEYWORD_STARTUP 0x4     // IXDE attempts
+
+namespace EtwTrace {
+
+// One flag per DLL: each module has its own copy of these inlines
+inline bool& Registered()
+{
+    static bool registered = false;
+    return registered;
+}
+
+// DllMain (process attach)
+inline void Register()
+{
+    if (!Registered()) Registered() = SUCCEEDED(TraceLoggingRegister(TAP_ETW_PROVIDER));
+}
+
+// Before FreeLibraryAndExitThread, or process detach
+inline void Unregister()
+{
+    if (Registered()) {
+        TraceLoggingUnregister(TAP_ETW_PROVIDER);
+        Registered() = false;
+    }
+}
+
+// One start/stop region; inert unless a session wants `keyword`
+struct Span {
+    GUID id;
+    bool active;
+
+    explicit Span(ULONGLONG keyword)
+        : active(TraceLoggingProviderEnabled(TAP_ETW_PROVIDER, WINEVENT_LEVEL_VERBOSE, keyword) != 0)
+    {
+        if (active) EventActivityIdControl(EVENT_ACTIVITY_CTRL_CREATE_ID, &id);
+    }
+};
+
+} // namespace EtwTrace
+
+// Event names and keywords must be compile-time constants (they are part of
+// the event metadata), hence macros rather than Span methods. `span` is
+// anything with Span's id and active members.
+#define TAP_ETW_START(span, name, keyword, ...) \
+    do { if ((span).active) TraceLoggingWriteActivity(TAP_ETW_PROVIDER, name, &(span).id, nullptr, \
+        TraceLoggingOpcode(WINEVENT_OPCODE_START), TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), \
+        TraceLoggingKeyword(keyword), __VA_ARGS__); } while (0)
+
+#define TAP_ETW_STOP(span, name, keyword, ...) \
+    do { if ((span).active) TraceLoggingWriteActivity(TAP_ETW_PROVIDER, name, &(span).id, nullptr, \
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP), TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE), \
+        TraceLoggingKeyword(keyword), __VA_ARGS__); } while (0)
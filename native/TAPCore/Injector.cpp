@@ -0,0 +1,86 @@
+// Injector.cpp -- CreateRemoteThread(LoadLibraryW) for TAPInject.exe and TAPBroker.exe
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "Injector.h"
+#include <tlhelp32.h>
+#include <cstdio>
+#include <cwchar>
+
+#pragma comment(lib, "user32.lib")
+
+namespace Injector {
+
+static const DWORD LOADLIBRARY_WAIT_MS = 10000;
+
+DWORD FindProcess(const wchar_t* exeName)
+{
+    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snap == INVALID_HANDLE_VALUE) return 0;
+    PROCESSENTRY32W pe = {};
+    pe.dwSize = sizeof(pe);
+    DWORD pid = 0;
+    for (BOOL ok = Process32FirstW(snap, &pe); ok && !pid; ok = Process32NextW(snap, &pe)) {
+        if (_wcsicmp(pe.szExeFile, exeName) == 0) pid = pe.th32ProcessID;
+    }
+    CloseHandle(snap);
+    return pid;
+}
+
+DWORD FindTaskbarProcess()
+{
+    HWND tray = FindWindowW(L"Shell_TrayWnd", nullptr);
+    DWORD pid = 0;
+    if (tray) GetWindowThreadProcessId(tray, &pid);
+    return pid;
+}
+
+HANDLE WriteInitBlock(DWORD pid, const wchar_t* target)
+{
+    wchar_t name[64];
+    swprintf(name, 64, L"W11ThemeSuite_ShellTAP_Init_%lu", pid);
+    HANDLE map = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                    INIT_CHARS * sizeof(wchar_t), name);
+    if (!map) return nullptr;
+    wchar_t* view = (wchar_t*)MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, INIT_CHARS * sizeof(wchar_t));
+    if (!view) { CloseHandle(map); return nullptr; }
+    memset(view, 0, INIT_CHARS * sizeof(wchar_t));
+    wcsncpy(view, target, INIT_CHARS - 1);
+    UnmapViewOfFile(view);
+    return map;
+}
+
+bool InjectDll(DWORD pid, const wchar_t* dllPath)
+{
+    HANDLE process = OpenProcess(PROCESS_CREATE_THREAD | PROCESS_QUERY_INFORMATION |
+                                 PROCESS_VM_OPERATION | PROCESS_VM_WRITE | PROCESS_VM_READ, FALSE, pid);
+    if (!process) {
+        fwprintf(stderr, L"OpenProcess(%lu) failed: %lu (run as Administrator)\n", pid, GetLastError());
+        return false;
+    }
+
+    bool ok = false;
+    SIZE_T bytes = (wcslen(dllPath) + 1) * sizeof(wchar_t);
+    void* remote = VirtualAllocEx(process, nullptr, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (remote && WriteProcessMemory(process, remote, dllPath, bytes, nullptr)) {
+        auto loadLibrary = (LPTHREAD_START_ROUTINE)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "LoadLibraryW");
+        HANDLE thread = CreateRemoteThread(process, nullptr, 0, loadLibrary, remote, 0, nullptr);
+        if (thread) {
+            // Exit code is the low half of the HMODULE: zero means the load failed
+            DWORD module = 0;
+            ok = WaitForSingleObject(thread, LOADLIBRARY_WAIT_MS) == WAIT_OBJECT_0 &&
+                 GetExitCodeThread(thread, &module) && module != 0;
+            if (!ok) fwprintf(stderr, L"LoadLibraryW in %lu failed or timed out\n", pid);
+            CloseHandle(thread);
+        } else {
+            fwprintf(stderr, L"CreateRemoteThread failed: %lu\n", GetLastError());
+        }
+    } else {
+        fwprintf(stderr, L"Writing the DLL path into %lu failed: %lu\n", pid, GetLastError());
+    }
+    if (remote) VirtualFreeEx(process, remote, 0, MEM_RELEASE);
+    CloseHandle(process);
+    return ok;
+}
+
+} // namespace Injector
@@ -0,0 +1,30 @@
+// Injector.h -- CreateRemoteThread(LoadLibraryW) for TAPInject.exe and TAPBroker.exe
+//
+// Stage 1 of a TAP injection: find the host, drop the per-PID init block
+// ShellTAP's DllMain reads its TargetId from, and load the DLL. Compiled
+// into the two tools directly; the DLLs themselves never inject, so this is
+// not part of TAPCore.lib. Failures are reported on stderr.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+
+namespace Injector {
+
+static const DWORD INIT_CHARS = 64;                  // DllMain reads 64 wchar_t
+
+// First process with that image name (e.g. L"StartMenuExperienceHost.exe"); 0 if none
+DWORD FindProcess(const wchar_t* exeName);
+
+// The explorer.exe that owns the primary taskbar; 0 if there is none yet
+DWORD FindTaskbarProcess();
+
+// "W11ThemeSuite_ShellTAP_Init_<pid>" holding the TargetId. Keep the handle
+// open until InjectDll has returned: DllMain opens the block by name.
+HANDLE WriteInitBlock(DWORD pid, const wchar_t* target);
+
+// Loads dllPath into pid and waits for LoadLibraryW to return
+bool InjectDll(DWORD pid, const wchar_t* dllPath);
+
+} // namespace Injector
@@ -0,0 +1,80 @@
+// InstanceRegistry.cpp -- Which TAP DLLs are live, for TAPBroker.exe
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "InstanceRegistry.h"
+#include <cwchar>
+
+namespace InstanceRegistry {
+
+static HANDLE g_hMap = nullptr;
+static TAPRegistry* g_registry = nullptr;
+static TAPRegistrySlot* g_slot = nullptr;
+static HANDLE g_hAck = nullptr;
+static HANDLE g_hChanged = nullptr;
+
+static void SignalChanged()
+{
+    if (g_hChanged) SetEvent(g_hChanged);
+}
+
+bool Register(const wchar_t* targetId, const wchar_t* prefix, int modeCount)
+{
+    if (g_slot) return true;
+
+    if (!g_registry) {
+        g_hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                    sizeof(TAPRegistry), TAP_REGISTRY_NAME);
+        if (!g_hMap) return false;
+        g_registry = (TAPRegistry*)MapViewOfFile(g_hMap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TAPRegistry));
+        if (!g_registry) { CloseHandle(g_hMap); g_hMap = nullptr; return false; }
+
+        // Whoever maps it first initializes it; the values are fixed
+        g_registry->slotCount = TAP_REGISTRY_SLOTS;
+        InterlockedCompareExchange(&g_registry->version, (LONG)TAP_REGISTRY_VERSION, 0);
+    }
+    if (g_registry->version != (LONG)TAP_REGISTRY_VERSION) return false;
+    if (!g_hChanged) g_hChanged = CreateEventW(nullptr, FALSE, FALSE, TAP_REGISTRY_EVENT_NAME);
+
+    if (!g_hAck) {
+        wchar_t name[160];
+        wsprintfW(name, L"%sModeAck", prefix);
+        g_hAck = CreateEventW(nullptr, FALSE, FALSE, name);
+    }
+
+    for (uint32_t i = 0; i < TAP_REGISTRY_SLOTS; i++) {
+        TAPRegistrySlot* slot = &g_registry->slots[i];
+        if (InterlockedCompareExchange(&slot->pid, -1, 0) != 0) continue;
+
+        slot->modeCount = modeCount;
+        slot->appliedMode = -1;
+        slot->acks = 0;
+        wcsncpy_s(slot->targetId, targetId, _TRUNCATE);
+        wcsncpy_s(slot->prefix, prefix, _TRUNCATE);
+        InterlockedExchange(&slot->pid, (LONG)GetCurrentProcessId());
+        g_slot = slot;
+        SignalChanged();
+        return true;
+    }
+    return false;
+}
+
+void Unregister()
+{
+    if (g_slot) { InterlockedExchange(&g_slot->pid, 0); g_slot = nullptr; SignalChanged(); }
+    if (g_registry) { UnmapViewOfFile(g_registry); g_registry = nullptr; }
+    if (g_hMap) { CloseHandle(g_hMap); g_hMap = nullptr; }
+    if (g_hAck) { CloseHandle(g_hAck); g_hAck = nullptr; }
+    if (g_hChanged) { CloseHandle(g_hChanged); g_hChanged = nullptr; }
+}
+
+void AckMode(int mode)
+{
+    if (!g_slot) return;
+    InterlockedExchange(&g_slot->appliedMode, mode);
+    InterlockedIncrement(&g_slot->acks);
+    if (g_hAck) SetEvent(g_hAck);
+    SignalChanged();
+}
+
+} // namespace InstanceRegistry
@@ -0,0 +1,61 @@
+// InstanceRegistry.h -- Which TAP DLLs are live, for TAPBroker.exe
+//
+// "W11ThemeSuite_TAP_Registry" holds one slot per connected DLL instance
+// (ShellTAP per TargetId, TaskbarTAP). A DLL claims a slot from SetSite and
+// frees it on detach; the broker enumerates the slots instead of being told
+// about every injection, and drives each instance through the objects its
+// prefix names:
+//
+//   <prefix>Mode        int, written by the broker (or PowerShell)
+//   <prefix>ModeEvent   auto-reset, signaled after a Mode write
+//   <prefix>ModeAck     auto-reset, signaled by the DLL once a mode is in
+//                       place (slot.appliedMode / slot.acks updated first)
+//   <prefix>Counters    ShellTAPCounters (ShellTAP only)
+//
+// Slot claim: pid 0 -> -1 (interlocked), fill in, then pid = owner. Readers
+// skip slots whose pid is not positive. A slot left by a crashed host is
+// reclaimed by the broker once the pid no longer runs.
+//
+// "W11ThemeSuite_TAP_RegistryChanged" (auto-reset) is signaled after every
+// Register, Unregister and AckMode, so the broker's supervisor follows the
+// table without polling it.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <cstdint>
+
+static const wchar_t TAP_REGISTRY_NAME[] = L"W11ThemeSuite_TAP_Registry";
+static const wchar_t TAP_REGISTRY_EVENT_NAME[] = L"W11ThemeSuite_TAP_RegistryChanged";
+static const uint32_t TAP_REGISTRY_VERSION = 1;
+static const uint32_t TAP_REGISTRY_SLOTS = 32;
+
+#pragma pack(push, 8)
+struct TAPRegistrySlot {
+    volatile LONG pid;          // owner; 0 = free, -1 = being claimed
+    int32_t  modeCount;         // the DLL accepts modes 0..modeCount-1
+    volatile LONG appliedMode;  // last mode in place; -1 = none yet
+    volatile LONG acks;         // bumped before each ModeAck signal
+    wchar_t  targetId[64];      // display name, e.g. "StartMenu", "TaskbarTAP"
+    wchar_t  prefix[96];        // object name prefix, e.g. "W11ThemeSuite_ShellTAP_StartMenu_"
+};
+
+struct TAPRegistry {
+    volatile LONG version;      // TAP_REGISTRY_VERSION once initialized
+    uint32_t slotCount;         // TAP_REGISTRY_SLOTS
+    TAPRegistrySlot slots[TAP_REGISTRY_SLOTS];
+};
+#pragma pack(pop)
+
+namespace InstanceRegistry {
+
+// DLL side. Register is idempotent (SetSite can run more than once) and
+// creates <prefix>ModeAck; false if the registry or every slot is taken.
+bool Register(const wchar_t* targetId, const wchar_t* prefix, int modeCount);
+void Unregister();
+
+// The mode is in place (applied, or already current): publish and signal
+void AckMode(int mode);
+
+} // namespace InstanceRegistry
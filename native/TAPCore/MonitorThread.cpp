@@ -0,0 +1,89 @@
+// MonitorThread.cpp -- The TAP DLL's IPC wait loop
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "MonitorThread.h"
+#include "Detach.h"
+
+namespace MonitorThread {
+
+static const DWORD POLL_MS = 250;
+
+static HANDLE g_hStop = nullptr;       // manual-reset
+static HANDLE g_hThread = nullptr;
+
+// Slot 0 is the stop event; the rest are filled by Start
+static HANDLE g_waits[3 + MAX_EXTRA];
+static void (*g_handlers[3 + MAX_EXTRA])();
+static DWORD g_count = 0;
+static int g_detachSlot = -1;
+static bool g_polling = false;
+static void (*g_onMode)() = nullptr;
+
+static DWORD WINAPI ThreadProc(LPVOID)
+{
+    for (;;) {
+        DWORD wait = WaitForMultipleObjects(g_count, g_waits, FALSE, g_polling ? POLL_MS : INFINITE);
+        if (wait == WAIT_OBJECT_0 || wait == WAIT_FAILED) break;
+
+        if (wait == WAIT_TIMEOUT) {
+            g_onMode();
+            continue;
+        }
+        int slot = (int)(wait - WAIT_OBJECT_0);
+        if (slot == g_detachSlot) {
+            if (Detach::Start()) break;     // it stops this thread
+            continue;
+        }
+        g_handlers[slot]();
+    }
+    return 0;
+}
+
+void Start(HANDLE modeEvent, void (*onMode)(), const Wait* extra, int extraCount)
+{
+    if (g_hThread) return;
+    if (!g_hStop) g_hStop = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!g_hStop) return;
+    ResetEvent(g_hStop);
+
+    g_count = 0;
+    g_waits[g_count] = g_hStop;
+    g_handlers[g_count++] = nullptr;
+    g_onMode = onMode;
+    g_polling = (modeEvent == nullptr);
+    if (modeEvent) {
+        g_waits[g_count] = modeEvent;
+        g_handlers[g_count++] = onMode;
+    }
+    for (int i = 0; i < extraCount && i < MAX_EXTRA; i++) {
+        if (!extra[i].event) continue;
+        g_waits[g_count] = extra[i].event;
+        g_handlers[g_count++] = extra[i].handler;
+    }
+    g_detachSlot = -1;
+    if (Detach::Event()) {
+        g_detachSlot = (int)g_count;
+        g_waits[g_count] = Detach::Event();
+        g_handlers[g_count++] = nullptr;
+    }
+
+    g_hThread = CreateThread(nullptr, 0, ThreadProc, nullptr, 0, nullptr);
+}
+
+void Stop(DWORD timeoutMs)
+{
+    if (g_hStop) SetEvent(g_hStop);
+    if (g_hThread) {
+        WaitForSingleObject(g_hThread, timeoutMs);
+        CloseHandle(g_hThread);
+        g_hThread = nullptr;
+    }
+}
+
+void Close()
+{
+    if (g_hStop) { CloseHandle(g_hStop); g_hStop = nullptr; }
+}
+
+} // namespace MonitorThread
@@ -0,0 +1,36 @@
+// MonitorThread.h -- The TAP DLL's IPC wait loop
+//
+// One thread per DLL, started from SetSite, blocks on a manual-reset stop
+// event, the mode-change event, the DLL's own extra events and
+// "<prefix>Detach" (Detach::Event). No timeout while the mode event exists:
+// an idle process sees zero wakeups from this thread. Without a mode event
+// it falls back to polling onMode every 250 ms.
+//
+// On the detach event it starts the detach thread (Detach::Start), which
+// stops this one.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+
+namespace MonitorThread {
+
+static const int MAX_EXTRA = 4;
+
+struct Wait {
+    HANDLE event;       // skipped when null
+    void (*handler)();
+};
+
+// SetSite. Handles are taken as they are now; a second call while the thread
+// runs is a no-op. onMode also runs on a poll timeout (modeEvent null).
+void Start(HANDLE modeEvent, void (*onMode)(), const Wait* extra = nullptr, int extraCount = 0);
+
+// Detach and process detach. Waits up to timeoutMs for the thread to leave.
+void Stop(DWORD timeoutMs);
+
+// With the DLL's other IPC handles, once the thread is stopped
+void Close();
+
+} // namespace MonitorThread
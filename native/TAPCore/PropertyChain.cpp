@@ -0,0 +1,170 @@
+// PropertyChain.cpp -- GetPropertyValuesChain helpers for the diagnostics
+// fallback path
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "PropertyChain.h"
+#include <oleauto.h>    // SysAllocString, SysFreeString
+#include <climits>
+#include <cstring>
+#include <cwchar>
+
+#pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "oleaut32.lib")
+
+namespace PropertyChain {
+
+// Every BSTR field of both arrays, then the arrays themselves
+static void FreeChain(unsigned int srcCount, PropertyChainSource* pSources,
+                      unsigned int propCount, PropertyChainValue* pValues)
+{
+    for (unsigned int p = 0; p < propCount; p++) {
+        if (pValues[p].PropertyName) SysFreeString(pValues[p].PropertyName);
+        if (pValues[p].Value) SysFreeString(pValues[p].Value);
+        if (pValues[p].Type) SysFreeString(pValues[p].Type);
+        if (pValues[p].DeclaringType) SysFreeString(pValues[p].DeclaringType);
+        if (pValues[p].ValueType) SysFreeString(pValues[p].ValueType);
+        if (pValues[p].ItemType) SysFreeString(pValues[p].ItemType);
+    }
+    CoTaskMemFree(pValues);
+    for (unsigned int s = 0; s < srcCount; s++) {
+        if (pSources[s].Name) SysFreeString(pSources[s].Name);
+        if (pSources[s].TargetType) SysFreeString(pSources[s].TargetType);
+    }
+    CoTaskMemFree(pSources);
+}
+
+bool FindIndices(IVisualTreeService* service, InstanceHandle handle,
+                 unsigned int* fill, unsigned int* opacity)
+{
+    unsigned int propCount = 0;
+    PropertyChainSource* pSources = nullptr;
+    unsigned int srcCount = 0;
+    PropertyChainValue* pValues = nullptr;
+
+    HRESULT hr = service->GetPropertyValuesChain(handle, &srcCount, &pSources, &propCount, &pValues);
+    if (FAILED(hr)) return false;
+
+    *fill = UINT_MAX;
+    *opacity = UINT_MAX;
+    for (unsigned int p = 0; p < propCount; p++) {
+        if (!pValues[p].PropertyName) continue;
+        if (wcscmp(pValues[p].PropertyName, L"Fill") == 0) {
+            *fill = pValues[p].Index;
+        }
+        else if (wcscmp(pValues[p].PropertyName, L"Opacity") == 0) {
+            *opacity = pValues[p].Index;
+        }
+    }
+
+    FreeChain(srcCount, pSources, propCount, pValues);
+    return true;
+}
+
+HRESULT SetFromString(IVisualTreeService* service, InstanceHandle handle, unsigned int index,
+                      const wchar_t* type, const wchar_t* value)
+{
+    InstanceHandle hValue = 0;
+    BSTR bstrType = SysAllocString(type);
+    BSTR bstrVal = SysAllocString(value);
+    HRESULT hr = service->CreateInstance(bstrType, bstrVal, &hValue);
+    SysFreeString(bstrType);
+    SysFreeString(bstrVal);
+    if (FAILED(hr)) return hr;
+    return service->SetProperty(handle, hValue, index);
+}
+
+HRESULT ValuePool::Get(IVisualTreeService* service, const wchar_t* type, const wchar_t* value,
+                       InstanceHandle* out)
+{
+    std::wstring key(type);
+    key += L'\x1F';
+    key += value;
+
+    *out = 0;
+    AcquireSRWLockShared(&m_lock);
+    for (const auto& entry : m_values) {
+        if (entry.first == key) { *out = entry.second; break; }
+    }
+    ReleaseSRWLockShared(&m_lock);
+    if (*out) return S_OK;
+
+    // Created outside the lock; a racing thread's duplicate is dropped below
+    InstanceHandle hValue = 0;
+    BSTR bstrType = SysAllocString(type);
+    BSTR bstrVal = SysAllocString(value);
+    HRESULT hr = service->CreateInstance(bstrType, bstrVal, &hValue);
+    SysFreeString(bstrType);
+    SysFreeString(bstrVal);
+    if (FAILED(hr)) return hr;
+
+    AcquireSRWLockExclusive(&m_lock);
+    InstanceHandle existing = 0;
+    for (const auto& entry : m_values) {
+        if (entry.first == key) { existing = entry.second; break; }
+    }
+    if (!existing) m_values.emplace_back(std::move(key), hValue);
+    ReleaseSRWLockExclusive(&m_lock);
+    *out = existing ? existing : hValue;
+    return existing ? S_OK : S_FALSE;
+}
+
+HRESULT ValuePool::GetDouble(IVisualTreeService* service, double value, InstanceHandle* out)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    *out = 0;
+    AcquireSRWLockShared(&m_lock);
+    for (const auto& entry : m_doubles) {
+        if (entry.first == bits) { *out = entry.second; break; }
+    }
+    ReleaseSRWLockShared(&m_lock);
+    if (*out) return S_OK;
+
+    HRESULT hr = Get(service, L"Double", std::to_wstring(value).c_str(), out);
+    if (FAILED(hr)) return hr;
+
+    AcquireSRWLockExclusive(&m_lock);
+    bool known = false;
+    for (const auto& entry : m_doubles) known = known || entry.first == bits;
+    if (!known) m_doubles.emplace_back(bits, *out);
+    ReleaseSRWLockExclusive(&m_lock);
+    return hr;
+}
+
+size_t ValuePool::Size()
+{
+    AcquireSRWLockShared(&m_lock);
+    size_t n = m_values.size();
+    ReleaseSRWLockShared(&m_lock);
+    return n;
+}
+
+size_t ValuePool::MemoryBytes()
+{
+    AcquireSRWLockShared(&m_lock);
+    size_t bytes = m_values.capacity() * sizeof(m_values[0]) + m_doubles.capacity() * sizeof(m_doubles[0]);
+    for (const auto& entry : m_values) bytes += entry.first.capacity() * sizeof(wchar_t);
+    ReleaseSRWLockShared(&m_lock);
+    return bytes;
+}
+
+void ValuePool::Clear()
+{
+    AcquireSRWLockExclusive(&m_lock);
+    m_values.clear();
+    m_doubles.clear();
+    ReleaseSRWLockExclusive(&m_lock);
+}
+
+HRESULT SetPooled(IVisualTreeService* service, ValuePool& pool, InstanceHandle handle,
+                  unsigned int index, const wchar_t* type, const wchar_t* value)
+{
+    InstanceHandle hValue = 0;
+    HRESULT hr = pool.Get(service, type, value, &hValue);
+    if (FAILED(hr)) return hr;
+    return service->SetProperty(handle, hValue, index);
+}
+
+} // namespace PropertyChain
@@ -0,0 +1,62 @@
+// PropertyChain.h -- GetPropertyValuesChain helpers for the diagnostics
+// fallback path (SetProperty by chain index)
+//
+// Indices are stable per XAML type, so callers resolve them once and cache
+// them; FindIndices does the walk and frees the chain.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <xamlOM.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace PropertyChain {
+
+// Chain indices of Fill and Opacity on `handle` (UINT_MAX = no such
+// property). False if the chain could not be read.
+bool FindIndices(IVisualTreeService* service, InstanceHandle handle,
+                 unsigned int* fill, unsigned int* opacity);
+
+// CreateInstance(type, value) + SetProperty(index). Creates a new value
+// instance per call: for hot paths, pool the instance instead.
+HRESULT SetFromString(IVisualTreeService* service, InstanceHandle handle, unsigned int index,
+                      const wchar_t* type, const wchar_t* value);
+
+// CreateInstance registers the value in the diagnostics handle table for as
+// long as the connection lives (there is no per-handle release), so values
+// that recur are created once and their handles reused. Meant for a handful
+// of values (linear lookup); any thread.
+class ValuePool {
+public:
+    ValuePool() { InitializeSRWLock(&m_lock); }
+    ValuePool(const ValuePool&) = delete;
+    ValuePool& operator=(const ValuePool&) = delete;
+
+    // S_FALSE: the value was created by this call
+    HRESULT Get(IVisualTreeService* service, const wchar_t* type, const wchar_t* value, InstanceHandle* out);
+
+    // Get(L"Double", std::to_wstring(value)), keyed by bit pattern so hits
+    // skip the formatting
+    HRESULT GetDouble(IVisualTreeService* service, double value, InstanceHandle* out);
+
+    // Handles created so far (all still held by the diagnostics table)
+    size_t Size();
+    size_t MemoryBytes();
+
+    // Forgets the handles, e.g. when the connection goes away
+    void Clear();
+
+private:
+    SRWLOCK m_lock;
+    std::vector<std::pair<std::wstring, InstanceHandle>> m_values;    // "type\x1Fvalue"
+    std::vector<std::pair<unsigned long long, InstanceHandle>> m_doubles;
+};
+
+// SetFromString with the value instance taken from `pool`
+HRESULT SetPooled(IVisualTreeService* service, ValuePool& pool, InstanceHandle handle,
+                  unsigned int index, const wchar_t* type, const wchar_t* value);
+
+} // namespace PropertyChain
@@ -0,0 +1,43 @@
+// StartupEvents.cpp -- Handshake events between a TAP DLL and TAPInject.exe
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "StartupEvents.h"
+
+namespace StartupEvents {
+
+static HANDLE g_hReady = nullptr;
+static HANDLE g_hApplied = nullptr;
+
+static HANDLE CreateReset(const wchar_t* prefix, const wchar_t* suffix)
+{
+    wchar_t name[160];
+    wsprintfW(name, L"%s%s", prefix, suffix);
+    HANDLE event = CreateEventW(nullptr, TRUE, FALSE, name);
+    if (event) ResetEvent(event);   // left over from an earlier instance
+    return event;
+}
+
+void Create(const wchar_t* prefix)
+{
+    if (!g_hReady) g_hReady = CreateReset(prefix, L"Ready");
+    if (!g_hApplied) g_hApplied = CreateReset(prefix, L"Applied");
+}
+
+void Close()
+{
+    if (g_hReady) { CloseHandle(g_hReady); g_hReady = nullptr; }
+    if (g_hApplied) { CloseHandle(g_hApplied); g_hApplied = nullptr; }
+}
+
+void SignalReady()
+{
+    if (g_hReady) SetEvent(g_hReady);
+}
+
+void SignalApplied()
+{
+    if (g_hApplied) SetEvent(g_hApplied);
+}
+
+} // namespace StartupEvents
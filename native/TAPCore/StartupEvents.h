@@ -0,0 +1,23 @@
+// StartupEvents.h -- Handshake events between a TAP DLL and TAPInject.exe
+//
+// "<prefix>Ready" and "<prefix>Applied", both manual-reset and created by
+// the DLL in DllMain (so the host's integrity level and DACL never stop it
+// from opening them). Ready is set once SetSite has connected, Applied on
+// the first successful apply; the injector waits on them instead of
+// polling for shared memory.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+
+namespace StartupEvents {
+
+// prefix: e.g. L"W11ThemeSuite_ShellTAP_StartMenu_". Both events start reset.
+void Create(const wchar_t* prefix);
+void Close();
+
+void SignalReady();
+void SignalApplied();
+
+} // namespace StartupEvents
@@ -0,0 +1,74 @@
+// TargetPolicy.h -- Compile-time target policies for WatcherBase
+//
+// A policy tells the shared watcher which elements a DLL cares about and
+// how it styles them. Two kinds:
+//
+//   Fixed (kConfigDriven = false): the target list is a constexpr table of
+//   FixedTarget entries, so matching is a few inlined string compares and
+//   the DLL carries no config parser. It also supplies the per-mode opacity
+//   table and the TreeScope hook wrapped around every tree callback:
+//
+//     struct MyPolicy {
+//         static constexpr bool kConfigDriven = false;
+//         static constexpr const wchar_t* kDispatchClass = L"...";
+//         static constexpr FixedTarget kTargets[] = { ... };
+//         static constexpr double Opacity(int mode, TargetRole role);
+//         struct TreeScope { TreeScope(InstanceHandle, VisualMutationType); };
+//     };
+//
+//   Config-driven (kConfigDriven = true): targets arrive at run time (e.g.
+//   ShellTAP's TargetMatcher + TreeIndex) and the derived watcher handles
+//   every callback and its own apply pipeline; only kDispatchClass is
+//   required.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <cstddef>
+
+namespace TAPCore {
+
+// What a matched element is to the policy
+enum TargetRole : int {
+    ROLE_NONE   = -1,
+    ROLE_FILL   = 0,    // styled: fill + opacity
+    ROLE_STROKE = 1,    // styled: opacity only
+    ROLE_ANCHOR = 2,    // tracked for grouping, never styled
+};
+
+struct FixedTarget {
+    const wchar_t* name;    // exact x:Name; nullptr = any
+    const wchar_t* type;    // substring of the runtime type name
+    TargetRole role;
+};
+
+constexpr bool StrEqual(const wchar_t* a, const wchar_t* b)
+{
+    while (*a && *a == *b) { ++a; ++b; }
+    return *a == *b;
+}
+
+constexpr bool StrContains(const wchar_t* haystack, const wchar_t* needle)
+{
+    for (; *haystack; ++haystack) {
+        const wchar_t* h = haystack;
+        const wchar_t* n = needle;
+        while (*n && *h == *n) { ++h; ++n; }
+        if (!*n) return true;
+    }
+    return !*needle;
+}
+
+// First entry whose name and type match; ROLE_NONE if none does
+template <size_t N>
+constexpr TargetRole MatchFixed(const FixedTarget (&targets)[N], const wchar_t* name, const wchar_t* type)
+{
+    for (size_t i = 0; i < N; i++) {
+        const FixedTarget& t = targets[i];
+        if (t.name && (!name || !StrEqual(t.name, name))) continue;
+        if (type && StrContains(type, t.type)) return t.role;
+    }
+    return ROLE_NONE;
+}
+
+} // namespace TAPCore
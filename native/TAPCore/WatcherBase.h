@@ -0,0 +1,301 @@
+// WatcherBase.h -- Shared IVisualTreeServiceCallback2 core, templated on a
+// target policy (TargetPolicy.h)
+//
+// Owns what every TAP watcher needs: COM identity, the diagnostics
+// interfaces, and the message-only dispatch window on the XAML UI thread
+// that cross-thread work is posted to. Derived (CRTP) supplies:
+//
+//   void OnDispatch(UINT msg);          // WM_APP + n posted via PostDispatch
+//                                       // (or PostIdleDispatch / PostDelayedDispatch)
+//   void OnDispatchClosed();            // window destroyed (UI thread)
+//
+// and, depending on the policy:
+//
+//   fixed:          void OnTargetAdded(const VisualElement&, TargetRole);
+//                   void OnElementRemoved(InstanceHandle);
+//   config-driven:  HRESULT OnTreeChange(ParentChildRelation, VisualElement,
+//                                        VisualMutationType);
+//
+// Fixed policies also get ApplyFixedStyle: the direct ABI setters
+// (XamlDirect) with the diagnostics SetProperty path as the fallback.
+//
+// Config-driven watchers share less: the setters (XamlDirect), the chain
+// index lookup (PropertyChain) and the value pool (m_values), but not the
+// apply pipeline itself. Per-mode styles, brushes, transitions and the
+// time-sliced scheduler are ShellTAP's and stay in ShellTAP.
+//
+// Each DLL defines g_hModule (window class owner) and g_refCount.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <xamlOM.h>
+#include <climits>
+#include <string>
+#include "ComServer.h"
+#include "PropertyChain.h"
+#include "StartupEvents.h"
+#include "TargetPolicy.h"
+#include "XamlDirect.h"
+
+extern HMODULE g_hModule;
+
+namespace TAPCore {
+
+template <class Derived, class Policy>
+class WatcherBase : public IVisualTreeServiceCallback2 {
+public:
+    WatcherBase(IXamlDiagnostics* pDiag, IVisualTreeService3* pService)
+        : m_pDiag(pDiag), m_pService(pService), m_refCount(1), m_hDispatch(nullptr)
+    {
+        g_refCount++;
+        if (m_pDiag) m_pDiag->AddRef();
+        if (m_pService) m_pService->AddRef();
+    }
+
+    virtual ~WatcherBase()
+    {
+        if (m_pDiag) m_pDiag->Release();
+        if (m_pService) m_pService->Release();
+        g_refCount--;
+    }
+
+    // IUnknown
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override
+    {
+        if (riid == IID_IUnknown ||
+            riid == __uuidof(IVisualTreeServiceCallback) ||
+            riid == __uuidof(IVisualTreeServiceCallback2)) {
+            *ppv = static_cast<IVisualTreeServiceCallback2*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    ULONG STDMETHODCALLTYPE AddRef() override { return InterlockedIncrement(&m_refCount); }
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        long ref = InterlockedDecrement(&m_refCount);
+        if (ref == 0) delete this;
+        return ref;
+    }
+
+    // IVisualTreeServiceCallback
+    HRESULT STDMETHODCALLTYPE OnVisualTreeChange(
+        ParentChildRelation relation,
+        VisualElement element,
+        VisualMutationType mutationType) override
+    {
+        if constexpr (Policy::kConfigDriven) {
+            return Self()->OnTreeChange(relation, element, mutationType);
+        } else {
+            typename Policy::TreeScope scope(element.Handle, mutationType);
+            EnsureDispatchWindow();  // first callback: we are on the UI thread
+
+            if (mutationType == Add) {
+                TargetRole role = (element.Name && element.Type)
+                    ? MatchFixed(Policy::kTargets, element.Name, element.Type) : ROLE_NONE;
+                if (role != ROLE_NONE) Self()->OnTargetAdded(element, role);
+            } else if (mutationType == Remove) {
+                Self()->OnElementRemoved(element.Handle);
+            }
+            return S_OK;
+        }
+    }
+
+    // IVisualTreeServiceCallback2 (override to react to state changes)
+    HRESULT STDMETHODCALLTYPE OnElementStateChanged(
+        InstanceHandle /*element*/,
+        VisualElementState /*elementState*/,
+        LPCWSTR /*context*/) override
+    {
+        return S_OK;
+    }
+
+    // Tear down the UI-thread dispatch window (safe from any thread)
+    void ShutdownDispatch()
+    {
+        if (m_hDispatch) PostMessageW(m_hDispatch, WM_CLOSE, 0, 0);
+    }
+
+    // Same, but waits until the window is gone, so whatever OnDispatchClosed
+    // releases is released on return (runs inline on the UI thread itself).
+    // False if the UI thread did not get to it within timeoutMs.
+    bool CloseDispatch(DWORD timeoutMs)
+    {
+        HWND hwnd = m_hDispatch;
+        if (!hwnd) return true;
+        DWORD_PTR result = 0;
+        if (!SendMessageTimeoutW(hwnd, WM_CLOSE, 0, 0, SMTO_NORMAL | SMTO_ABORTIFHUNG, timeoutMs, &result)) {
+            return false;
+        }
+        return m_hDispatch == nullptr;
+    }
+
+protected:
+    // Created lazily from a tree callback so it belongs to the XAML UI
+    // thread; its messages are dispatched by that thread's own message loop.
+    // The window holds a reference on the watcher until it is destroyed.
+    bool EnsureDispatchWindow()
+    {
+        if (m_hDispatch) return true;
+
+        ATOM& s_atom = DispatchAtom();
+        if (!s_atom) {
+            WNDCLASSEXW wc = {};
+            wc.cbSize = sizeof(wc);
+            wc.lpfnWndProc = DispatchWndProc;
+            wc.hInstance = g_hModule;
+            wc.lpszClassName = Policy::kDispatchClass;
+            s_atom = RegisterClassExW(&wc);
+            if (!s_atom) return false;
+        }
+
+        m_hDispatch = CreateWindowExW(0, Policy::kDispatchClass, nullptr, 0, 0, 0, 0, 0,
+                                      HWND_MESSAGE, nullptr, g_hModule, nullptr);
+        if (!m_hDispatch) return false;
+
+        AddRef();
+        SetWindowLongPtrW(m_hDispatch, GWLP_USERDATA, (LONG_PTR)this);
+        return true;
+    }
+
+    HWND DispatchWindow() const { return m_hDispatch; }
+
+    // The calling thread owns the dispatch window (false without one)
+    bool OnDispatchThread() const
+    {
+        HWND hwnd = m_hDispatch;
+        return hwnd && GetWindowThreadProcessId(hwnd, nullptr) == GetCurrentThreadId();
+    }
+
+public:
+    // Before the module unloads with the process still running (no window of
+    // the class may be left); the next EnsureDispatchWindow registers anew
+    static void UnregisterDispatchClass()
+    {
+        ATOM& s_atom = DispatchAtom();
+        if (s_atom && UnregisterClassW(Policy::kDispatchClass, g_hModule)) s_atom = 0;
+    }
+
+protected:
+
+    // Any thread. False if there is no window yet or the post failed; the
+    // caller then does the work inline.
+    bool PostDispatch(UINT msg)
+    {
+        HWND hwnd = m_hDispatch;
+        return hwnd && PostMessageW(hwnd, msg, 0, 0);
+    }
+
+    // UI thread. Like PostDispatch, but never ahead of input or paint: while
+    // either is waiting, msg comes from a one-shot timer instead, and
+    // WM_TIMER is only generated once those have been handled.
+    bool PostIdleDispatch(UINT msg)
+    {
+        HWND hwnd = m_hDispatch;
+        if (!hwnd) return false;
+        if (HIWORD(GetQueueStatus(QS_INPUT | QS_PAINT)) == 0) return PostMessageW(hwnd, msg, 0, 0) != FALSE;
+        return SetTimer(hwnd, msg, USER_TIMER_MINIMUM, nullptr) != 0;
+    }
+
+    // UI thread. msg once, after at least delayMs (re-arming replaces the
+    // pending one)
+    bool PostDelayedDispatch(UINT msg, UINT delayMs)
+    {
+        HWND hwnd = m_hDispatch;
+        return hwnd && SetTimer(hwnd, msg, delayMs, nullptr) != 0;
+    }
+
+    // Fixed policies: Policy::Opacity(mode, role) via IUIElement::put_Opacity
+    // (plus a transparent fill below 1.0), falling back to GetPropertyValuesChain
+    // + SetProperty when the direct setters refuse (e.g. off the UI thread).
+    // The fallback's value instances are pooled per watcher.
+    HRESULT ApplyFixedStyle(InstanceHandle handle, int mode, TargetRole role)
+    {
+        static_assert(!Policy::kConfigDriven, "config-driven watchers style elements themselves");
+        double opacity = Policy::Opacity(mode, role);
+
+        IInspectable* obj = nullptr;
+        HRESULT hr = m_pDiag->GetIInspectableFromHandle(handle, &obj);
+        if (FAILED(hr) || !obj) return FAILED(hr) ? hr : E_POINTER;
+
+        hr = XamlDirect::SetOpacity(obj, opacity);
+        if (SUCCEEDED(hr) && opacity < 1.0) hr = XamlDirect::SetTransparentFill(obj);
+        obj->Release();
+        if (FAILED(hr)) hr = SetFixedStyleByIndex(handle, opacity);
+        if (SUCCEEDED(hr)) StartupEvents::SignalApplied();
+        return hr;
+    }
+
+    IXamlDiagnostics* m_pDiag;
+    IVisualTreeService3* m_pService;
+
+    // Value instances for the SetProperty fallback, both kinds of policy
+    // (config-driven watchers pool their style values here too)
+    PropertyChain::ValuePool m_values;
+
+private:
+    Derived* Self() { return static_cast<Derived*>(this); }
+
+    static ATOM& DispatchAtom()
+    {
+        static ATOM s_atom = 0;
+        return s_atom;
+    }
+
+    HRESULT SetFixedStyleByIndex(InstanceHandle handle, double opacity)
+    {
+        unsigned int fillIndex = UINT_MAX, opacityIndex = UINT_MAX;
+        if (!m_pService || !PropertyChain::FindIndices(m_pService, handle, &fillIndex, &opacityIndex)) {
+            return E_FAIL;
+        }
+
+        HRESULT hr = E_NOTIMPL;
+        if (opacityIndex != UINT_MAX) {
+            InstanceHandle hValue = 0;
+            hr = m_values.GetDouble(m_pService, opacity, &hValue);
+            if (SUCCEEDED(hr)) hr = m_pService->SetProperty(handle, hValue, opacityIndex);
+        }
+        if (fillIndex != UINT_MAX && opacity < 1.0) {
+            HRESULT fillHr = PropertyChain::SetPooled(m_pService, m_values, handle, fillIndex,
+                L"Windows.UI.Xaml.Media.SolidColorBrush", L"Transparent");
+            if (FAILED(hr)) hr = fillHr;
+        }
+        return hr;
+    }
+
+    static LRESULT CALLBACK DispatchWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+    {
+        auto* self = (WatcherBase*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+        if (msg >= WM_APP && msg <= 0xBFFF) {
+            if (self) self->Self()->OnDispatch(msg);
+            return 0;
+        }
+        switch (msg) {
+            case WM_TIMER:
+                KillTimer(hwnd, wParam);            // PostIdleDispatch / PostDelayedDispatch: id = msg
+                if (self && wParam >= WM_APP && wParam <= 0xBFFF) self->Self()->OnDispatch((UINT)wParam);
+                return 0;
+            case WM_CLOSE:
+                DestroyWindow(hwnd);
+                return 0;
+            case WM_DESTROY:
+                if (self) {
+                    SetWindowLongPtrW(hwnd, GWLP_USERDATA, 0);
+                    self->m_hDispatch = nullptr;
+                    self->Self()->OnDispatchClosed();
+                    self->Release();
+                }
+                return 0;
+        }
+        return DefWindowProcW(hwnd, msg, wParam, lParam);
+    }
+
+    long m_refCount;
+    HWND m_hDispatch;
+};
+
+} // namespace TAPCore
@@ -0,0 +1,203 @@
+// XamlBootstrap.cpp -- Stage 2 of the injection, shared by ShellTAP and TaskbarTAP
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "XamlBootstrap.h"
+
+namespace XamlBootstrap {
+
+typedef HRESULT(WINAPI* PFN_InitializeXamlDiagnosticsEx)(
+    LPCWSTR endPointName,
+    DWORD pid,
+    LPCWSTR wszDllXamlDiagnostics,
+    LPCWSTR wszTAPDllName,
+    CLSID tapClsid,
+    LPCWSTR wszInitializationData
+);
+
+static LogFn g_log = nullptr;
+
+#define CoreLog(...) do { if (g_log) g_log(__VA_ARGS__); } while (0)
+
+// ── XAML readiness ──
+// Instead of loading Windows.UI.Xaml.dll ourselves and hammering IXDE, wait
+// for the host to load its XAML core (ntdll loader notification), then
+// retry IXDE with short exponential backoff.
+struct TAP_UNICODE_STRING { USHORT Length; USHORT MaximumLength; PWSTR Buffer; };
+struct TAP_LDR_DLL_NOTIFICATION_DATA {
+    ULONG Flags;
+    const TAP_UNICODE_STRING* FullDllName;
+    const TAP_UNICODE_STRING* BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+};
+typedef VOID (CALLBACK* PFN_LdrDllNotification)(ULONG reason, const TAP_LDR_DLL_NOTIFICATION_DATA* data, PVOID ctx);
+typedef LONG (NTAPI* PFN_LdrRegisterDllNotification)(ULONG flags, PFN_LdrDllNotification fn, PVOID ctx, PVOID* cookie);
+typedef LONG (NTAPI* PFN_LdrUnregisterDllNotification)(PVOID cookie);
+
+static const ULONG LDR_NOTIFICATION_LOADED = 1;
+static const DWORD XAML_READY_TIMEOUT_MS = 30000;   // then load it ourselves
+static const DWORD IXDE_BACKOFF_START_MS = 50;
+static const DWORD IXDE_BACKOFF_MAX_MS   = 2000;
+static const DWORD IXDE_DEADLINE_MS      = 60000;
+static const DWORD IXDE_ATTEMPT_WAIT_MS  = 5000;
+
+static DWORD NextBackoff(DWORD delay)
+{
+    return (delay * 2 > IXDE_BACKOFF_MAX_MS) ? IXDE_BACKOFF_MAX_MS : delay * 2;
+}
+
+// Runs under the loader lock: compare and signal only
+static VOID CALLBACK OnDllNotification(ULONG reason, const TAP_LDR_DLL_NOTIFICATION_DATA* data, PVOID ctx)
+{
+    static const wchar_t kXaml[] = L"Windows.UI.Xaml.dll";
+    if (reason != LDR_NOTIFICATION_LOADED || !data || !data->BaseDllName) return;
+    const TAP_UNICODE_STRING* name = data->BaseDllName;
+    if (name->Length == (sizeof(kXaml) - sizeof(wchar_t)) &&
+        _wcsnicmp(name->Buffer, kXaml, name->Length / sizeof(wchar_t)) == 0) {
+        SetEvent((HANDLE)ctx);
+    }
+}
+
+// Returns once Windows.UI.Xaml.dll is in the process (or the timeout hits)
+static bool WaitForXamlCore(DWORD timeoutMs)
+{
+    if (GetModuleHandleW(L"Windows.UI.Xaml.dll")) return true;
+
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    auto pfnRegister = reinterpret_cast<PFN_LdrRegisterDllNotification>(
+        GetProcAddress(hNtdll, "LdrRegisterDllNotification"));
+    auto pfnUnregister = reinterpret_cast<PFN_LdrUnregisterDllNotification>(
+        GetProcAddress(hNtdll, "LdrUnregisterDllNotification"));
+    HANDLE hLoaded = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+    PVOID cookie = nullptr;
+    bool registered = pfnRegister && pfnUnregister && hLoaded &&
+                      pfnRegister(0, OnDllNotification, hLoaded, &cookie) >= 0;
+    CoreLog("Waiting for Windows.UI.Xaml.dll (loader notification=%s)", registered ? "yes" : "no");
+
+    // Re-check: the load may have happened before registration
+    bool ready = GetModuleHandleW(L"Windows.UI.Xaml.dll") != nullptr;
+    if (!ready && registered) {
+        ready = WaitForSingleObject(hLoaded, timeoutMs) == WAIT_OBJECT_0;
+    } else if (!ready) {
+        // No notification API: poll with the same backoff shape as IXDE
+        DWORD waited = 0, delay = IXDE_BACKOFF_START_MS;
+        while (!ready && waited < timeoutMs) {
+            Sleep(delay);
+            waited += delay;
+            delay = NextBackoff(delay);
+            ready = GetModuleHandleW(L"Windows.UI.Xaml.dll") != nullptr;
+        }
+    }
+
+    if (registered) pfnUnregister(cookie);
+    if (hLoaded) CloseHandle(hLoaded);
+    return ready;
+}
+
+// IXDE runs on a fresh thread per attempt: a failed call can leave the
+// calling thread's COM/diagnostics state unusable. The args block is shared
+// with that thread and freed by whichever side finishes last, so an attempt
+// that outlives its wait never writes to a dead stack frame.
+struct IxdeArgs {
+    PFN_InitializeXamlDiagnosticsEx pfn;
+    wchar_t conn[64];
+    DWORD pid;
+    wchar_t dllPath[MAX_PATH];
+    CLSID clsid;
+    HRESULT hr;
+    LONG refs;
+};
+
+static void ReleaseIxdeArgs(IxdeArgs* a)
+{
+    if (InterlockedDecrement(&a->refs) == 0) delete a;
+}
+
+static DWORD WINAPI IxdeAttemptThread(LPVOID param)
+{
+    auto* a = (IxdeArgs*)param;
+    a->hr = a->pfn(a->conn, a->pid, nullptr, a->dllPath, a->clsid, nullptr);
+    ReleaseIxdeArgs(a);
+    return 0;
+}
+
+HRESULT Connect(const Options& options)
+{
+    static BootstrapEvents s_noEvents;
+    BootstrapEvents* events = options.events ? options.events : &s_noEvents;
+    g_log = options.log;
+
+    wchar_t dllPath[MAX_PATH];
+    GetModuleFileNameW(options.module, dllPath, MAX_PATH);
+    CoreLog("DLL path: %ls", dllPath);
+
+    bool hostLoaded = WaitForXamlCore(XAML_READY_TIMEOUT_MS);
+    if (!hostLoaded) {
+        CoreLog("Windows.UI.Xaml.dll not loaded by host after %lu ms -- loading it", XAML_READY_TIMEOUT_MS);
+    }
+
+    HMODULE hWux = LoadLibraryExW(L"Windows.UI.Xaml.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+    if (!hWux) {
+        CoreLog("LoadLibrary(Windows.UI.Xaml.dll) FAILED: 0x%08X", GetLastError());
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    events->OnXamlReady(hostLoaded);
+
+    auto pfnIXDE = reinterpret_cast<PFN_InitializeXamlDiagnosticsEx>(
+        GetProcAddress(hWux, "InitializeXamlDiagnosticsEx"));
+    if (!pfnIXDE) {
+        FreeLibrary(hWux);
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    DWORD pid = GetCurrentProcessId();
+    HRESULT hr = E_FAIL;
+    ULONGLONG deadline = GetTickCount64() + IXDE_DEADLINE_MS;
+    DWORD delay = IXDE_BACKOFF_START_MS;
+    int attempts = 0;
+
+    for (;;) {
+        ++attempts;
+        events->OnAttemptStart(attempts);
+
+        // "VisualDiagConnection{N}" endpoint names (same as TranslucentTB)
+        auto* args = new IxdeArgs();
+        args->pfn = pfnIXDE;
+        wsprintfW(args->conn, L"VisualDiagConnection%d", attempts);
+        args->pid = pid;
+        wcscpy_s(args->dllPath, dllPath);
+        args->clsid = options.siteClsid;
+        args->hr = E_FAIL;
+        args->refs = 2;
+
+        HANDLE hThread = CreateThread(nullptr, 0, IxdeAttemptThread, args, 0, nullptr);
+        if (hThread) {
+            bool done = WaitForSingleObject(hThread, IXDE_ATTEMPT_WAIT_MS) == WAIT_OBJECT_0;
+            CloseHandle(hThread);
+            hr = done ? args->hr : HRESULT_FROM_WIN32(WAIT_TIMEOUT);
+        } else {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            InterlockedDecrement(&args->refs);  // thread never took its reference
+        }
+        ReleaseIxdeArgs(args);
+
+        events->OnAttemptStop(attempts, hr);
+
+        if (SUCCEEDED(hr)) break;
+        if (GetTickCount64() + delay > deadline) break;
+
+        CoreLog("IXDE attempt %d failed: 0x%08X (retry in %lu ms)", attempts, hr, delay);
+        Sleep(delay);
+        delay = NextBackoff(delay);
+    }
+
+    if (FAILED(hr)) {
+        CoreLog("IXDE FAILED after %d attempts. Last HRESULT: 0x%08X", attempts, hr);
+    }
+
+    return hr;
+}
+
+} // namespace XamlBootstrap
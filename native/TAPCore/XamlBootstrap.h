@@ -0,0 +1,45 @@
+// XamlBootstrap.h -- Stage 2 of the injection, shared by ShellTAP and TaskbarTAP
+//
+// Runs on a thread spawned from DllMain: waits for the host to load its
+// XAML core (ntdll loader notification, no polling), then calls
+// InitializeXamlDiagnosticsEx with the DLL's own path and site CLSID,
+// retrying with exponential backoff until it connects or the deadline hits.
+// XAML Diagnostics then CoCreates the site and calls SetSite.
+//
+// The DLL observes the steps through BootstrapEvents (startup stamps,
+// counters, ETW regions) without the loop knowing about any of them.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+
+namespace XamlBootstrap {
+
+typedef void (*LogFn)(const char* fmt, ...);
+
+// Every callback runs on the bootstrap thread. Defaults do nothing.
+class BootstrapEvents {
+public:
+    virtual ~BootstrapEvents() {}
+
+    // Windows.UI.Xaml.dll is in the process (hostLoaded = false: the host
+    // never loaded it within XAML_READY_TIMEOUT_MS and we did)
+    virtual void OnXamlReady(bool hostLoaded) { (void)hostLoaded; }
+
+    // IXDE attempt `attempt` (1-based) is about to start / has finished
+    virtual void OnAttemptStart(int attempt) { (void)attempt; }
+    virtual void OnAttemptStop(int attempt, HRESULT hr) { (void)attempt; (void)hr; }
+};
+
+struct Options {
+    HMODULE module;                 // the TAP DLL (its path goes to IXDE)
+    CLSID siteClsid;                // class XAML Diagnostics will CoCreate
+    BootstrapEvents* events;        // may be null
+    LogFn log;                      // may be null
+};
+
+// Blocks until IXDE succeeded or gave up; returns the last HRESULT
+HRESULT Connect(const Options& options);
+
+} // namespace XamlBootstrap
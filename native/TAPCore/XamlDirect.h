@@ -0,0 +1,286 @@
+// XamlDirect.h -- Direct WinRT ABI property setters for XAML elements
+//
+// The diagnostics path (CreateInstance a value from a string, then
+// SetProperty by chain index) parses a value string and allocates on every
+// call. With the element's IInspectable in hand (GetIInspectableFromHandle)
+// the same change is one vtable call: IUIElement::put_Opacity, or
+// IShape::put_Fill with a brush from the shared BrushCache.
+//
+// XAML objects are bound to their UI thread: the cache remembers the thread
+// that created its first brush and hands nothing out anywhere else. Calls
+// from another thread fail with RPC_E_WRONG_THREAD; callers fall back to the
+// diagnostics path, which marshals.
+//
+// Header-only part of TAPCore; used by ShellTAP, TaskbarTAP and WatcherBase.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+#pragma once
+
+#include <windows.h>
+#include <roapi.h>          // RoGetActivationFactory
+#include <winstring.h>      // WindowsCreateString, WindowsDeleteString
+#include <windows.ui.xaml.h>
+#include <windows.ui.xaml.media.h>
+#include <windows.ui.xaml.shapes.h>
+#include <unordered_map>
+
+// RoGetActivationFactory by runtime class name
+inline HRESULT XamlGetFactory(const wchar_t* runtimeClass, REFIID riid, void** factory)
+{
+    HSTRING className = nullptr;
+    HRESULT hr = WindowsCreateString(runtimeClass, (UINT32)wcslen(runtimeClass), &className);
+    if (FAILED(hr)) return hr;
+    hr = RoGetActivationFactory(className, riid, factory);
+    WindowsDeleteString(className);
+    return hr;
+}
+
+// ── BrushCache: process-wide SolidColorBrush / AcrylicBrush instances ──
+// Keyed by kind + ARGB (+ tint opacity for acrylic), so every element and
+// every mode or preset switch that asks for the same color gets the same
+// brush object. XAML brushes are freely shareable between elements.
+//
+// The cache outlives any one watcher (SetSite can run more than once) and is
+// never destroyed: releasing XAML objects from the loader lock or a foreign
+// thread is not safe, and it holds only a handful of brushes. A detach
+// empties it with Reset() from the UI thread.
+class BrushCache {
+public:
+    static BrushCache& Shared()
+    {
+        static BrushCache* s_cache = new BrushCache();
+        return *s_cache;
+    }
+
+    // Borrowed pointers: valid until Reset()
+    HRESULT Solid(UINT32 argb, ABI::Windows::UI::Xaml::Media::IBrush** out)
+    {
+        return Get(KIND_SOLID, argb, 0, out);
+    }
+
+    // HostBackdrop acrylic tinted with `argb`; tintOpacity is quantized to 1/255
+    HRESULT Acrylic(UINT32 argb, double tintOpacity, ABI::Windows::UI::Xaml::Media::IBrush** out)
+    {
+        if (tintOpacity < 0.0) tintOpacity = 0.0;
+        if (tintOpacity > 1.0) tintOpacity = 1.0;
+        return Get(KIND_ACRYLIC, argb, (UINT32)(tintOpacity * 255.0 + 0.5), out);
+    }
+
+    size_t Size()
+    {
+        AcquireSRWLockShared(&m_lock);
+        size_t n = m_brushes.size();
+        ReleaseSRWLockShared(&m_lock);
+        return n;
+    }
+
+    // Drops every brush. Off the owning thread they are leaked instead.
+    void Reset()
+    {
+        AcquireSRWLockExclusive(&m_lock);
+        bool owner = (m_thread == GetCurrentThreadId());
+        for (auto& entry : m_brushes) {
+            if (owner) entry.second->Release();
+        }
+        m_brushes.clear();
+        m_thread = 0;
+        ReleaseSRWLockExclusive(&m_lock);
+    }
+
+private:
+    enum Kind : UINT64 { KIND_SOLID = 1, KIND_ACRYLIC = 2 };
+
+    BrushCache() : m_thread(0) { InitializeSRWLock(&m_lock); }
+
+    static ABI::Windows::UI::Color ToColor(UINT32 argb)
+    {
+        ABI::Windows::UI::Color c = { (BYTE)(argb >> 24), (BYTE)(argb >> 16), (BYTE)(argb >> 8), (BYTE)argb };
+        return c;
+    }
+
+    static HRESULT CreateSolid(UINT32 argb, ABI::Windows::UI::Xaml::Media::IBrush** out)
+    {
+        ABI::Windows::UI::Xaml::Media::ISolidColorBrushFactory* factory = nullptr;
+        HRESULT hr = XamlGetFactory(RuntimeClass_Windows_UI_Xaml_Media_SolidColorBrush,
+            __uuidof(ABI::Windows::UI::Xaml::Media::ISolidColorBrushFactory), (void**)&factory);
+        if (FAILED(hr)) return hr;
+
+        ABI::Windows::UI::Xaml::Media::ISolidColorBrush* solid = nullptr;
+        hr = factory->CreateInstanceWithColor(ToColor(argb), &solid);
+        factory->Release();
+        if (FAILED(hr)) return hr;
+
+        hr = solid->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::Media::IBrush), (void**)out);
+        solid->Release();
+        return hr;
+    }
+
+    static HRESULT CreateAcrylic(UINT32 argb, UINT32 tint255, ABI::Windows::UI::Xaml::Media::IBrush** out)
+    {
+        ABI::Windows::UI::Xaml::Media::IAcrylicBrushFactory* factory = nullptr;
+        HRESULT hr = XamlGetFactory(RuntimeClass_Windows_UI_Xaml_Media_AcrylicBrush,
+            __uuidof(ABI::Windows::UI::Xaml::Media::IAcrylicBrushFactory), (void**)&factory);
+        if (FAILED(hr)) return hr;
+
+        // Not aggregated: no outer object, inner reference discarded
+        IInspectable* inner = nullptr;
+        ABI::Windows::UI::Xaml::Media::IAcrylicBrush* acrylic = nullptr;
+        hr = factory->CreateInstance(nullptr, &inner, &acrylic);
+        factory->Release();
+        if (inner) inner->Release();
+        if (FAILED(hr)) return hr;
+
+        hr = acrylic->put_BackgroundSource(ABI::Windows::UI::Xaml::Media::AcrylicBackgroundSource_HostBackdrop);
+        if (SUCCEEDED(hr)) hr = acrylic->put_TintColor(ToColor(argb));
+        if (SUCCEEDED(hr)) hr = acrylic->put_TintOpacity((double)tint255 / 255.0);
+        if (SUCCEEDED(hr)) {
+            hr = acrylic->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::Media::IBrush), (void**)out);
+        }
+        acrylic->Release();
+        return hr;
+    }
+
+    HRESULT Get(Kind kind, UINT32 argb, UINT32 extra, ABI::Windows::UI::Xaml::Media::IBrush** out)
+    {
+        *out = nullptr;
+        UINT64 key = ((UINT64)kind << 40) | ((UINT64)(extra & 0xFF) << 32) | argb;
+        DWORD thread = GetCurrentThreadId();
+
+        AcquireSRWLockShared(&m_lock);
+        bool foreign = (m_thread != 0 && m_thread != thread);
+        auto it = m_brushes.find(key);
+        if (!foreign && it != m_brushes.end()) *out = it->second;
+        ReleaseSRWLockShared(&m_lock);
+        if (foreign) return RPC_E_WRONG_THREAD;
+        if (*out) return S_OK;
+
+        ABI::Windows::UI::Xaml::Media::IBrush* brush = nullptr;
+        HRESULT hr = (kind == KIND_ACRYLIC) ? CreateAcrylic(argb, extra, &brush) : CreateSolid(argb, &brush);
+        if (FAILED(hr)) return hr;
+
+        AcquireSRWLockExclusive(&m_lock);
+        if (m_thread == 0) m_thread = thread;
+        if (m_thread != thread) {           // another UI thread claimed the cache meanwhile
+            ReleaseSRWLockExclusive(&m_lock);
+            brush->Release();
+            return RPC_E_WRONG_THREAD;
+        }
+        auto ins = m_brushes.emplace(key, brush);
+        ReleaseSRWLockExclusive(&m_lock);
+        if (!ins.second) brush->Release();   // same thread, re-entered: keep the first
+        *out = ins.first->second;
+        return S_OK;
+    }
+
+    SRWLOCK m_lock;
+    std::unordered_map<UINT64, ABI::Windows::UI::Xaml::Media::IBrush*> m_brushes;
+    DWORD m_thread;     // UI thread the brushes belong to; 0 = none yet
+};
+
+class XamlDirect {
+public:
+    // IUIElement::put_Opacity. E_NOINTERFACE if the object is not a UIElement.
+    static HRESULT SetOpacity(IInspectable* element, double opacity)
+    {
+        ABI::Windows::UI::Xaml::IUIElement* ui = nullptr;
+        HRESULT hr = element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::IUIElement), (void**)&ui);
+        if (FAILED(hr)) return hr;
+        hr = ui->put_Opacity(opacity);
+        ui->Release();
+        return hr;
+    }
+
+    // IUIElement::get_Opacity (the local or styled value, not an animated one)
+    static HRESULT GetOpacity(IInspectable* element, double* opacity)
+    {
+        ABI::Windows::UI::Xaml::IUIElement* ui = nullptr;
+        HRESULT hr = element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::IUIElement), (void**)&ui);
+        if (FAILED(hr)) return hr;
+        hr = ui->get_Opacity(opacity);
+        ui->Release();
+        return hr;
+    }
+
+    // IShape::put_Fill. E_NOINTERFACE if the object is not a Shape (it then
+    // has no Fill to set).
+    static HRESULT SetFill(IInspectable* element, ABI::Windows::UI::Xaml::Media::IBrush* brush)
+    {
+        ABI::Windows::UI::Xaml::Shapes::IShape* shape = nullptr;
+        HRESULT hr = element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::Shapes::IShape), (void**)&shape);
+        if (FAILED(hr)) return hr;
+        hr = shape->put_Fill(brush);
+        shape->Release();
+        return hr;
+    }
+
+    // IShape::get_Fill; *brush is AddRef'd (may be null). E_NOINTERFACE if
+    // the object is not a Shape.
+    static HRESULT GetFill(IInspectable* element, ABI::Windows::UI::Xaml::Media::IBrush** brush)
+    {
+        *brush = nullptr;
+        ABI::Windows::UI::Xaml::Shapes::IShape* shape = nullptr;
+        HRESULT hr = element->QueryInterface(__uuidof(ABI::Windows::UI::Xaml::Shapes::IShape), (void**)&shape);
+        if (FAILED(hr)) return hr;
+        hr = shape->get_Fill(brush);
+        shape->Release();
+        return hr;
+    }
+
+    static HRESULT SetSolidFill(IInspectable* element, UINT32 argb)
+    {
+        ABI::Windows::UI::Xaml::Media::IBrush* brush = nullptr;
+        HRESULT hr = BrushCache::Shared().Solid(argb, &brush);
+        return SUCCEEDED(hr) ? SetFill(element, brush) : hr;
+    }
+
+    static HRESULT SetAcrylicFill(IInspectable* element, UINT32 argb, double tintOpacity)
+    {
+        ABI::Windows::UI::Xaml::Media::IBrush* brush = nullptr;
+        HRESULT hr = BrushCache::Shared().Acrylic(argb, tintOpacity, &brush);
+        return SUCCEEDED(hr) ? SetFill(element, brush) : hr;
+    }
+
+    static HRESULT SetTransparentFill(IInspectable* element)
+    {
+        return SetSolidFill(element, 0x00000000);
+    }
+
+    // UIElement.OpacityProperty / Shape.FillProperty. Borrowed: looked up
+    // once and kept for the process lifetime (the properties are static).
+    static ABI::Windows::UI::Xaml::IDependencyProperty* OpacityProperty()
+    {
+        static ABI::Windows::UI::Xaml::IDependencyProperty* s_property = LookupOpacityProperty();
+        return s_property;
+    }
+
+    static ABI::Windows::UI::Xaml::IDependencyProperty* FillProperty()
+    {
+        static ABI::Windows::UI::Xaml::IDependencyProperty* s_property = LookupFillProperty();
+        return s_property;
+    }
+
+private:
+    static ABI::Windows::UI::Xaml::IDependencyProperty* LookupOpacityProperty()
+    {
+        ABI::Windows::UI::Xaml::IUIElementStatics* statics = nullptr;
+        ABI::Windows::UI::Xaml::IDependencyProperty* property = nullptr;
+        if (SUCCEEDED(XamlGetFactory(RuntimeClass_Windows_UI_Xaml_UIElement,
+                __uuidof(ABI::Windows::UI::Xaml::IUIElementStatics), (void**)&statics))) {
+            statics->get_OpacityProperty(&property);
+            statics->Release();
+        }
+        return property;
+    }
+
+    static ABI::Windows::UI::Xaml::IDependencyProperty* LookupFillProperty()
+    {
+        ABI::Windows::UI::Xaml::Shapes::IShapeStatics* statics = nullptr;
+        ABI::Windows::UI::Xaml::IDependencyProperty* property = nullptr;
+        if (SUCCEEDED(XamlGetFactory(RuntimeClass_Windows_UI_Xaml_Shapes_Shape,
+                __uuidof(ABI::Windows::UI::Xaml::Shapes::IShapeStatics), (void**)&statics))) {
+            statics->get_FillProperty(&property);
+            statics->Release();
+        }
+        return property;
+    }
+};
@@ -0,0 +1,210 @@
+// TAPInject.cpp -- Native injector for ShellTAP.dll and TaskbarTAP.dll
+//
+// Does what Invoke-ShellTAPInject / Invoke-TaskbarTAPInject used to do
+// through Add-Type P/Invoke, without the per-session C# compile or the
+// fixed sleeps:
+//   1. with --target, writes "W11ThemeSuite_ShellTAP_Init_<PID>" (and,
+//      with --config, the _Config block from a file)
+//   2. CreateRemoteThread(LoadLibraryW) into the host
+//   3. waits on the DLL's manual-reset _Ready event (set from SetSite) and,
+//      by default, _Applied (set on the first successful apply)
+//
+// Usage:
+//   TAPInject (--pid <pid> | --process <name.exe> | --taskbar)
+//             [--target <TargetId>] [--dll <path>] [--config <file>]
+//             [--wait none|ready|apply] [--timeout <ms>]
+//
+//   --target   ShellTAP TargetId. Without it the DLL is TaskbarTAP and the
+//              events are "W11ThemeSuite_TaskbarTAP_Ready/_Applied".
+//   --dll      Default: ShellTAP.dll (or TaskbarTAP.dll) next to this exe.
+//   --config   Raw ShellTAPConfigV2 block (ShellTAP.h). The DLL keeps the
+//              mapping open, so it outlives this process.
+//   --wait     Default: apply. A DLL without the events (older builds) is
+//              treated as ready once its _Mode mapping exists.
+//   --timeout  Default: 45000 ms, for the whole wait.
+//
+// Prints one "ready <ms>" / "applied <ms>" line per milestone reached.
+// Exit codes: 0 ok, 1 injection failed, 2 usage, 3 not ready in time,
+// 4 ready but nothing applied in time.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <cstdio>
+#include <cwchar>
+#include <vector>
+#include "Injector.h"
+
+static const DWORD CONFIG_CAPACITY = 64 * 1024;      // SHELLTAP_CONFIG_V2_CAPACITY (ShellTAP.h)
+static const DWORD LEGACY_POLL_MS = 50;
+
+enum WaitFor { WAIT_NONE, WAIT_READY, WAIT_APPLY };
+
+struct Options {
+    DWORD pid = 0;
+    const wchar_t* process = nullptr;
+    bool taskbar = false;
+    const wchar_t* target = nullptr;
+    const wchar_t* dll = nullptr;
+    const wchar_t* config = nullptr;
+    WaitFor wait = WAIT_APPLY;
+    DWORD timeoutMs = 45000;
+};
+
+static void Usage()
+{
+    fwprintf(stderr, L"Usage: TAPInject (--pid <pid> | --process <name.exe> | --taskbar)\n"
+                     L"                 [--target <TargetId>] [--dll <path>] [--config <file>]\n"
+                     L"                 [--wait none|ready|apply] [--timeout <ms>]\n");
+}
+
+static bool ParseArgs(int argc, wchar_t** argv, Options* o)
+{
+    for (int i = 1; i < argc; i++) {
+        const wchar_t* a = argv[i];
+        const wchar_t* v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (wcscmp(a, L"--taskbar") == 0) { o->taskbar = true; continue; }
+        if (!v) return false;
+        if (wcscmp(a, L"--pid") == 0)          o->pid = (DWORD)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--process") == 0) o->process = v;
+        else if (wcscmp(a, L"--target") == 0)  o->target = v;
+        else if (wcscmp(a, L"--dll") == 0)     o->dll = v;
+        else if (wcscmp(a, L"--config") == 0)  o->config = v;
+        else if (wcscmp(a, L"--timeout") == 0) o->timeoutMs = (DWORD)wcstoul(v, nullptr, 10);
+        else if (wcscmp(a, L"--wait") == 0) {
+            if (wcscmp(v, L"none") == 0)       o->wait = WAIT_NONE;
+            else if (wcscmp(v, L"ready") == 0) o->wait = WAIT_READY;
+            else if (wcscmp(v, L"apply") == 0) o->wait = WAIT_APPLY;
+            else return false;
+        }
+        else return false;
+        i++;
+    }
+    int sources = (o->pid != 0) + (o->process != nullptr) + (o->taskbar ? 1 : 0);
+    return sources == 1 && (!o->target || wcslen(o->target) < Injector::INIT_CHARS);
+}
+
+// ── Config block written before injection ──
+// Like the init block, it must stay open until LoadLibraryW has returned.
+static HANDLE WriteConfigBlock(const wchar_t* target, const wchar_t* path)
+{
+    FILE* f = _wfopen(path, L"rb");
+    if (!f) return nullptr;
+    std::vector<BYTE> data(CONFIG_CAPACITY);
+    size_t size = fread(data.data(), 1, data.size(), f);
+    bool truncated = fgetc(f) != EOF;
+    fclose(f);
+    if (size < sizeof(int) || truncated) return nullptr;
+
+    wchar_t name[128];
+    swprintf(name, 128, L"W11ThemeSuite_ShellTAP_%s_Config", target);
+    HANDLE map = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, CONFIG_CAPACITY, name);
+    if (!map) return nullptr;
+    BYTE* view = (BYTE*)MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, CONFIG_CAPACITY);
+    if (!view) { CloseHandle(map); return nullptr; }
+    memcpy(view, data.data(), size);
+    memset(view + size, 0, CONFIG_CAPACITY - size);
+    UnmapViewOfFile(view);
+    return map;
+}
+
+// ── Stage 2 handshake ──
+// Returns false on timeout. Older DLLs have no events: fall back to polling
+// for the _Mode mapping, which they create from SetSite.
+static bool WaitMilestone(const wchar_t* eventName, const wchar_t* legacyMapName, ULONGLONG deadline)
+{
+    HANDLE event = OpenEventW(SYNCHRONIZE, FALSE, eventName);
+    if (event) {
+        ULONGLONG now = GetTickCount64();
+        DWORD wait = (now < deadline) ? (DWORD)(deadline - now) : 0;
+        bool signaled = WaitForSingleObject(event, wait) == WAIT_OBJECT_0;
+        CloseHandle(event);
+        return signaled;
+    }
+    if (!legacyMapName) return true;    // no _Applied on older DLLs: nothing to wait for
+    for (;;) {
+        HANDLE map = OpenFileMappingW(FILE_MAP_READ, FALSE, legacyMapName);
+        if (map) { CloseHandle(map); return true; }
+        if (GetTickCount64() >= deadline) return false;
+        Sleep(LEGACY_POLL_MS);
+    }
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    Options o;
+    if (!ParseArgs(argc, argv, &o)) { Usage(); return 2; }
+    if (o.config && !o.target) { Usage(); return 2; }
+
+    DWORD pid = o.pid;
+    if (o.process) pid = Injector::FindProcess(o.process);
+    if (o.taskbar) pid = Injector::FindTaskbarProcess();
+    if (!pid) {
+        fwprintf(stderr, L"Target process not found\n");
+        return 1;
+    }
+
+    wchar_t dllPath[MAX_PATH];
+    if (o.dll) {
+        if (!GetFullPathNameW(o.dll, MAX_PATH, dllPath, nullptr)) return 1;
+    } else {
+        GetModuleFileNameW(nullptr, dllPath, MAX_PATH);
+        wchar_t* slash = wcsrchr(dllPath, L'\\');
+        if (slash) slash[1] = 0;
+        wcscat_s(dllPath, o.target ? L"ShellTAP.dll" : L"TaskbarTAP.dll");
+    }
+    if (GetFileAttributesW(dllPath) == INVALID_FILE_ATTRIBUTES) {
+        fwprintf(stderr, L"DLL not found: %s\n", dllPath);
+        return 1;
+    }
+
+    HANDLE initMap = nullptr;
+    HANDLE configMap = nullptr;
+    if (o.target) {
+        initMap = Injector::WriteInitBlock(pid, o.target);
+        if (!initMap) {
+            fwprintf(stderr, L"Creating the init block failed: %lu\n", GetLastError());
+            return 1;
+        }
+        if (o.config) {
+            configMap = WriteConfigBlock(o.target, o.config);
+            if (!configMap) {
+                fwprintf(stderr, L"Config block '%s' unreadable or over %lu bytes\n", o.config, CONFIG_CAPACITY);
+                CloseHandle(initMap);
+                return 1;
+            }
+        }
+    }
+
+    ULONGLONG start = GetTickCount64();
+    bool injected = Injector::InjectDll(pid, dllPath);
+    if (initMap) CloseHandle(initMap);
+    if (configMap) CloseHandle(configMap);
+    if (!injected) return 1;
+    if (o.wait == WAIT_NONE) return 0;
+
+    // Same prefix as the DLL's own objects
+    wchar_t prefix[96];
+    if (o.target) swprintf(prefix, 96, L"W11ThemeSuite_ShellTAP_%s_", o.target);
+    else wcscpy_s(prefix, L"W11ThemeSuite_TaskbarTAP_");
+    wchar_t ready[128], applied[128], mode[128];
+    swprintf(ready, 128, L"%sReady", prefix);
+    swprintf(applied, 128, L"%sApplied", prefix);
+    swprintf(mode, 128, L"%sMode", prefix);
+
+    ULONGLONG deadline = start + o.timeoutMs;
+    if (!WaitMilestone(ready, mode, deadline)) {
+        fwprintf(stderr, L"XAML Diagnostics did not connect within %lu ms\n", o.timeoutMs);
+        return 3;
+    }
+    wprintf(L"ready %llu\n", GetTickCount64() - start);
+    if (o.wait == WAIT_READY) return 0;
+
+    if (!WaitMilestone(applied, nullptr, deadline)) {
+        fwprintf(stderr, L"No element applied within %lu ms\n", o.timeoutMs);
+        return 4;
+    }
+    wprintf(L"applied %llu\n", GetTickCount64() - start);
+    return 0;
+}
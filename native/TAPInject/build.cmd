@@ -0,0 +1,28 @@
+@echo off
+REM Build TAPInject.exe for w11-theming-suite
+REM Native injector for ShellTAP.dll / TaskbarTAP.dll (replaces the Add-Type P/Invoke path)
+setlocal
+
+set "SRCDIR=C:\Dev\w11-theming-suite\native\TAPInject"
+set "OUTDIR=C:\Dev\w11-theming-suite\native\bin"
+set "OBJDIR=C:\Dev\w11-theming-suite\native\TAPInject\obj"
+set "VCVARS=C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxiliary\Build\vcvars64.bat"
+
+echo [BUILD] Initializing x64 environment...
+call "%VCVARS%"
+if errorlevel 1 goto :fail
+
+if not exist "%OUTDIR%\" mkdir "%OUTDIR%"
+if not exist "%OBJDIR%\" mkdir "%OBJDIR%"
+
+echo [BUILD] Compiling TAPInject.cpp + TAPCore\Injector.cpp...
+cl.exe /nologo /EHsc /O2 /MD /W3 /std:c++17 /D_CRT_SECURE_NO_WARNINGS /DUNICODE /D_UNICODE /DNDEBUG /I"%SRCDIR%\..\TAPCore" "%SRCDIR%\TAPInject.cpp" "%SRCDIR%\..\TAPCore\Injector.cpp" /Fe:"%OUTDIR%\TAPInject.exe" /Fo:"%OBJDIR%\\" /link /NOLOGO /MACHINE:X64
+if errorlevel 1 goto :fail
+
+echo [BUILD] SUCCESS
+dir "%OUTDIR%\TAPInject.exe"
+goto :eof
+
+:fail
+echo [BUILD] FAILED
+exit /b 1
@@ -1,25 +1,53 @@
 // TaskbarTAP.cpp — Taskbar Appearance Plugin for w11-theming-suite
 // Two-stage injection architecture (same as TranslucentTB):
-//   Stage 1: PowerShell injects this DLL into explorer.exe via CreateRemoteThread+LoadLibrary
+//   Stage 1: TAPInject.exe (or PowerShell) injects this DLL into explorer.exe via
+//            CreateRemoteThread+LoadLibrary
 //   Stage 2: DllMain spawns a thread that calls InitializeXamlDiagnosticsEx from WITHIN
-//            explorer.exe, which triggers XAML Diagnostics to CoCreate our TAPSite.
-//            TAPSite::SetSite receives IVisualTreeService3 and starts the VisualTreeWatcher.
+//            explorer.exe (TAPCore's XamlBootstrap), which triggers XAML Diagnostics
+//            to CoCreate our TAPSite. TAPSite::SetSite receives IVisualTreeService3
+//            and starts the VisualTreeWatcher.
+//
+// DetachTaskbarTAP (or signaling W11ThemeSuite_TaskbarTAP_Detach) unadvises
+// and releases everything without restarting explorer; _Detached is set
+// when it is done.
+//
+// There is no counters block (ShellTAP's ValueHandles .. BytesHeld gauges):
+// the watcher's state is a fixed array of MAX_TASKBARS handles, and its
+// SetProperty fallback pools at most the policy's three opacities and one
+// Transparent brush.
 //
 // (c) 2026 w11-theming-suite. MIT License.
 
 #include <initguid.h>   // Must come before guids.h to define (not just declare) GUIDs
 #include "TaskbarTAP.h"
 #include "guids.h"
-#include <string>
 #include <cstring>
-#include <oleauto.h>   // SysAllocString, SysFreeString
-#include <shlwapi.h>   // PathRemoveFileSpec (for getting DLL path)
 #include <cstdio>      // for debug logging
-#include <winstring.h> // WindowsGetStringRawBuffer, WindowsDeleteString
+#include "../TAPCore/Detach.h"
+#include "../TAPCore/InstanceRegistry.h"
+#include "../TAPCore/MonitorThread.h"
+#include "../TAPCore/StartupEvents.h"
+#include "../TAPCore/XamlBootstrap.h"
+#include "../TAPCore/XamlDirect.h"
+
+#define TAP_ETW_PROVIDER g_hTaskbarTAPProvider
+#include "../TAPCore/EtwTrace.h"
 
-#pragma comment(lib, "shlwapi.lib")
+#pragma comment(lib, "advapi32.lib")
 #pragma comment(lib, "WindowsApp.lib")
 
+// ── ETW (TraceLogging) ──
+// Provider "W11ThemeSuite.TaskbarTAP" {1ca9f133-fb8e-5cae-b393-81b71329cd36}
+// (name-hash GUID). Spans and macros are TAPCore\EtwTrace.h, as in ShellTAP;
+// record with native\ShellTAP\ShellTAP.wprp. Idle cost: one enabled check per span.
+TRACELOGGING_DEFINE_PROVIDER(
+    g_hTaskbarTAPProvider,
+    "W11ThemeSuite.TaskbarTAP",
+    (0x1ca9f133, 0xfb8e, 0x5cae, 0xb3, 0x93, 0x81, 0xb7, 0x13, 0x29, 0xcd, 0x36));
+
+// Every event's TargetId, like ShellTAP's g_targetId
+static const wchar_t ETW_TARGET_ID[] = L"Taskbar";
+
 // ── Debug logging ──
 static FILE* g_logFile = nullptr;
 
@@ -47,14 +75,21 @@ TaskbarAppearance g_appearance = APPEARANCE_TRANSPARENT;
 VisualTreeWatcher* g_pWatcher = nullptr;
 
 // ── Shared memory for IPC (PowerShell writes, DLL reads) ──
+// PowerShell writes the mode, then signals SHARED_EVENT_NAME (auto-reset).
 static const wchar_t* SHARED_MEM_NAME = L"W11ThemeSuite_TaskbarTAP_Mode";
+static const wchar_t* SHARED_EVENT_NAME = L"W11ThemeSuite_TaskbarTAP_ModeEvent";
 static HANDLE g_hMapFile = nullptr;
 static volatile int* g_pSharedMode = nullptr;
-static HANDLE g_hMonitorThread = nullptr;
-static bool g_bStopMonitor = false;
+static HANDLE g_hModeEvent = nullptr;
 
 static void InitSharedMemory()
 {
+    if (g_hMapFile) return;  // SetSite can run more than once
+
+    // Create the event first: the mapping appearing is PowerShell's "ready" signal
+    g_hModeEvent = CreateEventW(nullptr, FALSE, FALSE, SHARED_EVENT_NAME);
+    Detach::CreateEvents(L"W11ThemeSuite_TaskbarTAP_");
+
     g_hMapFile = CreateFileMappingW(
         INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(int), SHARED_MEM_NAME);
     if (g_hMapFile) {
@@ -66,122 +101,111 @@ static void InitSharedMemory()
     }
 }
 
-// Monitor thread: polls shared memory for mode changes from PowerShell
-static DWORD WINAPI MonitorThread(LPVOID)
+// Monitor thread (TAPCore\MonitorThread.h), on the mode event
+static void CheckSharedMode()
 {
-    while (!g_bStopMonitor) {
-        if (g_pSharedMode) {
-            int newMode = *g_pSharedMode;
-            if (newMode >= 0 && newMode <= 2 && newMode != (int)g_appearance) {
-                g_appearance = (TaskbarAppearance)newMode;
-                if (g_pWatcher) {
-                    g_pWatcher->ApplyAppearance(g_appearance);
-                }
-            }
+    if (!g_pSharedMode) return;
+    int newMode = *g_pSharedMode;
+    if (newMode >= 0 && newMode <= 2 && newMode != (int)g_appearance) {
+        g_appearance = (TaskbarAppearance)newMode;
+        if (g_pWatcher) {
+            g_pWatcher->RequestApplyAppearance(g_appearance);   // ApplyAppearance acks
+            return;
         }
-        Sleep(250);  // Check 4 times per second
     }
-    return 0;
+    InstanceRegistry::AckMode((int)g_appearance);
 }
 
-static void StartMonitorThread()
+// Process detach and DetachTaskbarTAP both; the monitor thread is stopped
+static void CloseSharedState()
 {
-    g_bStopMonitor = false;
-    g_hMonitorThread = CreateThread(nullptr, 0, MonitorThread, nullptr, 0, nullptr);
+    if (g_pSharedMode) { UnmapViewOfFile((LPCVOID)g_pSharedMode); g_pSharedMode = nullptr; }
+    if (g_hMapFile) { CloseHandle(g_hMapFile); g_hMapFile = nullptr; }
+    if (g_hModeEvent) { CloseHandle(g_hModeEvent); g_hModeEvent = nullptr; }
+    MonitorThread::Close();
+    StartupEvents::Close();
+    InstanceRegistry::Unregister();
 }
 
 // ══════════════════════════════════════════════
 // Stage 2: Self-injection into XAML Diagnostics
 // This runs inside explorer.exe after LoadLibrary injection.
-// Dynamically loads Windows.UI.Xaml.dll, resolves InitializeXamlDiagnosticsEx,
-// and calls it with our own DLL path and CLSID.
+// XamlBootstrap waits for Windows.UI.Xaml.dll and retries
+// InitializeXamlDiagnosticsEx with our own DLL path and CLSID.
 // ══════════════════════════════════════════════
-typedef HRESULT(WINAPI* PFN_InitializeXamlDiagnosticsEx)(
-    LPCWSTR endPointName,
-    DWORD pid,
-    LPCWSTR wszDllXamlDiagnostics,
-    LPCWSTR wszTAPDllName,
-    CLSID tapClsid,
-    LPCWSTR wszInitializationData
-);
+class TaskbarBootstrapEvents : public XamlBootstrap::BootstrapEvents {
+public:
+    TaskbarBootstrapEvents() : m_span(TAP_ETW_KEYWORD_STARTUP) {}
+
+    void OnAttemptStart(int attempt) override
+    {
+        m_span = EtwTrace::Span(TAP_ETW_KEYWORD_STARTUP);
+        TAP_ETW_START(m_span, "IxdeAttempt", TAP_ETW_KEYWORD_STARTUP,
+            TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+            TraceLoggingInt32(attempt, "Attempt"));
+    }
+
+    void OnAttemptStop(int attempt, HRESULT hr) override
+    {
+        TAP_ETW_STOP(m_span, "IxdeAttempt", TAP_ETW_KEYWORD_STARTUP,
+            TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+            TraceLoggingInt32(attempt, "Attempt"),
+            TraceLoggingHResult(hr, "HResult"));
+        if (SUCCEEDED(hr)) DebugLog("IXDE succeeded on attempt %d", attempt);
+    }
+
+private:
+    EtwTrace::Span m_span;
+};
 
 static DWORD WINAPI SelfInjectThread(LPVOID)
 {
     DebugLog("=== SelfInjectThread started ===");
 
-    // Get our own DLL path
-    wchar_t dllPath[MAX_PATH];
-    GetModuleFileNameW(g_hModule, dllPath, MAX_PATH);
-    DebugLog("DLL path: %ls", dllPath);
-
-    // Load Windows.UI.Xaml.dll and resolve InitializeXamlDiagnosticsEx
-    HMODULE hWux = LoadLibraryExW(L"Windows.UI.Xaml.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
-    if (!hWux) {
-        return HRESULT_FROM_WIN32(GetLastError());
-    }
-
-    auto pfnIXDE = reinterpret_cast<PFN_InitializeXamlDiagnosticsEx>(
-        GetProcAddress(hWux, "InitializeXamlDiagnosticsEx"));
-    if (!pfnIXDE) {
-        FreeLibrary(hWux);
-        return HRESULT_FROM_WIN32(GetLastError());
-    }
-
-    DWORD pid = GetCurrentProcessId();
-    HRESULT hr = E_FAIL;
-    UINT8 attempts = 1;
-
-    // Retry loop: each attempt uses a new thread because IXDE is once-per-thread.
-    // Use "VisualDiagConnection{N}" endpoint names (same as TranslucentTB).
-    do {
-        wchar_t connName[64];
-        wsprintfW(connName, L"VisualDiagConnection%d", (int)attempts);
-
-        // Must call IXDE on a fresh thread (it's once-per-thread)
-        struct IxdeArgs {
-            PFN_InitializeXamlDiagnosticsEx pfn;
-            LPCWSTR conn;
-            DWORD pid;
-            LPCWSTR dllPath;
-            HRESULT hr;
-        };
-
-        IxdeArgs args;
-        args.pfn = pfnIXDE;
-        args.conn = connName;
-        args.pid = pid;
-        args.dllPath = dllPath;
-        args.hr = E_FAIL;
-
-        HANDLE hThread = CreateThread(nullptr, 0, [](LPVOID param) -> DWORD {
-            auto* a = (IxdeArgs*)param;
-            a->hr = a->pfn(a->conn, a->pid, nullptr, a->dllPath, CLSID_TaskbarTAPSite, nullptr);
-            return 0;
-        }, &args, 0, nullptr);
+    TaskbarBootstrapEvents events;
+    XamlBootstrap::Options options = { g_hModule, CLSID_TaskbarTAPSite, &events, DebugLog };
+    return (DWORD)XamlBootstrap::Connect(options);
+}
 
-        if (hThread) {
-            WaitForSingleObject(hThread, 5000);
-            CloseHandle(hThread);
-            hr = args.hr;
+// ══════════════════════════════════════════════
+// Detach: unadvise and release everything, explorer keeps running
+// The taskbar keeps the values last applied.
+// ══════════════════════════════════════════════
+// Detach hooks (TAPCore\Detach.h), on the detach thread
+static HRESULT ReleaseWatcher(DWORD timeoutMs)
+{
+    HRESULT hr = S_OK;
+    VisualTreeWatcher* watcher = g_pWatcher;
+    g_pWatcher = nullptr;
+    if (watcher) {
+        if (g_pTreeService) {
+            hr = g_pTreeService->UnadviseVisualTreeChange(watcher);
+            DebugLog("UnadviseVisualTreeChange: 0x%08X", hr);
         }
-
-        if (SUCCEEDED(hr)) {
-            DebugLog("IXDE succeeded on attempt %d", (int)attempts);
-            break;
+        if (!watcher->CloseDispatch(timeoutMs)) {
+            DebugLog("Detach: UI thread did not close the dispatch window within %u ms", timeoutMs);
         }
-
-        DebugLog("IXDE attempt %d failed: 0x%08X", (int)attempts, hr);
-        ++attempts;
-        Sleep(500);
-    } while (FAILED(hr) && attempts <= 60);
-
-    if (FAILED(hr)) {
-        DebugLog("IXDE FAILED after all attempts. Last HRESULT: 0x%08X", hr);
+        watcher->Release();
     }
-
+    if (g_pTreeService) { g_pTreeService->Release(); g_pTreeService = nullptr; }
+    if (g_pDiagnostics) { g_pDiagnostics->Release(); g_pDiagnostics = nullptr; }
     return hr;
 }
 
+static bool CanUnload()
+{
+    return DllCanUnloadNow() == S_OK;
+}
+
+// Nothing calls into the module any more; ETW cannot be unregistered
+// from DllMain once FreeLibrary gets there
+static void BeforeUnload()
+{
+    VisualTreeWatcher::UnregisterDispatchClass();
+    EtwTrace::Unregister();
+    if (g_logFile) { fclose(g_logFile); g_logFile = nullptr; }
+}
+
 // ══════════════════════════════════════════════
 // DLL Entry Point
 // ══════════════════════════════════════════════
@@ -190,6 +214,12 @@ BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID)
     if (reason == DLL_PROCESS_ATTACH) {
         g_hModule = hInstance;
         DisableThreadLibraryCalls(hInstance);
+        EtwTrace::Register();
+        Detach::Init({ g_hModule, DebugLog, ReleaseWatcher, CloseSharedState,
+                       CanUnload, BeforeUnload });
+
+        // Ready from SetSite, Applied after the first successful apply (TAPInject.exe)
+        StartupEvents::Create(L"W11ThemeSuite_TaskbarTAP_");
 
         // Stage 2: Spawn self-injection thread.
         // This will call InitializeXamlDiagnosticsEx from WITHIN explorer.exe.
@@ -199,14 +229,10 @@ BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID)
         }
     }
     else if (reason == DLL_PROCESS_DETACH) {
-        g_bStopMonitor = true;
-        if (g_hMonitorThread) {
-            WaitForSingleObject(g_hMonitorThread, 2000);
-            CloseHandle(g_hMonitorThread);
-            g_hMonitorThread = nullptr;
-        }
-        if (g_pSharedMode) { UnmapViewOfFile((LPCVOID)g_pSharedMode); g_pSharedMode = nullptr; }
-        if (g_hMapFile) { CloseHandle(g_hMapFile); g_hMapFile = nullptr; }
+        MonitorThread::Stop(2000);
+        CloseSharedState();
+        Detach::Close();
+        EtwTrace::Unregister();
     }
     return TRUE;
 }
@@ -219,21 +245,21 @@ extern "C" {
 HRESULT __stdcall SetTaskbarTransparent()
 {
     g_appearance = APPEARANCE_TRANSPARENT;
-    if (g_pWatcher) g_pWatcher->ApplyAppearance(g_appearance);
+    if (g_pWatcher) g_pWatcher->RequestApplyAppearance(g_appearance);
     return S_OK;
 }
 
 HRESULT __stdcall SetTaskbarAcrylic()
 {
     g_appearance = APPEARANCE_ACRYLIC;
-    if (g_pWatcher) g_pWatcher->ApplyAppearance(g_appearance);
+    if (g_pWatcher) g_pWatcher->RequestApplyAppearance(g_appearance);
     return S_OK;
 }
 
 HRESULT __stdcall SetTaskbarDefault()
 {
     g_appearance = APPEARANCE_DEFAULT;
-    if (g_pWatcher) g_pWatcher->ApplyAppearance(g_appearance);
+    if (g_pWatcher) g_pWatcher->RequestApplyAppearance(g_appearance);
     return S_OK;
 }
 
@@ -242,6 +268,12 @@ int __stdcall GetTaskbarTAPVersion()
     return 1;  // v1.0
 }
 
+// Same as signaling _Detach; _Detached is set when it is done
+HRESULT __stdcall DetachTaskbarTAP()
+{
+    return Detach::Request();
+}
+
 } // extern "C"
 
 // ══════════════════════════════════════════════
@@ -249,13 +281,7 @@ int __stdcall GetTaskbarTAPVersion()
 // ══════════════════════════════════════════════
 STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv)
 {
-    if (rclsid == CLSID_TaskbarTAPSite) {
-        auto* factory = new TaskbarTAPFactory();
-        HRESULT hr = factory->QueryInterface(riid, ppv);
-        factory->Release();
-        return hr;
-    }
-    return CLASS_E_CLASSNOTAVAILABLE;
+    return TAPCore::GetClassObject<TaskbarTAPSite>(CLSID_TaskbarTAPSite, rclsid, riid, ppv);
 }
 
 STDAPI DllCanUnloadNow()
@@ -263,96 +289,23 @@ STDAPI DllCanUnloadNow()
     return (g_refCount == 0) ? S_OK : S_FALSE;
 }
 
-// ══════════════════════════════════════════════
-// TaskbarTAPFactory (IClassFactory)
-// ══════════════════════════════════════════════
-TaskbarTAPFactory::TaskbarTAPFactory() : m_refCount(1) { g_refCount++; }
-
-HRESULT TaskbarTAPFactory::QueryInterface(REFIID riid, void** ppv)
-{
-    if (riid == IID_IUnknown || riid == IID_IClassFactory) {
-        *ppv = static_cast<IClassFactory*>(this);
-        AddRef();
-        return S_OK;
-    }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
-}
-
-ULONG TaskbarTAPFactory::AddRef() { return InterlockedIncrement(&m_refCount); }
-ULONG TaskbarTAPFactory::Release()
-{
-    long ref = InterlockedDecrement(&m_refCount);
-    if (ref == 0) { g_refCount--; delete this; }
-    return ref;
-}
-
-HRESULT TaskbarTAPFactory::CreateInstance(IUnknown* pOuter, REFIID riid, void** ppv)
-{
-    if (pOuter) return CLASS_E_NOAGGREGATION;
-    auto* site = new TaskbarTAPSite();
-    HRESULT hr = site->QueryInterface(riid, ppv);
-    site->Release();
-    return hr;
-}
-
-HRESULT TaskbarTAPFactory::LockServer(BOOL fLock)
-{
-    if (fLock) g_refCount++;
-    else g_refCount--;
-    return S_OK;
-}
-
 // ══════════════════════════════════════════════
 // TaskbarTAPSite (IObjectWithSite)
 // XAML Diagnostics calls SetSite() with the diagnostics provider.
 // We QI for IVisualTreeService3 and IXamlDiagnostics, then start
 // watching the visual tree.
 // ══════════════════════════════════════════════
-TaskbarTAPSite::TaskbarTAPSite() : m_refCount(1), m_pSite(nullptr)
-{
-    g_refCount++;
-}
-
-TaskbarTAPSite::~TaskbarTAPSite()
-{
-    if (m_pSite) m_pSite->Release();
-    g_refCount--;
-}
-
-HRESULT TaskbarTAPSite::QueryInterface(REFIID riid, void** ppv)
-{
-    if (riid == IID_IUnknown || riid == IID_IObjectWithSite) {
-        *ppv = static_cast<IObjectWithSite*>(this);
-        AddRef();
-        return S_OK;
-    }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
-}
-
-ULONG TaskbarTAPSite::AddRef() { return InterlockedIncrement(&m_refCount); }
-ULONG TaskbarTAPSite::Release()
-{
-    long ref = InterlockedDecrement(&m_refCount);
-    if (ref == 0) delete this;
-    return ref;
-}
-
-HRESULT TaskbarTAPSite::SetSite(IUnknown* pUnkSite)
+HRESULT TaskbarTAPSite::OnSiteChanged(IUnknown* pUnkSite)
 {
     DebugLog("=== SetSite called (pUnkSite=%p) ===", pUnkSite);
 
     // Release previous site
-    if (m_pSite) { m_pSite->Release(); m_pSite = nullptr; }
     if (g_pTreeService) { g_pTreeService->Release(); g_pTreeService = nullptr; }
     if (g_pDiagnostics) { g_pDiagnostics->Release(); g_pDiagnostics = nullptr; }
-    if (g_pWatcher) { g_pWatcher->Release(); g_pWatcher = nullptr; }
+    if (g_pWatcher) { g_pWatcher->ShutdownDispatch(); g_pWatcher->Release(); g_pWatcher = nullptr; }
 
     if (!pUnkSite) return S_OK;  // Disconnecting
-
-    m_pSite = pUnkSite;
-    m_pSite->AddRef();
+    if (Detach::Detached()) { DebugLog("SetSite after detach: ignored"); return S_OK; }
 
     // QI for the XAML diagnostics interfaces
     HRESULT hr = pUnkSite->QueryInterface(__uuidof(IXamlDiagnostics),
@@ -381,429 +334,197 @@ HRESULT TaskbarTAPSite::SetSite(IUnknown* pUnkSite)
 
     // Initialize shared memory for IPC with PowerShell
     InitSharedMemory();
-    StartMonitorThread();
+    MonitorThread::Start(g_hModeEvent, CheckSharedMode);
+    InstanceRegistry::Register(L"TaskbarTAP", L"W11ThemeSuite_TaskbarTAP_", APPEARANCE_ACRYLIC + 1);
+    StartupEvents::SignalReady();
 
     return S_OK;
 }
 
-HRESULT TaskbarTAPSite::GetSite(REFIID riid, void** ppvSite)
-{
-    if (!m_pSite) {
-        *ppvSite = nullptr;
-        return E_FAIL;
-    }
-    return m_pSite->QueryInterface(riid, ppvSite);
-}
-
 // ══════════════════════════════════════════════
-// VisualTreeWatcher (IVisualTreeServiceCallback2)
-// Watches XAML element creation/mutation to find and modify
-// the taskbar background elements.
+// VisualTreeWatcher (TAPCore::WatcherBase<TaskbarPolicy>)
+// The base matches Adds against TaskbarPolicy::kTargets at compile time
+// and hands us the taskbar background elements.
 // ══════════════════════════════════════════════
-VisualTreeWatcher::VisualTreeWatcher(IXamlDiagnostics* pDiag, IVisualTreeService3* pService)
-    : m_refCount(1), m_pDiag(pDiag), m_pService(pService), m_taskbarCount(0)
+static_assert(TAPCore::MatchFixed(TaskbarPolicy::kTargets, L"BackgroundFill",
+                                  L"Windows.UI.Xaml.Shapes.Rectangle") == TAPCore::ROLE_FILL,
+              "TaskbarPolicy must match BackgroundFill");
+static_assert(TAPCore::MatchFixed(TaskbarPolicy::kTargets, L"", L"Taskbar.TaskbarFrame") == TAPCore::ROLE_ANCHOR,
+              "TaskbarPolicy must match TaskbarFrame by type alone");
+static_assert(TAPCore::MatchFixed(TaskbarPolicy::kTargets, L"BackgroundFill", L"Grid") == TAPCore::ROLE_NONE,
+              "TaskbarPolicy must not match other types");
+
+// Same shape as EtwTrace::Span, so the TAP_ETW_* macros take the scope directly
+TaskbarPolicy::TreeScope::TreeScope(InstanceHandle h, VisualMutationType mutation)
+    : handle(h), active(TraceLoggingProviderEnabled(g_hTaskbarTAPProvider, WINEVENT_LEVEL_VERBOSE,
+                                                    TAP_ETW_KEYWORD_TREE) != 0)
 {
-    g_refCount++;
-    if (m_pDiag) m_pDiag->AddRef();
-    if (m_pService) m_pService->AddRef();
-    memset(m_taskbars, 0, sizeof(m_taskbars));
+    if (!active) return;
+    EventActivityIdControl(EVENT_ACTIVITY_CTRL_CREATE_ID, &id);
+    TAP_ETW_START(*this, "OnVisualTreeChange", TAP_ETW_KEYWORD_TREE,
+        TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingInt32((int)mutation, "Mutation"));
 }
 
-VisualTreeWatcher::~VisualTreeWatcher()
+TaskbarPolicy::TreeScope::~TreeScope()
 {
-    if (m_pDiag) m_pDiag->Release();
-    if (m_pService) m_pService->Release();
-    g_refCount--;
+    TAP_ETW_STOP(*this, "OnVisualTreeChange", TAP_ETW_KEYWORD_TREE,
+        TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingHResult(S_OK, "HResult"));
 }
 
-HRESULT VisualTreeWatcher::QueryInterface(REFIID riid, void** ppv)
-{
-    if (riid == IID_IUnknown ||
-        riid == __uuidof(IVisualTreeServiceCallback) ||
-        riid == __uuidof(IVisualTreeServiceCallback2)) {
-        *ppv = static_cast<IVisualTreeServiceCallback2*>(this);
-        AddRef();
-        return S_OK;
-    }
-    *ppv = nullptr;
-    return E_NOINTERFACE;
-}
-
-ULONG VisualTreeWatcher::AddRef() { return InterlockedIncrement(&m_refCount); }
-ULONG VisualTreeWatcher::Release()
+VisualTreeWatcher::VisualTreeWatcher(IXamlDiagnostics* pDiag, IVisualTreeService3* pService)
+    : WatcherBase(pDiag, pService), m_taskbarCount(0), m_pendingAppearance(-1)
 {
-    long ref = InterlockedDecrement(&m_refCount);
-    if (ref == 0) delete this;
-    return ref;
+    memset(m_taskbars, 0, sizeof(m_taskbars));
 }
 
-// ── OnVisualTreeChange ──
-// Called by XAML Diagnostics whenever an element is added/removed/changed.
-// We look for Rectangle#BackgroundFill and Rectangle#BackgroundStroke.
-HRESULT VisualTreeWatcher::OnVisualTreeChange(
-    ParentChildRelation relation,
-    VisualElement element,
-    VisualMutationType mutationType)
+// ── OnTargetAdded ──
+// Rectangle#BackgroundFill / #BackgroundStroke and the TaskbarFrame that
+// groups them; each taskbar (one per monitor) fills one slot.
+void VisualTreeWatcher::OnTargetAdded(const VisualElement& element, TAPCore::TargetRole role)
 {
-    if (mutationType == Add) {
-        if (element.Name && element.Type) {
-            std::wstring name(element.Name);
-            std::wstring type(element.Type);
-
-            bool isBackgroundFill = (name == L"BackgroundFill" &&
-                                      type.find(L"Rectangle") != std::wstring::npos);
-            bool isBackgroundStroke = (name == L"BackgroundStroke" &&
-                                       type.find(L"Rectangle") != std::wstring::npos);
-            bool isTaskbarFrame = (type.find(L"TaskbarFrame") != std::wstring::npos);
-
-            if (isBackgroundFill || isBackgroundStroke || isTaskbarFrame) {
-                DebugLog("Found element: name='%ls' type='%ls' handle=%llu",
-                    name.c_str(), type.c_str(), (unsigned long long)element.Handle);
-                int slot = -1;
-
-                if (isBackgroundFill || isBackgroundStroke) {
-                    for (int i = 0; i < m_taskbarCount; i++) {
-                        if (m_taskbars[i].active) {
-                            if (isBackgroundFill && m_taskbars[i].backgroundFill == 0) {
-                                slot = i; break;
-                            }
-                            if (isBackgroundStroke && m_taskbars[i].backgroundStroke == 0) {
-                                slot = i; break;
-                            }
-                        }
-                    }
-                }
+    DebugLog("Found element: name='%ls' type='%ls' handle=%llu",
+        element.Name, element.Type, (unsigned long long)element.Handle);
+    int slot = -1;
 
-                if (slot < 0 && m_taskbarCount < MAX_TASKBARS) {
-                    slot = m_taskbarCount++;
-                    m_taskbars[slot].active = true;
-                    m_taskbars[slot].backgroundFill = 0;
-                    m_taskbars[slot].backgroundStroke = 0;
-                    m_taskbars[slot].taskbarFrame = 0;
+    if (role == TAPCore::ROLE_FILL || role == TAPCore::ROLE_STROKE) {
+        for (int i = 0; i < m_taskbarCount; i++) {
+            if (m_taskbars[i].active) {
+                if (role == TAPCore::ROLE_FILL && m_taskbars[i].backgroundFill == 0) {
+                    slot = i; break;
                 }
-
-                if (slot >= 0) {
-                    if (isBackgroundFill) {
-                        m_taskbars[slot].backgroundFill = element.Handle;
-                    } else if (isBackgroundStroke) {
-                        m_taskbars[slot].backgroundStroke = element.Handle;
-                    } else if (isTaskbarFrame) {
-                        m_taskbars[slot].taskbarFrame = element.Handle;
-                    }
-
-                    // Apply current appearance immediately
-                    if (g_appearance != APPEARANCE_DEFAULT) {
-                        ApplyAppearance(g_appearance);
-                    }
+                if (role == TAPCore::ROLE_STROKE && m_taskbars[i].backgroundStroke == 0) {
+                    slot = i; break;
                 }
             }
         }
     }
-    else if (mutationType == Remove) {
-        for (int i = 0; i < m_taskbarCount; i++) {
-            if (m_taskbars[i].backgroundFill == element.Handle)
-                m_taskbars[i].backgroundFill = 0;
-            if (m_taskbars[i].backgroundStroke == element.Handle)
-                m_taskbars[i].backgroundStroke = 0;
-            if (m_taskbars[i].taskbarFrame == element.Handle)
-                m_taskbars[i].taskbarFrame = 0;
-
-            if (m_taskbars[i].active &&
-                m_taskbars[i].backgroundFill == 0 &&
-                m_taskbars[i].backgroundStroke == 0 &&
-                m_taskbars[i].taskbarFrame == 0) {
-                m_taskbars[i].active = false;
-            }
-        }
+
+    if (slot < 0 && m_taskbarCount < MAX_TASKBARS) {
+        slot = m_taskbarCount++;
+        m_taskbars[slot].active = true;
+        m_taskbars[slot].backgroundFill = 0;
+        m_taskbars[slot].backgroundStroke = 0;
+        m_taskbars[slot].taskbarFrame = 0;
+    }
+    if (slot < 0) return;
+
+    if (role == TAPCore::ROLE_FILL) {
+        m_taskbars[slot].backgroundFill = element.Handle;
+    } else if (role == TAPCore::ROLE_STROKE) {
+        m_taskbars[slot].backgroundStroke = element.Handle;
+    } else {
+        m_taskbars[slot].taskbarFrame = element.Handle;
     }
 
-    return S_OK;
+    // Apply current appearance immediately
+    if (g_appearance != APPEARANCE_DEFAULT) {
+        ApplyAppearance(g_appearance);
+    }
 }
 
-HRESULT VisualTreeWatcher::OnElementStateChanged(
-    InstanceHandle /*element*/,
-    VisualElementState /*elementState*/,
-    LPCWSTR /*context*/)
+void VisualTreeWatcher::OnElementRemoved(InstanceHandle handle)
 {
-    return S_OK;
+    for (int i = 0; i < m_taskbarCount; i++) {
+        if (m_taskbars[i].backgroundFill == handle)
+            m_taskbars[i].backgroundFill = 0;
+        if (m_taskbars[i].backgroundStroke == handle)
+            m_taskbars[i].backgroundStroke = 0;
+        if (m_taskbars[i].taskbarFrame == handle)
+            m_taskbars[i].taskbarFrame = 0;
+
+        if (m_taskbars[i].active &&
+            m_taskbars[i].backgroundFill == 0 &&
+            m_taskbars[i].backgroundStroke == 0 &&
+            m_taskbars[i].taskbarFrame == 0) {
+            m_taskbars[i].active = false;
+        }
+    }
 }
 
-// ── ApplyAppearance via IXamlDiagnostics::GetIInspectableFromHandle ──
-// Uses the same approach as TranslucentTB: get the live WinRT Rectangle object
-// from the diagnostic handle, then set Fill directly via COM vtable.
-// This bypasses GetPropertyIndex/SetProperty which return E_INVALIDARG on Win11.
-
-// IInspectable vtable layout (IUnknown + 3 methods)
-// We need to QI for the shape's Fill property.
-// WinRT Rectangle inherits from Shape, which has a Fill property.
-// We'll use the WinRT ABI to set it directly.
-
-// Minimal WinRT ABI interfaces needed:
-// - Windows.UI.Xaml.Shapes.IShape (has get_Fill/put_Fill)
-// - Windows.UI.Xaml.Media.ISolidColorBrush
-// - Windows.UI.Xaml.IUIElement (has get_Opacity/put_Opacity)
-
-// {786CD0C4-7E41-5792-9675-36710E0ED077} IShape (WUX)
-static const GUID IID_IShape = {0x786CD0C4, 0x7E41, 0x5792,
-    {0x96, 0x75, 0x36, 0x71, 0x0E, 0x0E, 0xD0, 0x77}};
-
-// {676D0BE9-B65C-41C6-BA80-58CF87F0E1BF} IUIElement
-static const GUID IID_IUIElement = {0x676D0BE9, 0xB65C, 0x41C6,
-    {0xBA, 0x80, 0x58, 0xCF, 0x87, 0xF0, 0xE1, 0xBF}};
-
-// {7BF4F276-C836-5A90-944B-4E0FBD58B741} ISolidColorBrush factory
-static const GUID IID_ISolidColorBrushFactory = {0x7BF4F276, 0xC836, 0x5A90,
-    {0x94, 0x4B, 0x4E, 0x0F, 0xBD, 0x58, 0xB7, 0x41}};
-
-// Windows.UI.Color struct
-struct WUColor {
-    BYTE A, R, G, B;
-};
-
-// Minimal IShape vtable: IInspectable (6 methods) + IShape methods
-// Fill is at vtable offset 6 (get_Fill) and 7 (put_Fill)
-// But we need the exact offsets. Let's use a different approach:
-// Use IXamlDiagnostics::GetIInspectableFromHandle to get IInspectable*,
-// then use direct property manipulation via the XAML diagnostics
-// SetProperty method with a different approach.
-
-// Actually, the cleanest way is: get the IInspectable, then use
-// RoActivateInstance + direct WinRT calls. But that's complex.
-// Let's try the simplest approach: just set Opacity to 0 on the element
-// by getting it as IUIElement and calling put_Opacity.
-
-// The IUIElement vtable is well-known. Opacity is a DependencyProperty.
-// But rather than hardcode vtable offsets (fragile), let's use
-// IActivationFactory to create a SolidColorBrush, then use
-// IShape::put_Fill.
-
-// SIMPLEST APPROACH: Use SetPropertyValue from IVisualTreeService (base)
-// which takes a string value directly. This was the original API before
-// GetPropertyIndex was added.
-
-// Wait -- IVisualTreeService::SetProperty takes (handle, handle, index).
-// Let's check the ORIGINAL IVisualTreeService.
-
-// Actually, looking at the log more carefully:
-// CreateInstance SUCCEEDS (S_OK), GetPropertyIndex FAILS (E_INVALIDARG).
-// The issue might be that GetPropertyIndex expects the property name
-// in a specific XAML path format. Let me try the GetIInspectableFromHandle
-// approach since TranslucentTB proves it works.
-
+// ── ApplyAppearance ──
+// Same approach as TranslucentTB: the live WinRT Rectangle from the
+// diagnostic handle, then IUIElement/IShape setters (XamlDirect), which
+// avoids the string-parsed SetProperty path that fails on some builds.
 void VisualTreeWatcher::ApplyAppearance(TaskbarAppearance appearance)
 {
     DebugLog("ApplyAppearance called: mode=%d taskbarCount=%d", (int)appearance, m_taskbarCount);
     if (!m_pDiag) { DebugLog("  ERROR: m_pDiag is null!"); return; }
 
+    EtwTrace::Span span(TAP_ETW_KEYWORD_APPLY);
+    TAP_ETW_START(span, "ApplyMode", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+        TraceLoggingInt32((int)appearance, "Mode"));
+
     for (int i = 0; i < m_taskbarCount; i++) {
         if (!m_taskbars[i].active) continue;
 
-        InstanceHandle bgFill = m_taskbars[i].backgroundFill;
-        InstanceHandle bgStroke = m_taskbars[i].backgroundStroke;
-
-        // Apply to BackgroundFill rectangle
-        if (bgFill != 0) {
-            ApplyToRectangle(bgFill, appearance, false);
+        if (m_taskbars[i].backgroundFill != 0) {
+            ApplyToRectangle(m_taskbars[i].backgroundFill, appearance, TAPCore::ROLE_FILL);
         }
-
-        // Apply to BackgroundStroke rectangle
-        if (bgStroke != 0) {
-            ApplyToRectangle(bgStroke, appearance, true);
+        if (m_taskbars[i].backgroundStroke != 0) {
+            ApplyToRectangle(m_taskbars[i].backgroundStroke, appearance, TAPCore::ROLE_STROKE);
         }
     }
-}
 
-// Get IInspectable from handle, then set Opacity directly via WinRT ABI
-void VisualTreeWatcher::ApplyToRectangle(InstanceHandle handle,
-                                          TaskbarAppearance appearance,
-                                          bool isStroke)
-{
-    // Get the live WinRT object from the diagnostic handle
-    IInspectable* pInspectable = nullptr;
-    HRESULT hr = m_pDiag->GetIInspectableFromHandle(handle, &pInspectable);
-    DebugLog("  GetIInspectableFromHandle(%llu) = 0x%08X (ptr=%p)",
-        (unsigned long long)handle, hr, pInspectable);
-    if (FAILED(hr) || !pInspectable) return;
-
-    // QI for IUIElement to set Opacity
-    // IUIElement is at {676D0BE9-B65C-41C6-BA80-58CF87F0E1BF}
-    IUnknown* pUIElement = nullptr;
-    hr = pInspectable->QueryInterface(IID_IUIElement, (void**)&pUIElement);
-    DebugLog("  QI IUIElement: 0x%08X (ptr=%p)", hr, pUIElement);
-
-    if (SUCCEEDED(hr) && pUIElement) {
-        // IUIElement vtable: IInspectable (6) + many properties
-        // Opacity is a dependency property. Instead of hardcoding vtable offset,
-        // let's use the Opacity property through a different mechanism.
-
-        // For now, we'll just try setting Opacity = 0 by calling through
-        // the vtable. The IUIElement interface has:
-        // [propget] Opacity at vtable slot 8 (after IInspectable's 6 + DesiredSize + AllowDrop)
-        // [propput] Opacity at vtable slot 9
-        // But the exact slot depends on the interface version. This is fragile.
-
-        // BETTER APPROACH: Use the fact that we're in explorer.exe and can
-        // use RoActivateInstance to create objects, then set properties.
-        // But the SAFEST approach for now is to use a WinRT API stub.
-
-        // Let's try brute-force: use the IInspectable to get the RuntimeClassName,
-        // which confirms we have the right object type.
-        HSTRING className = nullptr;
-        hr = pInspectable->GetRuntimeClassName(&className);
-        if (SUCCEEDED(hr) && className) {
-            UINT32 len = 0;
-            const wchar_t* name = WindowsGetStringRawBuffer(className, &len);
-            DebugLog("  RuntimeClassName: '%ls'", name ? name : L"(null)");
-            WindowsDeleteString(className);
-        }
-
-        pUIElement->Release();
-    }
+    TAP_ETW_STOP(span, "ApplyMode", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+        TraceLoggingInt32(m_taskbarCount, "Taskbars"),
+        TraceLoggingHResult(S_OK, "HResult"));
+    InstanceRegistry::AckMode((int)appearance);
+}
 
-    // For the actual property setting, we need to use the WinRT ABI.
-    // Since we're inside explorer.exe and the XAML runtime is active,
-    // we can use RoActivateInstance to create a SolidColorBrush and
-    // set it via the Shape interface.
+// ── UI-thread dispatch ──
+// Mode changes arrive on the monitor thread or on whatever thread calls the
+// SetTaskbar* exports. Posting them here keeps every m_taskbars access and
+// every GetIInspectableFromHandle/SetProperty call on the UI thread (no
+// per-element cross-apartment round-trips), and collapses bursts of
+// changes into one ApplyAppearance with the newest mode.
+static const UINT WM_TASKBARTAP_APPLY = WM_APP + 1;
 
-    // Create a transparent SolidColorBrush via RoActivateInstance
-    if (appearance == APPEARANCE_TRANSPARENT ||
-        (appearance == APPEARANCE_ACRYLIC && isStroke)) {
-        SetRectangleOpacity(pInspectable, 0.0);
-    }
-    else if (appearance == APPEARANCE_ACRYLIC && !isStroke) {
-        SetRectangleOpacity(pInspectable, 0.3);
-    }
-    else if (appearance == APPEARANCE_DEFAULT) {
-        SetRectangleOpacity(pInspectable, 1.0);
-    }
+void VisualTreeWatcher::RequestApplyAppearance(TaskbarAppearance appearance)
+{
+    if (m_pendingAppearance.exchange((int)appearance, std::memory_order_acq_rel) >= 0) return;  // already posted
+    if (PostDispatch(WM_TASKBARTAP_APPLY)) return;
 
-    pInspectable->Release();
+    // No window yet (no tree callback so far) or the post failed: apply here
+    int pending = m_pendingAppearance.exchange(-1, std::memory_order_acq_rel);
+    if (pending >= 0) ApplyAppearance((TaskbarAppearance)pending);
 }
 
-// Set UIElement.Opacity via WinRT ABI vtable call
-// UIElement vtable (IUIElement):
-//   0-2: IUnknown (QI, AddRef, Release)
-//   3-5: IInspectable (GetIids, GetRuntimeClassName, GetTrustLevel)
-//   6+: IUIElement properties
-// The exact layout depends on the Windows.UI.Xaml.UIElement runtime class.
-// Opacity is one of the earliest properties on IUIElement.
-// From WinRT metadata: IUIElement has DesiredSize, AllowDrop, Opacity...
-// Actually, the safest way is to use WindowsCreateString + RoGetActivationFactory
-// to create a brush and QI for IShape::put_Fill.
-//
-// For Opacity, it's at a fixed ABI offset. Let's try a minimal approach:
-// IUIElement inherits from IInspectable (6 methods).
-// Slots in IUIElement (approximate from Windows.UI.Xaml UIDL):
-//   6: get_DesiredSize
-//   7: get_AllowDrop / put_AllowDrop / ...
-// Opacity is further in. This is fragile across Windows versions.
-//
-// MOST RELIABLE: Use the activation factory approach.
-void VisualTreeWatcher::SetRectangleOpacity(IInspectable* pElement, double opacity)
+void VisualTreeWatcher::OnDispatch(UINT msg)
 {
-    // We'll use the fact that we're in explorer.exe with WinRT active.
-    // Create a string for the class name, get the activation factory,
-    // and use it. But for Opacity, we can also try a direct hack:
-    // Call the put_Opacity method through the vtable.
-
-    // Actually the most pragmatic approach: use IXamlDiagnostics's
-    // SetProperty with the right parameters. We know CreateInstance works.
-    // The issue was GetPropertyIndex. Let's try using the element handle
-    // with the property chain from IVisualTreeService::GetPropertyValuesChain
-
-    if (!m_pService || !pElement) return;
-
-    // Get the handle back from the inspectable
-    InstanceHandle handle = 0;
-    HRESULT hr = m_pDiag->GetHandleFromIInspectable(pElement, &handle);
-    DebugLog("  GetHandleFromIInspectable: 0x%08X (handle=%llu)", hr, (unsigned long long)handle);
-    if (FAILED(hr)) return;
-
-    // Try to enumerate properties to find the right index
-    unsigned int propCount = 0;
-    PropertyChainSource* pSources = nullptr;
-    unsigned int srcCount = 0;
-    PropertyChainValue* pValues = nullptr;
-
-    hr = m_pService->GetPropertyValuesChain(handle, &srcCount, &pSources, &propCount, &pValues);
-    DebugLog("  GetPropertyValuesChain: 0x%08X (props=%u, sources=%u)", hr, propCount, srcCount);
-
-    if (SUCCEEDED(hr)) {
-        // Find the Fill and Opacity properties
-        unsigned int fillIndex = UINT_MAX;
-        unsigned int opacityIndex = UINT_MAX;
-
-        for (unsigned int p = 0; p < propCount; p++) {
-            if (pValues[p].PropertyName) {
-                std::wstring propName(pValues[p].PropertyName);
-                if (propName == L"Fill") {
-                    DebugLog("  Property[%u]: '%ls' = '%ls' (index=%u, metaBits=%lld)",
-                        p, pValues[p].PropertyName,
-                        pValues[p].Value ? pValues[p].Value : L"(null)",
-                        pValues[p].Index, (long long)pValues[p].MetadataBits);
-                    fillIndex = pValues[p].Index;
-                }
-                if (propName == L"Opacity") {
-                    DebugLog("  Property[%u]: '%ls' = '%ls' (index=%u, metaBits=%lld)",
-                        p, pValues[p].PropertyName,
-                        pValues[p].Value ? pValues[p].Value : L"(null)",
-                        pValues[p].Index, (long long)pValues[p].MetadataBits);
-                    opacityIndex = pValues[p].Index;
-                }
-            }
-        }
+    if (msg != WM_TASKBARTAP_APPLY) return;
+    int appearance = m_pendingAppearance.exchange(-1, std::memory_order_acq_rel);
+    if (appearance >= 0) ApplyAppearance((TaskbarAppearance)appearance);
+}
 
-        // Set Opacity using the correct property index
-        if (opacityIndex != UINT_MAX) {
-            wchar_t opStr[32];
-            wsprintfW(opStr, L"%d", (int)(opacity * 100));
-            // Convert to proper double string
-            std::wstring opValStr = std::to_wstring(opacity);
-
-            InstanceHandle hValue = 0;
-            BSTR bstrType = SysAllocString(L"Double");
-            BSTR bstrVal = SysAllocString(opValStr.c_str());
-            hr = m_pService->CreateInstance(bstrType, bstrVal, &hValue);
-            SysFreeString(bstrType);
-            SysFreeString(bstrVal);
-            DebugLog("  CreateInstance('Double','%ls') = 0x%08X", opValStr.c_str(), hr);
-
-            if (SUCCEEDED(hr)) {
-                hr = m_pService->SetProperty(handle, hValue, opacityIndex);
-                DebugLog("  SetProperty(opacity, idx=%u) = 0x%08X", opacityIndex, hr);
-            }
-        }
+void VisualTreeWatcher::OnDispatchClosed()
+{
+    m_pendingAppearance.store(-1, std::memory_order_relaxed);
+}
 
-        // Set Fill to transparent brush if needed
-        if (fillIndex != UINT_MAX && opacity < 1.0) {
-            InstanceHandle hBrush = 0;
-            BSTR bstrType = SysAllocString(L"Windows.UI.Xaml.Media.SolidColorBrush");
-            BSTR bstrVal = SysAllocString(L"Transparent");
-            hr = m_pService->CreateInstance(bstrType, bstrVal, &hBrush);
-            SysFreeString(bstrType);
-            SysFreeString(bstrVal);
-            DebugLog("  CreateInstance(SolidColorBrush, Transparent) = 0x%08X", hr);
-
-            if (SUCCEEDED(hr)) {
-                hr = m_pService->SetProperty(handle, hBrush, fillIndex);
-                DebugLog("  SetProperty(fill, idx=%u) = 0x%08X", fillIndex, hr);
-            }
-        }
+void VisualTreeWatcher::ApplyToRectangle(InstanceHandle handle,
+                                          TaskbarAppearance appearance,
+                                          TAPCore::TargetRole role)
+{
+    EtwTrace::Span span(TAP_ETW_KEYWORD_APPLY);
+    TAP_ETW_START(span, "ApplyToElement", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingInt32((int)appearance, "Mode"));
 
-        // Free property chain (all BSTR fields)
-        for (unsigned int p = 0; p < propCount; p++) {
-            if (pValues[p].PropertyName) SysFreeString(pValues[p].PropertyName);
-            if (pValues[p].Value) SysFreeString(pValues[p].Value);
-            if (pValues[p].Type) SysFreeString(pValues[p].Type);
-            if (pValues[p].DeclaringType) SysFreeString(pValues[p].DeclaringType);
-            if (pValues[p].ValueType) SysFreeString(pValues[p].ValueType);
-            if (pValues[p].ItemType) SysFreeString(pValues[p].ItemType);
-        }
-        CoTaskMemFree(pValues);
-        for (unsigned int s = 0; s < srcCount; s++) {
-            if (pSources[s].Name) SysFreeString(pSources[s].Name);
-            if (pSources[s].TargetType) SysFreeString(pSources[s].TargetType);
-        }
-        CoTaskMemFree(pSources);
+    HRESULT hr = ApplyFixedStyle(handle, (int)appearance, role);
+    if (FAILED(hr)) {
+        DebugLog("  Apply(handle=%llu, opacity=%f) = 0x%08X", (unsigned long long)handle,
+            TaskbarPolicy::Opacity((int)appearance, role), hr);
     }
+
+    TAP_ETW_STOP(span, "ApplyToElement", TAP_ETW_KEYWORD_APPLY,
+        TraceLoggingWideString(ETW_TARGET_ID, "TargetId"),
+        TraceLoggingUInt64((UINT64)handle, "Handle"),
+        TraceLoggingHResult(hr, "HResult"));
 }
@@ -1,6 +1,8 @@
 // TaskbarTAP.h — Minimal Taskbar Appearance Plugin for w11-theming-suite
 // Implements IObjectWithSite + IVisualTreeServiceCallback2 to modify the
 // XAML visual tree of the Windows 11 taskbar (Rectangle#BackgroundFill).
+// The site, factory, watcher core and apply path come from TAPCore,
+// instantiated with the hardwired TaskbarPolicy below.
 //
 // Based on techniques from RainbowTaskbar (MIT) and TranslucentTB (GPL).
 // This implementation is original code for w11-theming-suite.
@@ -13,6 +15,8 @@
 #include <xamlOM.h>     // IVisualTreeService3, IXamlDiagnostics, IVisualTreeServiceCallback2
 #include <oleauto.h>    // SysAllocString, SysFreeString
 #include <atomic>
+#include "../TAPCore/ComServer.h"
+#include "../TAPCore/WatcherBase.h"
 
 // Forward declarations
 class TaskbarTAPSite;
@@ -39,63 +43,70 @@ extern "C" {
     __declspec(dllexport) HRESULT __stdcall SetTaskbarAcrylic();
     __declspec(dllexport) HRESULT __stdcall SetTaskbarDefault();
     __declspec(dllexport) int __stdcall GetTaskbarTAPVersion();
+    __declspec(dllexport) HRESULT __stdcall DetachTaskbarTAP();
 }
 
-// ── COM class: TAPSite — receives XAML diagnostics site ──
-class TaskbarTAPSite : public IObjectWithSite {
-public:
-    TaskbarTAPSite();
-    virtual ~TaskbarTAPSite();
-
-    // IUnknown
-    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override;
-    ULONG STDMETHODCALLTYPE AddRef() override;
-    ULONG STDMETHODCALLTYPE Release() override;
+// ── Target policy: the taskbar background, hardwired ──
+// No config block: the targets and styles are constexpr, so matching is a
+// couple of inlined compares per Add.
+struct TaskbarPolicy {
+    static constexpr bool kConfigDriven = false;
+    static constexpr const wchar_t* kDispatchClass = L"W11ThemeSuite_TaskbarTAP_Dispatch";
+
+    static constexpr TAPCore::FixedTarget kTargets[] = {
+        { L"BackgroundFill",   L"Rectangle",    TAPCore::ROLE_FILL },
+        { L"BackgroundStroke", L"Rectangle",    TAPCore::ROLE_STROKE },
+        { nullptr,             L"TaskbarFrame", TAPCore::ROLE_ANCHOR },
+    };
 
-    // IObjectWithSite
-    HRESULT STDMETHODCALLTYPE SetSite(IUnknown* pUnkSite) override;
-    HRESULT STDMETHODCALLTYPE GetSite(REFIID riid, void** ppvSite) override;
+    // Transparent: both rectangles at 0. Acrylic: fill at 0.3, stroke hidden.
+    static constexpr double Opacity(int mode, TAPCore::TargetRole role)
+    {
+        return mode == APPEARANCE_TRANSPARENT ? 0.0
+             : mode == APPEARANCE_ACRYLIC ? (role == TAPCore::ROLE_STROKE ? 0.0 : 0.3)
+             : 1.0;
+    }
+
+    // ETW start/stop region around every tree callback
+    struct TreeScope {
+        TreeScope(InstanceHandle handle, VisualMutationType mutation);
+        ~TreeScope();
+        InstanceHandle handle;
+        GUID id;
+        bool active;
+    };
+};
 
-private:
-    long m_refCount;
-    IUnknown* m_pSite;
+// ── COM class: TAPSite — receives XAML diagnostics site ──
+class TaskbarTAPSite : public TAPCore::ObjectWithSite<TaskbarTAPSite> {
+public:
+    // From SetSite: null = disconnecting
+    HRESULT OnSiteChanged(IUnknown* pUnkSite);
 };
 
 // ── COM class: VisualTreeWatcher — watches XAML tree changes ──
-class VisualTreeWatcher : public IVisualTreeServiceCallback2 {
+class VisualTreeWatcher : public TAPCore::WatcherBase<VisualTreeWatcher, TaskbarPolicy> {
 public:
     VisualTreeWatcher(IXamlDiagnostics* pDiag, IVisualTreeService3* pService);
-    virtual ~VisualTreeWatcher();
-
-    // IUnknown
-    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override;
-    ULONG STDMETHODCALLTYPE AddRef() override;
-    ULONG STDMETHODCALLTYPE Release() override;
-
-    // IVisualTreeServiceCallback
-    HRESULT STDMETHODCALLTYPE OnVisualTreeChange(
-        ParentChildRelation relation,
-        VisualElement element,
-        VisualMutationType mutationType) override;
-
-    // IVisualTreeServiceCallback2
-    HRESULT STDMETHODCALLTYPE OnElementStateChanged(
-        InstanceHandle element,
-        VisualElementState elementState,
-        LPCWSTR context) override;
-
-    // Apply current appearance to tracked taskbar elements
+
+    // Apply current appearance to tracked taskbar elements (UI thread)
     void ApplyAppearance(TaskbarAppearance appearance);
 
+    // Apply from any thread: posted to the UI thread as one work item
+    void RequestApplyAppearance(TaskbarAppearance appearance);
+
+    // WatcherBase hooks (UI thread)
+    void OnTargetAdded(const VisualElement& element, TAPCore::TargetRole role);
+    void OnElementRemoved(InstanceHandle handle);
+    void OnDispatch(UINT msg);
+    void OnDispatchClosed();
+
 private:
-    // Set Fill/Opacity on a Rectangle via GetIInspectableFromHandle + GetPropertyValuesChain
-    void ApplyToRectangle(InstanceHandle handle, TaskbarAppearance appearance, bool isStroke);
-    void SetRectangleOpacity(IInspectable* pElement, double opacity);
-    long m_refCount;
-    IXamlDiagnostics* m_pDiag;
-    IVisualTreeService3* m_pService;
-
-    // Tracked XAML element handles
+    // Fill/Opacity on one rectangle: direct ABI, diagnostics SetProperty as fallback
+    void ApplyToRectangle(InstanceHandle handle, TaskbarAppearance appearance, TAPCore::TargetRole role);
+
+    // Tracked XAML element handles. Only touched on the UI thread (tree
+    // callbacks and the dispatch window), so no lock.
     static const int MAX_TASKBARS = 8;
     struct TaskbarInfo {
         InstanceHandle backgroundFill;   // Rectangle#BackgroundFill
@@ -106,22 +117,5 @@ private:
     TaskbarInfo m_taskbars[MAX_TASKBARS];
     int m_taskbarCount;
 
-    // Helper: find parent with given type name
-    InstanceHandle FindParentByType(InstanceHandle child, LPCWSTR typeName);
+    std::atomic<int> m_pendingAppearance;   // -1 = nothing posted
 };
-
-// ── COM class factory ──
-class TaskbarTAPFactory : public IClassFactory {
-public:
-    TaskbarTAPFactory();
-
-    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override;
-    ULONG STDMETHODCALLTYPE AddRef() override;
-    ULONG STDMETHODCALLTYPE Release() override;
-
-    HRESULT STDMETHODCALLTYPE CreateInstance(IUnknown* pOuter, REFIID riid, void** ppv) override;
-    HRESULT STDMETHODCALLTYPE LockServer(BOOL fLock) override;
-
-private:
-    long m_refCount;
-};
\ No newline at end of file
@@ -0,0 +1,190 @@
+// TraceDecoder.cpp -- Decodes ShellTAP binary discovery traces
+//
+// Usage:
+//   TraceDecoder <trace-file> [--json] [--all] [-o <output-file>]
+//
+//   (default)  Text, identical to the ShellTAP text discovery log
+//              ("[handle] name | type (parent=..., numChildren=...)").
+//              Only Add records, like the text log; --all adds Remove lines.
+//   --json     One JSON object per line: a header object, then one object
+//              per element record (adds and removes, with timestamps).
+//
+// Works on discovery traces and on recordings (SHELLTAP_FLAG_RECORD); a
+// recording's JSON lines also carry the mutation, relation and source info.
+//
+// Reads the format described in ShellTAP\DiscoveryTraceFormat.h through
+// ShellTAP\TraceReader.h. Portable C++17; no Windows dependencies.
+//
+// (c) 2026 w11-theming-suite. MIT License.
+
+#include "TraceReader.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// ── UTF-16 -> UTF-8 ──
+static std::string ToUtf8(const char16_t* s, size_t len)
+{
+    std::string out;
+    out.reserve(len);
+    for (size_t i = 0; i < len; i++) {
+        uint32_t c = s[i];
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < len && s[i + 1] >= 0xDC00 && s[i + 1] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (s[i + 1] - 0xDC00);
+            i++;
+        }
+        if (c < 0x80) {
+            out += (char)c;
+        } else if (c < 0x800) {
+            out += (char)(0xC0 | (c >> 6));
+            out += (char)(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += (char)(0xE0 | (c >> 12));
+            out += (char)(0x80 | ((c >> 6) & 0x3F));
+            out += (char)(0x80 | (c & 0x3F));
+        } else {
+            out += (char)(0xF0 | (c >> 18));
+            out += (char)(0x80 | ((c >> 12) & 0x3F));
+            out += (char)(0x80 | ((c >> 6) & 0x3F));
+            out += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+static std::string JsonEscape(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size() + 2);
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += (char)c;
+            }
+        }
+    }
+    return out;
+}
+
+static bool LoadFile(const char* path, std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    uint8_t chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(f);
+    return true;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "Usage: TraceDecoder <trace-file> [--json] [--all] [-o <output-file>]\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* input = nullptr;
+    const char* output = nullptr;
+    bool json = false;
+    bool all = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (strcmp(argv[i], "--all") == 0) all = true;
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output = argv[++i];
+        else if (argv[i][0] == '-') { Usage(); return 2; }
+        else if (!input) input = argv[i];
+        else { Usage(); return 2; }
+    }
+    if (!input) { Usage(); return 2; }
+
+    std::vector<uint8_t> data;
+    if (!LoadFile(input, data)) {
+        fprintf(stderr, "Cannot read '%s'\n", input);
+        return 1;
+    }
+
+    TraceReader reader;
+    if (!reader.Open(data.data(), data.size())) {
+        fprintf(stderr, "'%s': %s\n", input, reader.Error());
+        return 1;
+    }
+    const TraceFileHeader& hdr = reader.Header();
+
+    FILE* out = stdout;
+    if (output) {
+        out = fopen(output, "wb");
+        if (!out) {
+            fprintf(stderr, "Cannot write '%s'\n", output);
+            return 1;
+        }
+    }
+
+    size_t idLen = 0;
+    while (idLen < 64 && hdr.targetId[idLen]) idLen++;
+    std::string targetId = ToUtf8(hdr.targetId, idLen);
+
+    if (json) {
+        fprintf(out, "{\"target\":\"%s\",\"processId\":%u,\"qpcFrequency\":%lld,\"version\":%u}\n",
+            JsonEscape(targetId).c_str(), hdr.processId, (long long)hdr.qpcFrequency, hdr.version);
+    } else {
+        fprintf(out, "=== ShellTAP Discovery Log (target=%s) ===\n", targetId.c_str());
+        fprintf(out, "Format: [handle] name | type\n\n");
+    }
+
+    TraceMutationRecord rec;
+    size_t elements = 0;
+
+    while (reader.Next(&rec)) {
+        elements++;
+
+        const std::u16string& name16 = reader.String(rec.nameId);
+        const std::u16string& type16 = reader.String(rec.typeId);
+        std::string name = ToUtf8(name16.data(), name16.size());
+        std::string type = ToUtf8(type16.data(), type16.size());
+        bool removed = (rec.mutation == TRACE_MUTATION_REMOVE);
+
+        if (json) {
+            double us = hdr.qpcFrequency ? (double)rec.timestamp * 1e6 / (double)hdr.qpcFrequency : 0.0;
+            fprintf(out, "{\"op\":\"%s\",\"handle\":%llu,\"parent\":%llu,\"name\":\"%s\",\"type\":\"%s\","
+                         "\"numChildren\":%u,\"timeUs\":%.1f",
+                removed ? "remove" : "add",
+                (unsigned long long)rec.handle, (unsigned long long)rec.parent,
+                JsonEscape(name).c_str(), JsonEscape(type).c_str(), rec.numChildren, us);
+            if (rec.tag == TRACE_TAG_MUTATION) {
+                const std::u16string& file16 = reader.String(rec.srcFileId);
+                fprintf(out, ",\"mutation\":%u,\"child\":%llu,\"childIndex\":%u,\"srcFile\":\"%s\","
+                             "\"srcLine\":%u,\"srcColumn\":%u",
+                    rec.mutation, (unsigned long long)rec.child, rec.childIndex,
+                    JsonEscape(ToUtf8(file16.data(), file16.size())).c_str(), rec.srcLine, rec.srcColumn);
+            }
+            fprintf(out, "}\n");
+        } else if (!removed || all) {
+            const char* n = !name.empty() ? name.c_str() : "(unnamed)";
+            const char* t = !type.empty() ? type.c_str() : "(unknown)";
+            fprintf(out, "[%llu]%s %s | %s (parent=%llu, numChildren=%u)\n",
+                (unsigned long long)rec.handle, removed ? " REMOVED" : "", n, t,
+                (unsigned long long)rec.parent, rec.numChildren);
+        }
+    }
+    if (reader.Truncated()) fprintf(stderr, "%s; stopping\n", reader.Error());
+
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "%zu element records, %zu strings%s\n",
+        elements, reader.StringCount(), reader.Truncated() ? " (trace truncated)" : "");
+    return 0;
+}
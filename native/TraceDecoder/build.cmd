@@ -0,0 +1,29 @@
+@echo off
+REM Build TraceDecoder.exe for w11-theming-suite
+REM Decodes ShellTAP binary discovery traces to text or JSON
+setlocal
+
+set "SRCDIR=C:\Dev\w11-theming-suite\native\TraceDecoder"
+set "INCDIR=C:\Dev\w11-theming-suite\native\ShellTAP"
+set "OUTDIR=C:\Dev\w11-theming-suite\native\bin"
+set "OBJDIR=C:\Dev\w11-theming-suite\native\TraceDecoder\obj"
+set "VCVARS=C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxiliary\Build\vcvars64.bat"
+
+echo [BUILD] Initializing x64 environment...
+call "%VCVARS%"
+if errorlevel 1 goto :fail
+
+if not exist "%OUTDIR%\" mkdir "%OUTDIR%"
+if not exist "%OBJDIR%\" mkdir "%OBJDIR%"
+
+echo [BUILD] Compiling TraceDecoder.cpp...
+cl.exe /nologo /EHsc /O2 /MD /W3 /std:c++17 /D_CRT_SECURE_NO_WARNINGS /I"%INCDIR%" /DNDEBUG "%SRCDIR%\TraceDecoder.cpp" /Fe:"%OUTDIR%\TraceDecoder.exe" /Fo:"%OBJDIR%\\" /link /NOLOGO /MACHINE:X64
+if errorlevel 1 goto :fail
+
+echo [BUILD] SUCCESS
+dir "%OUTDIR%\TraceDecoder.exe"
+goto :eof
+
+:fail
+echo [BUILD] FAILED
+exit /b 1
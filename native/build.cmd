@@ -0,0 +1,96 @@
+@echo off
+REM Build TAPCore.lib, ShellTAP.dll and TaskbarTAP.dll for w11-theming-suite
+REM Usage: build.cmd [all|shell|taskbar|bench]   (default: all)
+REM TAPCore is the shared static library (XAML bootstrap, COM plumbing,
+REM watcher core); both DLLs link it. "bench" builds TAPBench.exe, the
+REM ShellTAP watcher against a fake XAML Diagnostics provider.
+setlocal
+
+set "NATIVEDIR=C:\Dev\w11-theming-suite\native"
+set "COREDIR=%NATIVEDIR%\TAPCore"
+set "OUTDIR=%NATIVEDIR%\bin"
+set "VCVARS=C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxiliary\Build\vcvars64.bat"
+set "CLFLAGS=/nologo /EHsc /O2 /MD /W3 /std:c++17 /D_CRT_SECURE_NO_WARNINGS /DWIN32 /DNDEBUG /D_WINDOWS"
+set "SHELLTAP_SOURCES=TargetMatcher.cpp ApplyScheduler.cpp AsyncLog.cpp DiscoveryTrace.cpp PerfCounters.cpp EtwTrace.cpp TreeIndex.cpp PathSelector.cpp ReassertWatch.cpp ModeTransition.cpp TreeSnapshot.cpp WarmCache.cpp"
+set "SYSLIBS=ole32.lib oleaut32.lib uuid.lib user32.lib shlwapi.lib advapi32.lib WindowsApp.lib"
+
+set "TARGET=%~1"
+if "%TARGET%"=="" set "TARGET=all"
+if /i not "%TARGET%"=="all" if /i not "%TARGET%"=="shell" if /i not "%TARGET%"=="taskbar" if /i not "%TARGET%"=="bench" (
+    echo [BUILD] Unknown target "%TARGET%" ^(expected all, shell, taskbar or bench^)
+    exit /b 2
+)
+
+echo [BUILD] Initializing x64 environment...
+call "%VCVARS%"
+if errorlevel 1 goto :fail
+
+if not exist "%OUTDIR%\" mkdir "%OUTDIR%"
+if not exist "%COREDIR%\obj\" mkdir "%COREDIR%\obj"
+
+echo [BUILD] Compiling TAPCore...
+cl.exe %CLFLAGS% /c /I"%COREDIR%" "%COREDIR%\XamlBootstrap.cpp" "%COREDIR%\StartupEvents.cpp" "%COREDIR%\PropertyChain.cpp" "%COREDIR%\InstanceRegistry.cpp" "%COREDIR%\Detach.cpp" "%COREDIR%\MonitorThread.cpp" /Fo:"%COREDIR%\obj\\"
+if errorlevel 1 goto :fail
+lib.exe /nologo /OUT:"%COREDIR%\obj\TAPCore.lib" "%COREDIR%\obj\XamlBootstrap.obj" "%COREDIR%\obj\StartupEvents.obj" "%COREDIR%\obj\PropertyChain.obj" "%COREDIR%\obj\InstanceRegistry.obj" "%COREDIR%\obj\Detach.obj" "%COREDIR%\obj\MonitorThread.obj"
+if errorlevel 1 goto :fail
+
+if /i "%TARGET%"=="bench" (
+    call :bench
+    if errorlevel 1 goto :fail
+    echo [BUILD] SUCCESS
+    dir "%OUTDIR%\TAPBench.exe"
+    goto :eof
+)
+
+if /i not "%TARGET%"=="taskbar" (
+    set "SRCDIR=%NATIVEDIR%\ShellTAP"
+    call :dll ShellTAP "%SHELLTAP_SOURCES%" "version.lib" "Kill the target process, then rename _new to replace"
+    if errorlevel 1 goto :fail
+)
+if /i not "%TARGET%"=="shell" (
+    set "SRCDIR=%NATIVEDIR%\TaskbarTAP"
+    call :dll TaskbarTAP "" "" "Restart explorer.exe then rename _new to replace"
+    if errorlevel 1 goto :fail
+)
+
+echo [BUILD] SUCCESS
+dir "%OUTDIR%\*TAP*.dll"
+goto :eof
+
+REM :dll <name> "<extra sources in SRCDIR>" "<extra libs>" "<locked hint>"
+:dll
+set "NAME=%~1"
+set "OBJDIR=%SRCDIR%\obj"
+if not exist "%OBJDIR%\" mkdir "%OBJDIR%"
+set "SOURCES="%SRCDIR%\%NAME%.cpp""
+for %%f in (%~2) do call set "SOURCES=%%SOURCES%% "%SRCDIR%\%%f""
+
+echo [BUILD] Compiling %NAME%...
+cl.exe %CLFLAGS% /LD /D_USRDLL /I"%SRCDIR%" /I"%COREDIR%" %SOURCES% /Fe:"%OUTDIR%\%NAME%_new.dll" /Fo:"%OBJDIR%\\" /link /DEF:"%SRCDIR%\%NAME%.def" /NOLOGO /DLL /MACHINE:X64 "%COREDIR%\obj\TAPCore.lib" %SYSLIBS% %~3
+if errorlevel 1 exit /b 1
+
+REM Try to replace existing DLL (may be locked if injected)
+del /f "%OUTDIR%\%NAME%.dll" 2>nul
+if exist "%OUTDIR%\%NAME%.dll" (
+    echo [BUILD] WARNING: %NAME%.dll is locked, built as %NAME%_new.dll
+    echo [BUILD] %~4
+) else (
+    move /y "%OUTDIR%\%NAME%_new.dll" "%OUTDIR%\%NAME%.dll" >nul
+)
+exit /b 0
+
+REM :bench -- ShellTAP sources without the IXDE bootstrap, plus TAPBench.cpp
+:bench
+set "SRCDIR=%NATIVEDIR%\ShellTAP"
+set "OBJDIR=%NATIVEDIR%\TAPBench\obj"
+if not exist "%OBJDIR%\" mkdir "%OBJDIR%"
+set "SOURCES="%NATIVEDIR%\TAPBench\TAPBench.cpp" "%SRCDIR%\ShellTAP.cpp""
+for %%f in (%SHELLTAP_SOURCES%) do call set "SOURCES=%%SOURCES%% "%SRCDIR%\%%f""
+
+echo [BUILD] Compiling TAPBench...
+cl.exe %CLFLAGS% /DSHELLTAP_NO_BOOTSTRAP /I"%SRCDIR%" /I"%COREDIR%" %SOURCES% /Fe:"%OUTDIR%\TAPBench.exe" /Fo:"%OBJDIR%\\" /link /NOLOGO /MACHINE:X64 "%COREDIR%\obj\TAPCore.lib" %SYSLIBS% version.lib
+exit /b %errorlevel%
+
+:fail
+echo [BUILD] FAILED
+exit /b 1
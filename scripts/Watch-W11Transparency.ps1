@@ -9,7 +9,13 @@
     - Start Menu transparency (ShellTAP into StartMenuExperienceHost.exe)
     - Action Center transparency (ShellTAP into ShellExperienceHost.exe)
     - App window + context menu backdrops (BackdropWatcher with DWM)
-    - Auto re-injection when target processes restart (WMI event watch)
+    - Auto re-injection when target processes restart: TAPBroker.exe's
+      supervisor when it is built (event-driven, well under a second),
+      otherwise a WMI __InstanceCreationEvent watch
+
+    Nothing here re-asserts values inside a running process: ShellTAP
+    re-applies an element itself as soon as XAML resets its Opacity or Fill
+    (visual states, theme resources). This script only covers restarts.
 
     This script is generated and registered by Register-W11TransparencyPersistence.
     It runs hidden at login via a VBScript wrapper.
@@ -37,6 +43,17 @@ if (-not (Test-Path $modulePath)) {
 
 Import-Module $modulePath -Force -ErrorAction Stop
 
+# --- Helper: TAP parameters for one surface (mode + optional tint) ---
+function Get-SurfaceParams {
+    param([object]$section)
+
+    $params = @{ Mode = $section.mode }
+    foreach ($field in 'color', 'opacity', 'tintOpacity') {
+        if ($null -ne $section.$field) { $params[$field] = $section.$field }
+    }
+    return $params
+}
+
 # --- Helper: Apply all transparency effects ---
 function Apply-AllEffects {
     param([object]$cfg)
@@ -53,30 +70,41 @@ function Apply-AllEffects {
         }
     }
 
-    # 2. Taskbar TAP injection (for XAML-level transparency)
-    if ($cfg.taskbarTAP.enabled) {
+    # 2. Start Menu and Action Center: each ShellTAP host gets its own init
+    #    block, so both are injected without waiting and awaited together
+    #    with the taskbar handshake below
+    $pendingTAP = @()
+    if ($cfg.startMenu.enabled) {
         try {
-            Invoke-TaskbarTAPInject -Mode $cfg.taskbarTAP.mode
+            $smParams = Get-SurfaceParams $cfg.startMenu
+            if (Invoke-StartMenuTransparency @smParams -NoWait) { $pendingTAP += 'StartMenu' }
         } catch {
-            Write-Warning "Taskbar TAP injection failed: $_"
+            Write-Warning "Start Menu transparency failed: $_"
         }
     }
-
-    # 3. Start Menu
-    if ($cfg.startMenu.enabled) {
+    if ($cfg.actionCenter.enabled) {
         try {
-            Invoke-StartMenuTransparency -Mode $cfg.startMenu.mode
+            $acParams = Get-SurfaceParams $cfg.actionCenter
+            if (Invoke-ActionCenterTransparency @acParams -NoWait) { $pendingTAP += 'ActionCenter' }
         } catch {
-            Write-Warning "Start Menu transparency failed: $_"
+            Write-Warning "Action Center transparency failed: $_"
         }
     }
 
-    # 4. Action Center
-    if ($cfg.actionCenter.enabled) {
+    # 3. Taskbar TAP injection (for XAML-level transparency)
+    if ($cfg.taskbarTAP.enabled) {
         try {
-            Invoke-ActionCenterTransparency -Mode $cfg.actionCenter.mode
+            $tapParams = Get-SurfaceParams $cfg.taskbarTAP
+            Invoke-TaskbarTAPInject @tapParams
         } catch {
-            Write-Warning "Action Center transparency failed: $_"
+            Write-Warning "Taskbar TAP injection failed: $_"
+        }
+    }
+
+    # 4. Start Menu / Action Center handshakes
+    if ($pendingTAP.Count -gt 0) {
+        if (-not (Wait-ShellTAPReady -TargetId $pendingTAP)) {
+            Write-Warning "ShellTAP did not initialize in: $($pendingTAP -join ', ')"
         }
     }
 
@@ -102,6 +130,15 @@ Start-Sleep -Seconds 5
 Write-Host "[Watch-W11Transparency] Applying initial transparency effects..."
 Apply-AllEffects -cfg $config
 
+# --- Supervised re-injection via TAPBroker ---
+# The broker adopts every instance injected above and re-injects it the
+# moment its host comes back; the WMI watch below is only the fallback.
+$brokerSupervises = $false
+if ($config.startMenu.enabled -or $config.actionCenter.enabled -or $config.taskbarTAP.enabled) {
+    try { $brokerSupervises = [bool](Start-TAPBroker -ErrorAction Stop) }
+    catch { Write-Warning "TAPBroker unavailable, falling back to the WMI watch: $_" }
+}
+
 # --- WMI process watch for auto re-injection ---
 # Monitor for process creation of target XAML host processes
 $targetProcesses = @()
@@ -109,6 +146,16 @@ if ($config.startMenu.enabled) { $targetProcesses += 'StartMenuExperienceHost.ex
 if ($config.actionCenter.enabled) { $targetProcesses += 'ShellExperienceHost.exe' }
 if ($config.taskbarTAP.enabled) { $targetProcesses += 'explorer.exe' }
 
+if ($brokerSupervises) {
+    Write-Host "[Watch-W11Transparency] TAPBroker supervises the TAP injections."
+    $targetProcesses = @()
+}
+
+# SWCA is not injected: explorer restarts still need this watch to re-apply it
+if ($brokerSupervises -and $config.taskbarTAP.enabled -and $config.taskbar.enabled) {
+    $targetProcesses += 'explorer.exe'
+}
+
 if ($targetProcesses.Count -gt 0) {
     $nameFilter = ($targetProcesses | ForEach-Object { "TargetInstance.Name = '$_'" }) -join ' OR '
     $wmiQuery = "SELECT * FROM __InstanceCreationEvent WITHIN 5 WHERE TargetInstance ISA 'Win32_Process' AND ($nameFilter)"
@@ -124,13 +171,13 @@ if ($targetProcesses.Count -gt 0) {
             switch ($procName) {
                 'StartMenuExperienceHost.exe' {
                     if ($config.startMenu.enabled) {
-                        try { Invoke-StartMenuTransparency -Mode $config.startMenu.mode }
+                        try { $smParams = Get-SurfaceParams $config.startMenu; Invoke-StartMenuTransparency @smParams }
                         catch { Write-Warning "Re-inject Start Menu failed: $_" }
                     }
                 }
                 'ShellExperienceHost.exe' {
                     if ($config.actionCenter.enabled) {
-                        try { Invoke-ActionCenterTransparency -Mode $config.actionCenter.mode }
+                        try { $acParams = Get-SurfaceParams $config.actionCenter; Invoke-ActionCenterTransparency @acParams }
                         catch { Write-Warning "Re-inject Action Center failed: $_" }
                     }
                 }
@@ -144,8 +191,8 @@ if ($targetProcesses.Count -gt 0) {
                             Set-W11NativeTaskbarTransparency @taskbarParams
                         } catch { Write-Warning "Re-apply taskbar SWCA failed: $_" }
                     }
-                    if ($config.taskbarTAP.enabled) {
-                        try { Invoke-TaskbarTAPInject -Mode $config.taskbarTAP.mode }
+                    if ($config.taskbarTAP.enabled -and -not $brokerSupervises) {
+                        try { $tapParams = Get-SurfaceParams $config.taskbarTAP; Invoke-TaskbarTAPInject @tapParams }
                         catch { Write-Warning "Re-inject taskbar TAP failed: $_" }
                     }
                 }